@@ -0,0 +1,83 @@
+#include "ExternalSorter.h"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+
+static constexpr memSize kMB = 1024 * 1024L;
+
+// Sorts `range(0)` MB of int64 with a memory budget of `range(1)` MB, runs
+// sorted as RunSort `range(2)` says and cut as RunGeneration `range(3)` says.
+// The input is random, or sorted if `range(4)`. The output is only checked,
+// not stored.
+static void BM_ExternalSort(benchmark::State &state) {
+  const memSize dataBytes = state.range(0) * kMB;
+  const memSize budget = state.range(1) * kMB;
+  const bool presorted = state.range(4) != 0;
+  Config conf{.spillDir = "./spill_bench_sort",
+              .quota = budget,
+              .compressionType = CompressionType::Lz4};
+  uint64_t faults = 0, spilledBytes = 0, runs = 0;
+  for (auto _ : state) {
+    BufferManager mgr(conf);
+    ExternalSorter<int64_t> sorter(
+        mgr, budget, {},
+        {.runGeneration = static_cast<RunGeneration>(state.range(3)),
+         .runSort = static_cast<RunSort>(state.range(2))});
+    std::mt19937_64 rng(42);
+    uint64_t remaining = dataBytes / sizeof(int64_t);
+    int64_t next = INT64_MIN;
+    sorter.addAll([&](int64_t &v) {
+      // Sorted input takes small random steps.
+      v = presorted ? next += rng() % 1024 : static_cast<int64_t>(rng());
+      return remaining-- > 0;
+    });
+    runs += sorter.runCount();
+    int64_t previous = INT64_MIN;
+    bool ordered = true;
+    sorter.finish([&](const int64_t *values, size_t count) {
+      for (size_t i = 0; i < count; ++i) {
+        ordered &= values[i] >= previous;
+        previous = values[i];
+      }
+    });
+    if (!ordered) {
+      state.SkipWithError("merge output out of order");
+      break;
+    }
+    faults += mgr.pageFaultStats().pageFaultCount;
+    Statistics spills = mgr.spillStats();
+    for (int i = 0; i < Statistics::kCodecCount; ++i) {
+      spilledBytes += spills.codecInputBytes[i];
+    }
+  }
+  state.counters["runs"] =
+      benchmark::Counter(runs, benchmark::Counter::kAvgIterations);
+  state.counters["faults"] =
+      benchmark::Counter(faults, benchmark::Counter::kAvgIterations);
+  state.counters["spilled_bytes"] =
+      benchmark::Counter(spilledBytes, benchmark::Counter::kAvgIterations);
+  state.SetBytesProcessed(state.iterations() * dataBytes);
+}
+
+static constexpr int kBlocks = static_cast<int>(RunGeneration::Blocks);
+static constexpr int kSelection =
+    static_cast<int>(RunGeneration::ReplacementSelection);
+
+BENCHMARK(BM_ExternalSort)
+    ->ArgNames({"dataMB", "budgetMB", "runSort", "generation", "sorted"})
+    ->ArgsProduct({{256}, {64},
+                   {static_cast<int>(RunSort::Comparison),
+                    static_cast<int>(RunSort::RadixInPlace),
+                    static_cast<int>(RunSort::RadixPingPong)},
+                   {kBlocks}, {0}})
+    // Blocks against replacement selection, random and presorted input.
+    ->ArgsProduct({{256}, {64},
+                   {static_cast<int>(RunSort::Auto)},
+                   {kBlocks, kSelection}, {0, 1}})
+    ->Args({1024, 256, static_cast<int>(RunSort::Auto), kBlocks, 0})
+    ->Args({1024, 256, static_cast<int>(RunSort::Auto), kSelection, 0})
+    ->Args({4096, 1024, static_cast<int>(RunSort::Auto), kBlocks, 0})
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,65 @@
+#include "MmapMemory.h"
+#include "PageFaultHandler.h"
+#include "Spiller.h"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <sys/mman.h>
+
+static constexpr memSize kRegionSize = 32 * 1024 * 1024L;
+static constexpr int kTouches = 256;
+
+// Latency of random demand faults on a spilled region. Arg 0 is the codec
+// the region was spilled with, arg 1 log2(pageSize). The counters are the
+// fault handler's own percentiles, in microseconds, from the fault message
+// to the page being mapped.
+static void BM_FaultInLatency(benchmark::State &state) {
+  const auto codec = static_cast<CompressionType>(state.range(0));
+  const memSize pageSize = memSize(1) << state.range(1);
+  auto spiller = std::make_shared<Spiller>("./spill_bench_faultin", codec);
+  PageFaultHandler handler(spiller, kDefaultFaultIoDepth, 1, 0);
+  auto mem = std::make_shared<MmapMemory>(kRegionSize, pageSize);
+  auto *values = reinterpret_cast<int64_t *>(mem->address());
+  std::mt19937_64 rng(42);
+  // Sorted small integers, about as compressible as a sorted run.
+  for (memSize i = 0; i < kRegionSize / sizeof(int64_t); ++i) {
+    values[i] = static_cast<int64_t>(i * 7 + rng() % 5);
+  }
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+  handler.registerMemory(mem);
+
+  std::vector<memSize> pages;
+  for (int i = 0; i < kTouches; ++i) {
+    pages.push_back(rng() % (kRegionSize / pageSize));
+  }
+  char *addr = mem->address();
+  for (auto _ : state) {
+    state.PauseTiming();
+    madvise(addr, kRegionSize, MADV_DONTNEED);
+    state.ResumeTiming();
+    int64_t sum = 0;
+    for (memSize page : pages) {
+      sum += addr[page * pageSize];
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  auto total = handler.latency().total.snapshot();
+  auto decompress = handler.latency().decompress.snapshot();
+  state.counters["fault_p50_us"] = total.percentile(0.5) / 1e3;
+  state.counters["fault_p99_us"] = total.percentile(0.99) / 1e3;
+  state.counters["decompress_p50_us"] = decompress.percentile(0.5) / 1e3;
+  state.counters["faults"] = benchmark::Counter(
+      total.count, benchmark::Counter::kAvgIterations);
+  state.SetBytesProcessed(state.iterations() * pages.size() * pageSize);
+  handler.unregisterMemory(addr, mem->size());
+}
+
+BENCHMARK(BM_FaultInLatency)
+    ->ArgNames({"codec", "log2page"})
+    ->ArgsProduct({{CompressionType::None, CompressionType::Zstd,
+                    CompressionType::Lz4, CompressionType::Adaptive},
+                   {12, 16, 20}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,110 @@
+#include "LoserTree.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <queue>
+#include <random>
+#include <vector>
+
+static constexpr size_t kRecords = 1 << 22;
+static constexpr size_t kBatch = 4096;
+
+// `fanIn` sorted runs of random int64 with kRecords between them.
+static std::vector<std::vector<int64_t>> makeRuns(size_t fanIn) {
+  std::mt19937_64 rng(42);
+  std::vector<std::vector<int64_t>> runs(fanIn);
+  for (size_t i = 0; i < kRecords; ++i) {
+    runs[i % fanIn].push_back(static_cast<int64_t>(rng()));
+  }
+  for (auto &run : runs) {
+    std::sort(run.begin(), run.end());
+  }
+  return runs;
+}
+
+static std::vector<MergeSource<int64_t>>
+sourcesOf(const std::vector<std::vector<int64_t>> &runs) {
+  std::vector<MergeSource<int64_t>> sources;
+  for (const auto &run : runs) {
+    sources.push_back({run.data(), run.data() + run.size()});
+  }
+  return sources;
+}
+
+// Not std::less, so that the tree compares through the sources.
+struct IndirectLess {
+  bool operator()(int64_t a, int64_t b) const { return a < b; }
+};
+
+template <typename Tree>
+static void mergeWithTree(benchmark::State &state) {
+  auto runs = makeRuns(state.range(0));
+  auto sources = sourcesOf(runs);
+  std::vector<int64_t> out(kBatch);
+  for (auto _ : state) {
+    Tree tree(sources);
+    while (size_t n = tree.pop(out.data(), out.size())) {
+      benchmark::DoNotOptimize(out.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kRecords);
+}
+
+// Keys inline in the nodes.
+static void BM_MergeLoserTreeInline(benchmark::State &state) {
+  mergeWithTree<LoserTree<int64_t>>(state);
+}
+
+static void BM_MergeLoserTree(benchmark::State &state) {
+  mergeWithTree<LoserTree<int64_t, IndirectLess>>(state);
+}
+
+// The heap merge the sorter used before, a pop and a push per record.
+static void BM_MergePriorityQueue(benchmark::State &state) {
+  auto runs = makeRuns(state.range(0));
+  struct Element {
+    int64_t value;
+    size_t arrayIdx;
+    size_t elementIdx;
+    bool operator>(const Element &other) const { return value > other.value; }
+  };
+  std::vector<int64_t> out(kBatch);
+  for (auto _ : state) {
+    std::priority_queue<Element, std::vector<Element>, std::greater<Element>>
+        heap;
+    for (size_t i = 0; i < runs.size(); ++i) {
+      if (!runs[i].empty()) {
+        heap.push({runs[i][0], i, 0});
+      }
+    }
+    size_t n = 0;
+    while (!heap.empty()) {
+      Element e = heap.top();
+      heap.pop();
+      out[n++ % kBatch] = e.value;
+      if (e.elementIdx + 1 < runs[e.arrayIdx].size()) {
+        heap.push({runs[e.arrayIdx][e.elementIdx + 1], e.arrayIdx,
+                   e.elementIdx + 1});
+      }
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kRecords);
+}
+
+BENCHMARK(BM_MergeLoserTreeInline)
+    ->ArgName("fanIn")
+    ->RangeMultiplier(4)
+    ->Range(2, 1024)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MergeLoserTree)
+    ->ArgName("fanIn")
+    ->RangeMultiplier(4)
+    ->Range(2, 1024)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MergePriorityQueue)
+    ->ArgName("fanIn")
+    ->RangeMultiplier(4)
+    ->Range(2, 1024)
+    ->Unit(benchmark::kMillisecond);
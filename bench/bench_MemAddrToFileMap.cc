@@ -0,0 +1,44 @@
+#include "MemAddrToFileMap.h"
+
+#include <benchmark/benchmark.h>
+#include <random>
+
+static constexpr int64_t kRegions = 4096;
+
+static char *regionAddr(int64_t i) {
+  return reinterpret_cast<char *>((i + 1) * 64 * 1024);
+}
+
+// Spill file lookups from every fault handler thread while some of the
+// operations record new spills. Arg 0 is the percentage of lookups.
+static void BM_MemAddrToFileMapMixed(benchmark::State &state) {
+  static MemAddrToFileMap *map = nullptr;
+  const int64_t readPercent = state.range(0);
+  if (state.thread_index() == 0) {
+    map = new MemAddrToFileMap();
+    for (int64_t i = 0; i < kRegions; ++i) {
+      map->set(regionAddr(i), {0, static_cast<uint64_t>(i) * 4096, 4096});
+    }
+  }
+  std::mt19937_64 rng(state.thread_index());
+  for (auto _ : state) {
+    int64_t i = rng() % kRegions;
+    if (static_cast<int64_t>(rng() % 100) < readPercent) {
+      benchmark::DoNotOptimize(map->get(regionAddr(i)));
+    } else {
+      map->set(regionAddr(i), {0, static_cast<uint64_t>(i) * 4096, 4096});
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete map;
+  }
+}
+
+BENCHMARK(BM_MemAddrToFileMapMixed)
+    ->ArgName("readPercent")
+    ->Arg(100)
+    ->Arg(95)
+    ->Arg(50)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
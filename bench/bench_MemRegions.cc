@@ -0,0 +1,69 @@
+#include "MemRegions.h"
+
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+static constexpr memSize kRegionSize = 64 * 1024;
+
+// Regions laid out back to back in a fake address space, nothing is mapped.
+static char *regionAddr(int64_t i) {
+  return reinterpret_cast<char *>((i + 1) * kRegionSize);
+}
+
+// Fault path lookup with `range(0)` live regions, one lookup per iteration.
+static void BM_MemRegionsFind(benchmark::State &state) {
+  static MemRegions *regions = nullptr;
+  const int64_t count = state.range(0);
+  if (state.thread_index() == 0) {
+    regions = new MemRegions();
+    for (int64_t i = 0; i < count; ++i) {
+      regions->add(regionAddr(i), kRegionSize);
+    }
+  }
+  std::mt19937_64 rng(state.thread_index());
+  for (auto _ : state) {
+    char *addr = regionAddr(rng() % count) + kRegionSize / 2;
+    benchmark::DoNotOptimize(regions->find(addr));
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete regions;
+  }
+}
+
+BENCHMARK(BM_MemRegionsFind)
+    ->Arg(10)
+    ->Arg(1000)
+    ->Arg(100000)
+    ->ThreadRange(1, 4);
+
+// Lookups while another thread keeps registering and unregistering regions.
+static void BM_MemRegionsFindDuringUpdates(benchmark::State &state) {
+  const int64_t count = state.range(0);
+  MemRegions regions;
+  for (int64_t i = 0; i < count; ++i) {
+    regions.add(regionAddr(i), kRegionSize);
+  }
+  std::atomic<bool> stop{false};
+  std::thread writer([&]() {
+    int64_t next = count;
+    while (!stop.load(std::memory_order_relaxed)) {
+      regions.add(regionAddr(next), kRegionSize);
+      regions.remove(regionAddr(next));
+      next++;
+    }
+  });
+  std::mt19937_64 rng(42);
+  for (auto _ : state) {
+    char *addr = regionAddr(rng() % count) + kRegionSize / 2;
+    benchmark::DoNotOptimize(regions.find(addr));
+  }
+  stop = true;
+  writer.join();
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_MemRegionsFindDuringUpdates)->Arg(10)->Arg(1000)->Arg(100000);
@@ -0,0 +1,69 @@
+#include "MmapMemory.h"
+#include "PageFaultHandler.h"
+#include "Spiller.h"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <sys/mman.h>
+
+static constexpr memSize kRegionSize = 64 * 1024 * 1024L;
+static constexpr memSize kTouchStride = 4096;
+static constexpr int kRandomTouches = 64;
+
+// Fault-in cost of one spilled region at different page sizes. Arg 0 is
+// log2(pageSize), arg 1 selects a sequential scan (with prefetch) or random
+// 4 KB touches.
+static void BM_FaultInGranularity(benchmark::State &state) {
+  const memSize pageSize = memSize(1) << state.range(0);
+  const bool sequential = state.range(1) != 0;
+  auto spiller = std::make_shared<Spiller>("./spill_bench_granularity",
+                                           CompressionType::Lz4);
+  PageFaultHandler handler(spiller, kDefaultFaultIoDepth, 1,
+                           sequential ? kDefaultPrefetchDepth : 0);
+  auto mem = std::make_shared<MmapMemory>(kRegionSize, pageSize);
+  auto *values = reinterpret_cast<int64_t *>(mem->address());
+  std::mt19937_64 rng(42);
+  for (memSize i = 0; i < kRegionSize / sizeof(int64_t); ++i) {
+    values[i] = static_cast<int64_t>(rng() % 1000000);
+  }
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+  handler.registerMemory(mem);
+
+  std::vector<memSize> offsets;
+  if (sequential) {
+    for (memSize off = 0; off < kRegionSize; off += kTouchStride) {
+      offsets.push_back(off);
+    }
+  } else {
+    for (int i = 0; i < kRandomTouches; ++i) {
+      offsets.push_back(rng() % (kRegionSize / kTouchStride) * kTouchStride);
+    }
+  }
+
+  char *addr = mem->address();
+  uint64_t faultsBefore = handler.stats().pageFaultCount;
+  for (auto _ : state) {
+    state.PauseTiming();
+    // The spill file stays mapped, dropping the pages makes every touch
+    // fault again.
+    madvise(addr, kRegionSize, MADV_DONTNEED);
+    state.ResumeTiming();
+    int64_t sum = 0;
+    for (memSize off : offsets) {
+      sum += addr[off];
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  uint64_t faults = handler.stats().pageFaultCount - faultsBefore;
+  state.counters["faults"] =
+      benchmark::Counter(faults, benchmark::Counter::kAvgIterations);
+  state.SetBytesProcessed(state.iterations() * offsets.size() * kTouchStride);
+  handler.unregisterMemory(addr, mem->size());
+}
+
+BENCHMARK(BM_FaultInGranularity)
+    ->ArgsProduct({{12, 16, 20, 24, 26}, {0, 1}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,78 @@
+#include "ParallelMerge.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+static constexpr size_t kRecords = 1 << 24;
+
+// `fanIn` sorted runs of random int64 with kRecords between them.
+static std::vector<std::vector<int64_t>> makeRuns(size_t fanIn) {
+  std::mt19937_64 rng(42);
+  std::vector<std::vector<int64_t>> runs(fanIn);
+  for (size_t i = 0; i < kRecords; ++i) {
+    runs[i % fanIn].push_back(static_cast<int64_t>(rng()));
+  }
+  for (auto &run : runs) {
+    std::sort(run.begin(), run.end());
+  }
+  return runs;
+}
+
+// Merges `range(0)` runs on `range(1)` threads, in windows of `range(2)`
+// records, 0 for the whole output at once.
+static void BM_ParallelMerge(benchmark::State &state) {
+  auto runs = makeRuns(state.range(0));
+  const uint32_t threads = static_cast<uint32_t>(state.range(1));
+  const size_t window = state.range(2) != 0 ? state.range(2) : kRecords;
+  std::vector<int64_t> out(kRecords);
+  for (auto _ : state) {
+    std::vector<PartedSource<int64_t>> sources;
+    for (const auto &run : runs) {
+      sources.emplace_back(std::vector<MergeSource<int64_t>>{
+          {run.data(), run.data() + run.size()}});
+    }
+    ParallelMerger<int64_t> merger(std::move(sources), threads);
+    size_t total = 0;
+    while (size_t n = merger.merge(out.data() + total,
+                                   std::min(window, kRecords - total))) {
+      total += n;
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kRecords);
+}
+
+BENCHMARK(BM_ParallelMerge)
+    ->ArgNames({"fanIn", "threads", "window"})
+    ->ArgsProduct({{8, 64}, {1, 2, 4, 8}, {0, 1 << 20}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// The same merge on one LoserTree, what a single thread costs.
+static void BM_LoserTreeMerge(benchmark::State &state) {
+  auto runs = makeRuns(state.range(0));
+  std::vector<MergeSource<int64_t>> sources;
+  for (const auto &run : runs) {
+    sources.push_back({run.data(), run.data() + run.size()});
+  }
+  std::vector<int64_t> out(kRecords);
+  for (auto _ : state) {
+    LoserTree<int64_t> tree(sources);
+    size_t total = 0;
+    while (size_t n = tree.pop(out.data() + total, kRecords - total)) {
+      total += n;
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kRecords);
+}
+
+BENCHMARK(BM_LoserTreeMerge)
+    ->ArgNames({"fanIn"})
+    ->Arg(8)
+    ->Arg(64)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
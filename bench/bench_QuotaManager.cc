@@ -0,0 +1,48 @@
+#include "QuotaManager.h"
+
+#include <benchmark/benchmark.h>
+#include <string>
+
+static constexpr memSize kQuota = 1024 * 1024 * 1024L;
+static constexpr memSize kCharge = 64 * 1024;
+
+// Reserving and returning quota from many threads, never enough to spill.
+// Arg 0 selects the process pool, or an operator pool per thread under one
+// query pool, which takes the same tree lock for every level.
+static void BM_QuotaReserveRelease(benchmark::State &state) {
+  static SpillerPtr spiller;
+  static QuotaManager *quota = nullptr;
+  static QuotaPoolPtr query;
+  const bool pools = state.range(0) != 0;
+  if (state.thread_index() == 0) {
+    spiller = std::make_shared<Spiller>("./spill_bench_quota",
+                                        CompressionType::None);
+    quota = new QuotaManager(kQuota, spiller);
+    query = quota->root()->createChild("query", kQuota);
+  }
+  // Pools are created once the threads are past the start barrier.
+  QuotaPoolPtr pool;
+  for (auto _ : state) {
+    if (pools && pool == nullptr) {
+      pool = query->createChild(
+          "operator-" + std::to_string(state.thread_index()), kQuota);
+    }
+    auto reservation = quota->reserve(kCharge, pool);
+    benchmark::DoNotOptimize(reservation);
+  }
+  pool.reset();
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    query.reset();
+    delete quota;
+    quota = nullptr;
+    spiller.reset();
+  }
+}
+
+BENCHMARK(BM_QuotaReserveRelease)
+    ->ArgName("pools")
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
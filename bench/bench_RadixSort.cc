@@ -0,0 +1,73 @@
+#include "RadixSort.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Sort variants, arg 1 of every benchmark.
+enum Variant { kStdSort = 0, kSimdSort = 1, kRadixLsd = 2, kRadixMsd = 3 };
+
+template <typename T> static std::vector<T> makeKeys(size_t size) {
+  std::mt19937_64 rng(42);
+  std::vector<T> keys(size);
+  for (auto &key : keys) {
+    if constexpr (std::is_floating_point_v<T>) {
+      key = static_cast<T>(static_cast<int64_t>(rng())) / 1e6;
+    } else {
+      key = static_cast<T>(rng());
+    }
+  }
+  return keys;
+}
+
+// Arg 0 is the number of keys, arg 1 the Variant, arg 2 the radix sort
+// threads.
+template <typename T> static void BM_RunSort(benchmark::State &state) {
+  const int variant = state.range(1);
+  if constexpr (!isSimdSortable<T, std::less<T>>) {
+    if (variant == kSimdSort) {
+      state.SkipWithError("no simdSort for this key type");
+      return;
+    }
+  }
+  auto input = makeKeys<T>(state.range(0));
+  std::vector<T> keys(input.size());
+  std::vector<T> scratch(input.size());
+  RadixSorter<T> sorter({.threads = static_cast<uint32_t>(state.range(2))});
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::copy(input.begin(), input.end(), keys.begin());
+    state.ResumeTiming();
+    T *sorted = keys.data();
+    if (variant == kStdSort) {
+      std::sort(keys.begin(), keys.end(), RadixKey<T>::less);
+    } else if (variant == kSimdSort) {
+      if constexpr (isSimdSortable<T, std::less<T>>) {
+        simdSort(keys.data(), keys.size());
+      }
+    } else if (variant == kRadixLsd) {
+      sorted = sorter.sort(keys.data(), scratch.data(), keys.size());
+    } else {
+      sorter.sortInPlace(keys.data(), keys.size());
+    }
+    benchmark::DoNotOptimize(sorted);
+  }
+  state.SetItemsProcessed(state.iterations() * input.size());
+  state.SetBytesProcessed(state.iterations() * input.size() * sizeof(T));
+}
+
+static void runSortArgs(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"keys", "variant", "threads"})
+      ->ArgsProduct({{1 << 16, 1 << 20, 1 << 24},
+                     {kStdSort, kSimdSort, kRadixLsd, kRadixMsd},
+                     {1}})
+      ->Args({1 << 24, kRadixLsd, 4})
+      ->Args({1 << 24, kRadixMsd, 4})
+      ->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_TEMPLATE(BM_RunSort, int64_t)->Apply(runSortArgs);
+BENCHMARK_TEMPLATE(BM_RunSort, uint32_t)->Apply(runSortArgs);
+BENCHMARK_TEMPLATE(BM_RunSort, double)->Apply(runSortArgs);
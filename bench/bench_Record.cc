@@ -0,0 +1,76 @@
+#include "RandomGenerator.h"
+#include "Record.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <vector>
+
+static RecordSchemaPtr makeSchema(bool stringKey) {
+  return std::make_shared<RecordSchema>(
+      std::vector<Column>{{"id", ColumnType::Int64},
+                          {"name", ColumnType::String},
+                          {"score", ColumnType::Double}},
+      std::vector<SortKeyColumn>{{stringKey ? 1u : 0u}, {2}});
+}
+
+// Sorts pointers to `range(0)` packed records by the key, `range(1)` picks an
+// integer or a string key and `range(2)` whether comparisons start with the
+// prefix or go to the key columns right away.
+static void BM_SortRecords(benchmark::State &state) {
+  auto schema = makeSchema(state.range(1) != 0);
+  const bool usePrefix = state.range(2) != 0;
+  RandomRecordGenerator generator(schema, state.range(0));
+  Record record(schema);
+  std::vector<uint64_t> buffer;
+  std::vector<size_t> offsets;
+  size_t used = 0;
+  while (generator.hasNext()) {
+    generator.next(record);
+    buffer.resize((used + record.size()) / 8);
+    record.serialize(reinterpret_cast<char *>(buffer.data()) + used);
+    offsets.push_back(used);
+    used += record.size();
+  }
+  std::vector<const char *> input;
+  for (size_t offset : offsets) {
+    input.push_back(reinterpret_cast<const char *>(buffer.data()) + offset);
+  }
+  RecordComparator comparator(schema);
+  std::vector<const char *> records(input.size());
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::copy(input.begin(), input.end(), records.begin());
+    state.ResumeTiming();
+    if (usePrefix) {
+      std::sort(records.begin(), records.end(), comparator);
+    } else {
+      std::sort(records.begin(), records.end(),
+                [&](const char *a, const char *b) {
+                  return comparator.compareKey(a, b) < 0;
+                });
+    }
+    benchmark::DoNotOptimize(records.data());
+  }
+  state.SetItemsProcessed(state.iterations() * input.size());
+}
+
+BENCHMARK(BM_SortRecords)
+    ->ArgNames({"records", "stringKey", "prefix"})
+    ->ArgsProduct({{1 << 16, 1 << 20}, {0, 1}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_SerializeRecord(benchmark::State &state) {
+  auto schema = makeSchema(true);
+  RandomRecordGenerator generator(schema, 1);
+  Record record(schema);
+  generator.next(record);
+  std::vector<uint64_t> buffer(record.size() / 8);
+  for (auto _ : state) {
+    record.serialize(reinterpret_cast<char *>(buffer.data()));
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetBytesProcessed(state.iterations() * record.size());
+}
+
+BENCHMARK(BM_SerializeRecord);
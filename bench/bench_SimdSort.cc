@@ -0,0 +1,58 @@
+#include "SimdSort.h"
+
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Input shapes, arg 1 of every benchmark.
+enum Shape { kRandom = 0, kSorted = 1, kFewDistinct = 2 };
+
+template <typename T> static std::vector<T> makeKeys(size_t size, int shape) {
+  std::mt19937_64 rng(42);
+  std::vector<T> keys(size);
+  for (auto &key : keys) {
+    key = static_cast<T>(shape == kFewDistinct ? rng() % 16 : rng());
+  }
+  if (shape == kSorted) {
+    std::sort(keys.begin(), keys.end());
+  }
+  return keys;
+}
+
+// Arg 0 is the number of keys, arg 1 the shape, arg 2 the SimdLevel or -1
+// for std::sort.
+template <typename T> static void BM_SortKeys(benchmark::State &state) {
+  const int level = state.range(2);
+  if (level > static_cast<int>(simdLevel())) {
+    state.SkipWithError("not supported by this CPU");
+    return;
+  }
+  auto input = makeKeys<T>(state.range(0), state.range(1));
+  std::vector<T> keys(input.size());
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::copy(input.begin(), input.end(), keys.begin());
+    state.ResumeTiming();
+    if (level < 0) {
+      std::sort(keys.begin(), keys.end());
+    } else {
+      simdSort(keys.data(), keys.size(), static_cast<SimdLevel>(level));
+    }
+    benchmark::DoNotOptimize(keys.data());
+  }
+  state.SetItemsProcessed(state.iterations() * input.size());
+}
+
+static void sortArgs(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"keys", "shape", "level"})
+      ->ArgsProduct({{1 << 12, 1 << 20, 1 << 24},
+                     {kRandom, kSorted, kFewDistinct},
+                     {-1, static_cast<int>(SimdLevel::Avx2),
+                      static_cast<int>(SimdLevel::Avx512)}})
+      ->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_TEMPLATE(BM_SortKeys, int64_t)->Apply(sortArgs);
+BENCHMARK_TEMPLATE(BM_SortKeys, int32_t)->Apply(sortArgs);
@@ -0,0 +1,44 @@
+#include "MmapMemory.h"
+#include "Spiller.h"
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+
+static constexpr memSize kRegionSize = 64 * 1024 * 1024L;
+static constexpr memSize kSpillPageSize = 1024 * 1024L;
+
+// Write throughput of spilling whole regions. Arg 0 is the codec, arg 1 the
+// compression threads of the writer.
+static void BM_SpillThroughput(benchmark::State &state) {
+  const auto codec = static_cast<CompressionType>(state.range(0));
+  const auto threads = static_cast<uint32_t>(state.range(1));
+  Spiller spiller("./spill_bench_spill", codec, kDefaultSpillIoDepth, false,
+                  EvictionPolicyType::Fifo, kDefaultSpillSegmentSize, threads);
+  std::mt19937_64 rng(42);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto mem = std::make_shared<MmapMemory>(kRegionSize, kSpillPageSize);
+    auto *values = reinterpret_cast<int64_t *>(mem->address());
+    for (memSize i = 0; i < kRegionSize / sizeof(int64_t); ++i) {
+      values[i] = static_cast<int64_t>(i * 7 + rng() % 5);
+    }
+    spiller.registerMem(mem);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(spiller.spill(mem->size()));
+    state.PauseTiming();
+    spiller.unregisterMem(mem->address());
+    state.ResumeTiming();
+  }
+  Statistics stats = spiller.stats();
+  state.counters["ratio"] = stats.compressionRatio();
+  state.SetBytesProcessed(state.iterations() * kRegionSize);
+}
+
+BENCHMARK(BM_SpillThroughput)
+    ->ArgNames({"codec", "threads"})
+    ->ArgsProduct({{CompressionType::None, CompressionType::Zstd,
+                    CompressionType::Lz4, CompressionType::Adaptive},
+                   {1, 2, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Conf.h"
+#include "FileUtils.h"
+#include "Metrics.h"
+
+#include <functional>
+#include <liburing.h>
+#include <memory>
+#include <vector>
+
+// Reads ranges of open spill files through io_uring. Every frame read goes
+// into one of `queueDepth` registered buffers and is decoded when it
+// completes, so several faults can wait on the disk at the same time. Not
+// thread safe, it is meant to be driven by one handler thread.
+//
+// The registered buffers fit frames of up to `frameSize` bytes, larger frames
+// are read with plain reads into per-slot heap buffers kept for reuse.
+class AsyncSpillReader {
+public:
+  using Callback = std::function<void(bool ok)>;
+
+  // Decoding time goes to `stats` when given, read and decoding latency of
+  // every frame to `latency`.
+  explicit AsyncSpillReader(uint32_t queueDepth = kDefaultFaultIoDepth,
+                            memSize frameSize = kDefaultRegisteredFrameSize,
+                            Statistics *stats = nullptr,
+                            FaultLatency *latency = nullptr);
+
+  ~AsyncSpillReader();
+
+  AsyncSpillReader(const AsyncSpillReader &) = delete;
+  AsyncSpillReader(AsyncSpillReader &&) = delete;
+  AsyncSpillReader &operator=(const AsyncSpillReader &) = delete;
+  AsyncSpillReader &operator=(AsyncSpillReader &&) = delete;
+
+  // Blocks only when every buffer is busy. `dst` must stay valid until the
+  // callback has run.
+  void submit(const SpillFilePtr &file, int64_t offset, char *dst,
+              memSize size, Callback callback);
+
+  // Runs the callbacks of completed reads, waits for one if `wait`.
+  void poll(bool wait);
+
+  void drain();
+
+  // Readable whenever completions are pending.
+  int eventFd() const;
+
+  uint32_t pendingReads() const;
+
+private:
+  struct Request;
+  struct Op;
+
+  uint32_t acquireSlot();
+  char *slotBuffer(uint32_t slot, memSize size);
+  void onComplete(Op *op, int res);
+
+  io_uring ring_;
+  int eventFd_;
+  const uint32_t queueDepth_;
+  memSize bufferSize_;
+  bool registered_;
+  std::vector<char *> buffers_;
+  std::vector<std::unique_ptr<char, void (*)(void *)>> largeBuffers_;
+  std::vector<memSize> largeSizes_;
+  std::vector<uint32_t> freeSlots_;
+  CompressionContext codec_;
+  Statistics *stats_;
+  FaultLatency *latency_;
+  uint32_t pendingOps_;
+};
+
+using AsyncSpillReaderPtr = std::unique_ptr<AsyncSpillReader>;
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Conf.h"
+#include "FileUtils.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <liburing.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes spill files in the framed format through io_uring. Up to
+// `queueDepth` frames are in flight at once, each compressed into its own
+// registered buffer, so compressing the next frame (or the next region)
+// overlaps with the disk writes of the previous ones. The callback runs once
+// the data has been fdatasync'ed, or failed.
+//
+// With more than one compression thread the frames of a region are
+// compressed in parallel by a pool of that many threads, as many at a time as
+// there are free buffers, and still written in order. The calling thread
+// only places the compressed frames in the file and builds the frame index.
+//
+// The registered buffers fit frames of up to `frameSize` bytes, larger frames
+// use per-slot heap buffers that are kept for reuse.
+class AsyncSpillWriter {
+public:
+  // `length` is the number of bytes the spill file takes.
+  using Callback = std::function<void(bool ok, memSize length)>;
+
+  // Codec counters go to `stats` when given. There are at least as many
+  // buffers as compression threads.
+  explicit AsyncSpillWriter(
+      uint32_t queueDepth = kDefaultSpillIoDepth,
+      memSize frameSize = kDefaultRegisteredFrameSize,
+      Statistics *stats = nullptr,
+      uint32_t compressionThreads = kDefaultSpillCompressionThreads);
+
+  ~AsyncSpillWriter();
+
+  AsyncSpillWriter(const AsyncSpillWriter &) = delete;
+  AsyncSpillWriter(AsyncSpillWriter &&) = delete;
+  AsyncSpillWriter &operator=(const AsyncSpillWriter &) = delete;
+  AsyncSpillWriter &operator=(AsyncSpillWriter &&) = delete;
+
+  // Writes the spill file at `base` of `fd`, it takes at most
+  // FileUtils::maxFramedSize bytes. `fd` must stay open and `addr` valid and
+  // unchanged until the callback has run.
+  void submit(int fd, uint64_t base, char *addr, memSize size,
+              CompressionType type, memSize frameSize, Callback callback);
+
+  // Same into a file of its own, removed again if the write fails.
+  void submit(const std::string &fileName, char *addr, memSize size,
+              CompressionType type, memSize frameSize, Callback callback);
+
+  // Blocks until every submitted file has completed.
+  void drain();
+
+  uint32_t pendingFiles() const;
+
+private:
+  struct Job;
+  struct Op;
+  // Compression of one frame into the buffer of a slot.
+  struct Task {
+    const char *src;
+    memSize size;
+    char *buffer;
+    memSize capacity;
+    CompressionType type;
+    FrameEntry entry;
+    // What to write, the buffer or `src` for a raw frame.
+    const char *data;
+    std::exception_ptr error;
+    bool done;
+  };
+
+  uint32_t acquireSlot();
+  char *slotBuffer(uint32_t slot, memSize size);
+  void enqueueWrite(const std::shared_ptr<Job> &job, int slot,
+                    const char *data, memSize len, uint64_t offset);
+  void enqueueSync(const std::shared_ptr<Job> &job);
+  io_uring_sqe *nextSqe();
+  void reap(bool wait);
+  void onComplete(Op *op, int res);
+  void start(const std::shared_ptr<Job> &job, char *addr, memSize size,
+             CompressionType type, memSize frameSize);
+  void finish(const std::shared_ptr<Job> &job, bool ok);
+  void dispatch(Task &task);
+  // Rethrows what the compression threw if `rethrow`.
+  void wait(Task &task, bool rethrow);
+  void runTask(Task &task, CompressionContext &ctx);
+  void compressLoop();
+
+  io_uring ring_;
+  const uint32_t queueDepth_;
+  const memSize frameSize_;
+  memSize bufferSize_;
+  bool registered_;
+  std::vector<char *> buffers_;
+  std::vector<std::vector<char>> largeBuffers_;
+  std::vector<uint32_t> freeSlots_;
+  CompressionContext codec_;
+  Statistics *stats_;
+  uint32_t pendingOps_;
+  uint32_t pendingFiles_;
+  // One per slot.
+  std::vector<Task> tasks_;
+  // Empty when compressing on the calling thread.
+  std::vector<std::thread> compressors_;
+  std::mutex taskMutex_;
+  std::condition_variable taskCv_;
+  std::condition_variable doneCv_;
+  std::deque<Task *> queue_;
+  bool stopping_;
+};
+
+using AsyncSpillWriterPtr = std::unique_ptr<AsyncSpillWriter>;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Conf.h"
+#include "Metrics.h"
 #include "MmapMemory.h"
 #include "PageFaultHandler.h"
 #include "QuotaManager.h"
@@ -17,10 +18,28 @@ public:
   BufferManager &operator=(const BufferManager &) = delete;
   BufferManager &operator=(BufferManager &&) = delete;
 
-  MmapMemoryPtr accquireMemory(int64_t size);
+  // `pageSize` is the fault and spill granularity of the region, see
+  // isValidPageSize. The region's quota is reserved in `pool`, the process
+  // pool if null, and returned as it is spilled or destroyed. A `pinned`
+  // region isn't spilled until unpinned, see Spiller::setPinned.
+  MmapMemoryPtr accquireMemory(int64_t size, memSize pageSize = kPageSize,
+                               const QuotaPoolPtr &pool = nullptr,
+                               bool pinned = false);
+
+  void setPinned(const MmapMemoryPtr &mem, bool pinned);
+
+  // The process pool, create query and operator pools below it.
+  const QuotaPoolPtr &quotaPool() const { return quotaManager_->root(); }
 
   Statistics pageFaultStats() const;
 
+  // Compression ratio and time per codec of the spills.
+  Statistics spillStats() const;
+
+  // Counters, latency histograms and memory usage, walks the page tables of
+  // every region. Latencies are in seconds.
+  MetricsSnapshot metrics() const;
+
 private:
   SpillerPtr spiller_;
   std::unique_ptr<QuotaManager> quotaManager_;
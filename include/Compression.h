@@ -4,15 +4,93 @@
 
 #include <cstdint>
 #include <istream>
+#include <memory>
 #include <ostream>
 #include <vector>
 
+// Zstd level used unless chooseCodec asks for another one.
+constexpr int kDefaultZstdLevel = 1;
+
 std::vector<char> compressBuffer(const char *src, size_t size,
                                  CompressionType type);
 
+// Upper bound of the compressed size of `size` bytes with `type`, for
+// Adaptive whichever codec gets picked.
+size_t compressBound(size_t size, CompressionType type);
+
+// Compresses into a caller-owned buffer and returns the compressed size.
+// Uses the calling thread's CompressionContext.
+size_t compressBuffer(const char *src, size_t size, char *dst,
+                      size_t capacity, CompressionType type);
+
 void decompressBuffer(const char *src, size_t csize, char *dst, size_t dsize,
                       CompressionType type);
 
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct LZ4F_cctx_s;
+struct LZ4F_dctx_s;
+
+// Codec state and scratch buffers reused across calls, so compressing and
+// decoding in steady state allocates nothing. Owned by one thread at a time,
+// either explicitly (the spill writer and every fault reader keep one) or
+// through local().
+class CompressionContext {
+public:
+  // Scratch buffers, each grows to the largest size asked for.
+  enum BufferId { kInputBuffer = 0, kOutputBuffer = 1, kFrameBuffer = 2 };
+
+  CompressionContext();
+  ~CompressionContext();
+
+  CompressionContext(const CompressionContext &) = delete;
+  CompressionContext &operator=(const CompressionContext &) = delete;
+
+  // The context of the calling thread.
+  static CompressionContext &local();
+
+  // `level` only applies to Zstd.
+  size_t compress(const char *src, size_t size, char *dst, size_t capacity,
+                  CompressionType type, int level = kDefaultZstdLevel);
+
+  void decompress(const char *src, size_t csize, char *dst, size_t dsize,
+                  CompressionType type);
+
+  // Contents are not kept when it grows.
+  char *buffer(BufferId id, size_t size);
+
+  // Reset for a new stream, created on first use.
+  ZSTD_CCtx_s *zstdStream();
+  ZSTD_DCtx_s *zstdDecoder();
+  LZ4F_cctx_s *lz4Stream();
+  LZ4F_dctx_s *lz4Decoder();
+
+private:
+  static constexpr int kBufferCount = 3;
+
+  ZSTD_CCtx_s *zstdC_;
+  ZSTD_DCtx_s *zstdD_;
+  LZ4F_cctx_s *lz4fC_;
+  LZ4F_dctx_s *lz4fD_;
+  // LZ4 block compression state, LZ4_sizeofState() bytes.
+  void *lz4State_;
+  std::unique_ptr<char[]> buffers_[kBufferCount];
+  size_t bufferSizes_[kBufferCount];
+};
+
+struct CodecChoice {
+  CompressionType type;
+  int level;
+};
+
+// How CompressionType::Adaptive stores one chunk. Near random bytes, judged
+// by the entropy of a sample, are stored raw without trying a codec.
+// Otherwise a prefix is compressed with both codecs: data neither shrinks
+// much stays raw, Zstd is only picked when it beats LZ4 by a clear margin,
+// at a higher level when the data is very redundant.
+CodecChoice chooseCodec(const char *src, size_t size,
+                        CompressionContext &ctx = CompressionContext::local());
+
 void compressToStream(const char *src, size_t size, CompressionType type,
                       std::ostream &out);
 
@@ -7,14 +7,77 @@ using memSize = uint64_t;
 
 constexpr memSize kPageSize = 16 * 1024 * 1024L;
 
+// Regions pick their own page size, a power of two in this range. It is the
+// unit of allocation rounding, spill frames and fault handling.
+constexpr memSize kMinPageSize = 4 * 1024L;
+constexpr memSize kMaxPageSize = 64 * 1024 * 1024L;
+
+constexpr bool isValidPageSize(memSize pageSize) {
+  return pageSize >= kMinPageSize && pageSize <= kMaxPageSize &&
+         (pageSize & (pageSize - 1)) == 0;
+}
+
+// Frames up to this size are staged in the registered io_uring buffers of
+// the spill writer and readers, which are pinned and not charged to any
+// quota. Larger ones go through heap buffers grown when first needed.
+constexpr memSize kDefaultRegisteredFrameSize = 1024 * 1024L;
+
+// Frames in flight for the asynchronous spill writer.
+constexpr uint32_t kDefaultSpillIoDepth = 4;
+
+// Threads compressing spill frames, with one frames are compressed by the
+// spilling thread itself.
+constexpr uint32_t kDefaultSpillCompressionThreads = 1;
+
+// Page reads each fault handler thread keeps outstanding.
+constexpr uint32_t kDefaultFaultIoDepth = 4;
+
+constexpr uint32_t kDefaultFaultHandlerThreads = 2;
+
+// Pages read ahead once a region is faulted sequentially, 0 disables it.
+constexpr uint32_t kDefaultPrefetchDepth = 2;
+
+// Spill files are extents of segment files of this size, see SpillStore.h.
+constexpr memSize kDefaultSpillSegmentSize = 256 * 1024 * 1024L;
+
+// Background spilling starts once quota usage is above the high watermark
+// and stops below the low one, both fractions of the quota.
+constexpr double kDefaultSpillHighWatermark = 0.9;
+constexpr double kDefaultSpillLowWatermark = 0.75;
+
+// How long an allocation waits for background spilling to free quota.
+constexpr uint32_t kDefaultQuotaWaitMs = 1000;
+
 enum CompressionType {
   None = 0,
   Zstd = 1,
   Lz4 = 2,
+  // Picks one of the above per frame, see chooseCodec.
+  Adaptive = 3,
+};
+
+// Order in which the spiller evicts regions, see EvictionPolicy.h.
+enum EvictionPolicyType {
+  Fifo = 0,
+  Lru = 1,
+  Clock = 2,
+  CostAware = 3,
 };
 
 struct Config {
   std::string spillDir;
   memSize quota;
   CompressionType compressionType;
+  uint32_t spillIoDepth = kDefaultSpillIoDepth;
+  uint32_t spillCompressionThreads = kDefaultSpillCompressionThreads;
+  uint32_t faultIoDepth = kDefaultFaultIoDepth;
+  uint32_t faultHandlerThreads = kDefaultFaultHandlerThreads;
+  uint32_t prefetchDepth = kDefaultPrefetchDepth;
+  // Read spill files with O_DIRECT on the fault path.
+  bool spillDirectIo = false;
+  EvictionPolicyType evictionPolicy = EvictionPolicyType::Fifo;
+  memSize spillSegmentSize = kDefaultSpillSegmentSize;
+  double spillHighWatermark = kDefaultSpillHighWatermark;
+  double spillLowWatermark = kDefaultSpillLowWatermark;
+  uint32_t quotaWaitMs = kDefaultQuotaWaitMs;
 };
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Conf.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Decides which regions the spiller evicts first. Regions are identified by
+// their start address. Not thread safe, the spiller serializes the calls.
+class EvictionPolicy {
+public:
+  virtual ~EvictionPolicy() = default;
+
+  virtual void add(char *addr, memSize size) = 0;
+
+  virtual void remove(char *addr) = 0;
+
+  // A page fault on the region.
+  virtual void recordAccess(char * /*addr*/) {}
+
+  // The region has been written, its spill file takes `compressedSize`.
+  virtual void recordSpillFile(char * /*addr*/,
+                               memSize /*compressedSize*/) {}
+
+  // The region lost pages to a spill.
+  virtual void recordEviction(char * /*addr*/) {}
+
+  // Every region, the first ones are evicted first.
+  virtual std::vector<char *> victims() = 0;
+};
+
+using EvictionPolicyPtr = std::unique_ptr<EvictionPolicy>;
+
+EvictionPolicyPtr createEvictionPolicy(EvictionPolicyType type);
+
+// Round robin in registration order, an evicted region goes to the back.
+class FifoEvictionPolicy : public EvictionPolicy {
+public:
+  void add(char *addr, memSize size) override;
+  void remove(char *addr) override;
+  void recordEviction(char *addr) override;
+  std::vector<char *> victims() override;
+
+protected:
+  void moveToBack(char *addr);
+
+  std::list<char *> order_;
+  std::unordered_map<char *, std::list<char *>::iterator> index_;
+};
+
+// Least recently faulted (or allocated) first.
+class LruEvictionPolicy : public FifoEvictionPolicy {
+public:
+  void recordAccess(char *addr) override;
+  void recordEviction(char *addr) override;
+};
+
+// Second chance: a fault sets the reference bit of a region, the hand
+// clears it and passes the region over once.
+class ClockEvictionPolicy : public EvictionPolicy {
+public:
+  void add(char *addr, memSize size) override;
+  void remove(char *addr) override;
+  void recordAccess(char *addr) override;
+  void recordEviction(char *addr) override;
+  std::vector<char *> victims() override;
+
+private:
+  std::vector<char *> ring_;
+  std::unordered_map<char *, bool> referenced_;
+  size_t hand_{0};
+};
+
+// Orders regions by what evicting them costs: writing the region if it has
+// no spill file yet, plus reading its compressed bytes back, weighted by how
+// recently it was faulted. Regions already on disk that compress well and
+// have gone cold come first.
+class CostAwareEvictionPolicy : public EvictionPolicy {
+public:
+  void add(char *addr, memSize size) override;
+  void remove(char *addr) override;
+  void recordAccess(char *addr) override;
+  void recordSpillFile(char *addr, memSize compressedSize) override;
+  std::vector<char *> victims() override;
+
+private:
+  struct Entry {
+    memSize size;
+    // Unknown until written, assumed incompressible.
+    memSize compressedSize;
+    bool onDisk{false};
+    uint64_t lastAccess{0};
+  };
+
+  double cost(const Entry &entry) const;
+
+  std::unordered_map<char *, Entry> entries_;
+  uint64_t clock_{0};
+};
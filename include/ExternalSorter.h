@@ -0,0 +1,620 @@
+#pragma once
+
+#include "BufferManager.h"
+#include "Conf.h"
+#include "LoserTree.h"
+#include "MmapMemory.h"
+#include "ParallelMerge.h"
+#include "QuotaPool.h"
+#include "RadixSort.h"
+#include "SimdSort.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Page size of the run regions, faults and spills happen in these units.
+constexpr memSize kDefaultSortPageSize = 1024 * 1024L;
+
+// Records handed to the sink at a time.
+constexpr size_t kDefaultSortOutputBatch = 4096;
+
+// How runs are sorted once full.
+enum class RunSort {
+  // simdSort for the integer keys it takes, else an in place radix sort for
+  // keys with a RadixKey, else std::sort.
+  Auto = 0,
+  // std::sort with the sort's Compare, or simdSort.
+  Comparison = 1,
+  // MSD radix sort in the run's region.
+  RadixInPlace = 2,
+  // LSD radix sort between the run's region and a second one taken from
+  // the sort's pool along with it, the run keeps whichever ends up sorted.
+  // Needs two runs to fit in the budget.
+  RadixPingPong = 3,
+};
+
+// How the input is cut into runs.
+enum class RunGeneration {
+  // A run per region of runSize bytes, sorted once full.
+  Blocks = 0,
+  // Batched replacement selection. The budget less two regions of runSize
+  // bytes is a workspace of sorted batches, and the run being written takes
+  // the smallest record of the batches that can still go in it, the rest of
+  // a batch sorting before that record waits for the next run. Runs come
+  // out 1.7 to 2 times the workspace on random input, presorted input is a
+  // single run, at the cost of a merge of the batches as they are written.
+  // Reversed input is the worst case, runs of the workspace.
+  ReplacementSelection = 1,
+};
+
+struct ExternalSortOptions {
+  memSize pageSize = kDefaultSortPageSize;
+  // Bytes of one run, half the memory budget if 0, so that one run can be
+  // filled while the one before it is spilled. With ReplacementSelection
+  // the bytes written to a run region at a time, 1/32 of the budget if 0.
+  memSize runSize = 0;
+  size_t outputBatch = kDefaultSortOutputBatch;
+  RunGeneration runGeneration = RunGeneration::Blocks;
+  // Replacement selection sorts its batches in place, RadixPingPong as
+  // RadixInPlace.
+  RunSort runSort = RunSort::Auto;
+  // Threads of the radix sorts.
+  uint32_t sortThreads = 1;
+  // Threads of the final merge, a ParallelMerger cuts the output in windows
+  // of a quarter of the budget at most, one range per thread.
+  uint32_t mergeThreads = 1;
+  // The sort's pool is created below this one, the process pool if null.
+  QuotaPoolPtr parentPool = nullptr;
+};
+
+// Sorts more records than fit in memory. Records are appended to runs in
+// regions of the BufferManager, each run is sorted once full, and the quota
+// pool of the sort, `memoryBudget` bytes, makes the manager spill the older
+// runs. Runs are sorted as ExternalSortOptions::runSort says, the radix sorts
+// need records with a RadixKey in ascending order, and can be made longer by
+// replacement selection, see RunGeneration. finish() merges the runs with a
+// LoserTree, or on several threads with a ParallelMerger, and hands the
+// output to a sink in order.
+// Records are moved as bytes, so T must be trivially copyable.
+//
+//   ExternalSorter<int64_t> sorter(manager, 1L << 30);
+//   sorter.addAll([&](int64_t &v) { return in.read(v); });
+//   sorter.finish([&](const int64_t *v, size_t n) { out.write(v, n); });
+template <typename T, typename Compare = std::less<T>> class ExternalSorter {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "records are stored and spilled as bytes");
+
+public:
+  // Gets the output in order, a batch at a time. The records are only
+  // valid during the call.
+  using Sink = std::function<void(const T *records, size_t count)>;
+
+  ExternalSorter(BufferManager &manager, memSize memoryBudget,
+                 Compare compare = Compare(),
+                 const ExternalSortOptions &options = {})
+      : manager_(manager), compare_(std::move(compare)), options_(options),
+        runSize_(options.runSize != 0 ? options.runSize
+                                      : defaultRunSize(memoryBudget, options)),
+        runSort_(chooseRunSort(options.runSort)),
+        current_(nullptr), capacity_(0), filled_(0), recordCount_(0),
+        finished_(false), workspaceSize_(0), batchRecords_(0),
+        pageRecords_(0), pageCount_(0), pages_(nullptr), lastOut_(),
+        hasLastOut_(false), chunk_(nullptr), chunkFilled_(0) {
+    if (!isValidPageSize(options_.pageSize)) {
+      throw std::runtime_error("invalid sort page size " +
+                               std::to_string(options_.pageSize));
+    }
+    if (runSize_ < options_.pageSize || runSize_ < sizeof(T) ||
+        runSize_ > memoryBudget) {
+      throw std::runtime_error("sort budget of " +
+                               std::to_string(memoryBudget) +
+                               " bytes can't hold a run");
+    }
+    if (options_.runGeneration == RunGeneration::ReplacementSelection) {
+      planWorkspace(memoryBudget);
+    } else if (runSort_ == RunSort::RadixPingPong &&
+               runSize_ > memoryBudget / 2) {
+      throw std::runtime_error("sort budget of " +
+                               std::to_string(memoryBudget) +
+                               " bytes can't hold two runs");
+    }
+    const QuotaPoolPtr &parent = options_.parentPool != nullptr
+                                     ? options_.parentPool
+                                     : manager_.quotaPool();
+    pool_ = parent->createChild("external-sort", memoryBudget);
+  }
+
+  ExternalSorter(const ExternalSorter &) = delete;
+  ExternalSorter(ExternalSorter &&) = delete;
+  ExternalSorter &operator=(const ExternalSorter &) = delete;
+  ExternalSorter &operator=(ExternalSorter &&) = delete;
+
+  void add(const T &record) { add(&record, 1); }
+
+  void add(const T *records, size_t count) {
+    if (finished_) {
+      throw std::runtime_error("records added to a finished sort");
+    }
+    while (count > 0) {
+      if (filled_ == capacity_) {
+        if (!selecting()) {
+          sealRun();
+          startRun();
+        } else if (workspaceMem_ == nullptr) {
+          startSelection();
+        } else {
+          addBatch();
+        }
+      }
+      size_t n = std::min(count, capacity_ - filled_);
+      std::copy(records, records + n, current_ + filled_);
+      filled_ += n;
+      records += n;
+      count -= n;
+      recordCount_ += n;
+    }
+  }
+
+  // Adds records from `next`, a `bool(T &)` that returns false at the end of
+  // its input.
+  template <typename Source> void addAll(Source &&next) {
+    T record;
+    while (next(record)) {
+      add(record);
+    }
+  }
+
+  // Sorts the last run and merges all of them into `sink`. Runs are released
+  // as soon as they are merged.
+  void finish(const Sink &sink) {
+    if (finished_) {
+      throw std::runtime_error("sort already finished");
+    }
+    if (selecting()) {
+      finishSelection();
+    } else {
+      sealRun();
+    }
+    finished_ = true;
+    merge(sink);
+    runs_.clear();
+  }
+
+  // Runs written so far, the one being filled included. With replacement
+  // selection the records still in the workspace count as the runs they
+  // are bound for.
+  size_t runCount() const {
+    if (!selecting()) {
+      return runs_.size() + (current_ ? 1 : 0);
+    }
+    bool open = !openRun_.empty() || chunk_ != nullptr ||
+                !currentBatches_.empty() || filled_ > 0;
+    return runs_.size() + open + !nextBatches_.empty();
+  }
+
+  uint64_t recordCount() const { return recordCount_; }
+
+  const QuotaPoolPtr &pool() const { return pool_; }
+
+private:
+  // Part of a run, in a region of its own.
+  struct Chunk {
+    MmapMemoryPtr mem;
+    const T *records;
+    size_t count;
+  };
+
+  // Chunks in order, one for block runs. Chunks before `next` are merged.
+  struct Run {
+    std::vector<Chunk> chunks;
+    size_t next;
+  };
+
+  // A sorted batch of the replacement selection, in pages of the workspace.
+  struct Batch {
+    std::vector<uint32_t> pages;
+    size_t count;
+    // The records before it are written, and their pages given back up to
+    // the one it's in. Only brought up to date as pages run out or the tree
+    // is rebuilt.
+    size_t next;
+  };
+
+  static memSize defaultRunSize(memSize memoryBudget,
+                                const ExternalSortOptions &options) {
+    if (options.runGeneration == RunGeneration::Blocks) {
+      return memoryBudget / 2;
+    }
+    return std::max(options.pageSize, memoryBudget / 32 / options.pageSize *
+                                          options.pageSize);
+  }
+
+  // The regions of a run stay pinned while it's written, the quota they take
+  // comes from sealed runs.
+  void startRun() {
+    currentMem_ =
+        manager_.accquireMemory(runSize_, options_.pageSize, pool_, true);
+    if (runSort_ == RunSort::RadixPingPong) {
+      scratchMem_ =
+          manager_.accquireMemory(runSize_, options_.pageSize, pool_, true);
+    }
+    current_ = reinterpret_cast<T *>(currentMem_->address());
+    capacity_ = currentMem_->size() / sizeof(T);
+    filled_ = 0;
+  }
+
+  static RunSort chooseRunSort(RunSort runSort) {
+    if (runSort == RunSort::Auto) {
+      return isRadixSortable<T, Compare> && !isSimdSortable<T, Compare>
+                 ? RunSort::RadixInPlace
+                 : RunSort::Comparison;
+    }
+    if (runSort != RunSort::Comparison && !isRadixSortable<T, Compare>) {
+      throw std::runtime_error("records can't be radix sorted");
+    }
+    return runSort;
+  }
+
+  // Sorts in place, every RunSort but RadixPingPong.
+  void sortRecords(T *records, size_t count) const {
+    if constexpr (isRadixSortable<T, Compare>) {
+      if (runSort_ != RunSort::Comparison) {
+        RadixSorter<T> radix({.threads = options_.sortThreads});
+        radix.sortInPlace(records, count);
+        return;
+      }
+    }
+    if constexpr (isSimdSortable<T, Compare>) {
+      simdSort(records, count);
+    } else {
+      std::sort(records, records + count, compare_);
+    }
+  }
+
+  void sealRun() {
+    if (current_ == nullptr) {
+      return;
+    }
+    if constexpr (isRadixSortable<T, Compare>) {
+      if (runSort_ == RunSort::RadixPingPong) {
+        RadixSorter<T> radix({.threads = options_.sortThreads});
+        T *scratch = reinterpret_cast<T *>(scratchMem_->address());
+        if (radix.sort(current_, scratch, filled_) == scratch) {
+          std::swap(currentMem_, scratchMem_);
+          current_ = scratch;
+        }
+        scratchMem_.reset();
+      }
+    }
+    if (runSort_ != RunSort::RadixPingPong) {
+      sortRecords(current_, filled_);
+    }
+    manager_.setPinned(currentMem_, false);
+    std::vector<Chunk> chunks;
+    chunks.push_back({std::move(currentMem_), current_, filled_});
+    runs_.push_back({std::move(chunks), 0});
+    current_ = nullptr;
+    capacity_ = filled_ = 0;
+  }
+
+  bool selecting() const {
+    return options_.runGeneration == RunGeneration::ReplacementSelection;
+  }
+
+  // The workspace is an input batch of batchRecords_ followed by pageCount_
+  // pages of pageRecords_. A batch of 1/32 of it in pages of 1/64 of a batch
+  // keeps the merge of the batches to some 64 sources and the pages left
+  // part empty to a few percent.
+  // Two run regions are left out of it, one to fill while the one before is
+  // spilled.
+  void planWorkspace(memSize memoryBudget) {
+    workspaceSize_ = memoryBudget > 2 * runSize_
+                         ? (memoryBudget - 2 * runSize_) / options_.pageSize *
+                               options_.pageSize
+                         : 0;
+    size_t records = workspaceSize_ / sizeof(T);
+    batchRecords_ = std::max<size_t>(records / 32, 1);
+    pageRecords_ = std::max<size_t>(batchRecords_ / 64, 1);
+    pageCount_ = records > batchRecords_
+                     ? (records - batchRecords_) / pageRecords_
+                     : 0;
+    // Twice the pages of the largest batch, which can take one more when
+    // it's split.
+    if (workspaceSize_ == 0 ||
+        pageCount_ < 2 * (batchRecords_ / pageRecords_ + 2)) {
+      throw std::runtime_error("sort budget of " +
+                               std::to_string(memoryBudget) +
+                               " bytes can't hold a selection workspace");
+    }
+  }
+
+  // The workspace stays pinned until finish(), the runs are written to
+  // regions of runSize_ that are spilled as they fill.
+  void startSelection() {
+    workspaceMem_ = manager_.accquireMemory(workspaceSize_, options_.pageSize,
+                                            pool_, true);
+    current_ = reinterpret_cast<T *>(workspaceMem_->address());
+    capacity_ = batchRecords_;
+    filled_ = 0;
+    pages_ = current_ + batchRecords_;
+    for (size_t i = pageCount_; i > 0; --i) {
+      freePages_.push_back(static_cast<uint32_t>(i - 1));
+    }
+  }
+
+  T *page(uint32_t index) const { return pages_ + index * pageRecords_; }
+
+  // What is left of the page `batch.next` is in.
+  MergeSource<T> headOf(const Batch &batch) const {
+    size_t index = batch.next / pageRecords_;
+    const T *begin = page(batch.pages[index]);
+    size_t end = std::min(pageRecords_, batch.count - index * pageRecords_);
+    return {begin + batch.next % pageRecords_, begin + end};
+  }
+
+  // Sorts the input batch and moves it to pages. The part that sorts before
+  // the last record written can only go to the next run.
+  void addBatch() {
+    if (filled_ == 0) {
+      return;
+    }
+    sortRecords(current_, filled_);
+    makeRoom((filled_ + pageRecords_ - 1) / pageRecords_ + 1);
+    T *end = current_ + filled_;
+    T *split = hasLastOut_
+                   ? std::lower_bound(current_, end, lastOut_, compare_)
+                   : current_;
+    if (split != current_) {
+      nextBatches_.push_back(toPages(current_, split));
+    }
+    if (split != end) {
+      dropTree();
+      currentBatches_.push_back(toPages(split, end));
+    }
+    filled_ = 0;
+  }
+
+  Batch toPages(const T *begin, const T *end) {
+    Batch batch{{}, static_cast<size_t>(end - begin), 0};
+    while (begin != end) {
+      uint32_t index = freePages_.back();
+      freePages_.pop_back();
+      size_t n = std::min<size_t>(pageRecords_, end - begin);
+      std::copy(begin, begin + n, page(index));
+      batch.pages.push_back(index);
+      begin += n;
+    }
+    return batch;
+  }
+
+  // Writes records until `pages` are free, ending runs whose batches run
+  // out.
+  void makeRoom(size_t pages) {
+    while (freePages_.size() < pages) {
+      if (!emit()) {
+        endRun();
+      }
+    }
+  }
+
+  // Writes up to a batch of the current run, returns false if it has no
+  // records left.
+  bool emit() {
+    if (tree_ == nullptr) {
+      buildTree();
+    }
+    if (tree_->empty()) {
+      return false;
+    }
+    if (chunk_ == nullptr) {
+      chunkMem_ =
+          manager_.accquireMemory(runSize_, options_.pageSize, pool_, true);
+      chunk_ = reinterpret_cast<T *>(chunkMem_->address());
+    }
+    const size_t chunkRecords = chunkMem_->size() / sizeof(T);
+    size_t n = tree_->pop(
+        chunk_ + chunkFilled_,
+        std::min(chunkRecords - chunkFilled_,
+                 std::max<size_t>(options_.outputBatch, 1)));
+    chunkFilled_ += n;
+    lastOut_ = chunk_[chunkFilled_ - 1];
+    hasLastOut_ = true;
+    if (chunkFilled_ == chunkRecords) {
+      sealChunk();
+    }
+    for (size_t i = 0; i < currentBatches_.size(); ++i) {
+      Batch &batch = currentBatches_[i];
+      if (batch.next == batch.count || !tree_->exhausted(i)) {
+        continue;
+      }
+      size_t index = batch.next / pageRecords_;
+      freePages_.push_back(batch.pages[index]);
+      batch.next = std::min((index + 1) * pageRecords_, batch.count);
+      if (batch.next != batch.count) {
+        MergeSource<T> head = headOf(batch);
+        tree_->refill(i, head.begin, head.end);
+      }
+    }
+    return true;
+  }
+
+  void buildTree() {
+    currentBatches_.erase(
+        std::remove_if(currentBatches_.begin(), currentBatches_.end(),
+                       [](const Batch &b) { return b.next == b.count; }),
+        currentBatches_.end());
+    std::vector<MergeSource<T>> sources;
+    for (const Batch &batch : currentBatches_) {
+      sources.push_back(headOf(batch));
+    }
+    tree_ = std::make_unique<LoserTree<T, Compare>>(sources, compare_);
+  }
+
+  // Keeps where the tree got to in each batch before it goes.
+  void dropTree() {
+    if (tree_ == nullptr) {
+      return;
+    }
+    for (size_t i = 0; i < currentBatches_.size(); ++i) {
+      Batch &batch = currentBatches_[i];
+      if (batch.next != batch.count) {
+        size_t index = batch.next / pageRecords_;
+        batch.next = index * pageRecords_ +
+                     (tree_->position(i) - page(batch.pages[index]));
+      }
+    }
+    tree_.reset();
+  }
+
+  void sealChunk() {
+    manager_.setPinned(chunkMem_, false);
+    openRun_.push_back({std::move(chunkMem_), chunk_, chunkFilled_});
+    chunk_ = nullptr;
+    chunkFilled_ = 0;
+  }
+
+  // The batches of the current run are all written, the ones held back
+  // start the next.
+  void endRun() {
+    if (chunk_ != nullptr) {
+      sealChunk();
+    }
+    if (!openRun_.empty()) {
+      runs_.push_back({std::move(openRun_), 0});
+      openRun_.clear();
+    }
+    currentBatches_ = std::move(nextBatches_);
+    nextBatches_.clear();
+    tree_.reset();
+    hasLastOut_ = false;
+  }
+
+  void finishSelection() {
+    if (workspaceMem_ == nullptr) {
+      return;
+    }
+    addBatch();
+    while (!currentBatches_.empty() || !nextBatches_.empty()) {
+      if (!emit()) {
+        endRun();
+      }
+    }
+    endRun();
+    workspaceMem_.reset();
+    current_ = pages_ = nullptr;
+    capacity_ = filled_ = 0;
+    freePages_.clear();
+  }
+
+  void merge(const Sink &sink) {
+    if (options_.mergeThreads > 1) {
+      mergeInParallel(sink);
+      return;
+    }
+    std::vector<MergeSource<T>> sources;
+    for (const Run &run : runs_) {
+      const Chunk &first = run.chunks.front();
+      sources.push_back({first.records, first.records + first.count});
+    }
+    LoserTree<T, Compare> tree(sources, compare_);
+    std::vector<T> batch(std::max<size_t>(options_.outputBatch, 1));
+    while (size_t n = tree.pop(batch.data(), batch.size())) {
+      sink(batch.data(), n);
+      for (size_t r = 0; r < runs_.size(); ++r) {
+        Run &run = runs_[r];
+        if (run.next == run.chunks.size() || !tree.exhausted(r)) {
+          continue;
+        }
+        // Gives the quota and spill file back.
+        run.chunks[run.next++].mem.reset();
+        if (run.next != run.chunks.size()) {
+          const Chunk &chunk = run.chunks[run.next];
+          tree.refill(r, chunk.records, chunk.records + chunk.count);
+        }
+      }
+    }
+  }
+
+  // The window is a pinned region of the sort's pool, the sink gets it a
+  // batch at a time.
+  void mergeInParallel(const Sink &sink) {
+    std::vector<PartedSource<T>> sources;
+    for (const Run &run : runs_) {
+      std::vector<MergeSource<T>> parts;
+      for (const Chunk &chunk : run.chunks) {
+        parts.push_back({chunk.records, chunk.records + chunk.count});
+      }
+      sources.emplace_back(std::move(parts));
+    }
+    ParallelMerger<T, Compare> merger(std::move(sources),
+                                      options_.mergeThreads, compare_);
+    if (merger.empty()) {
+      return;
+    }
+    const size_t windowRecords = std::max<size_t>(
+        1, std::min<size_t>(options_.mergeThreads * 4 * kMergeRecordsPerThread,
+                            pool_->limit() / 4 / sizeof(T)));
+    MmapMemoryPtr windowMem = manager_.accquireMemory(
+        windowRecords * sizeof(T), options_.pageSize, pool_, true);
+    T *window = reinterpret_cast<T *>(windowMem->address());
+    const size_t batch = std::max<size_t>(options_.outputBatch, 1);
+    std::vector<size_t> merged(runs_.size(), 0);
+    while (size_t n = merger.merge(window, windowRecords)) {
+      for (size_t i = 0; i < n; i += batch) {
+        sink(window + i, std::min(batch, n - i));
+      }
+      for (size_t r = 0; r < runs_.size(); ++r) {
+        Run &run = runs_[r];
+        while (run.next != run.chunks.size() &&
+               merged[r] + run.chunks[run.next].count <= merger.position(r)) {
+          merged[r] += run.chunks[run.next].count;
+          run.chunks[run.next++].mem.reset();
+        }
+      }
+    }
+  }
+
+  BufferManager &manager_;
+  Compare compare_;
+  const ExternalSortOptions options_;
+  const memSize runSize_;
+  const RunSort runSort_;
+  QuotaPoolPtr pool_;
+  std::vector<Run> runs_;
+  // The run being filled.
+  MmapMemoryPtr currentMem_;
+  // The other region of a RadixPingPong sort.
+  MmapMemoryPtr scratchMem_;
+  T *current_;
+  size_t capacity_;
+  size_t filled_;
+  uint64_t recordCount_;
+  bool finished_;
+
+  // Replacement selection, current_ is the input batch in the workspace.
+  memSize workspaceSize_;
+  size_t batchRecords_;
+  size_t pageRecords_;
+  size_t pageCount_;
+  MmapMemoryPtr workspaceMem_;
+  T *pages_;
+  std::vector<uint32_t> freePages_;
+  // Batches of the run being written and of the one after it.
+  std::vector<Batch> currentBatches_;
+  std::vector<Batch> nextBatches_;
+  // Over currentBatches_, rebuilt when a batch joins.
+  std::unique_ptr<LoserTree<T, Compare>> tree_;
+  T lastOut_;
+  bool hasLastOut_;
+  // The run being written, chunk_ the region being filled.
+  std::vector<Chunk> openRun_;
+  MmapMemoryPtr chunkMem_;
+  T *chunk_;
+  size_t chunkFilled_;
+};
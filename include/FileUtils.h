@@ -2,11 +2,19 @@
 
 #include "Conf.h"
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <cstdint>
+#include <vector>
 #include "Compression.h"
+#include "Statistics.h"
+
+constexpr uint32_t kSpillFileMagic = 0x53554C46;
+constexpr uint16_t kSpillFileStreamVersion = 1;
+constexpr uint16_t kSpillFileFramedVersion = 2;
 
 struct FileMeta {
   uint32_t magic;
@@ -16,14 +24,95 @@ struct FileMeta {
   uint64_t compressedSize;
 };
 
+// Version 2 layout:
+//   [FileMeta][frame 0]...[frame n-1][FrameEntry x n][FrameFooter]
+// Every frame holds `frameSize` bytes of the region (the last one may be
+// shorter) compressed independently, so a read only decodes the frames it
+// overlaps.
+struct FrameEntry {
+  uint64_t offset;
+  uint32_t compressedSize;
+  // Codec actually used for this frame, frames that don't shrink are stored
+  // raw. With Adaptive spills it differs from frame to frame.
+  uint16_t method;
+  // Zstd level the frame was written at, for information only.
+  uint16_t level;
+};
+
+struct FrameFooter {
+  uint64_t frameSize;
+  uint64_t frameCount;
+  uint32_t magic;
+  uint32_t reserved;
+};
+
+// A framed spill file kept open with its frame index loaded, so repeated
+// reads cost one pread (or one io_uring read) per frame. The file may be an
+// extent of a larger one, frame offsets are relative to `base`.
+struct SpillFile {
+  std::string fileName;
+  int fd{-1};
+  // O_DIRECT descriptor, -1 when not requested or not supported.
+  int directFd{-1};
+  uint64_t base{0};
+  // Extents of a spill segment share the segment's descriptors.
+  bool ownsFds{true};
+  FileMeta meta{};
+  FrameFooter footer{};
+  std::vector<FrameEntry> entries;
+
+  memSize frameLength(uint64_t frame) const {
+    return std::min<uint64_t>(footer.frameSize,
+                              meta.originalSize - frame * footer.frameSize);
+  }
+
+  ~SpillFile();
+};
+
+using SpillFilePtr = std::shared_ptr<SpillFile>;
+
 class FileUtils {
 public:
   static std::string write(const std::string &fileName, char *addr,
                            memSize size,
-                           CompressionType type = CompressionType::None);
+                           CompressionType type = CompressionType::None,
+                           memSize frameSize = kPageSize);
 
   static void read(std::string &fileName, int64_t offset, char *addr,
                    memSize size);
 
+  static SpillFilePtr open(const std::string &fileName, bool direct = false);
+
+  // Opens the spill file stored in [base, base + length) of an open file,
+  // the descriptors stay owned by the caller.
+  static SpillFilePtr open(const std::string &name, int fd, int directFd,
+                           uint64_t base, memSize length);
+
+  // Upper bound of the framed layout of `size` bytes, whatever the codec.
+  static memSize maxFramedSize(memSize size, memSize frameSize);
+
+  // Reads through the scratch buffers of `ctx`, allocation free once they
+  // have grown to a frame.
+  static void read(const SpillFile &file, int64_t offset, char *addr,
+                   memSize size,
+                   CompressionContext &ctx = CompressionContext::local());
+
+  // Compresses one frame into `dst`, which holds compressBound(size, type)
+  // bytes, and sets the size, codec and level of `entry`. Returns what to
+  // write: `dst`, or `src` itself when the frame is stored raw.
+  static const char *
+  encodeFrame(const char *src, memSize size, char *dst, memSize capacity,
+              CompressionType type, FrameEntry &entry,
+              CompressionContext &ctx = CompressionContext::local(),
+              Statistics *stats = nullptr);
+
+  // Decodes `size` bytes starting at `from` of one frame into `dst`, partial
+  // frames go through the frame buffer of `ctx`.
+  static void decodeFrame(const FrameEntry &entry, const char *compressed,
+                          memSize frameLen, memSize from, char *dst,
+                          memSize size,
+                          CompressionContext &ctx = CompressionContext::local(),
+                          Statistics *stats = nullptr);
+
   static void remove(const std::string &fileName);
 };
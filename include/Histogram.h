@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Steady clock nanoseconds, what latencies are recorded in.
+inline uint64_t nowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// The counts of a histogram at one point in time, merged over its shards.
+struct HistogramSnapshot {
+  std::vector<uint64_t> counts;
+  uint64_t count{0};
+  uint64_t sum{0};
+  uint64_t max{0};
+
+  // Highest value of the bucket the `q` quantile falls in, at most `max`.
+  // 0 while empty.
+  uint64_t percentile(double q) const;
+
+  double mean() const;
+
+  void merge(const HistogramSnapshot &other);
+};
+
+// Log-linear buckets in the way of HdrHistogram: values below 32 get a bucket
+// each, every power of two above is split into 16 equal buckets, so a value
+// is known to within 1/16 of itself. Values above kMaxValue count as
+// kMaxValue. Recording is a few relaxed adds to the shard of the calling
+// thread, threads are spread over the shards round robin and readers merge
+// them, so the fault handler threads don't contend on the counters.
+class Histogram {
+public:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr int kMaxValueBits = 40;
+  // About 18 minutes in nanoseconds, 1 TB in bytes.
+  static constexpr uint64_t kMaxValue = (1ULL << kMaxValueBits) - 1;
+  static constexpr size_t kBucketCount =
+      (kMaxValueBits - kSubBucketBits + 1) << kSubBucketBits;
+  static constexpr size_t kShards = 8;
+
+  Histogram();
+  ~Histogram();
+
+  Histogram(const Histogram &) = delete;
+  Histogram(Histogram &&) = delete;
+  Histogram &operator=(const Histogram &) = delete;
+  Histogram &operator=(Histogram &&) = delete;
+
+  void record(uint64_t value);
+
+  // Records the nanoseconds since `startNanos`, see nowNanos.
+  void recordSince(uint64_t startNanos) { record(nowNanos() - startNanos); }
+
+  HistogramSnapshot snapshot() const;
+
+  static size_t bucketOf(uint64_t value);
+
+  // Values of `bucket` are [bucketLow, bucketHigh].
+  static uint64_t bucketLow(size_t bucket);
+  static uint64_t bucketHigh(size_t bucket);
+
+private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> counts[kBucketCount]{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+  };
+
+  std::unique_ptr<Shard[]> shards_;
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A sorted input of a merge, [begin, end).
+template <typename T> struct MergeSource {
+  const T *begin;
+  const T *end;
+};
+
+// Tournament tree over k sorted sources. Every inner node keeps the loser
+// of the match played there and the root slot the overall winner, so taking
+// the smallest record costs one match per level, log k comparisons, against
+// about 2 log k for a binary heap. Equal records come out in source order.
+// Exhausted sources lose every match.
+template <typename T, typename Compare = std::less<T>> class LoserTree {
+public:
+  LoserTree(const std::vector<MergeSource<T>> &sources,
+            Compare compare = Compare())
+      : compare_(std::move(compare)), leaves_(leafCount(sources.size())),
+        tree_(leaves_, 0), current_(leaves_), end_(leaves_) {
+    for (size_t i = 0; i < sources.size(); ++i) {
+      current_[i] = sources[i].begin;
+      end_[i] = sources[i].end;
+    }
+    // Padding leaves are empty sources.
+    for (size_t i = sources.size(); i < leaves_; ++i) {
+      current_[i] = end_[i] = nullptr;
+    }
+    tree_[0] = build(1);
+  }
+
+  LoserTree(const LoserTree &) = delete;
+  LoserTree(LoserTree &&) = delete;
+  LoserTree &operator=(const LoserTree &) = delete;
+  LoserTree &operator=(LoserTree &&) = delete;
+
+  bool empty() const { return exhausted(tree_[0]); }
+
+  // The smallest record left, the tree must not be empty.
+  const T &top() const { return *current_[tree_[0]]; }
+
+  // The source `top` comes from.
+  size_t topSource() const { return tree_[0]; }
+
+  void pop() {
+    uint32_t winner = tree_[0];
+    ++current_[winner];
+    replay(winner);
+  }
+
+  // Writes up to `n` records to `out` in order, returns how many. Stops
+  // early once a source runs out, so that it can be refilled before the
+  // merge goes on.
+  size_t pop(T *out, size_t n) {
+    size_t written = 0;
+    uint32_t winner = tree_[0];
+    while (written < n && !exhausted(winner)) {
+      uint32_t source = winner;
+      out[written++] = *current_[source]++;
+      winner = replay(source);
+      if (exhausted(source)) {
+        break;
+      }
+    }
+    return written;
+  }
+
+  bool exhausted(size_t source) const {
+    return current_[source] == end_[source];
+  }
+
+  // The next record of `source`, its end once exhausted.
+  const T *position(size_t source) const { return current_[source]; }
+
+  // Gives an exhausted `source` its next part, [begin, end), for sources
+  // that come in several. Plays every match again, k of them.
+  void refill(size_t source, const T *begin, const T *end) {
+    current_[source] = begin;
+    end_[source] = end;
+    tree_[0] = build(1);
+  }
+
+private:
+  static size_t leafCount(size_t sources) {
+    size_t leaves = 1;
+    while (leaves < sources) {
+      leaves *= 2;
+    }
+    return leaves;
+  }
+
+  // Whether source `a` wins against source `b`.
+  bool beats(uint32_t a, uint32_t b) const {
+    if (exhausted(a)) {
+      return false;
+    }
+    if (exhausted(b)) {
+      return true;
+    }
+    if (compare_(*current_[a], *current_[b])) {
+      return true;
+    }
+    return !compare_(*current_[b], *current_[a]) && a < b;
+  }
+
+  // Plays the matches below `node`, returns their winner.
+  uint32_t build(size_t node) {
+    if (node >= leaves_) {
+      return static_cast<uint32_t>(node - leaves_);
+    }
+    uint32_t left = build(2 * node);
+    uint32_t right = build(2 * node + 1);
+    if (beats(left, right)) {
+      tree_[node] = right;
+      return left;
+    }
+    tree_[node] = left;
+    return right;
+  }
+
+  // Replays the path from the leaf of `source` to the root after the source
+  // moved on, returns the new winner.
+  uint32_t replay(uint32_t source) {
+    uint32_t winner = source;
+    for (size_t node = (source + leaves_) / 2; node > 0; node /= 2) {
+      if (beats(tree_[node], winner)) {
+        std::swap(tree_[node], winner);
+      }
+    }
+    tree_[0] = winner;
+    return winner;
+  }
+
+  Compare compare_;
+  const size_t leaves_;
+  // Node 0 holds the winner, node i > 0 the loser of the match between its
+  // children 2i and 2i + 1. Leaf i is node leaves_ + i.
+  std::vector<uint32_t> tree_;
+  std::vector<const T *> current_;
+  std::vector<const T *> end_;
+};
+
+// Loser tree of 64-bit integer keys in ascending order. The nodes keep the
+// key they play with next to the source, mapped to an unsigned order, so a
+// match is one integer comparison of values already in the tree rather than
+// two loads from the sources. Ties and exhausted sources are decided by a
+// rank, the source index, or past every source once exhausted, compared
+// after the key.
+template <typename T> class InlineKeyLoserTree {
+  static_assert(std::is_integral_v<T> && sizeof(T) == 8,
+                "keys must be 64-bit integers");
+
+public:
+  explicit InlineKeyLoserTree(const std::vector<MergeSource<T>> &sources)
+      : leaves_(leafCount(sources.size())), tree_(leaves_),
+        current_(leaves_), end_(leaves_) {
+    for (size_t i = 0; i < sources.size(); ++i) {
+      current_[i] = sources[i].begin;
+      end_[i] = sources[i].end;
+    }
+    for (size_t i = sources.size(); i < leaves_; ++i) {
+      current_[i] = end_[i] = nullptr;
+    }
+    tree_[0] = build(1);
+  }
+
+  InlineKeyLoserTree(const InlineKeyLoserTree &) = delete;
+  InlineKeyLoserTree(InlineKeyLoserTree &&) = delete;
+  InlineKeyLoserTree &operator=(const InlineKeyLoserTree &) = delete;
+  InlineKeyLoserTree &operator=(InlineKeyLoserTree &&) = delete;
+
+  bool empty() const { return rankOf(tree_[0]) >= leaves_; }
+
+  const T &top() const { return *current_[rankOf(tree_[0])]; }
+
+  size_t topSource() const { return rankOf(tree_[0]); }
+
+  void pop() { replay(advance(rankOf(tree_[0]))); }
+
+  size_t pop(T *out, size_t n) {
+    size_t written = 0;
+    Node winner = tree_[0];
+    while (written < n && rankOf(winner) < leaves_) {
+      size_t source = rankOf(winner);
+      out[written++] = *current_[source];
+      winner = replay(advance(source));
+      if (exhausted(source)) {
+        break;
+      }
+    }
+    return written;
+  }
+
+  bool exhausted(size_t source) const {
+    return current_[source] == end_[source];
+  }
+
+  const T *position(size_t source) const { return current_[source]; }
+
+  void refill(size_t source, const T *begin, const T *end) {
+    current_[source] = begin;
+    end_[source] = end;
+    tree_[0] = build(1);
+  }
+
+private:
+  // The key in the high half, the rank in the low one, so that a match is a
+  // single 128-bit comparison.
+  using Node = unsigned __int128;
+
+  static uint64_t rankOf(Node node) { return static_cast<uint64_t>(node); }
+
+  static Node makeNode(uint64_t key, uint64_t rank) {
+    return (static_cast<Node>(key) << 64) | rank;
+  }
+
+  static size_t leafCount(size_t sources) {
+    size_t leaves = 1;
+    while (leaves < sources) {
+      leaves *= 2;
+    }
+    return leaves;
+  }
+
+  // Signed keys compare as unsigned with the sign bit flipped.
+  static uint64_t orderKey(T key) {
+    uint64_t bits = static_cast<uint64_t>(key);
+    return std::is_signed_v<T> ? bits ^ (uint64_t(1) << 63) : bits;
+  }
+
+  // The node of the next record of `source`.
+  Node head(size_t source) const {
+    if (current_[source] == end_[source]) {
+      return makeNode(std::numeric_limits<uint64_t>::max(), leaves_ + source);
+    }
+    return makeNode(orderKey(*current_[source]), source);
+  }
+
+  Node advance(size_t source) {
+    ++current_[source];
+    return head(source);
+  }
+
+  Node build(size_t node) {
+    if (node >= leaves_) {
+      return head(node - leaves_);
+    }
+    Node left = build(2 * node);
+    Node right = build(2 * node + 1);
+    if (left < right) {
+      tree_[node] = right;
+      return left;
+    }
+    tree_[node] = left;
+    return right;
+  }
+
+  Node replay(Node winner) {
+    size_t source = rankOf(winner) & (leaves_ - 1);
+    for (size_t node = (source + leaves_) / 2; node > 0; node /= 2) {
+      // Without a branch, which way a match goes is a coin toss on random
+      // input.
+      Node other = tree_[node];
+      bool lost = other < winner;
+      tree_[node] = lost ? winner : other;
+      winner = lost ? other : winner;
+    }
+    tree_[0] = winner;
+    return winner;
+  }
+
+  const size_t leaves_;
+  std::vector<Node> tree_;
+  std::vector<const T *> current_;
+  std::vector<const T *> end_;
+};
+
+// Ascending merges of 64-bit integers keep their keys inline.
+template <>
+class LoserTree<int64_t, std::less<int64_t>>
+    : public InlineKeyLoserTree<int64_t> {
+public:
+  explicit LoserTree(const std::vector<MergeSource<int64_t>> &sources,
+                     std::less<int64_t> = {})
+      : InlineKeyLoserTree(sources) {}
+};
+
+template <>
+class LoserTree<uint64_t, std::less<uint64_t>>
+    : public InlineKeyLoserTree<uint64_t> {
+public:
+  explicit LoserTree(const std::vector<MergeSource<uint64_t>> &sources,
+                     std::less<uint64_t> = {})
+      : InlineKeyLoserTree(sources) {}
+};
@@ -1,22 +1,24 @@
 #pragma once
 
-#include "FileUtils.h"
+#include "SpillStore.h"
 
 #include <cstdint>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
 
+// Region start address to the extent of its spill file in the SpillStore.
 class MemAddrToFileMap {
 public:
-  void set(char *addr, const std::string &fileName) {
+  void set(char *addr, const SpillExtent &extent) {
     std::unique_lock<std::shared_mutex> g(mutex_);
-    index_[addr] = fileName;
+    index_[addr] = extent;
   }
 
-  std::optional<std::string> get(char *addr) {
+  std::optional<SpillExtent> get(char *addr) {
     std::shared_lock<std::shared_mutex> g(mutex_);
     auto it = index_.find(addr);
     if (it == index_.end()) {
@@ -25,17 +27,19 @@ public:
     return it->second;
   }
 
-  void erase(char *addr) {
+  // Returns the extent, for the caller to give back to the store.
+  SpillExtent erase(char *addr) {
     std::unique_lock<std::shared_mutex> g(mutex_);
     auto it = index_.find(addr);
     if (it == index_.end()) {
       throw std::runtime_error("addr not found!");
     }
-    FileUtils::remove(it->second);
-    index_.erase(addr);
+    SpillExtent extent = it->second;
+    index_.erase(it);
+    return extent;
   }
 
 private:
   std::shared_mutex mutex_;
-  std::unordered_map<char *, std::string> index_;
+  std::unordered_map<char *, SpillExtent> index_;
 };
@@ -1,40 +1,69 @@
 #pragma once
 
 #include "Conf.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
-#include <vector>
 
-// Can be optimzied to O(logn)
+struct MemRegion {
+  char *start;
+  memSize size;
+  memSize pageSize;
+};
+
+// Regions ordered by start address in a persistent treap. Updates copy the
+// O(log n) nodes on their path and publish a new root, lookups walk the root
+// they loaded without taking a lock. Replaced nodes are freed once every
+// lookup that started before the update is done (a grace period in the RCU
+// sense), so page faults never wait on add/remove.
 class MemRegions {
 public:
-  void add(char *addr, memSize size) {
-    std::unique_lock<std::mutex> guard(mutex_);
-    regions_.emplace_back(addr, size);
-  }
-
-  char *findStart(char *addr) {
-    std::unique_lock<std::mutex> guard(mutex_);
-    for (const auto &region : regions_) {
-      if (addr >= region.first && addr < region.first + region.second) {
-        return region.first;
-      }
-    }
-    throw std::runtime_error("Can't find start address");
-  }
-
-  bool remove(char *addr) {
-    std::unique_lock<std::mutex> guard(mutex_);
-    for (auto region = regions_.begin(); region != regions_.end(); ++region) {
-      if (addr >= region->first && addr < region->first + region->second) {
-        regions_.erase(region);
-        return true;
-      }
-    }
-    return false;
-  }
+  MemRegions();
+  ~MemRegions();
+
+  MemRegions(const MemRegions &) = delete;
+  MemRegions(MemRegions &&) = delete;
+  MemRegions &operator=(const MemRegions &) = delete;
+  MemRegions &operator=(MemRegions &&) = delete;
+
+  void add(char *addr, memSize size, memSize pageSize = kPageSize);
+
+  char *findStart(char *addr) { return find(addr).start; }
+
+  // Lock free.
+  MemRegion find(char *addr) const;
+
+  // Removes the region containing `addr`.
+  bool remove(char *addr);
+
+  size_t size() const;
 
 private:
-  std::mutex mutex_;
-  std::vector<std::pair<char *, memSize>> regions_;
+  struct Node;
+  using NodePtr = std::shared_ptr<const Node>;
+
+  static NodePtr insert(const NodePtr &node, const MemRegion &region,
+                        uint64_t priority);
+  static NodePtr erase(const NodePtr &node, char *start);
+  static std::pair<NodePtr, NodePtr> split(const NodePtr &node, char *start);
+  static NodePtr merge(const NodePtr &left, const NodePtr &right);
+
+  // Region with the greatest start not above `addr`, or nullptr.
+  static const Node *floor(const Node *node, char *addr);
+
+  void publish(NodePtr root);
+
+  // Waits until the lookups that may still see the previous root are done.
+  void synchronize();
+
+  mutable std::mutex writeMutex_;
+  // Owns the nodes, only touched by writers.
+  NodePtr root_;
+  std::atomic<const Node *> published_;
+  size_t count_;
+  // Lookups in flight per epoch parity.
+  std::atomic<uint64_t> epoch_;
+  mutable std::atomic<int64_t> readers_[2];
 };
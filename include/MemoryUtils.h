@@ -1,19 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <fstream>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <vector>
 
 class MemoryUtils {
 public:
   static constexpr int64_t kInvalidRssSize = 0;
 
   static int64_t getProcessRss() {
-    static const int64_t kPageSize = [] {
-      const long pageSize = sysconf(_SC_PAGESIZE);
-      return pageSize > 0 ? pageSize : 4096; // Typically 4096 bytes
-    }();
-
     std::ifstream statmFile("/proc/self/statm");
     if (!statmFile) {
       return kInvalidRssSize;
@@ -24,6 +22,32 @@ public:
     statmFile >> rssPages;
     // The second value is the number of pages in the RSS
     statmFile >> rssPages;
-    return rssPages * kPageSize;
+    return rssPages * systemPageSize();
+  }
+
+  // Resident bytes of every `granularity` sized page of [addr, addr + size),
+  // `addr` must be aligned to the system page size. When mincore fails the
+  // whole range counts as resident.
+  static std::vector<int64_t> residentBytes(char *addr, int64_t size,
+                                            int64_t granularity) {
+    const int64_t osPage = systemPageSize();
+    std::vector<int64_t> resident((size + granularity - 1) / granularity, 0);
+    std::vector<unsigned char> vec((size + osPage - 1) / osPage);
+    bool known = mincore(addr, size, vec.data()) == 0;
+    for (size_t i = 0; i < vec.size(); ++i) {
+      if (!known || (vec[i] & 1)) {
+        int64_t offset = static_cast<int64_t>(i) * osPage;
+        resident[offset / granularity] += std::min(osPage, size - offset);
+      }
+    }
+    return resident;
+  }
+
+  static int64_t systemPageSize() {
+    static const int64_t kPageSize = [] {
+      const long pageSize = sysconf(_SC_PAGESIZE);
+      return pageSize > 0 ? pageSize : 4096; // Typically 4096 bytes
+    }();
+    return kPageSize;
   }
 };
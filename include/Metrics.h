@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Histogram.h"
+
+#include <string>
+#include <vector>
+
+// Where the time of a fault goes, in nanoseconds.
+struct FaultLatency {
+  // Finding the region and its spill file.
+  Histogram lookup;
+  // Submitting a frame read to its completion being seen.
+  Histogram read;
+  // Decoding one frame.
+  Histogram decompress;
+  // UFFDIO_COPY of one page, prefetched ones included.
+  Histogram copy;
+  // The fault message to the page being mapped, demand faults only.
+  Histogram total;
+};
+
+// What spilling takes, nanoseconds unless bytes.
+struct SpillLatency {
+  // One Spiller::spill call, until its files are durable.
+  Histogram spill;
+  // Quota freed by one Spiller::spill call.
+  Histogram spillBytes;
+  // Submitting the write of one region to it being durable.
+  Histogram write;
+  // Bytes written for one region.
+  Histogram writeBytes;
+};
+
+// Values collected at one point in time, rendered as Prometheus text or JSON.
+// Samples sharing a name must be added one after the other, they differ by a
+// label. Histograms are rendered as summaries, their values multiplied by
+// `scale`, e.g. 1e-9 to report nanoseconds in seconds.
+class MetricsSnapshot {
+public:
+  struct Label {
+    std::string name;
+    std::string value;
+  };
+
+  void addCounter(const std::string &name, const std::string &help,
+                  double value, const Label &label = {});
+
+  void addGauge(const std::string &name, const std::string &help,
+                double value, const Label &label = {});
+
+  void addHistogram(const std::string &name, const std::string &help,
+                    HistogramSnapshot histogram, double scale = 1.0);
+
+  // The value of a counter or gauge, NaN if there is none.
+  double value(const std::string &name, const std::string &label = "") const;
+
+  // Null if there is none.
+  const HistogramSnapshot *histogram(const std::string &name) const;
+
+  // The text exposition format, version 0.0.4.
+  std::string toPrometheus() const;
+
+  // One object keyed by name, labelled samples nest by label value and
+  // histograms hold their count, sum, max and quantiles.
+  std::string toJson() const;
+
+private:
+  struct Sample {
+    std::string name;
+    std::string help;
+    const char *type;
+    Label label;
+    double value;
+  };
+
+  struct Summary {
+    std::string name;
+    std::string help;
+    HistogramSnapshot histogram;
+    double scale;
+  };
+
+  void add(const std::string &name, const std::string &help, const char *type,
+           double value, const Label &label);
+
+  std::vector<Sample> samples_;
+  std::vector<Summary> summaries_;
+};
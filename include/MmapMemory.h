@@ -6,8 +6,8 @@
 
 class MmapMemory {
 public:
-  explicit MmapMemory(memSize size);
-  MmapMemory(char *addr, memSize size);
+  explicit MmapMemory(memSize size, memSize pageSize = kPageSize);
+  MmapMemory(char *addr, memSize size, memSize pageSize = kPageSize);
 
   MmapMemory(const MmapMemory &) = delete;
   MmapMemory(MmapMemory &&) = delete;
@@ -17,10 +17,11 @@ public:
   char *address();
   memSize size();
   memSize requestSize();
+  memSize pageSize();
   ~MmapMemory();
 
 private:
-  memSize size_, requestSize_;
+  memSize size_, requestSize_, pageSize_;
   char *ptr_;
 };
 
@@ -1,17 +1,27 @@
 #pragma once
 
+#include "AsyncSpillReader.h"
 #include "Buffer.h"
 #include "Conf.h"
 #include "MemRegions.h"
+#include "Metrics.h"
 #include "MmapMemory.h"
 #include "Spiller.h"
 #include "Statistics.h"
 
+#include <linux/userfaultfd.h>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 class PageFaultHandler {
 public:
-  explicit PageFaultHandler(SpillerPtr spiller);
+  explicit PageFaultHandler(SpillerPtr spiller,
+                            uint32_t ioDepth = kDefaultFaultIoDepth,
+                            uint32_t threads = kDefaultFaultHandlerThreads,
+                            uint32_t prefetchDepth = kDefaultPrefetchDepth);
 
   ~PageFaultHandler();
 
@@ -21,16 +31,60 @@ public:
 
   Statistics stats() const;
 
+  const FaultLatency &latency() const { return latency_; }
+
 private:
-  void loop();
-  void handleEvent();
+  // Every handler thread polls the shared userfaultfd and owns its reader
+  // and staging buffers, so faults are read and decoded in parallel.
+  struct Worker {
+    std::thread thread;
+    AsyncSpillReaderPtr reader;
+    // One staging buffer per outstanding fault.
+    std::vector<BufferPtr> buffers;
+    std::vector<uint32_t> freeBuffers;
+    // Fault messages read at a time, up to the handler's io depth.
+    std::vector<uffd_msg> msgs;
+  };
+
+  // Fault history of one region, pages [prefetchStart, prefetchEnd) have
+  // been read ahead and not reached by the stream yet.
+  struct AccessStream {
+    int64_t lastPage{-1};
+    uint32_t run{0};
+    int64_t prefetchStart{0};
+    int64_t prefetchEnd{0};
+  };
+
+  void loop(Worker &worker);
+  void handleEvents(Worker &worker);
+  void serveFault(Worker &worker, char *addr);
+  // A write to a page the spiller protected, no data to read.
+  void serveWriteFault(char *addr);
+  std::pair<int64_t, int64_t> trackAccess(char *startAddr, int64_t page,
+                                          int64_t pages, uint32_t budget);
+  // `faultNanos` is when the fault was taken, for demand faults.
+  bool readPage(Worker &worker, const SpillFilePtr &file, char *startAddr,
+                memSize pageSize, int64_t page, bool prefetch,
+                uint64_t faultNanos = 0);
+  // Charges the page to its region and maps it.
+  void onPageRead(Worker &worker, char *startAddr, char *pageAddr,
+                  memSize size, uint32_t slot, bool prefetch,
+                  uint64_t faultNanos, bool ok);
 
 private:
   int userFaultFd_, stopEventFd_;
-  std::thread handlerThread_;
   MemRegions regions_;
   SpillerPtr spiller_;
   Statistics stats_;
-  BufferPtr buffer_;
+  FaultLatency latency_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Pages with a read in flight on any thread, later faults on them just
+  // wait for it.
+  std::mutex inflightMutex_;
+  std::unordered_set<char *> inflightPages_;
+  const uint32_t prefetchDepth_;
+  std::mutex streamsMutex_;
+  std::unordered_map<char *, AccessStream> streams_;
 };
 using PageFaultHandlerPtr = std::shared_ptr<PageFaultHandler>;
+using PageFaultHandlerWeakPtr = std::weak_ptr<PageFaultHandler>;
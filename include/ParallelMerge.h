@@ -0,0 +1,281 @@
+#pragma once
+
+#include "LoserTree.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Records a thread merges at least, fewer threads are used for small
+// windows.
+constexpr size_t kMergeRecordsPerThread = 64 * 1024;
+
+// A sorted input of a merge in parts, each following on from the one before
+// it, such as a run written to several regions.
+template <typename T> class PartedSource {
+public:
+  explicit PartedSource(std::vector<MergeSource<T>> parts)
+      : parts_(std::move(parts)), starts_(parts_.size() + 1, 0) {
+    for (size_t p = 0; p < parts_.size(); ++p) {
+      starts_[p + 1] = starts_[p] + (parts_[p].end - parts_[p].begin);
+    }
+  }
+
+  size_t size() const { return starts_.back(); }
+
+  const T &operator[](size_t i) const {
+    size_t p = partOf(i);
+    return parts_[p].begin[i - starts_[p]];
+  }
+
+  // Appends the pieces of the parts that hold [begin, end), none empty.
+  void slice(size_t begin, size_t end,
+             std::vector<MergeSource<T>> &out) const {
+    for (size_t p = begin < end ? partOf(begin) : parts_.size();
+         p < parts_.size() && starts_[p] < end; ++p) {
+      size_t from = std::max(begin, starts_[p]) - starts_[p];
+      size_t to = std::min(end, starts_[p + 1]) - starts_[p];
+      if (from != to) {
+        out.push_back({parts_[p].begin + from, parts_[p].begin + to});
+      }
+    }
+  }
+
+private:
+  size_t partOf(size_t i) const {
+    return std::upper_bound(starts_.begin(), starts_.end(), i) -
+           starts_.begin() - 1;
+  }
+
+  std::vector<MergeSource<T>> parts_;
+  // Index of the first record of each part, and the size at the back.
+  std::vector<size_t> starts_;
+};
+
+// Where the merge of `sources` is cut after its first `rank` records, as a
+// position in each source. Equal records come from the lower source first,
+// as in a LoserTree, so the cut is unique. The cut must lie in [lo[i], hi[i]]
+// of every source, the search only reads records in there.
+//
+// Each step takes the middle record x of the widest range left and counts
+// the records of every source that come out before it, a binary search in
+// each. If fewer than `rank` do, x and those records are before the cut and
+// the ranges start there, else the ranges end there. The widest range halves
+// every step, k log n steps of k binary searches for k sources.
+template <typename T, typename Compare>
+std::vector<size_t> coRank(const std::vector<PartedSource<T>> &sources,
+                           size_t rank, std::vector<size_t> lo,
+                           std::vector<size_t> hi, const Compare &compare) {
+  const size_t k = sources.size();
+  std::vector<size_t> before(k);
+  for (;;) {
+    size_t j = k, widest = 0;
+    for (size_t i = 0; i < k; ++i) {
+      if (hi[i] - lo[i] > widest) {
+        widest = hi[i] - lo[i];
+        j = i;
+      }
+    }
+    if (j == k) {
+      return lo;
+    }
+    const size_t m = lo[j] + widest / 2;
+    const T &x = sources[j][m];
+    size_t total = 0;
+    for (size_t i = 0; i < k; ++i) {
+      if (i == j) {
+        before[i] = m;
+      } else {
+        // Lower sources win ties, their records equal to x come out first.
+        size_t first = lo[i], count = hi[i] - lo[i];
+        while (count > 0) {
+          size_t half = count / 2;
+          const T &y = sources[i][first + half];
+          if (i < j ? !compare(x, y) : compare(y, x)) {
+            first += half + 1;
+            count -= half + 1;
+          } else {
+            count = half;
+          }
+        }
+        before[i] = first;
+      }
+      total += before[i];
+    }
+    if (total < rank) {
+      for (size_t i = 0; i < k; ++i) {
+        lo[i] = std::max(lo[i], before[i]);
+      }
+      lo[j] = m + 1;
+    } else {
+      for (size_t i = 0; i < k; ++i) {
+        hi[i] = std::min(hi[i], before[i]);
+      }
+    }
+  }
+}
+
+// Merges k sorted sources on several threads. Each call takes the next
+// window of the output and cuts it in one range per thread with coRank,
+// every thread finds its own cuts and merges its range with a LoserTree
+// into its own part of the output, nothing is shared while they run. The
+// output is the same as one LoserTree over the sources. The threads are
+// started with the merger and wait for the windows, the calling thread
+// merges the first range.
+template <typename T, typename Compare = std::less<T>> class ParallelMerger {
+public:
+  ParallelMerger(std::vector<PartedSource<T>> sources, uint32_t threads,
+                 Compare compare = Compare())
+      : sources_(std::move(sources)),
+        threads_(std::max<uint32_t>(threads, 1)),
+        compare_(std::move(compare)), position_(sources_.size(), 0),
+        merged_(0), total_(0) {
+    for (const auto &source : sources_) {
+      total_ += source.size();
+    }
+    for (uint32_t t = 1; t < threads_; ++t) {
+      workers_.emplace_back([this, t]() { work(t); });
+    }
+  }
+
+  ~ParallelMerger() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ParallelMerger(const ParallelMerger &) = delete;
+  ParallelMerger(ParallelMerger &&) = delete;
+  ParallelMerger &operator=(const ParallelMerger &) = delete;
+  ParallelMerger &operator=(ParallelMerger &&) = delete;
+
+  bool empty() const { return merged_ == total_; }
+
+  // Records of `source` merged so far.
+  size_t position(size_t source) const { return position_[source]; }
+
+  // Writes the next `n` records of the merge to `out`, fewer at the end,
+  // returns how many.
+  size_t merge(T *out, size_t n) {
+    n = std::min(n, total_ - merged_);
+    if (n == 0) {
+      return 0;
+    }
+    const uint32_t threads = static_cast<uint32_t>(std::min<size_t>(
+        threads_, std::max<size_t>(1, n / kMergeRecordsPerThread)));
+    // No source gives more than the window.
+    std::vector<size_t> hi(sources_.size());
+    for (size_t i = 0; i < sources_.size(); ++i) {
+      hi[i] = std::min(sources_[i].size(), position_[i] + n);
+    }
+    std::vector<size_t> end =
+        coRank(sources_, merged_ + n, position_, hi, compare_);
+    runOnThreads(threads, [&](uint32_t t) {
+      size_t from = n / threads * t;
+      size_t to = t + 1 == threads ? n : n / threads * (t + 1);
+      std::vector<size_t> first =
+          t == 0 ? position_ : coRank(sources_, merged_ + from, position_, end,
+                                      compare_);
+      std::vector<size_t> last =
+          t + 1 == threads
+              ? end
+              : coRank(sources_, merged_ + to, first, end, compare_);
+      mergeRange(first, last, out + from);
+    });
+    position_ = std::move(end);
+    merged_ += n;
+    return n;
+  }
+
+private:
+  // Runs fn(0) to fn(threads - 1), fn(0) on the calling thread and the
+  // others on the workers of the same number.
+  void runOnThreads(uint32_t threads,
+                    const std::function<void(uint32_t)> &fn) {
+    if (threads > 1) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      task_ = &fn;
+      taskThreads_ = threads;
+      pending_ = threads - 1;
+      ++generation_;
+    }
+    wake_.notify_all();
+    fn(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_ == 0; });
+  }
+
+  // Worker t runs its part of every task that has one.
+  void work(uint32_t t) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      wake_.wait(lock, [&]() { return stopping_ || generation_ != seen; });
+      if (stopping_) {
+        return;
+      }
+      seen = generation_;
+      if (t >= taskThreads_) {
+        continue;
+      }
+      const std::function<void(uint32_t)> &fn = *task_;
+      lock.unlock();
+      fn(t);
+      lock.lock();
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+
+  // Merges [first[i], last[i]) of every source to `out`.
+  void mergeRange(const std::vector<size_t> &first,
+                  const std::vector<size_t> &last, T *out) const {
+    const size_t k = sources_.size();
+    std::vector<std::vector<MergeSource<T>>> pieces(k);
+    std::vector<size_t> next(k, 1);
+    std::vector<MergeSource<T>> heads;
+    for (size_t i = 0; i < k; ++i) {
+      sources_[i].slice(first[i], last[i], pieces[i]);
+      heads.push_back(pieces[i].empty() ? MergeSource<T>{nullptr, nullptr}
+                                        : pieces[i][0]);
+    }
+    LoserTree<T, Compare> tree(heads, compare_);
+    while (size_t n = tree.pop(out, kMergeRecordsPerThread)) {
+      out += n;
+      for (size_t i = 0; i < k; ++i) {
+        if (next[i] < pieces[i].size() && tree.exhausted(i)) {
+          const MergeSource<T> &piece = pieces[i][next[i]++];
+          tree.refill(i, piece.begin, piece.end);
+        }
+      }
+    }
+  }
+
+  std::vector<PartedSource<T>> sources_;
+  const uint32_t threads_;
+  Compare compare_;
+  std::vector<size_t> position_;
+  size_t merged_;
+  size_t total_;
+  std::vector<std::thread> workers_;
+  // Guards the task fields, a new task bumps the generation.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(uint32_t)> *task_ = nullptr;
+  uint32_t taskThreads_ = 0;
+  uint32_t pending_ = 0;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
@@ -1,13 +1,27 @@
 #pragma once
 
 #include "Conf.h"
+#include "Histogram.h"
+#include "QuotaPool.h"
 #include "Spiller.h"
 
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <thread>
 
+// Tracks the memory charged against the quota, in a tree of pools under the
+// process pool of `size` bytes. A background thread spills once usage goes
+// above the high watermark, or allocations are waiting, and keeps going until
+// usage is below the low watermark. For an allocation that is waiting the
+// watermark is taken of the pool it doesn't fit in, and spilling starts with
+// the pool below it that is most over its share.
 class QuotaManager {
 public:
-  QuotaManager(memSize size, SpillerPtr &spiller);
+  QuotaManager(memSize size, SpillerPtr &spiller,
+               double highWatermark = kDefaultSpillHighWatermark,
+               double lowWatermark = kDefaultSpillLowWatermark,
+               uint32_t waitMs = kDefaultQuotaWaitMs);
   ~QuotaManager();
 
   QuotaManager(const QuotaManager &) = delete;
@@ -15,6 +29,18 @@ public:
   QuotaManager &operator=(const QuotaManager &) = delete;
   QuotaManager &operator=(QuotaManager &&) = delete;
 
+  // The process pool.
+  const QuotaPoolPtr &root() const { return root_; }
+
+  // Reserves `size` bytes in `pool`, the process pool if null. Waits up to
+  // `waitMs` for the background thread to make room, null if it couldn't.
+  QuotaReservationPtr reserve(memSize size,
+                              const QuotaPoolPtr &pool = nullptr);
+
+  // Same for `size` more bytes of a reservation.
+  bool grow(QuotaReservation &reservation, memSize size);
+
+  // Charges the process pool without a reservation, waits like reserve.
   bool tryAcquire(memSize size);
 
   void release(memSize size);
@@ -23,9 +49,38 @@ public:
 
   memSize available();
 
+  // Nanoseconds each charge took, waiting for room included.
+  const Histogram &waitLatency() const { return waitLatency_; }
+
 private:
+  // An allocation waiting for room.
+  struct Waiter {
+    QuotaPool *pool;
+    memSize size;
+  };
+
+  bool charge(QuotaPool &pool, memSize size);
+
+  void spillLoop();
+
+  // Spilling is due, called with mutex_ held.
+  bool needSpill() const;
+
   std::mutex mutex_;
+  // Wakes the spill thread.
+  std::condition_variable spillCv_;
+  // Wakes allocations waiting for quota.
+  std::condition_variable freedCv_;
   const memSize size_;
-  memSize used_;
+  const memSize highMark_;
+  const memSize lowMark_;
+  const double lowWatermark_;
+  const uint32_t waitMs_;
+  QuotaPoolPtr root_;
+  // Oldest first.
+  std::deque<Waiter *> waiters_;
+  bool stop_;
+  Histogram waitLatency_;
   SpillerPtr spiller_;
+  std::thread spillThread_;
 };
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Conf.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class QuotaPool;
+using QuotaPoolPtr = std::shared_ptr<QuotaPool>;
+
+// A node in a tree of memory limits, process -> query -> operator. Bytes
+// charged to a pool count against it and every pool above it, a charge only
+// succeeds if none of them would go over its limit. Children keep their
+// parent alive, not the other way round.
+class QuotaPool : public std::enable_shared_from_this<QuotaPool> {
+public:
+  static QuotaPoolPtr createRoot(const std::string &name, memSize limit);
+
+  QuotaPoolPtr createChild(const std::string &name, memSize limit);
+
+  QuotaPool(const QuotaPool &) = delete;
+  QuotaPool(QuotaPool &&) = delete;
+  QuotaPool &operator=(const QuotaPool &) = delete;
+  QuotaPool &operator=(QuotaPool &&) = delete;
+
+  bool tryCharge(memSize size);
+
+  // Charges `size` even over a limit, for memory in use whatever the quota.
+  void forceCharge(memSize size);
+
+  void release(memSize size);
+
+  // The pool from here up to the root that `size` more bytes would take over
+  // its limit, the one closest to the root, or nullptr if they fit.
+  QuotaPoolPtr blocking(memSize size);
+
+  // Where spilling for this pool should start: walking down, the child most
+  // over its share of the parent, as long as one is, or the only child in
+  // use. A child's share is its limit, at most an equal part of the parent's
+  // limit.
+  QuotaPoolPtr victim();
+
+  // Whether `pool` is this one or below it.
+  bool contains(const QuotaPool *pool) const;
+
+  const std::string &name() const { return name_; }
+
+  memSize limit() const { return limit_; }
+
+  memSize used() const;
+
+  const QuotaPoolPtr &parent() const { return parent_; }
+
+  // Runs after every release in the tree, outside of the pool lock. There is
+  // one listener per tree.
+  void setReleaseListener(std::function<void()> listener);
+
+private:
+  struct Tree {
+    // Guards `used_` and `children_` of every pool in the tree.
+    std::mutex mutex;
+    std::mutex listenerMutex;
+    std::function<void()> listener;
+  };
+
+  QuotaPool(const std::string &name, memSize limit, QuotaPoolPtr parent,
+            std::shared_ptr<Tree> tree);
+
+  // Called with the tree mutex held.
+  QuotaPool *blockingLocked(memSize size);
+
+  const std::string name_;
+  const memSize limit_;
+  const QuotaPoolPtr parent_;
+  const std::shared_ptr<Tree> tree_;
+  memSize used_;
+  std::vector<std::weak_ptr<QuotaPool>> children_;
+};
+
+// Bytes one consumer holds in a pool, returned when it is destroyed. Regions
+// handed out by the BufferManager each hold one, the spiller shrinks it by
+// what it evicts.
+class QuotaReservation {
+public:
+  // `size` bytes must already be charged to `pool`.
+  QuotaReservation(QuotaPoolPtr pool, memSize size);
+
+  ~QuotaReservation();
+
+  QuotaReservation(const QuotaReservation &) = delete;
+  QuotaReservation(QuotaReservation &&) = delete;
+  QuotaReservation &operator=(const QuotaReservation &) = delete;
+  QuotaReservation &operator=(QuotaReservation &&) = delete;
+
+  // Fails without waiting if the pool has no room, see QuotaManager::grow.
+  bool grow(memSize size);
+
+  // Takes `size` more even over a limit, for pages already back in memory.
+  void forceGrow(memSize size);
+
+  // Takes over `size` bytes already charged to the pool.
+  void adopt(memSize size) { size_ += size; }
+
+  // Gives back up to `size` bytes.
+  void shrink(memSize size);
+
+  memSize size() const { return size_; }
+
+  const QuotaPoolPtr &pool() const { return pool_; }
+
+private:
+  const QuotaPoolPtr pool_;
+  std::atomic<memSize> size_;
+};
+
+using QuotaReservationPtr = std::shared_ptr<QuotaReservation>;
@@ -0,0 +1,454 @@
+#pragma once
+
+#include "SimdSort.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Keys shorter than this are sorted by comparison, whole or, for the MSD
+// sort, per bucket.
+constexpr size_t kDefaultRadixSortThreshold = 512;
+
+// The same for the keys of simdSort, which beats a radix pass up to larger
+// sizes than std::sort does.
+constexpr size_t kDefaultRadixSimdSortThreshold = 16384;
+
+// Keys a thread gets at least, fewer threads are used for small inputs.
+constexpr size_t kRadixKeysPerThread = 64 * 1024;
+
+// Bytes buffered per bucket by the scatter, a few cache lines, 64 KB for all
+// of the buckets, which stays in L2.
+constexpr size_t kRadixCombineBytes = 256;
+
+// N bytes compared as unsigned, the first one most significant, the form
+// keys are normalized to when their order isn't that of an integer.
+template <size_t N> struct ByteKey {
+  uint8_t bytes[N];
+
+  bool operator<(const ByteKey &other) const {
+    return memcmp(bytes, other.bytes, N) < 0;
+  }
+  bool operator==(const ByteKey &other) const {
+    return memcmp(bytes, other.bytes, N) == 0;
+  }
+};
+
+// How a key splits into radix digits, one per byte: digit(key, 0) is the
+// least significant, digit(key, kBytes - 1) the most, and less() is the order
+// they give. Integers, floating point numbers and ByteKeys have one.
+template <typename T, typename = void> struct RadixKey {
+  static constexpr bool kSupported = false;
+};
+
+// Signed integers flip the sign bit to order as unsigned.
+template <typename T>
+struct RadixKey<T, std::enable_if_t<std::is_integral_v<T> &&
+                                    !std::is_same_v<T, bool>>> {
+  static constexpr bool kSupported = true;
+  static constexpr size_t kBytes = sizeof(T);
+  using Bits = std::make_unsigned_t<T>;
+
+  static Bits bits(T key) {
+    Bits b = static_cast<Bits>(key);
+    return std::is_signed_v<T> ? b ^ (Bits(1) << (8 * sizeof(T) - 1)) : b;
+  }
+  static uint8_t digit(T key, size_t d) {
+    return static_cast<uint8_t>(bits(key) >> (8 * d));
+  }
+  static bool less(T a, T b) { return bits(a) < bits(b); }
+};
+
+// Positive numbers flip the sign bit, negative ones every bit, which orders
+// -0 before +0 and NaNs past the infinities of their sign.
+template <typename T>
+struct RadixKey<T, std::enable_if_t<std::is_floating_point_v<T> &&
+                                    (sizeof(T) == 4 || sizeof(T) == 8)>> {
+  static constexpr bool kSupported = true;
+  static constexpr size_t kBytes = sizeof(T);
+  using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+
+  static Bits bits(T key) {
+    Bits b;
+    memcpy(&b, &key, sizeof(b));
+    constexpr Bits sign = Bits(1) << (8 * sizeof(T) - 1);
+    return (b & sign) ? ~b : b ^ sign;
+  }
+  static uint8_t digit(T key, size_t d) {
+    return static_cast<uint8_t>(bits(key) >> (8 * d));
+  }
+  static bool less(T a, T b) { return bits(a) < bits(b); }
+};
+
+template <size_t N> struct RadixKey<ByteKey<N>> {
+  static constexpr bool kSupported = true;
+  static constexpr size_t kBytes = N;
+
+  static uint8_t digit(const ByteKey<N> &key, size_t d) {
+    return key.bytes[N - 1 - d];
+  }
+  static bool less(const ByteKey<N> &a, const ByteKey<N> &b) { return a < b; }
+};
+
+// Whether sorting T by Compare can go through a RadixSorter.
+template <typename T, typename Compare>
+constexpr bool isRadixSortable =
+    RadixKey<T>::kSupported && std::is_same_v<Compare, std::less<T>>;
+
+struct RadixSortOptions {
+  uint32_t threads = 1;
+  // 0 for the default of the key type.
+  size_t comparisonThreshold = 0;
+};
+
+// Radix sort of keys with a RadixKey, a byte per pass, passes on which every
+// key has the same digit are skipped. Two variants:
+//  - sort(), LSD: stable, scatters between the input and a scratch buffer of
+//    the same size and returns the one that ends up sorted, so two regions
+//    can swap roles instead of copying back. Each thread scatters its slice
+//    of the input through a few cache lines of buffer per bucket, which
+//    turns 256 streams of single key stores into full line writes.
+//  - sortInPlace(), MSD: American flag sort, needs no scratch. The first
+//    digit is counted and permuted by all threads, the buckets are then
+//    sorted by whichever thread is free, largest first.
+// Inputs, and MSD buckets, below the comparison threshold are sorted by
+// simdSort or std::sort.
+template <typename T> class RadixSorter {
+  static_assert(RadixKey<T>::kSupported, "no radix digits for this key type");
+  static_assert(std::is_trivially_copyable_v<T>, "keys are moved as bytes");
+
+public:
+  explicit RadixSorter(const RadixSortOptions &options = {})
+      : threads_(std::max<uint32_t>(options.threads, 1)),
+        threshold_(options.comparisonThreshold != 0
+                       ? options.comparisonThreshold
+                   : isSimdSortable<T, std::less<T>>
+                       ? kDefaultRadixSimdSortThreshold
+                       : kDefaultRadixSortThreshold) {}
+
+  RadixSorter(const RadixSorter &) = delete;
+  RadixSorter(RadixSorter &&) = delete;
+  RadixSorter &operator=(const RadixSorter &) = delete;
+  RadixSorter &operator=(RadixSorter &&) = delete;
+
+  // Sorts `data` using `scratch`, at least `size` keys, returns which of the
+  // two holds the result. The other one is left with garbage.
+  T *sort(T *data, T *scratch, size_t size) const {
+    if (size < threshold_) {
+      comparisonSort(data, size);
+      return data;
+    }
+    const uint32_t threads = threadsFor(size);
+    // Every digit of every thread's slice, counted in one read of the input.
+    std::vector<Counts> counts(threads * kBytes, Counts{});
+    runOnThreads(threads, [&](uint32_t t) {
+      Counts *c = &counts[t * kBytes];
+      for (size_t i = begin(t, threads, size); i < end(t, threads, size);
+           ++i) {
+        for (size_t d = 0; d < kBytes; ++d) {
+          ++c[d][Key::digit(data[i], d)];
+        }
+      }
+    });
+    T *src = data;
+    T *dst = scratch;
+    bool moved = false;
+    for (size_t d = 0; d < kBytes; ++d) {
+      if (isTrivialDigit(counts, threads, d, size)) {
+        continue;
+      }
+      if (moved) {
+        // The slices hold other keys since the first count.
+        runOnThreads(threads, [&](uint32_t t) {
+          Counts &c = counts[t * kBytes + d];
+          c.fill(0);
+          for (size_t i = begin(t, threads, size); i < end(t, threads, size);
+               ++i) {
+            ++c[Key::digit(src[i], d)];
+          }
+        });
+      }
+      // Bucket b of thread t starts after the smaller buckets, and after
+      // bucket b of the threads before it, which keeps the sort stable.
+      std::vector<std::array<T *, 256>> out(threads);
+      T *next = dst;
+      for (size_t b = 0; b < 256; ++b) {
+        for (uint32_t t = 0; t < threads; ++t) {
+          out[t][b] = next;
+          next += counts[t * kBytes + d][b];
+        }
+      }
+      runOnThreads(threads, [&](uint32_t t) {
+        scatter(src + begin(t, threads, size), src + end(t, threads, size), d,
+                out[t]);
+      });
+      std::swap(src, dst);
+      moved = true;
+    }
+    return src;
+  }
+
+  void sortInPlace(T *data, size_t size) const {
+    if (size < threshold_) {
+      comparisonSort(data, size);
+      return;
+    }
+    const uint32_t threads = threadsFor(size);
+    // The most significant digit the keys don't all share.
+    size_t d = kBytes;
+    Counts total;
+    do {
+      if (d == 0) {
+        return;
+      }
+      --d;
+      std::vector<Counts> counts(threads);
+      runOnThreads(threads, [&](uint32_t t) {
+        counts[t].fill(0);
+        for (size_t i = begin(t, threads, size); i < end(t, threads, size);
+             ++i) {
+          ++counts[t][Key::digit(data[i], d)];
+        }
+      });
+      total.fill(0);
+      for (uint32_t t = 0; t < threads; ++t) {
+        for (size_t b = 0; b < 256; ++b) {
+          total[b] += counts[t][b];
+        }
+      }
+    } while (std::find(total.begin(), total.end(), size) != total.end());
+    permuteOnThreads(data, total, d);
+    if (d == 0) {
+      return;
+    }
+    std::array<size_t, 256> start;
+    std::array<uint32_t, 256> order;
+    size_t offset = 0;
+    for (size_t b = 0; b < 256; ++b) {
+      start[b] = offset;
+      offset += total[b];
+      order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return total[a] > total[b];
+    });
+    std::atomic<size_t> next(0);
+    runOnThreads(threads, [&](uint32_t) {
+      for (size_t i = next++; i < 256 && total[order[i]] > 0; i = next++) {
+        sortBucket(data + start[order[i]], total[order[i]], d - 1);
+      }
+    });
+  }
+
+private:
+  using Key = RadixKey<T>;
+  using Counts = std::array<size_t, 256>;
+  static constexpr size_t kBytes = Key::kBytes;
+  static constexpr size_t kCombineKeys =
+      std::max<size_t>(1, kRadixCombineBytes / sizeof(T));
+
+  // Runs fn(0) to fn(threads - 1), all but the first on threads of their own.
+  template <typename Fn> static void runOnThreads(uint32_t threads, Fn &&fn) {
+    std::vector<std::thread> workers;
+    for (uint32_t t = 1; t < threads; ++t) {
+      workers.emplace_back([&fn, t]() { fn(t); });
+    }
+    fn(0);
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  uint32_t threadsFor(size_t size) const {
+    size_t most = std::max<size_t>(1, size / kRadixKeysPerThread);
+    return static_cast<uint32_t>(
+        std::min<size_t>(threads_, most));
+  }
+
+  // The slice of thread t.
+  static size_t begin(uint32_t t, uint32_t threads, size_t size) {
+    return size / threads * t;
+  }
+  static size_t end(uint32_t t, uint32_t threads, size_t size) {
+    return t + 1 == threads ? size : size / threads * (t + 1);
+  }
+
+  static bool isTrivialDigit(const std::vector<Counts> &counts,
+                             uint32_t threads, size_t d, size_t size) {
+    for (size_t b = 0; b < 256; ++b) {
+      size_t total = 0;
+      for (uint32_t t = 0; t < threads; ++t) {
+        total += counts[t * kBytes + d][b];
+      }
+      if (total != 0) {
+        return total == size;
+      }
+    }
+    return true;
+  }
+
+  // Moves [begin, end) to `out`, by digit d. A bucket's keys are written
+  // once its buffer is full, the first time once they reach a boundary of
+  // kRadixCombineBytes in the output so that later writes are aligned.
+  static void scatter(const T *begin, const T *end, size_t d,
+                      std::array<T *, 256> &out) {
+    std::unique_ptr<T[]> buffer(new T[256 * kCombineKeys]);
+    std::array<uint32_t, 256> filled;
+    std::array<uint32_t, 256> limit;
+    for (size_t b = 0; b < 256; ++b) {
+      filled[b] = 0;
+      size_t misaligned = reinterpret_cast<uintptr_t>(out[b]) %
+                          kRadixCombineBytes / sizeof(T);
+      limit[b] = misaligned != 0 && misaligned < kCombineKeys
+                     ? kCombineKeys - misaligned
+                     : kCombineKeys;
+    }
+    for (const T *p = begin; p < end; ++p) {
+      uint8_t b = Key::digit(*p, d);
+      T *line = &buffer[b * kCombineKeys];
+      line[filled[b]] = *p;
+      if (++filled[b] == limit[b]) {
+        memcpy(out[b], line, limit[b] * sizeof(T));
+        out[b] += limit[b];
+        filled[b] = 0;
+        limit[b] = kCombineKeys;
+      }
+    }
+    for (size_t b = 0; b < 256; ++b) {
+      memcpy(out[b], &buffer[b * kCombineKeys], filled[b] * sizeof(T));
+      out[b] += filled[b];
+    }
+  }
+
+  // Where the buckets of digit d start, and end.
+  static void bounds(const Counts &counts, Counts &head, Counts &tail) {
+    size_t offset = 0;
+    for (size_t b = 0; b < 256; ++b) {
+      head[b] = offset;
+      offset += counts[b];
+      tail[b] = offset;
+    }
+  }
+
+  // Moves every key to its bucket by digit d, following the cycles of the
+  // permutation.
+  static void permute(T *data, const Counts &counts, size_t d) {
+    Counts head;
+    Counts tail;
+    bounds(counts, head, tail);
+    cycle(data, head, tail, d);
+  }
+
+  // Fills [head[b], tail[b]) of every bucket b from the keys in there. A key
+  // whose bucket is full already stays in the slot it was taken from, which
+  // only happens if the ranges don't hold as many keys of each bucket as
+  // they have room for.
+  static void cycle(T *data, Counts &head, const Counts &tail, size_t d) {
+    for (size_t b = 0; b < 256; ++b) {
+      while (head[b] < tail[b]) {
+        T key = data[head[b]];
+        uint8_t k = Key::digit(key, d);
+        while (k != b && head[k] < tail[k]) {
+          std::swap(key, data[head[k]++]);
+          k = Key::digit(key, d);
+        }
+        data[head[b]++] = key;
+      }
+    }
+  }
+
+  // permute() on as many threads as the size takes, as in PARADIS. Each
+  // thread gets a stripe of what is left of every bucket and cycles keys
+  // between its own stripes, so some end up in the wrong bucket. Each
+  // bucket then moves the keys that are its own to the front, the rest go
+  // round again. Once too few are left for threads, or a round places none,
+  // one thread finishes.
+  void permuteOnThreads(T *data, const Counts &counts, size_t d) const {
+    Counts head;
+    Counts tail;
+    bounds(counts, head, tail);
+    size_t left = tail[255];
+    uint32_t threads;
+    while ((threads = threadsFor(left)) > 1) {
+      std::vector<Counts> heads(threads);
+      std::vector<Counts> tails(threads);
+      for (size_t b = 0; b < 256; ++b) {
+        size_t length = tail[b] - head[b];
+        for (uint32_t t = 0; t < threads; ++t) {
+          heads[t][b] = head[b] + begin(t, threads, length);
+          tails[t][b] = head[b] + end(t, threads, length);
+        }
+      }
+      runOnThreads(threads, [&](uint32_t t) {
+        cycle(data, heads[t], tails[t], d);
+      });
+      std::atomic<size_t> next(0);
+      runOnThreads(threads, [&](uint32_t) {
+        for (size_t b = next++; b < 256; b = next++) {
+          head[b] = std::partition(data + head[b], data + tail[b],
+                                   [&](const T &key) {
+                                     return Key::digit(key, d) == b;
+                                   }) -
+                    data;
+        }
+      });
+      size_t before = left;
+      left = 0;
+      for (size_t b = 0; b < 256; ++b) {
+        left += tail[b] - head[b];
+      }
+      if (left == before) {
+        break;
+      }
+    }
+    cycle(data, head, tail, d);
+  }
+
+  // MSD sort of keys that agree above digit d.
+  void sortBucket(T *data, size_t size, size_t d) const {
+    while (size >= threshold_) {
+      Counts counts;
+      counts.fill(0);
+      for (size_t i = 0; i < size; ++i) {
+        ++counts[Key::digit(data[i], d)];
+      }
+      bool trivial =
+          std::find(counts.begin(), counts.end(), size) != counts.end();
+      if (!trivial) {
+        permute(data, counts, d);
+      }
+      if (d == 0) {
+        return;
+      }
+      if (trivial) {
+        --d;
+        continue;
+      }
+      size_t offset = 0;
+      for (size_t b = 0; b < 256; ++b) {
+        sortBucket(data + offset, counts[b], d - 1);
+        offset += counts[b];
+      }
+      return;
+    }
+    comparisonSort(data, size);
+  }
+
+  static void comparisonSort(T *data, size_t size) {
+    if constexpr (isSimdSortable<T, std::less<T>>) {
+      simdSort(data, size);
+    } else {
+      std::sort(data, data + size, Key::less);
+    }
+  }
+
+  const uint32_t threads_;
+  const size_t threshold_;
+};
@@ -1,41 +1,56 @@
 #pragma once
 
+#include "Record.h"
+
 #include <cstdint>
+#include <random>
 #include <string>
-#include <vector>
-
-class Record {
-public:
-  Record() {}
-  ~Record() {}
-
-  Record(const Record &) = delete;
-  Record(Record &&) = delete;
-  Record &operator=(const Record &) = delete;
-  Record &operator=(Record &&) = delete;
-
-  int64_t size() { return size_; }
-
-  void serialize(char *dst) { int64_t cols = data_.size();
-    
-  }
-
-  void deserialize() {}
-
-private:
-  std::vector<std::string> data_;
-  int64_t size_;
-};
 
+// Records with random columns: integers over their whole range, doubles of
+// both signs, and strings of up to `maxStringLength` lowercase letters, so
+// that short keys share prefixes.
 class RandomRecordGenerator {
 public:
-  RandomRecordGenerator(int64_t size) : size_(size), count_(0) {}
+  RandomRecordGenerator(RecordSchemaPtr schema, int64_t size,
+                        uint64_t seed = 42, uint32_t maxStringLength = 24)
+      : schema_(std::move(schema)), size_(size), count_(0), rng_(seed),
+        maxStringLength_(maxStringLength) {}
   ~RandomRecordGenerator() {}
 
+  RandomRecordGenerator(const RandomRecordGenerator &) = delete;
+  RandomRecordGenerator(RandomRecordGenerator &&) = delete;
+  RandomRecordGenerator &operator=(const RandomRecordGenerator &) = delete;
+  RandomRecordGenerator &operator=(RandomRecordGenerator &&) = delete;
+
   bool hasNext() { return count_ < size_; }
 
-  int64_t next() { return rand(); }
+  // Fills `record`, of the generator's schema, with the next record.
+  void next(Record &record) {
+    ++count_;
+    for (size_t i = 0; i < schema_->columnCount(); ++i) {
+      switch (schema_->column(i).type) {
+      case ColumnType::Int64:
+        record.setInt64(i, static_cast<int64_t>(rng_()));
+        break;
+      case ColumnType::Double:
+        record.setDouble(i, static_cast<double>(static_cast<int64_t>(rng_())) /
+                                1e6);
+        break;
+      case ColumnType::String:
+        string_.resize(rng_() % (maxStringLength_ + 1));
+        for (char &c : string_) {
+          c = static_cast<char>('a' + rng_() % 26);
+        }
+        record.setString(i, string_);
+        break;
+      }
+    }
+  }
 
 private:
+  RecordSchemaPtr schema_;
   int64_t size_, count_;
+  std::mt19937_64 rng_;
+  uint32_t maxStringLength_;
+  std::string string_;
 };
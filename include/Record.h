@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bytes of the normalized key kept at the front of every packed record.
+constexpr uint32_t kKeyPrefixBytes = 16;
+
+// Packed records start at and are padded to multiples of this.
+constexpr uint32_t kRecordAlignment = 8;
+
+enum class ColumnType : uint8_t {
+  Int64 = 0,
+  Double = 1,
+  String = 2,
+};
+
+struct Column {
+  std::string name;
+  ColumnType type;
+};
+
+struct SortKeyColumn {
+  uint32_t column;
+  bool descending = false;
+};
+
+// Columns of the records and the columns they are sorted by.
+class RecordSchema {
+public:
+  RecordSchema(std::vector<Column> columns, std::vector<SortKeyColumn> key);
+
+  RecordSchema(const RecordSchema &) = delete;
+  RecordSchema(RecordSchema &&) = delete;
+  RecordSchema &operator=(const RecordSchema &) = delete;
+  RecordSchema &operator=(RecordSchema &&) = delete;
+
+  size_t columnCount() const { return columns_.size(); }
+
+  const Column &column(size_t i) const { return columns_[i]; }
+
+  const std::vector<SortKeyColumn> &key() const { return key_; }
+
+  // Bytes of a record before its strings.
+  uint32_t fixedSize() const { return fixedSize_; }
+
+  // Whether the key prefix holds the whole key, equal prefixes then mean
+  // equal keys.
+  bool prefixIsKey() const { return prefixIsKey_; }
+
+private:
+  std::vector<Column> columns_;
+  std::vector<SortKeyColumn> key_;
+  uint32_t fixedSize_;
+  bool prefixIsKey_;
+};
+
+using RecordSchemaPtr = std::shared_ptr<const RecordSchema>;
+
+// A packed record is position independent, so it can be copied, spilled and
+// faulted back in anywhere:
+//
+//   uint32 size             of the whole record, a multiple of 8
+//   uint32 unused
+//   uint8  prefix[16]       normalized key, see below
+//   uint64 slot[columns]    Int64 and Double values, or for a String the
+//                           offset of its bytes from the record start in
+//                           the low half and its length in the high half
+//   strings
+//
+// The prefix encodes the key columns in order so that memcmp of two prefixes
+// orders the records as the key does whenever they differ: integers big
+// endian with the sign bit flipped, doubles by the bits of RadixKey<double>,
+// inverted for descending columns. A String takes the rest of the prefix,
+// padded with 0, or 0xff when descending, and ends it, the columns after it
+// are only compared in full.
+class RecordView {
+public:
+  explicit RecordView(const char *data) : data_(data) {}
+
+  uint32_t size() const { return load<uint32_t>(0); }
+
+  const uint8_t *prefix() const {
+    return reinterpret_cast<const uint8_t *>(data_ + kPrefixOffset);
+  }
+
+  int64_t getInt64(size_t column) const {
+    return load<int64_t>(slotOffset(column));
+  }
+
+  double getDouble(size_t column) const {
+    return load<double>(slotOffset(column));
+  }
+
+  std::string_view getString(size_t column) const {
+    uint64_t slot = load<uint64_t>(slotOffset(column));
+    return std::string_view(data_ + static_cast<uint32_t>(slot), slot >> 32);
+  }
+
+  const char *data() const { return data_; }
+
+  static constexpr uint32_t kPrefixOffset = 8;
+  static constexpr uint32_t kSlotsOffset = kPrefixOffset + kKeyPrefixBytes;
+
+  static uint32_t slotOffset(size_t column) {
+    return kSlotsOffset + static_cast<uint32_t>(column) * 8;
+  }
+
+private:
+  template <typename V> V load(uint32_t offset) const {
+    V value;
+    memcpy(&value, data_ + offset, sizeof(value));
+    return value;
+  }
+
+  const char *data_;
+};
+
+// Builds a record and packs it, the columns not set are 0 or empty.
+class Record {
+public:
+  explicit Record(RecordSchemaPtr schema);
+
+  Record(const Record &) = delete;
+  Record(Record &&) = delete;
+  Record &operator=(const Record &) = delete;
+  Record &operator=(Record &&) = delete;
+
+  void setInt64(size_t column, int64_t value);
+  void setDouble(size_t column, double value);
+  void setString(size_t column, std::string_view value);
+
+  // Copies the columns of a packed record of the same schema.
+  void deserialize(const char *src);
+
+  // Bytes serialize() writes.
+  uint32_t size() const;
+
+  // Packs the record into `dst`, which must be 8-byte aligned and hold
+  // size() bytes.
+  void serialize(char *dst) const;
+
+  const RecordSchemaPtr &schema() const { return schema_; }
+
+private:
+  void checkColumn(size_t column, ColumnType type) const;
+
+  RecordSchemaPtr schema_;
+  // Int64 and Double values as their bits.
+  std::vector<uint64_t> values_;
+  std::vector<std::string> data_;
+};
+
+// Orders packed records by the key of their schema. Records whose prefixes
+// differ are ordered by two integer comparisons, only ties compare the key
+// columns in full.
+class RecordComparator {
+public:
+  explicit RecordComparator(RecordSchemaPtr schema)
+      : schema_(std::move(schema)) {}
+
+  // Negative, 0 or positive as `a` sorts before, with or after `b`.
+  int compare(const char *a, const char *b) const {
+    int c = comparePrefix(RecordView(a).prefix(), RecordView(b).prefix());
+    if (c != 0 || schema_->prefixIsKey()) {
+      return c;
+    }
+    return compareKey(a, b);
+  }
+
+  bool operator()(const char *a, const char *b) const {
+    return compare(a, b) < 0;
+  }
+
+  static int comparePrefix(const uint8_t *a, const uint8_t *b) {
+    for (uint32_t i = 0; i < kKeyPrefixBytes; i += 8) {
+      uint64_t x, y;
+      memcpy(&x, a + i, 8);
+      memcpy(&y, b + i, 8);
+      x = __builtin_bswap64(x);
+      y = __builtin_bswap64(y);
+      if (x != y) {
+        return x < y ? -1 : 1;
+      }
+    }
+    return 0;
+  }
+
+  // Compares the key columns, ignoring the prefix.
+  int compareKey(const char *a, const char *b) const;
+
+private:
+  RecordSchemaPtr schema_;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "BufferManager.h"
+#include "Conf.h"
+#include "MmapMemory.h"
+#include "QuotaPool.h"
+#include "RadixSort.h"
+#include "Record.h"
+
+#include <cstdint>
+
+// Records ahead of the one being copied whose first lines the gather asks
+// for, 0 disables prefetching.
+constexpr uint32_t kDefaultGatherPrefetchDistance = 8;
+
+// A record's key prefix as two integers, the first 8 bytes in `high`, and
+// where the record starts.
+struct RecordSortEntry {
+  uint64_t high;
+  uint64_t low;
+  uint64_t offset;
+};
+
+template <> struct RadixKey<RecordSortEntry> {
+  static constexpr bool kSupported = true;
+  static constexpr size_t kBytes = kKeyPrefixBytes;
+
+  static uint8_t digit(const RecordSortEntry &e, size_t d) {
+    return static_cast<uint8_t>(d < 8 ? e.low >> (8 * d)
+                                      : e.high >> (8 * (d - 8)));
+  }
+  static bool less(const RecordSortEntry &a, const RecordSortEntry &b) {
+    return a.high < b.high || (a.high == b.high && a.low < b.low);
+  }
+};
+
+struct RecordSortOptions {
+  // Page size of the entry and output regions.
+  memSize pageSize = 1024 * 1024L;
+  // Threads of the radix sort of the entries.
+  uint32_t threads = 1;
+  uint32_t prefetchDistance = kDefaultGatherPrefetchDistance;
+};
+
+struct SortedRecords {
+  // Holds the records back to back in order, null if there were none.
+  MmapMemoryPtr mem;
+  memSize bytes;
+  size_t count;
+};
+
+// Sorts packed records without moving them until the end. An entry of key
+// prefix and offset is built for each record, 24 bytes whatever the width of
+// the record, in a pinned region of the manager. The entries are radix
+// sorted on the prefix and runs of equal prefixes are ordered by the full
+// key, the only time the records are read. The records are then copied in
+// order to a new region, prefetching the ones a few entries ahead since the
+// reads are random. The input can be spilled meanwhile, the gather faults
+// it back in.
+class RecordSorter {
+public:
+  RecordSorter(BufferManager &manager, RecordSchemaPtr schema,
+               const RecordSortOptions &options = {});
+
+  RecordSorter(const RecordSorter &) = delete;
+  RecordSorter(RecordSorter &&) = delete;
+  RecordSorter &operator=(const RecordSorter &) = delete;
+  RecordSorter &operator=(RecordSorter &&) = delete;
+
+  // Sorts the records packed back to back in [data, data + bytes). The
+  // regions are charged to `pool`, the process pool if null.
+  SortedRecords sort(const char *data, memSize bytes,
+                     const QuotaPoolPtr &pool = nullptr) const;
+
+  // The steps of sort(). Returns the number of entries written to `entries`,
+  // which must hold one per record.
+  size_t buildEntries(const char *data, memSize bytes,
+                      RecordSortEntry *entries) const;
+  void sortEntries(RecordSortEntry *entries, size_t count,
+                   const char *data) const;
+  // Copies the records to `out` in the order of `entries`, returns the bytes
+  // written.
+  memSize gather(const RecordSortEntry *entries, size_t count,
+                 const char *data, char *out) const;
+
+private:
+  BufferManager &manager_;
+  RecordSchemaPtr schema_;
+  RecordComparator comparator_;
+  const RecordSortOptions options_;
+};
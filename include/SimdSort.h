@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+// Instruction sets the sort kernel is built for, in increasing order.
+enum class SimdLevel {
+  Scalar = 0,
+  Avx2 = 1,
+  Avx512 = 2,
+};
+
+// The widest level this CPU and build support, detected once.
+SimdLevel simdLevel();
+
+const char *simdLevelName(SimdLevel level);
+
+// Ascending in place sort of fixed-width integer keys: a quicksort that
+// partitions a vector at a time and finishes blocks of up to 16 registers
+// with a bitonic sorting network kept in registers. Falls back to std::sort
+// without AVX2, and for ranges quicksort doesn't split well. Not stable,
+// which equal keys can't tell. Input already in order is left as is. A
+// `level` above simdLevel() is lowered to it.
+void simdSort(int32_t *data, size_t size, SimdLevel level = simdLevel());
+void simdSort(uint32_t *data, size_t size, SimdLevel level = simdLevel());
+void simdSort(int64_t *data, size_t size, SimdLevel level = simdLevel());
+void simdSort(uint64_t *data, size_t size, SimdLevel level = simdLevel());
+
+// Whether sorting T by Compare can go through simdSort.
+template <typename T, typename Compare>
+constexpr bool isSimdSortable =
+    std::is_same_v<Compare, std::less<T>> &&
+    (std::is_same_v<T, int32_t> || std::is_same_v<T, uint32_t> ||
+     std::is_same_v<T, int64_t> || std::is_same_v<T, uint64_t>);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Conf.h"
+#include "FileUtils.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Where a spill file lives inside the store. The store reserves `length`
+// rounded up to whole blocks.
+struct SpillExtent {
+  uint32_t segmentId;
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Spill files stored as extents of a few large segment files instead of one
+// file each. Segments are fallocate'd when created and kept open, extents
+// are handed out first fit from the free ranges of each segment and given
+// back when a region is released. Once less than half of a segment is in
+// use its free ranges are punched out of the file, a segment with nothing
+// left in it is removed unless it is the last one.
+class SpillStore {
+public:
+  explicit SpillStore(const std::string &path,
+                      memSize segmentSize = kDefaultSpillSegmentSize,
+                      bool directIo = false);
+
+  ~SpillStore();
+
+  SpillStore(const SpillStore &) = delete;
+  SpillStore(SpillStore &&) = delete;
+  SpillStore &operator=(const SpillStore &) = delete;
+  SpillStore &operator=(SpillStore &&) = delete;
+
+  // Opens a new segment when no free range is large enough.
+  SpillExtent allocate(memSize length);
+
+  // Keeps the first `length` bytes of `extent`, the rest is free again.
+  SpillExtent shrink(const SpillExtent &extent, memSize length);
+
+  void release(const SpillExtent &extent);
+
+  // Descriptor to write `extent` through.
+  int fd(const SpillExtent &extent);
+
+  // The spill file written to `extent`, valid until the extent is released.
+  SpillFilePtr open(const SpillExtent &extent);
+
+  size_t segmentCount();
+
+  // Bytes held by extents.
+  memSize usedBytes();
+
+private:
+  struct Segment {
+    std::string fileName;
+    int fd{-1};
+    int directFd{-1};
+    memSize size{0};
+    memSize used{0};
+    // Free ranges, offset to length, never adjacent.
+    std::map<uint64_t, uint64_t> freeRanges;
+  };
+  using SegmentPtr = std::unique_ptr<Segment>;
+
+  Segment &segment(uint32_t segmentId);
+  uint32_t createSegment(memSize size);
+  void removeSegment(uint32_t segmentId);
+  void freeRange(Segment &seg, uint64_t offset, uint64_t length);
+  void punch(Segment &seg, uint64_t offset, uint64_t length);
+
+  std::mutex mutex_;
+  const std::string path_;
+  const memSize segmentSize_;
+  const bool directIo_;
+  // Released segments leave a null entry, ids are never reused.
+  std::vector<SegmentPtr> segments_;
+};
+
+using SpillStorePtr = std::unique_ptr<SpillStore>;
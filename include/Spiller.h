@@ -1,16 +1,30 @@
 #pragma once
 
+#include "AsyncSpillWriter.h"
 #include "Conf.h"
+#include "EvictionPolicy.h"
 #include "MemAddrToFileMap.h"
+#include "Metrics.h"
 #include "MmapMemory.h"
+#include "QuotaPool.h"
+#include "SpillStore.h"
+#include "Statistics.h"
 
+#include <functional>
 #include <memory>
-#include <queue>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 class Spiller {
 public:
-  explicit Spiller(const std::string &path, CompressionType compressionType);
+  explicit Spiller(const std::string &path, CompressionType compressionType,
+                   uint32_t ioDepth = kDefaultSpillIoDepth,
+                   bool directIo = false,
+                   EvictionPolicyType evictionPolicy = EvictionPolicyType::Fifo,
+                   memSize segmentSize = kDefaultSpillSegmentSize,
+                   uint32_t compressionThreads =
+                       kDefaultSpillCompressionThreads);
 
   ~Spiller();
 
@@ -21,19 +35,117 @@ public:
 
   void recoverMem(char *startAddr, int64_t offset, char *dst, memSize size);
 
-  void registerMem(MmapMemoryPtr &mem);
+  // The spill file of a region, opened once and kept open until the region
+  // is released.
+  SpillFilePtr spillFile(char *startAddr);
 
-  memSize spill(memSize targetSize);
+  // The spiller only keeps a weak reference to `mem`. `reservation` is the
+  // quota the region holds, shrunk by what gets evicted and given back with
+  // the region. A `pinned` region is not spilled until unpinned.
+  void registerMem(MmapMemoryPtr &mem,
+                   QuotaReservationPtr reservation = nullptr,
+                   bool pinned = false);
+
+  // Keeps a region from being spilled, or lets it be again.
+  void setPinned(char *startAddr, bool pinned);
+
+  // Write protects a range, or lifts the protection, returns whether it
+  // could. Protected pages report their next write through recordWrite.
+  using WriteProtector = std::function<bool(char *, memSize, bool)>;
+
+  // Set by the fault handler, null again once it is gone. A region with a
+  // spill file is evicted by dropping its pages only while it hasn't been
+  // written since, without a protector every spilled region counts as
+  // written and keeps its pages.
+  void setWriteProtector(WriteProtector protector);
+
+  // Forgets the region and drops its spill file, returns the quota it still
+  // held. Regions whose owner let go without calling it are dropped by the
+  // next spill.
+  memSize unregisterMem(char *startAddr);
+
+  // Called by the fault handler threads on every demand fault.
+  void recordAccess(char *startAddr);
+
+  // Called by the fault handler threads before a page of `size` bytes is
+  // copied back into a region, charges it to the region even over its
+  // quota. cancelFaultIn gives it back if the page was not copied.
+  void recordFaultIn(char *startAddr, memSize size);
+  void cancelFaultIn(char *startAddr, memSize size);
+
+  // Called by the fault handler threads on a write to a protected page,
+  // lifts the protection of [addr, addr + size).
+  void recordWrite(char *startAddr, char *addr, memSize size);
+
+  // Frees at least `targetSize` bytes if it can and returns the bytes
+  // actually freed. Regions are visited in the order of the eviction policy,
+  // pinned ones are skipped,
+  // those in use only lose their cold tail pages, as many as it takes, the
+  // pages in front of them stay resident. With a `pool`, only regions whose
+  // quota is held in it or below it are visited.
+  memSize spill(memSize targetSize, const QuotaPoolPtr &pool = nullptr);
+
+  // Codec counters of the spills written so far.
+  Statistics stats() const;
+
+  const SpillLatency &latency() const { return latency_; }
+
+  struct Usage {
+    // Sizes of the registered regions.
+    memSize regionBytes;
+    // Of those, what is in memory.
+    memSize residentBytes;
+    // Held by spill files.
+    memSize spillFileBytes;
+  };
+
+  // Walks the page tables of every region, meant for metrics.
+  Usage usage();
 
 private:
-  void eraseMem(MmapMemoryPtr &mem);
+  // Evicts the tail of `mem` holding about `need` resident bytes and returns
+  // the quota it gives back.
+  memSize eraseMem(MmapMemoryPtr &mem, memSize need, memSize &failedSize);
+
+  // First page of the shortest tail of `mem` with `need` resident bytes, or
+  // 0 if the whole region has fewer. `resident` gets the bytes in the tail.
+  memSize coldTail(MmapMemoryPtr &mem, memSize need, memSize &resident);
+
+  void evictPages(const MmapMemoryPtr &mem, memSize fromPage);
+
+  // Reads every page of `mem` that is not in memory, the fault handler
+  // brings them back from the spill file.
+  void faultIn(const MmapMemoryPtr &mem);
 
-  std::string nextFileName();
+  void closeFile(char *startAddr);
 
   std::string spillPath_;
   MemAddrToFileMap addrToFileMap_;
-  std::queue<MmapMemoryPtr> queue_;
+  // Guards regions_, writeProtector_ and policy_, never held across I/O.
+  // Protecting pages and dropping those of a clean region happen under it,
+  // so a write can't slip in between.
+  std::mutex regionsMutex_;
+  struct Region {
+    std::weak_ptr<MmapMemory> mem;
+    // Quota the region still holds, its size less the bytes evicted, plus
+    // those faulted back in.
+    memSize charged;
+    // Holds `charged` bytes, null for regions registered without one.
+    QuotaReservationPtr reservation;
+    bool pinned;
+    // Written since its spill file was, or has none.
+    bool dirty;
+  };
+  std::unordered_map<char *, Region> regions_;
+  WriteProtector writeProtector_;
+  EvictionPolicyPtr policy_;
   CompressionType compressionType_;
+  Statistics stats_;
+  SpillLatency latency_;
+  AsyncSpillWriterPtr writer_;
+  SpillStorePtr store_;
+  std::mutex openFilesMutex_;
+  std::unordered_map<char *, SpillFilePtr> openFiles_;
 };
 
 using SpillerPtr = std::shared_ptr<Spiller>;
@@ -1,12 +1,128 @@
 #pragma once
 
+#include "Conf.h"
+
+#include <atomic>
 #include <cstdint>
 #include <string>
 
+// Counters are updated by every fault handler thread, copies are snapshots.
+// The spiller fills in the compression side of the codec counters, the fault
+// handler the decompression side.
 struct Statistics {
-  uint64_t pageFaultCount{0};
+  // Codec counters are indexed by CompressionType, without Adaptive.
+  static constexpr int kCodecCount = 3;
+
+  std::atomic<uint64_t> pageFaultCount{0};
+  // Faults on a page whose read was already in flight.
+  std::atomic<uint64_t> duplicateFaultCount{0};
+  // Writes to pages protected since the spill file of their region was
+  // written.
+  std::atomic<uint64_t> writeFaultCount{0};
+  // Pages read ahead of a sequential stream.
+  std::atomic<uint64_t> prefetchCount{0};
+  // Prefetched pages the stream went through without faulting.
+  std::atomic<uint64_t> prefetchHitCount{0};
+  // Faults of a stream already detected as sequential.
+  std::atomic<uint64_t> prefetchMissCount{0};
+  // Prefetched pages that were already present or never reached.
+  std::atomic<uint64_t> prefetchWastedCount{0};
+  // Frames compressed with a codec, None counts frames that were not tried.
+  std::atomic<uint64_t> codecFrames[kCodecCount]{};
+  std::atomic<uint64_t> codecInputBytes[kCodecCount]{};
+  // Bytes written for those frames, raw frames count in full.
+  std::atomic<uint64_t> codecOutputBytes[kCodecCount]{};
+  std::atomic<uint64_t> codecCompressNanos[kCodecCount]{};
+  // Decoding, by the codec a frame was stored with.
+  std::atomic<uint64_t> codecDecompressNanos[kCodecCount]{};
+  // Time Adaptive spent sampling chunks.
+  std::atomic<uint64_t> codecSelectNanos{0};
+
+  Statistics() = default;
+
+  Statistics(const Statistics &other) { *this = other; }
+
+  Statistics &operator=(const Statistics &other) {
+    copy(pageFaultCount, other.pageFaultCount);
+    copy(duplicateFaultCount, other.duplicateFaultCount);
+    copy(writeFaultCount, other.writeFaultCount);
+    copy(prefetchCount, other.prefetchCount);
+    copy(prefetchHitCount, other.prefetchHitCount);
+    copy(prefetchMissCount, other.prefetchMissCount);
+    copy(prefetchWastedCount, other.prefetchWastedCount);
+    for (int i = 0; i < kCodecCount; ++i) {
+      copy(codecFrames[i], other.codecFrames[i]);
+      copy(codecInputBytes[i], other.codecInputBytes[i]);
+      copy(codecOutputBytes[i], other.codecOutputBytes[i]);
+      copy(codecCompressNanos[i], other.codecCompressNanos[i]);
+      copy(codecDecompressNanos[i], other.codecDecompressNanos[i]);
+    }
+    copy(codecSelectNanos, other.codecSelectNanos);
+    return *this;
+  }
+
+  void recordCompression(CompressionType type, uint64_t inputBytes,
+                         uint64_t outputBytes, uint64_t nanos) {
+    codecFrames[type].fetch_add(1, std::memory_order_relaxed);
+    codecInputBytes[type].fetch_add(inputBytes, std::memory_order_relaxed);
+    codecOutputBytes[type].fetch_add(outputBytes, std::memory_order_relaxed);
+    codecCompressNanos[type].fetch_add(nanos, std::memory_order_relaxed);
+  }
+
+  // Written over original bytes, 1 before anything was compressed.
+  double compressionRatio(CompressionType type) const {
+    uint64_t input = codecInputBytes[type].load(std::memory_order_relaxed);
+    return input == 0 ? 1.0
+                      : static_cast<double>(codecOutputBytes[type].load(
+                            std::memory_order_relaxed)) /
+                            input;
+  }
+
+  // Over all codecs.
+  double compressionRatio() const {
+    uint64_t input = 0, output = 0;
+    for (int i = 0; i < kCodecCount; ++i) {
+      input += codecInputBytes[i].load(std::memory_order_relaxed);
+      output += codecOutputBytes[i].load(std::memory_order_relaxed);
+    }
+    return input == 0 ? 1.0 : static_cast<double>(output) / input;
+  }
 
   std::string toString() const {
-    return "pageFaultCount: " + std::to_string(pageFaultCount);
+    return "pageFaultCount: " + std::to_string(pageFaultCount) +
+           ", duplicateFaultCount: " + std::to_string(duplicateFaultCount) +
+           ", writeFaultCount: " + std::to_string(writeFaultCount) +
+           ", prefetchCount: " + std::to_string(prefetchCount) +
+           ", prefetchHitCount: " + std::to_string(prefetchHitCount) +
+           ", prefetchMissCount: " + std::to_string(prefetchMissCount) +
+           ", prefetchWastedCount: " + std::to_string(prefetchWastedCount) +
+           codecString();
+  }
+
+private:
+  std::string codecString() const {
+    static const char *names[kCodecCount] = {"none", "zstd", "lz4"};
+    std::string result;
+    for (int i = 0; i < kCodecCount; ++i) {
+      if (codecFrames[i] == 0 && codecDecompressNanos[i] == 0) {
+        continue;
+      }
+      auto type = static_cast<CompressionType>(i);
+      result += std::string(", ") + names[i] +
+                ": {frames: " + std::to_string(codecFrames[i]) +
+                ", ratio: " + std::to_string(compressionRatio(type)) +
+                ", compressNanos: " + std::to_string(codecCompressNanos[i]) +
+                ", decompressNanos: " +
+                std::to_string(codecDecompressNanos[i]) + "}";
+    }
+    if (codecSelectNanos != 0) {
+      result += ", codecSelectNanos: " + std::to_string(codecSelectNanos);
+    }
+    return result;
+  }
+
+  static void copy(std::atomic<uint64_t> &to,
+                   const std::atomic<uint64_t> &from) {
+    to.store(from.load(std::memory_order_relaxed), std::memory_order_relaxed);
   }
 };
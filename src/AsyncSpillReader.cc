@@ -0,0 +1,237 @@
+#include "AsyncSpillReader.h"
+#include "Compression.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <glog/logging.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// O_DIRECT needs offset, length and buffer aligned to the logical block size.
+static constexpr uint64_t kDirectAlignment = 4096;
+
+struct AsyncSpillReader::Request {
+  Callback callback;
+  uint32_t pending{0};
+  bool failed{false};
+};
+
+struct AsyncSpillReader::Op {
+  std::shared_ptr<Request> request;
+  SpillFilePtr file;
+  uint64_t frame;
+  uint32_t slot;
+  // Bytes in front of the frame when the read was widened for O_DIRECT.
+  memSize skip;
+  memSize from;
+  memSize size;
+  char *dst;
+  char *buffer;
+  uint64_t submitNanos;
+};
+
+AsyncSpillReader::AsyncSpillReader(uint32_t queueDepth, memSize frameSize,
+                                   Statistics *stats, FaultLatency *latency)
+    : eventFd_(-1), queueDepth_(std::max<uint32_t>(queueDepth, 1)),
+      registered_(false), stats_(stats), latency_(latency), pendingOps_(0) {
+  int ret = io_uring_queue_init(queueDepth_, &ring_, 0);
+  if (ret < 0) {
+    throw std::runtime_error("io_uring init failed: " +
+                             std::string(strerror(-ret)));
+  }
+  eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd_ < 0 || io_uring_register_eventfd(&ring_, eventFd_) < 0) {
+    io_uring_queue_exit(&ring_);
+    throw std::runtime_error("register io_uring eventfd failed!");
+  }
+  bufferSize_ = std::max(compressBound(frameSize, CompressionType::Zstd),
+                         compressBound(frameSize, CompressionType::Lz4));
+  bufferSize_ = (bufferSize_ + 2 * kDirectAlignment - 1) / kDirectAlignment *
+                kDirectAlignment;
+  std::vector<iovec> iovecs;
+  for (uint32_t i = 0; i < queueDepth_; ++i) {
+    void *buf = nullptr;
+    if (posix_memalign(&buf, kDirectAlignment, bufferSize_) != 0) {
+      for (auto *b : buffers_) {
+        free(b);
+      }
+      close(eventFd_);
+      io_uring_queue_exit(&ring_);
+      throw std::runtime_error("allocate read buffer failed!");
+    }
+    buffers_.push_back(reinterpret_cast<char *>(buf));
+    iovecs.push_back({buf, bufferSize_});
+    freeSlots_.push_back(i);
+    largeBuffers_.emplace_back(nullptr, free);
+    largeSizes_.push_back(0);
+  }
+  ret = io_uring_register_buffers(&ring_, iovecs.data(), iovecs.size());
+  registered_ = ret == 0;
+  if (!registered_) {
+    LOG(WARNING) << "spill reader register buffers failed: " << strerror(-ret);
+  }
+}
+
+AsyncSpillReader::~AsyncSpillReader() {
+  drain();
+  if (registered_) {
+    io_uring_unregister_buffers(&ring_);
+  }
+  io_uring_unregister_eventfd(&ring_);
+  io_uring_queue_exit(&ring_);
+  close(eventFd_);
+  for (auto *buf : buffers_) {
+    free(buf);
+  }
+}
+
+void AsyncSpillReader::submit(const SpillFilePtr &file, int64_t offset,
+                              char *dst, memSize size, Callback callback) {
+  if (static_cast<uint64_t>(offset) + size > file->meta.originalSize) {
+    throw std::runtime_error("Read range exceeds original size");
+  }
+  auto request = std::make_shared<Request>();
+  request->callback = std::move(callback);
+  if (size == 0) {
+    request->callback(true);
+    return;
+  }
+  const uint64_t frameSize = file->footer.frameSize;
+  uint64_t first = static_cast<uint64_t>(offset) / frameSize;
+  uint64_t last = (static_cast<uint64_t>(offset) + size - 1) / frameSize;
+  request->pending = last - first + 1;
+
+  memSize produced = 0;
+  for (uint64_t i = first; i <= last; ++i) {
+    const FrameEntry &entry = file->entries[i];
+    uint64_t frameStart = i * frameSize;
+    memSize from = std::max<uint64_t>(offset, frameStart) - frameStart;
+    memSize cp =
+        std::min<memSize>(file->frameLength(i) - from, size - produced);
+
+    int fd = file->fd;
+    uint64_t readOffset = file->base + entry.offset;
+    memSize readLen = entry.compressedSize;
+    memSize skip = 0;
+    if (file->directFd >= 0) {
+      fd = file->directFd;
+      readOffset = readOffset / kDirectAlignment * kDirectAlignment;
+      skip = file->base + entry.offset - readOffset;
+      readLen = (skip + entry.compressedSize + kDirectAlignment - 1) /
+                kDirectAlignment * kDirectAlignment;
+    }
+
+    uint32_t slot = acquireSlot();
+    char *buffer = slotBuffer(slot, readLen);
+    io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+    if (sqe == nullptr) {
+      io_uring_submit(&ring_);
+      sqe = io_uring_get_sqe(&ring_);
+    }
+    if (registered_ && buffer == buffers_[slot]) {
+      io_uring_prep_read_fixed(sqe, fd, buffer, readLen, readOffset, slot);
+    } else {
+      io_uring_prep_read(sqe, fd, buffer, readLen, readOffset);
+    }
+    io_uring_sqe_set_data(sqe, new Op{request, file, i, slot, skip, from, cp,
+                                      dst + produced, buffer,
+                                      latency_ ? nowNanos() : 0});
+    pendingOps_++;
+    produced += cp;
+  }
+  io_uring_submit(&ring_);
+}
+
+void AsyncSpillReader::poll(bool wait) {
+  uint64_t v;
+  [[maybe_unused]] ssize_t r = read(eventFd_, &v, sizeof(v));
+  if (pendingOps_ == 0) {
+    return;
+  }
+  io_uring_cqe *cqe = nullptr;
+  int ret = wait ? io_uring_wait_cqe(&ring_, &cqe)
+                 : io_uring_peek_cqe(&ring_, &cqe);
+  while (ret == 0 && cqe != nullptr) {
+    auto *op = reinterpret_cast<Op *>(io_uring_cqe_get_data(cqe));
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring_, cqe);
+    onComplete(op, res);
+    ret = io_uring_peek_cqe(&ring_, &cqe);
+  }
+  if (wait && ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+    throw std::runtime_error("io_uring wait failed: " +
+                             std::string(strerror(-ret)));
+  }
+}
+
+void AsyncSpillReader::drain() {
+  while (pendingOps_ > 0) {
+    poll(true);
+  }
+}
+
+int AsyncSpillReader::eventFd() const { return eventFd_; }
+
+uint32_t AsyncSpillReader::pendingReads() const { return pendingOps_; }
+
+uint32_t AsyncSpillReader::acquireSlot() {
+  while (freeSlots_.empty()) {
+    poll(true);
+  }
+  uint32_t slot = freeSlots_.back();
+  freeSlots_.pop_back();
+  return slot;
+}
+
+char *AsyncSpillReader::slotBuffer(uint32_t slot, memSize size) {
+  if (size <= bufferSize_) {
+    return buffers_[slot];
+  }
+  if (largeSizes_[slot] < size) {
+    // Aligned as well, the read may be O_DIRECT.
+    void *buf = nullptr;
+    if (posix_memalign(&buf, kDirectAlignment, size) != 0) {
+      throw std::runtime_error("allocate read buffer failed!");
+    }
+    largeBuffers_[slot].reset(reinterpret_cast<char *>(buf));
+    largeSizes_[slot] = size;
+  }
+  return largeBuffers_[slot].get();
+}
+
+void AsyncSpillReader::onComplete(Op *op, int res) {
+  std::unique_ptr<Op> guard(op);
+  auto &request = op->request;
+  const FrameEntry &entry = op->file->entries[op->frame];
+  pendingOps_--;
+  if (latency_ != nullptr) {
+    latency_->read.recordSince(op->submitNanos);
+  }
+  if (res < 0 || static_cast<memSize>(res) < op->skip + entry.compressedSize) {
+    LOG(ERROR) << "spill read failed file=" << op->file->fileName
+               << " frame=" << op->frame << " res=" << res;
+    request->failed = true;
+  } else {
+    try {
+      uint64_t start = latency_ ? nowNanos() : 0;
+      FileUtils::decodeFrame(entry, op->buffer + op->skip,
+                             op->file->frameLength(op->frame), op->from,
+                             op->dst, op->size, codec_, stats_);
+      if (latency_ != nullptr) {
+        latency_->decompress.recordSince(start);
+      }
+    } catch (const std::exception &e) {
+      LOG(ERROR) << "spill frame decode failed file=" << op->file->fileName
+                 << " frame=" << op->frame << " error=" << e.what();
+      request->failed = true;
+    }
+  }
+  freeSlots_.push_back(op->slot);
+  if (--request->pending == 0) {
+    request->callback(!request->failed);
+  }
+}
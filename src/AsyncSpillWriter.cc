@@ -0,0 +1,402 @@
+#include "AsyncSpillWriter.h"
+#include "Compression.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdexcept>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static constexpr size_t kBufferAlignment = 4096;
+
+struct AsyncSpillWriter::Job {
+  // Empty when writing into a caller's file.
+  std::string fileName;
+  int fd{-1};
+  uint64_t base{0};
+  memSize length{0};
+  Callback callback;
+  FileMeta meta{};
+  // Frame index and footer, written after the frames.
+  std::vector<char> tail;
+  uint32_t pending{0};
+  bool sealed{false};
+  bool failed{false};
+};
+
+struct AsyncSpillWriter::Op {
+  enum Kind { Write, Sync };
+  std::shared_ptr<Job> job;
+  Kind kind;
+  int slot;
+  memSize len;
+};
+
+AsyncSpillWriter::AsyncSpillWriter(uint32_t queueDepth, memSize frameSize,
+                                   Statistics *stats,
+                                   uint32_t compressionThreads)
+    : queueDepth_(std::max<uint32_t>({queueDepth, compressionThreads, 1})),
+      frameSize_(frameSize), registered_(false), stats_(stats),
+      pendingOps_(0), pendingFiles_(0), stopping_(false) {
+  if (frameSize_ == 0) {
+    throw std::runtime_error("Frame size must be positive");
+  }
+  // Besides the frame writes every file has a header, a tail and a sync op.
+  int ret = io_uring_queue_init(queueDepth_ * 2 + 4, &ring_, 0);
+  if (ret < 0) {
+    throw std::runtime_error("io_uring init failed: " +
+                             std::string(strerror(-ret)));
+  }
+  bufferSize_ = std::max(compressBound(frameSize_, CompressionType::Zstd),
+                         compressBound(frameSize_, CompressionType::Lz4));
+  bufferSize_ = (bufferSize_ + kBufferAlignment - 1) / kBufferAlignment *
+                kBufferAlignment;
+  std::vector<iovec> iovecs;
+  for (uint32_t i = 0; i < queueDepth_; ++i) {
+    void *buf = nullptr;
+    if (posix_memalign(&buf, kBufferAlignment, bufferSize_) != 0) {
+      for (auto *b : buffers_) {
+        free(b);
+      }
+      io_uring_queue_exit(&ring_);
+      throw std::runtime_error("allocate spill buffer failed!");
+    }
+    buffers_.push_back(reinterpret_cast<char *>(buf));
+    iovecs.push_back({buf, bufferSize_});
+    freeSlots_.push_back(i);
+  }
+  largeBuffers_.resize(queueDepth_);
+  // Registration pins the buffers, it may exceed RLIMIT_MEMLOCK. Plain writes
+  // from the same buffers still work then.
+  ret = io_uring_register_buffers(&ring_, iovecs.data(), iovecs.size());
+  registered_ = ret == 0;
+  if (!registered_) {
+    LOG(WARNING) << "spill writer register buffers failed: " << strerror(-ret);
+  }
+  tasks_.resize(queueDepth_);
+  if (compressionThreads > 1) {
+    for (uint32_t i = 0; i < compressionThreads; ++i) {
+      compressors_.emplace_back([this] { compressLoop(); });
+    }
+  }
+  LOG(INFO) << "spill writer init depth=" << queueDepth_
+            << " frameSize=" << frameSize_ << " registered=" << registered_
+            << " compressionThreads=" << compressors_.size();
+}
+
+AsyncSpillWriter::~AsyncSpillWriter() {
+  drain();
+  {
+    std::lock_guard<std::mutex> guard(taskMutex_);
+    stopping_ = true;
+  }
+  taskCv_.notify_all();
+  for (auto &thread : compressors_) {
+    thread.join();
+  }
+  if (registered_) {
+    io_uring_unregister_buffers(&ring_);
+  }
+  io_uring_queue_exit(&ring_);
+  for (auto *buf : buffers_) {
+    free(buf);
+  }
+}
+
+static void checkArgs(CompressionType type, memSize frameSize) {
+  if (type != CompressionType::None && type != CompressionType::Zstd &&
+      type != CompressionType::Lz4 && type != CompressionType::Adaptive) {
+    throw std::runtime_error("Unsupported compression type");
+  }
+  if (frameSize == 0) {
+    throw std::runtime_error("Frame size must be positive");
+  }
+}
+
+void AsyncSpillWriter::submit(int fd, uint64_t base, char *addr,
+                              memSize size, CompressionType type,
+                              memSize frameSize, Callback callback) {
+  checkArgs(type, frameSize);
+  auto job = std::make_shared<Job>();
+  job->fd = fd;
+  job->base = base;
+  job->callback = std::move(callback);
+  start(job, addr, size, type, frameSize);
+}
+
+void AsyncSpillWriter::submit(const std::string &fileName, char *addr,
+                              memSize size, CompressionType type,
+                              memSize frameSize, Callback callback) {
+  checkArgs(type, frameSize);
+  int fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open " + fileName + " for write.");
+  }
+  auto job = std::make_shared<Job>();
+  job->fileName = fileName;
+  job->fd = fd;
+  job->callback = std::move(callback);
+  start(job, addr, size, type, frameSize);
+}
+
+void AsyncSpillWriter::start(const std::shared_ptr<Job> &job, char *addr,
+                             memSize size, CompressionType type,
+                             memSize frameSize) {
+  const memSize bound =
+      std::max(compressBound(frameSize, CompressionType::Zstd),
+               compressBound(frameSize, CompressionType::Lz4));
+  pendingFiles_++;
+
+  const memSize frames = (size + frameSize - 1) / frameSize;
+  std::vector<FrameEntry> entries;
+  entries.reserve(frames);
+  uint64_t pos = sizeof(FileMeta);
+  // Slots of the frames being compressed, in frame order.
+  std::deque<uint32_t> compressing;
+  memSize next = 0;
+  try {
+    while (entries.size() < frames) {
+      if (!compressors_.empty()) {
+        reap(false);
+      }
+      // On the calling thread a frame is written as soon as it is
+      // compressed, with a pool every free slot takes the next frame.
+      while (next < frames &&
+             (compressing.empty() ||
+              (!compressors_.empty() && !freeSlots_.empty()))) {
+        uint32_t slot = acquireSlot();
+        memSize start = next * frameSize;
+        Task &task = tasks_[slot];
+        task.src = addr + start;
+        task.size = std::min(frameSize, size - start);
+        task.buffer = slotBuffer(slot, bound);
+        task.capacity = bound;
+        task.type = type;
+        dispatch(task);
+        compressing.push_back(slot);
+        next++;
+      }
+      uint32_t slot = compressing.front();
+      Task &task = tasks_[slot];
+      wait(task, true);
+      compressing.pop_front();
+      task.entry.offset = pos;
+      enqueueWrite(job, slot, task.data, task.entry.compressedSize, pos);
+      pos += task.entry.compressedSize;
+      entries.push_back(task.entry);
+    }
+  } catch (...) {
+    // The frames still compressing write into their slots.
+    for (uint32_t slot : compressing) {
+      wait(tasks_[slot], false);
+      freeSlots_.push_back(slot);
+    }
+    // Writes already queued still reference the job, the last one to
+    // complete reports the failure.
+    job->failed = true;
+    job->sealed = true;
+    if (job->pending == 0) {
+      finish(job, false);
+    }
+    throw;
+  }
+
+  job->meta = {kSpillFileMagic, kSpillFileFramedVersion,
+               static_cast<uint16_t>(type), size, pos - sizeof(FileMeta)};
+  FrameFooter footer{frameSize, entries.size(), kSpillFileMagic, 0};
+  job->tail.resize(entries.size() * sizeof(FrameEntry) + sizeof(footer));
+  std::memcpy(job->tail.data(), entries.data(),
+              entries.size() * sizeof(FrameEntry));
+  std::memcpy(job->tail.data() + entries.size() * sizeof(FrameEntry), &footer,
+              sizeof(footer));
+  job->length = pos + job->tail.size();
+  enqueueWrite(job, -1, job->tail.data(), job->tail.size(), pos);
+  enqueueWrite(job, -1, reinterpret_cast<const char *>(&job->meta),
+               sizeof(job->meta), 0);
+  job->sealed = true;
+  io_uring_submit(&ring_);
+}
+
+void AsyncSpillWriter::dispatch(Task &task) {
+  task.error = nullptr;
+  if (compressors_.empty()) {
+    runTask(task, codec_);
+    task.done = true;
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(taskMutex_);
+    task.done = false;
+    queue_.push_back(&task);
+  }
+  taskCv_.notify_one();
+}
+
+void AsyncSpillWriter::wait(Task &task, bool rethrow) {
+  if (!compressors_.empty()) {
+    std::unique_lock<std::mutex> lock(taskMutex_);
+    doneCv_.wait(lock, [&task] { return task.done; });
+  }
+  if (rethrow && task.error) {
+    std::rethrow_exception(task.error);
+  }
+}
+
+void AsyncSpillWriter::runTask(Task &task, CompressionContext &ctx) {
+  try {
+    task.data = FileUtils::encodeFrame(task.src, task.size, task.buffer,
+                                       task.capacity, task.type, task.entry,
+                                       ctx, stats_);
+  } catch (...) {
+    task.error = std::current_exception();
+  }
+}
+
+void AsyncSpillWriter::compressLoop() {
+  std::unique_lock<std::mutex> lock(taskMutex_);
+  while (true) {
+    taskCv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return;
+    }
+    Task *task = queue_.front();
+    queue_.pop_front();
+    lock.unlock();
+    runTask(*task, CompressionContext::local());
+    lock.lock();
+    task->done = true;
+    doneCv_.notify_all();
+  }
+}
+
+void AsyncSpillWriter::drain() {
+  while (pendingOps_ > 0) {
+    reap(true);
+  }
+}
+
+uint32_t AsyncSpillWriter::pendingFiles() const { return pendingFiles_; }
+
+uint32_t AsyncSpillWriter::acquireSlot() {
+  while (freeSlots_.empty()) {
+    reap(true);
+  }
+  uint32_t slot = freeSlots_.back();
+  freeSlots_.pop_back();
+  return slot;
+}
+
+char *AsyncSpillWriter::slotBuffer(uint32_t slot, memSize size) {
+  if (size <= bufferSize_) {
+    return buffers_[slot];
+  }
+  auto &large = largeBuffers_[slot];
+  if (large.size() < size) {
+    large.resize(size);
+  }
+  return large.data();
+}
+
+io_uring_sqe *AsyncSpillWriter::nextSqe() {
+  io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+  while (sqe == nullptr) {
+    io_uring_submit(&ring_);
+    sqe = io_uring_get_sqe(&ring_);
+  }
+  return sqe;
+}
+
+void AsyncSpillWriter::enqueueWrite(const std::shared_ptr<Job> &job, int slot,
+                                    const char *data, memSize len,
+                                    uint64_t offset) {
+  io_uring_sqe *sqe = nextSqe();
+  bool fixed = registered_ && slot >= 0 && data == buffers_[slot];
+  if (fixed) {
+    io_uring_prep_write_fixed(sqe, job->fd, data, len, job->base + offset,
+                              slot);
+  } else {
+    io_uring_prep_write(sqe, job->fd, data, len, job->base + offset);
+  }
+  io_uring_sqe_set_data(sqe, new Op{job, Op::Write, slot, len});
+  job->pending++;
+  pendingOps_++;
+  // Hand the frame to the kernel right away so it overlaps with compressing
+  // the next one.
+  io_uring_submit(&ring_);
+}
+
+void AsyncSpillWriter::enqueueSync(const std::shared_ptr<Job> &job) {
+  io_uring_sqe *sqe = nextSqe();
+  io_uring_prep_fsync(sqe, job->fd, IORING_FSYNC_DATASYNC);
+  io_uring_sqe_set_data(sqe, new Op{job, Op::Sync, -1, 0});
+  job->pending++;
+  pendingOps_++;
+  io_uring_submit(&ring_);
+}
+
+void AsyncSpillWriter::reap(bool wait) {
+  io_uring_cqe *cqe = nullptr;
+  int ret = wait ? io_uring_wait_cqe(&ring_, &cqe)
+                 : io_uring_peek_cqe(&ring_, &cqe);
+  while (ret == 0 && cqe != nullptr) {
+    auto *op = reinterpret_cast<Op *>(io_uring_cqe_get_data(cqe));
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring_, cqe);
+    onComplete(op, res);
+    ret = io_uring_peek_cqe(&ring_, &cqe);
+  }
+  if (wait && ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+    throw std::runtime_error("io_uring wait failed: " +
+                             std::string(strerror(-ret)));
+  }
+}
+
+void AsyncSpillWriter::onComplete(Op *op, int res) {
+  std::unique_ptr<Op> guard(op);
+  auto job = op->job;
+  job->pending--;
+  pendingOps_--;
+  if (op->slot >= 0) {
+    freeSlots_.push_back(op->slot);
+  }
+  if (op->kind == Op::Write) {
+    if (res < 0 || static_cast<memSize>(res) != op->len) {
+      LOG(ERROR) << "spill write failed file=" << job->fileName
+                 << " fd=" << job->fd << " res=" << res << " expected=" << op->len;
+      job->failed = true;
+    }
+    if (job->sealed && job->pending == 0) {
+      if (job->failed) {
+        finish(job, false);
+      } else {
+        enqueueSync(job);
+      }
+    }
+  } else {
+    if (res < 0) {
+      LOG(ERROR) << "spill sync failed file=" << job->fileName
+                 << " fd=" << job->fd
+                 << " error=" << strerror(-res);
+    }
+    finish(job, res == 0 && !job->failed);
+  }
+}
+
+void AsyncSpillWriter::finish(const std::shared_ptr<Job> &job, bool ok) {
+  if (!job->fileName.empty()) {
+    close(job->fd);
+    if (!ok) {
+      unlink(job->fileName.c_str());
+    }
+  }
+  job->fd = -1;
+  pendingFiles_--;
+  if (job->callback) {
+    job->callback(ok, ok ? job->length : 0);
+  }
+}
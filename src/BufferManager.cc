@@ -1,29 +1,167 @@
 #include "BufferManager.h"
+#include "MemoryUtils.h"
+#include <algorithm>
 #include <glog/logging.h>
 
+static const std::string kPrefix = "buffer_manager_";
+static constexpr double kNanosToSeconds = 1e-9;
+
 BufferManager::BufferManager(const Config &conf) {
-  spiller_ = std::make_shared<Spiller>(conf.spillDir, conf.compressionType);
-  pageFaultHandler_ = std::make_shared<PageFaultHandler>(spiller_);
-  quotaManager_ = std::make_unique<QuotaManager>(conf.quota, spiller_);
+  spiller_ = std::make_shared<Spiller>(conf.spillDir, conf.compressionType,
+                                       conf.spillIoDepth, conf.spillDirectIo,
+                                       conf.evictionPolicy,
+                                       conf.spillSegmentSize,
+                                       conf.spillCompressionThreads);
+  pageFaultHandler_ =
+      std::make_shared<PageFaultHandler>(spiller_, conf.faultIoDepth,
+                                         conf.faultHandlerThreads,
+                                         conf.prefetchDepth);
+  quotaManager_ = std::make_unique<QuotaManager>(
+      conf.quota, spiller_, conf.spillHighWatermark, conf.spillLowWatermark,
+      conf.quotaWaitMs);
 }
 
 BufferManager::~BufferManager() {}
 
-MmapMemoryPtr BufferManager::accquireMemory(int64_t size) {
-  if (!quotaManager_->tryAcquire(size)) {
+MmapMemoryPtr BufferManager::accquireMemory(int64_t size, memSize pageSize,
+                                            const QuotaPoolPtr &pool,
+                                            bool pinned) {
+  if (!isValidPageSize(pageSize)) {
+    throw std::runtime_error("invalid page size " + std::to_string(pageSize));
+  }
+  auto memory = std::make_unique<MmapMemory>(size, pageSize);
+  // Charged in whole pages, as mapped.
+  auto reservation = quotaManager_->reserve(memory->size(), pool);
+  if (reservation == nullptr) {
     throw std::runtime_error("quota not enough! OOM error!");
   }
+  // The spiller queue can outlive the handler while the manager is torn down.
+  PageFaultHandlerWeakPtr handler = pageFaultHandler_;
+  SpillerWeakPtr spiller = spiller_;
   auto mem = std::shared_ptr<MmapMemory>(
-      new MmapMemory(size), [this](MmapMemory *mem) {
-        pageFaultHandler_->unregisterMemory(mem->address(), mem->size());
+      memory.release(), [handler, spiller](MmapMemory *mem) {
+        if (auto h = handler.lock()) {
+          h->unregisterMemory(mem->address(), mem->size());
+        }
+        // Drops the spill file and gives the quota back.
+        if (auto s = spiller.lock()) {
+          s->unregisterMem(mem->address());
+        }
         delete mem;
       });
-  // auto mem = std::make_shared<MmapMemory>(size);
-  spiller_->registerMem(mem);
+  spiller_->registerMem(mem, std::move(reservation), pinned);
   pageFaultHandler_->registerMemory(mem);
   return mem;
 }
 
+void BufferManager::setPinned(const MmapMemoryPtr &mem, bool pinned) {
+  spiller_->setPinned(mem->address(), pinned);
+}
+
 Statistics BufferManager::pageFaultStats() const {
   return pageFaultHandler_->stats();
 }
+
+Statistics BufferManager::spillStats() const { return spiller_->stats(); }
+
+MetricsSnapshot BufferManager::metrics() const {
+  MetricsSnapshot m;
+  Statistics faults = pageFaultHandler_->stats();
+  Statistics spills = spiller_->stats();
+  m.addCounter(kPrefix + "page_faults_total", "Page faults served.",
+               faults.pageFaultCount);
+  m.addCounter(kPrefix + "duplicate_faults_total",
+               "Faults on a page whose read was already in flight.",
+               faults.duplicateFaultCount);
+  m.addCounter(kPrefix + "write_faults_total",
+               "Writes to pages whose spill file was already written.",
+               faults.writeFaultCount);
+  m.addCounter(kPrefix + "prefetched_pages_total",
+               "Pages read ahead of a sequential stream.",
+               faults.prefetchCount);
+  m.addCounter(kPrefix + "prefetch_hits_total",
+               "Prefetched pages reached without faulting.",
+               faults.prefetchHitCount);
+  m.addCounter(kPrefix + "prefetch_wasted_total",
+               "Prefetched pages already present or never reached.",
+               faults.prefetchWastedCount);
+
+  static const char *codecs[Statistics::kCodecCount] = {"none", "zstd",
+                                                        "lz4"};
+  auto perCodec = [&](const std::string &name, const std::string &help,
+                      bool gauge, auto value) {
+    for (int i = 0; i < Statistics::kCodecCount; ++i) {
+      MetricsSnapshot::Label label{"codec", codecs[i]};
+      if (gauge) {
+        m.addGauge(kPrefix + name, help, value(i), label);
+      } else {
+        m.addCounter(kPrefix + name, help, value(i), label);
+      }
+    }
+  };
+  perCodec("spill_frames_total", "Frames spilled, by codec.", false,
+           [&](int i) { return spills.codecFrames[i].load(); });
+  perCodec("spill_input_bytes_total", "Bytes spilled before compression.",
+           false, [&](int i) { return spills.codecInputBytes[i].load(); });
+  perCodec("spill_output_bytes_total", "Bytes written for spilled frames.",
+           false, [&](int i) { return spills.codecOutputBytes[i].load(); });
+  perCodec("compression_ratio", "Bytes written over bytes spilled.", true,
+           [&](int i) {
+             return spills.compressionRatio(static_cast<CompressionType>(i));
+           });
+  perCodec("compress_seconds_total", "Time spent compressing frames.", false,
+           [&](int i) {
+             return spills.codecCompressNanos[i] * kNanosToSeconds;
+           });
+  perCodec("decompress_seconds_total", "Time spent decoding frames.", false,
+           [&](int i) {
+             return faults.codecDecompressNanos[i] * kNanosToSeconds;
+           });
+
+  Spiller::Usage usage = spiller_->usage();
+  m.addGauge(kPrefix + "quota_limit_bytes", "Size of the process pool.",
+             quotaManager_->root()->limit());
+  m.addGauge(kPrefix + "quota_used_bytes",
+             "Bytes charged to the process pool.", quotaManager_->used());
+  m.addGauge(kPrefix + "region_bytes", "Size of the live regions.",
+             usage.regionBytes);
+  m.addGauge(kPrefix + "resident_bytes", "Bytes of the regions in memory.",
+             usage.residentBytes);
+  m.addGauge(kPrefix + "spilled_bytes",
+             "Bytes of the regions not in memory.",
+             usage.regionBytes - std::min(usage.regionBytes,
+                                          usage.residentBytes));
+  m.addGauge(kPrefix + "spill_file_bytes", "Bytes held by spill files.",
+             usage.spillFileBytes);
+  m.addGauge(kPrefix + "process_rss_bytes", "Resident set of the process.",
+             MemoryUtils::getProcessRss());
+
+  const FaultLatency &fault = pageFaultHandler_->latency();
+  m.addHistogram(kPrefix + "fault_seconds",
+                 "Demand fault, from the message to the page being mapped.",
+                 fault.total.snapshot(), kNanosToSeconds);
+  m.addHistogram(kPrefix + "fault_lookup_seconds",
+                 "Finding the region and spill file of a fault.",
+                 fault.lookup.snapshot(), kNanosToSeconds);
+  m.addHistogram(kPrefix + "fault_read_seconds", "Reading one frame.",
+                 fault.read.snapshot(), kNanosToSeconds);
+  m.addHistogram(kPrefix + "fault_decompress_seconds", "Decoding one frame.",
+                 fault.decompress.snapshot(), kNanosToSeconds);
+  m.addHistogram(kPrefix + "fault_copy_seconds", "UFFDIO_COPY of one page.",
+                 fault.copy.snapshot(), kNanosToSeconds);
+  const SpillLatency &spill = spiller_->latency();
+  m.addHistogram(kPrefix + "spill_seconds",
+                 "One spill, until its files are durable.",
+                 spill.spill.snapshot(), kNanosToSeconds);
+  m.addHistogram(kPrefix + "spill_bytes", "Quota freed by one spill.",
+                 spill.spillBytes.snapshot());
+  m.addHistogram(kPrefix + "spill_write_seconds",
+                 "Writing the spill file of one region.",
+                 spill.write.snapshot(), kNanosToSeconds);
+  m.addHistogram(kPrefix + "spill_write_bytes",
+                 "Bytes written for one region.", spill.writeBytes.snapshot());
+  m.addHistogram(kPrefix + "quota_wait_seconds",
+                 "Charging quota, waiting for room included.",
+                 quotaManager_->waitLatency().snapshot(), kNanosToSeconds);
+  return m;
+}
@@ -2,6 +2,9 @@
 
 #include <stdexcept>
 #include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <istream>
 #include <ostream>
@@ -10,59 +13,106 @@
 #include <lz4.h>
 #include <lz4frame.h>
 
-static std::vector<char> compressZstd(const char *src, size_t size) {
-  size_t bound = ZSTD_compressBound(size);
-  std::vector<char> out(bound);
-  size_t ret = ZSTD_compress(out.data(), out.size(), src, size, 1);
-  if (ZSTD_isError(ret)) {
-    throw std::runtime_error("ZSTD compress error");
+static void decompressLz4(const char *src, size_t cSize, char *dst, size_t dSize) {
+  int ret = LZ4_decompress_safe(src, dst, static_cast<int>(cSize), static_cast<int>(dSize));
+  if (ret < 0 || static_cast<size_t>(ret) != dSize) {
+    throw std::runtime_error("LZ4 decompress error");
   }
-  out.resize(ret);
-  return out;
 }
 
-static std::vector<char> compressLz4(const char *src, size_t size) {
-  int bound = LZ4_compressBound(static_cast<int>(size));
-  std::vector<char> out(static_cast<size_t>(bound));
-  int ret = LZ4_compress_default(src, out.data(), static_cast<int>(size), bound);
-  if (ret <= 0) {
-    throw std::runtime_error("LZ4 compress error");
-  }
-  out.resize(static_cast<size_t>(ret));
+std::vector<char> compressBuffer(const char *src, size_t size, CompressionType type) {
+  std::vector<char> out(compressBound(size, type));
+  out.resize(CompressionContext::local().compress(src, size, out.data(), out.size(), type));
   return out;
 }
 
-static void decompressZstd(const char *src, size_t cSize, char *dst, size_t dSize) {
-  size_t ret = ZSTD_decompress(dst, dSize, src, cSize);
-  if (ZSTD_isError(ret) || ret != dSize) {
-    throw std::runtime_error("ZSTD decompress error");
+size_t compressBound(size_t size, CompressionType type) {
+  if (type == CompressionType::None) {
+    return size;
+  } else if (type == CompressionType::Zstd) {
+    return ZSTD_compressBound(size);
+  } else if (type == CompressionType::Lz4) {
+    return static_cast<size_t>(LZ4_compressBound(static_cast<int>(size)));
+  } else if (type == CompressionType::Adaptive) {
+    return std::max(compressBound(size, CompressionType::Zstd),
+                    compressBound(size, CompressionType::Lz4));
   }
+  throw std::runtime_error("Unsupported compression type");
 }
 
-static void decompressLz4(const char *src, size_t cSize, char *dst, size_t dSize) {
-  int ret = LZ4_decompress_safe(src, dst, static_cast<int>(cSize), static_cast<int>(dSize));
-  if (ret < 0 || static_cast<size_t>(ret) != dSize) {
-    throw std::runtime_error("LZ4 decompress error");
+size_t compressBuffer(const char *src, size_t size, char *dst, size_t capacity,
+                      CompressionType type) {
+  return CompressionContext::local().compress(src, size, dst, capacity, type);
+}
+
+void decompressBuffer(const char *src, size_t csize, char *dst, size_t dsize, CompressionType type) {
+  CompressionContext::local().decompress(src, csize, dst, dsize, type);
+}
+
+CompressionContext::CompressionContext()
+    : zstdC_(nullptr), zstdD_(nullptr), lz4fC_(nullptr), lz4fD_(nullptr),
+      lz4State_(nullptr), bufferSizes_{0, 0, 0} {
+  zstdC_ = ZSTD_createCCtx();
+  zstdD_ = ZSTD_createDCtx();
+  lz4State_ = malloc(static_cast<size_t>(LZ4_sizeofState()));
+  if (!zstdC_ || !zstdD_ || !lz4State_) {
+    ZSTD_freeCCtx(zstdC_);
+    ZSTD_freeDCtx(zstdD_);
+    free(lz4State_);
+    throw std::runtime_error("create compression context failed");
   }
 }
 
-std::vector<char> compressBuffer(const char *src, size_t size, CompressionType type) {
+CompressionContext::~CompressionContext() {
+  ZSTD_freeCCtx(zstdC_);
+  ZSTD_freeDCtx(zstdD_);
+  if (lz4fC_) LZ4F_freeCompressionContext(lz4fC_);
+  if (lz4fD_) LZ4F_freeDecompressionContext(lz4fD_);
+  free(lz4State_);
+}
+
+CompressionContext &CompressionContext::local() {
+  thread_local CompressionContext context;
+  return context;
+}
+
+size_t CompressionContext::compress(const char *src, size_t size, char *dst,
+                                    size_t capacity, CompressionType type,
+                                    int level) {
   if (type == CompressionType::None) {
-    return std::vector<char>(src, src + size);
+    if (capacity < size) {
+      throw std::runtime_error("Destination buffer too small");
+    }
+    std::memcpy(dst, src, size);
+    return size;
   } else if (type == CompressionType::Zstd) {
-    return compressZstd(src, size);
+    size_t ret = ZSTD_compressCCtx(zstdC_, dst, capacity, src, size, level);
+    if (ZSTD_isError(ret)) {
+      throw std::runtime_error("ZSTD compress error");
+    }
+    return ret;
   } else if (type == CompressionType::Lz4) {
-    return compressLz4(src, size);
+    int ret = LZ4_compress_fast_extState(lz4State_, src, dst,
+                                         static_cast<int>(size),
+                                         static_cast<int>(capacity), 1);
+    if (ret <= 0) {
+      throw std::runtime_error("LZ4 compress error");
+    }
+    return static_cast<size_t>(ret);
   }
   throw std::runtime_error("Unsupported compression type");
 }
 
-void decompressBuffer(const char *src, size_t csize, char *dst, size_t dsize, CompressionType type) {
+void CompressionContext::decompress(const char *src, size_t csize, char *dst,
+                                    size_t dsize, CompressionType type) {
   if (type == CompressionType::None) {
     std::memcpy(dst, src, dsize);
     return;
   } else if (type == CompressionType::Zstd) {
-    decompressZstd(src, csize, dst, dsize);
+    size_t ret = ZSTD_decompressDCtx(zstdD_, dst, dsize, src, csize);
+    if (ZSTD_isError(ret) || ret != dsize) {
+      throw std::runtime_error("ZSTD decompress error");
+    }
     return;
   } else if (type == CompressionType::Lz4) {
     decompressLz4(src, csize, dst, dsize);
@@ -71,80 +121,173 @@ void decompressBuffer(const char *src, size_t csize, char *dst, size_t dsize, Co
   throw std::runtime_error("Unsupported compression type");
 }
 
+char *CompressionContext::buffer(BufferId id, size_t size) {
+  if (bufferSizes_[id] < size) {
+    buffers_[id].reset(new char[size]);
+    bufferSizes_[id] = size;
+  }
+  return buffers_[id].get();
+}
+
+ZSTD_CCtx *CompressionContext::zstdStream() {
+  ZSTD_CCtx_reset(zstdC_, ZSTD_reset_session_and_parameters);
+  return zstdC_;
+}
+
+ZSTD_DCtx *CompressionContext::zstdDecoder() {
+  ZSTD_DCtx_reset(zstdD_, ZSTD_reset_session_only);
+  return zstdD_;
+}
+
+LZ4F_cctx *CompressionContext::lz4Stream() {
+  // LZ4F_compressBegin starts every frame from scratch.
+  if (!lz4fC_ && LZ4F_isError(LZ4F_createCompressionContext(&lz4fC_, LZ4F_VERSION))) {
+    lz4fC_ = nullptr;
+    throw std::runtime_error("LZ4F createCompressionContext failed");
+  }
+  return lz4fC_;
+}
+
+LZ4F_dctx *CompressionContext::lz4Decoder() {
+  if (!lz4fD_) {
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&lz4fD_, LZ4F_VERSION))) {
+      lz4fD_ = nullptr;
+      throw std::runtime_error("LZ4F createDecompressionContext failed");
+    }
+  } else {
+    LZ4F_resetDecompressionContext(lz4fD_);
+  }
+  return lz4fD_;
+}
+
+// chooseCodec samples this many blocks of kSampleBlock bytes for the
+// entropy estimate, whole blocks so the byte lanes of fixed width keys are
+// all seen, and compresses a prefix of up to kTrialPrefix bytes.
+static constexpr size_t kSampleBlocks = 64;
+static constexpr size_t kSampleBlock = 64;
+static constexpr size_t kTrialPrefix = 16 << 10;
+// Order-0 entropy, in bits per byte, above which a chunk is stored raw. The
+// estimate of uniform random bytes from 4 KB of samples is about 7.95.
+static constexpr double kRawEntropy = 7.5;
+// Ratios (compressed / original) of the trial.
+static constexpr double kRawRatio = 0.9;
+static constexpr double kZstdAdvantage = 0.85;
+static constexpr double kRedundantRatio = 0.25;
+static constexpr int kRedundantZstdLevel = 3;
+
+static double sampledEntropy(const char *src, size_t size) {
+  uint32_t counts[256] = {};
+  size_t blocks = std::max<size_t>(1, std::min(kSampleBlocks, size / kSampleBlock));
+  size_t step = blocks > 1 ? (size - kSampleBlock) / (blocks - 1) : 0;
+  size_t sampled = 0;
+  for (size_t b = 0; b < blocks; ++b) {
+    const auto *block = reinterpret_cast<const uint8_t *>(src + b * step);
+    size_t len = std::min(kSampleBlock, size - b * step);
+    for (size_t i = 0; i < len; ++i) {
+      counts[block[i]]++;
+    }
+    sampled += len;
+  }
+  double bits = 0;
+  for (uint32_t count : counts) {
+    if (count != 0) {
+      double p = static_cast<double>(count) / sampled;
+      bits -= p * std::log2(p);
+    }
+  }
+  return bits;
+}
+
+CodecChoice chooseCodec(const char *src, size_t size, CompressionContext &ctx) {
+  if (size == 0 || sampledEntropy(src, size) > kRawEntropy) {
+    return {CompressionType::None, 0};
+  }
+  size_t prefix = std::min(size, kTrialPrefix);
+  size_t capacity = compressBound(prefix, CompressionType::Adaptive);
+  char *trial = ctx.buffer(CompressionContext::kFrameBuffer, capacity);
+  double lz4Ratio =
+      static_cast<double>(ctx.compress(src, prefix, trial, capacity, CompressionType::Lz4)) /
+      prefix;
+  double zstdRatio =
+      static_cast<double>(ctx.compress(src, prefix, trial, capacity, CompressionType::Zstd)) /
+      prefix;
+  if (std::min(lz4Ratio, zstdRatio) > kRawRatio) {
+    return {CompressionType::None, 0};
+  }
+  if (zstdRatio >= lz4Ratio * kZstdAdvantage) {
+    return {CompressionType::Lz4, 0};
+  }
+  int level = zstdRatio < kRedundantRatio ? kRedundantZstdLevel : kDefaultZstdLevel;
+  return {CompressionType::Zstd, level};
+}
+
+// Streams are read and written in chunks of this size.
+static constexpr size_t kStreamChunk = 1 << 16;
+
 void compressToStream(const char *src, size_t size, CompressionType type, std::ostream &out) {
   if (type == CompressionType::None) {
     out.write(src, size);
     return;
-  } else if (type == CompressionType::Zstd) {
-    const size_t chunk = 1 << 16;
-    ZSTD_CCtx *cctx = ZSTD_createCCtx();
-    if (!cctx) throw std::runtime_error("ZSTD createCCtx failed");
-    size_t const cLevel = 1;
-    size_t ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, cLevel);
+  }
+  auto &context = CompressionContext::local();
+  if (type == CompressionType::Zstd) {
+    ZSTD_CCtx *cctx = context.zstdStream();
+    size_t ret = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 1);
     if (ZSTD_isError(ret)) {
-      ZSTD_freeCCtx(cctx);
       throw std::runtime_error("ZSTD setParameter failed");
     }
-    std::vector<char> outBuf(ZSTD_CStreamOutSize());
+    const size_t outSize = ZSTD_CStreamOutSize();
+    char *outBuf = context.buffer(CompressionContext::kOutputBuffer, outSize);
     ZSTD_inBuffer input{src, size, 0};
     while (input.pos < input.size) {
-      size_t toRead = std::min(chunk, input.size - input.pos);
+      size_t toRead = std::min(kStreamChunk, input.size - input.pos);
       ZSTD_inBuffer chunkIn{src + input.pos, toRead, 0};
       while (chunkIn.pos < chunkIn.size) {
-        ZSTD_outBuffer outBuffer{outBuf.data(), outBuf.size(), 0};
+        ZSTD_outBuffer outBuffer{outBuf, outSize, 0};
         size_t r = ZSTD_compressStream2(cctx, &outBuffer, &chunkIn, ZSTD_e_continue);
         if (ZSTD_isError(r)) {
-          ZSTD_freeCCtx(cctx);
           throw std::runtime_error("ZSTD compressStream2 error");
         }
-        out.write(outBuf.data(), outBuffer.pos);
+        out.write(outBuf, outBuffer.pos);
       }
       input.pos += toRead;
     }
-    ZSTD_outBuffer outBuffer{outBuf.data(), outBuf.size(), 0};
-    size_t r = ZSTD_compressStream2(cctx, &outBuffer, &input, ZSTD_e_end);
-    if (ZSTD_isError(r)) {
-      ZSTD_freeCCtx(cctx);
-      throw std::runtime_error("ZSTD finalize error");
-    }
-    out.write(outBuf.data(), outBuffer.pos);
-    ZSTD_freeCCtx(cctx);
+    size_t remaining;
+    do {
+      ZSTD_outBuffer outBuffer{outBuf, outSize, 0};
+      remaining = ZSTD_compressStream2(cctx, &outBuffer, &input, ZSTD_e_end);
+      if (ZSTD_isError(remaining)) {
+        throw std::runtime_error("ZSTD finalize error");
+      }
+      out.write(outBuf, outBuffer.pos);
+    } while (remaining != 0);
     return;
   } else if (type == CompressionType::Lz4) {
-    LZ4F_compressionContext_t cctx;
-    size_t const createRes = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
-    if (LZ4F_isError(createRes)) {
-      throw std::runtime_error("LZ4F createCompressionContext failed");
-    }
+    LZ4F_cctx *cctx = context.lz4Stream();
     LZ4F_preferences_t prefs{};
-    std::vector<char> outBuf(1 << 16);
-    size_t headerSize = LZ4F_compressBegin(cctx, outBuf.data(), outBuf.size(), &prefs);
+    size_t outSize = std::max<size_t>(LZ4F_compressBound(kStreamChunk, &prefs),
+                                      LZ4F_HEADER_SIZE_MAX);
+    char *outBuf = context.buffer(CompressionContext::kOutputBuffer, outSize);
+    size_t headerSize = LZ4F_compressBegin(cctx, outBuf, outSize, &prefs);
     if (LZ4F_isError(headerSize)) {
-      LZ4F_freeCompressionContext(cctx);
       throw std::runtime_error("LZ4F compressBegin failed");
     }
-    out.write(outBuf.data(), headerSize);
+    out.write(outBuf, headerSize);
     size_t pos = 0;
-    const size_t chunk = 1 << 16;
     while (pos < size) {
-      size_t toRead = std::min(chunk, size - pos);
-      size_t bound = LZ4F_compressBound(toRead, &prefs);
-      if (outBuf.size() < bound) outBuf.resize(bound);
-      size_t ret = LZ4F_compressUpdate(cctx, outBuf.data(), outBuf.size(), src + pos, toRead, nullptr);
+      size_t toRead = std::min(kStreamChunk, size - pos);
+      size_t ret = LZ4F_compressUpdate(cctx, outBuf, outSize, src + pos, toRead, nullptr);
       if (LZ4F_isError(ret)) {
-        LZ4F_freeCompressionContext(cctx);
         throw std::runtime_error("LZ4F compressUpdate failed");
       }
-      out.write(outBuf.data(), ret);
+      out.write(outBuf, ret);
       pos += toRead;
     }
-    size_t endSize = LZ4F_compressEnd(cctx, outBuf.data(), outBuf.size(), nullptr);
+    size_t endSize = LZ4F_compressEnd(cctx, outBuf, outSize, nullptr);
     if (LZ4F_isError(endSize)) {
-      LZ4F_freeCompressionContext(cctx);
       throw std::runtime_error("LZ4F compressEnd failed");
     }
-    out.write(outBuf.data(), endSize);
-    LZ4F_freeCompressionContext(cctx);
+    out.write(outBuf, endSize);
     return;
   }
   throw std::runtime_error("Unsupported compression type");
@@ -160,32 +303,33 @@ void decompressFromStreamToRange(std::istream &in, CompressionType type, size_t
     in.read(dst, size);
     if (!in.good()) throw std::runtime_error("istream read error");
     return;
-  } else if (type == CompressionType::Zstd) {
-    ZSTD_DCtx *dctx = ZSTD_createDCtx();
-    if (!dctx) throw std::runtime_error("ZSTD createDCtx failed");
+  }
+  auto &context = CompressionContext::local();
+  if (type == CompressionType::Zstd) {
+    ZSTD_DCtx *dctx = context.zstdDecoder();
     const size_t inChunk = ZSTD_DStreamInSize();
-    std::vector<char> inBuf(inChunk);
+    const size_t outChunk = ZSTD_DStreamOutSize();
+    char *inBuf = context.buffer(CompressionContext::kInputBuffer, inChunk);
+    char *tmp = context.buffer(CompressionContext::kOutputBuffer, outChunk);
     size_t produced = 0;
     size_t consumedOriginal = 0;
     while (produced < size) {
-      in.read(inBuf.data(), inBuf.size());
+      in.read(inBuf, inChunk);
       size_t got = static_cast<size_t>(in.gcount());
-      ZSTD_inBuffer inB{inBuf.data(), got, 0};
+      ZSTD_inBuffer inB{inBuf, got, 0};
       while (inB.pos < inB.size) {
         size_t remainOriginal = originalSize - consumedOriginal;
         size_t needPos = offset - consumedOriginal;
         size_t outAvail = size - produced;
-        std::vector<char> tmp(std::min(remainOriginal, static_cast<size_t>(ZSTD_DStreamOutSize())));
-        ZSTD_outBuffer outB{tmp.data(), tmp.size(), 0};
+        ZSTD_outBuffer outB{tmp, std::min(remainOriginal, outChunk), 0};
         size_t r = ZSTD_decompressStream(dctx, &outB, &inB);
         if (ZSTD_isError(r)) {
-          ZSTD_freeDCtx(dctx);
           throw std::runtime_error("ZSTD decompressStream error");
         }
         if (needPos < outB.pos) {
           size_t start = needPos;
           size_t cp = std::min(outB.pos - start, outAvail);
-          std::memcpy(dst + produced, tmp.data() + start, cp);
+          std::memcpy(dst + produced, tmp + start, cp);
           produced += cp;
           offset += cp;
         }
@@ -194,30 +338,25 @@ void decompressFromStreamToRange(std::istream &in, CompressionType type, size_t
       }
       if (got == 0) break;
     }
-    ZSTD_freeDCtx(dctx);
     if (produced != size) throw std::runtime_error("ZSTD ranged decode incomplete");
     return;
   } else if (type == CompressionType::Lz4) {
-    LZ4F_decompressionContext_t dctx;
-    size_t const createRes = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
-    if (LZ4F_isError(createRes)) {
-      throw std::runtime_error("LZ4F createDecompressionContext failed");
-    }
-    const size_t inChunk = 1 << 16;
-    std::vector<char> inBuf(inChunk);
-    std::vector<char> outBuf(inChunk * 4);
+    LZ4F_dctx *dctx = context.lz4Decoder();
+    const size_t inChunk = kStreamChunk;
+    const size_t outChunk = kStreamChunk * 4;
+    char *inBuf = context.buffer(CompressionContext::kInputBuffer, inChunk);
+    char *outBuf = context.buffer(CompressionContext::kOutputBuffer, outChunk);
     size_t produced = 0;
     size_t consumedOriginal = 0;
     while (produced < size) {
-      in.read(inBuf.data(), inBuf.size());
+      in.read(inBuf, inChunk);
       size_t srcSize = static_cast<size_t>(in.gcount());
       size_t srcPos = 0;
       while (srcPos < srcSize && produced < size) {
-        size_t dstSize = outBuf.size();
+        size_t dstSize = outChunk;
         size_t srcChunk = srcSize - srcPos;
-        size_t res = LZ4F_decompress(dctx, outBuf.data(), &dstSize, inBuf.data() + srcPos, &srcChunk, nullptr);
+        size_t res = LZ4F_decompress(dctx, outBuf, &dstSize, inBuf + srcPos, &srcChunk, nullptr);
         if (LZ4F_isError(res)) {
-          LZ4F_freeDecompressionContext(dctx);
           throw std::runtime_error("LZ4F decompress error");
         }
         srcPos += srcChunk;
@@ -226,7 +365,7 @@ void decompressFromStreamToRange(std::istream &in, CompressionType type, size_t
         if (needPos < dstSize) {
           size_t start = needPos;
           size_t cp = std::min(dstSize - start, outAvail);
-          std::memcpy(dst + produced, outBuf.data() + start, cp);
+          std::memcpy(dst + produced, outBuf + start, cp);
           produced += cp;
           offset += cp;
         }
@@ -235,7 +374,6 @@ void decompressFromStreamToRange(std::istream &in, CompressionType type, size_t
       }
       if (srcSize == 0) break;
     }
-    LZ4F_freeDecompressionContext(dctx);
     if (produced != size) throw std::runtime_error("LZ4 ranged decode incomplete");
     return;
   }
@@ -0,0 +1,147 @@
+#include "EvictionPolicy.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+EvictionPolicyPtr createEvictionPolicy(EvictionPolicyType type) {
+  switch (type) {
+  case EvictionPolicyType::Fifo:
+    return std::make_unique<FifoEvictionPolicy>();
+  case EvictionPolicyType::Lru:
+    return std::make_unique<LruEvictionPolicy>();
+  case EvictionPolicyType::Clock:
+    return std::make_unique<ClockEvictionPolicy>();
+  case EvictionPolicyType::CostAware:
+    return std::make_unique<CostAwareEvictionPolicy>();
+  }
+  throw std::runtime_error("Unsupported eviction policy");
+}
+
+void FifoEvictionPolicy::add(char *addr, memSize /*size*/) {
+  if (index_.count(addr) == 0) {
+    index_[addr] = order_.insert(order_.end(), addr);
+  }
+}
+
+void FifoEvictionPolicy::remove(char *addr) {
+  auto it = index_.find(addr);
+  if (it != index_.end()) {
+    order_.erase(it->second);
+    index_.erase(it);
+  }
+}
+
+void FifoEvictionPolicy::recordEviction(char *addr) { moveToBack(addr); }
+
+std::vector<char *> FifoEvictionPolicy::victims() {
+  return std::vector<char *>(order_.begin(), order_.end());
+}
+
+void FifoEvictionPolicy::moveToBack(char *addr) {
+  auto it = index_.find(addr);
+  if (it != index_.end()) {
+    order_.splice(order_.end(), order_, it->second);
+  }
+}
+
+void LruEvictionPolicy::recordAccess(char *addr) { moveToBack(addr); }
+
+// Losing pages is not a use of the region.
+void LruEvictionPolicy::recordEviction(char * /*addr*/) {}
+
+void ClockEvictionPolicy::add(char *addr, memSize /*size*/) {
+  if (referenced_.emplace(addr, true).second) {
+    ring_.push_back(addr);
+  }
+}
+
+void ClockEvictionPolicy::remove(char *addr) {
+  if (referenced_.erase(addr) == 0) {
+    return;
+  }
+  auto it = std::find(ring_.begin(), ring_.end(), addr);
+  size_t pos = it - ring_.begin();
+  ring_.erase(it);
+  if (pos < hand_) {
+    hand_--;
+  }
+  if (hand_ >= ring_.size()) {
+    hand_ = 0;
+  }
+}
+
+void ClockEvictionPolicy::recordAccess(char *addr) {
+  auto it = referenced_.find(addr);
+  if (it != referenced_.end()) {
+    it->second = true;
+  }
+}
+
+void ClockEvictionPolicy::recordEviction(char *addr) {
+  auto it = std::find(ring_.begin(), ring_.end(), addr);
+  if (it != ring_.end()) {
+    hand_ = (it - ring_.begin() + 1) % ring_.size();
+  }
+}
+
+std::vector<char *> ClockEvictionPolicy::victims() {
+  // One turn of the hand, referenced regions get their second chance at the
+  // end.
+  std::vector<char *> result, secondChance;
+  for (size_t i = 0; i < ring_.size(); ++i) {
+    char *addr = ring_[(hand_ + i) % ring_.size()];
+    bool &referenced = referenced_[addr];
+    if (referenced) {
+      referenced = false;
+      secondChance.push_back(addr);
+    } else {
+      result.push_back(addr);
+    }
+  }
+  result.insert(result.end(), secondChance.begin(), secondChance.end());
+  return result;
+}
+
+void CostAwareEvictionPolicy::add(char *addr, memSize size) {
+  entries_.emplace(addr, Entry{size, size, false, ++clock_});
+}
+
+void CostAwareEvictionPolicy::remove(char *addr) { entries_.erase(addr); }
+
+void CostAwareEvictionPolicy::recordAccess(char *addr) {
+  auto it = entries_.find(addr);
+  if (it != entries_.end()) {
+    it->second.lastAccess = ++clock_;
+  }
+}
+
+void CostAwareEvictionPolicy::recordSpillFile(char *addr,
+                                              memSize compressedSize) {
+  auto it = entries_.find(addr);
+  if (it != entries_.end()) {
+    it->second.onDisk = true;
+    it->second.compressedSize = compressedSize;
+  }
+}
+
+double CostAwareEvictionPolicy::cost(const Entry &entry) const {
+  double write = entry.onDisk ? 0 : static_cast<double>(entry.size);
+  // A region faulted long ago is less likely to be read back.
+  double age = static_cast<double>(clock_ - entry.lastAccess);
+  return write + static_cast<double>(entry.compressedSize) / (1 + age);
+}
+
+std::vector<char *> CostAwareEvictionPolicy::victims() {
+  std::vector<std::pair<double, char *>> scored;
+  scored.reserve(entries_.size());
+  for (const auto &[addr, entry] : entries_) {
+    scored.emplace_back(cost(entry), addr);
+  }
+  std::sort(scored.begin(), scored.end());
+  std::vector<char *> result;
+  result.reserve(scored.size());
+  for (const auto &[cost, addr] : scored) {
+    result.push_back(addr);
+  }
+  return result;
+}
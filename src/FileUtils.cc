@@ -1,6 +1,7 @@
 #include "FileUtils.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
@@ -16,53 +17,325 @@
 
 #include "Compression.h"
 
-static constexpr uint32_t kMagic = 0x53554C46;
-static constexpr uint16_t kVersion = 1;
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void readStream(std::ifstream &file, const FileMeta &meta,
+                       int64_t offset, char *addr, memSize size) {
+  auto method = static_cast<CompressionType>(meta.method);
+  if (method == CompressionType::None) {
+    file.seekg(static_cast<std::streamoff>(sizeof(meta)) + offset);
+    file.read(static_cast<char *>(addr), size);
+    if (!file.good()) {
+      throw std::runtime_error("Encounter error for reading file.");
+    }
+  } else {
+    file.seekg(static_cast<std::streamoff>(sizeof(meta)));
+    decompressFromStreamToRange(file, method, meta.originalSize, offset, addr,
+                                size);
+  }
+}
+
+static void readFramed(std::ifstream &file, const FileMeta &meta,
+                       int64_t offset, char *addr, memSize size) {
+  FrameFooter footer;
+  file.seekg(-static_cast<std::streamoff>(sizeof(footer)), std::ios::end);
+  file.read(reinterpret_cast<char *>(&footer), sizeof(footer));
+  if (!file.good() || footer.magic != kSpillFileMagic ||
+      footer.frameSize == 0) {
+    throw std::runtime_error("Encounter bad frame index when reading.");
+  }
+
+  if (size == 0) {
+    return;
+  }
+  uint64_t first = static_cast<uint64_t>(offset) / footer.frameSize;
+  uint64_t last = (static_cast<uint64_t>(offset) + size - 1) / footer.frameSize;
+  if (last >= footer.frameCount) {
+    throw std::runtime_error("Encounter bad frame index when reading.");
+  }
+
+  // Only the entries for the frames we need are loaded.
+  std::vector<FrameEntry> entries(last - first + 1);
+  auto indexPos = static_cast<std::streamoff>(
+      sizeof(meta) + meta.compressedSize + first * sizeof(FrameEntry));
+  file.seekg(indexPos);
+  file.read(reinterpret_cast<char *>(entries.data()),
+            entries.size() * sizeof(FrameEntry));
+  if (!file.good()) {
+    throw std::runtime_error("Encounter error for reading frame index.");
+  }
+
+  auto &ctx = CompressionContext::local();
+  memSize produced = 0;
+  for (uint64_t i = first; i <= last; ++i) {
+    const FrameEntry &entry = entries[i - first];
+    uint64_t frameStart = i * footer.frameSize;
+    memSize frameLen =
+        std::min<uint64_t>(footer.frameSize, meta.originalSize - frameStart);
+    uint64_t from = std::max<uint64_t>(offset, frameStart) - frameStart;
+    memSize cp = std::min<memSize>(frameLen - from, size - produced);
+
+    char *compressed =
+        ctx.buffer(CompressionContext::kInputBuffer, entry.compressedSize);
+    file.seekg(static_cast<std::streamoff>(entry.offset));
+    file.read(compressed, entry.compressedSize);
+    if (!file.good()) {
+      throw std::runtime_error("Encounter error for reading file.");
+    }
+
+    FileUtils::decodeFrame(entry, compressed, frameLen, from, addr + produced,
+                           cp, ctx);
+    produced += cp;
+  }
+}
+
+static uint64_t nanosSince(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - begin)
+      .count();
+}
+
+const char *FileUtils::encodeFrame(const char *src, memSize size, char *dst,
+                                   memSize capacity, CompressionType type,
+                                   FrameEntry &entry, CompressionContext &ctx,
+                                   Statistics *stats) {
+  int level = kDefaultZstdLevel;
+  if (type == CompressionType::Adaptive) {
+    auto begin = std::chrono::steady_clock::now();
+    CodecChoice choice = chooseCodec(src, size, ctx);
+    type = choice.type;
+    level = choice.level;
+    if (stats != nullptr) {
+      stats->codecSelectNanos.fetch_add(nanosSince(begin),
+                                        std::memory_order_relaxed);
+    }
+  }
+  entry.compressedSize = static_cast<uint32_t>(size);
+  entry.method = static_cast<uint16_t>(CompressionType::None);
+  entry.level = 0;
+  const char *out = src;
+  auto begin = std::chrono::steady_clock::now();
+  if (type != CompressionType::None) {
+    memSize compressed = ctx.compress(src, size, dst, capacity, type, level);
+    if (compressed < size) {
+      entry.compressedSize = static_cast<uint32_t>(compressed);
+      entry.method = static_cast<uint16_t>(type);
+      entry.level =
+          type == CompressionType::Zstd ? static_cast<uint16_t>(level) : 0;
+      out = dst;
+    }
+  }
+  if (stats != nullptr) {
+    uint64_t nanos = type == CompressionType::None ? 0 : nanosSince(begin);
+    stats->recordCompression(type, size, entry.compressedSize, nanos);
+  }
+  return out;
+}
+
+void FileUtils::decodeFrame(const FrameEntry &entry, const char *compressed,
+                            memSize frameLen, memSize from, char *dst,
+                            memSize size, CompressionContext &ctx,
+                            Statistics *stats) {
+  auto method = static_cast<CompressionType>(entry.method);
+  if (method == CompressionType::None) {
+    if (entry.compressedSize != frameLen) {
+      throw std::runtime_error("Encounter bad raw frame when reading.");
+    }
+    std::memcpy(dst, compressed + from, size);
+    return;
+  }
+  char *out = dst;
+  if (from != 0 || size != frameLen) {
+    out = ctx.buffer(CompressionContext::kFrameBuffer, frameLen);
+  }
+  auto begin = std::chrono::steady_clock::now();
+  ctx.decompress(compressed, entry.compressedSize, out, frameLen, method);
+  if (stats != nullptr) {
+    stats->codecDecompressNanos[method].fetch_add(nanosSince(begin),
+                                                  std::memory_order_relaxed);
+  }
+  if (out != dst) {
+    std::memcpy(dst, out + from, size);
+  }
+}
+
+SpillFile::~SpillFile() {
+  if (!ownsFds) {
+    return;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (directFd >= 0) {
+    close(directFd);
+  }
+}
+
+static void preadFully(int fd, char *dst, memSize size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t n = pread(fd, dst, size, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("Encounter error for reading file.");
+    }
+    dst += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+// Loads the meta, footer and frame index of the spill file stored in
+// [file.base, file.base + length).
+static void loadIndex(SpillFile &file, memSize length) {
+  if (length < sizeof(FileMeta) + sizeof(FrameFooter)) {
+    throw std::runtime_error("Encounter bad spill file when reading.");
+  }
+  preadFully(file.fd, reinterpret_cast<char *>(&file.meta), sizeof(file.meta),
+             file.base);
+  if (file.meta.magic != kSpillFileMagic ||
+      file.meta.version != kSpillFileFramedVersion) {
+    throw std::runtime_error("Only framed spill files can be kept open.");
+  }
+  preadFully(file.fd, reinterpret_cast<char *>(&file.footer),
+             sizeof(file.footer), file.base + length - sizeof(FrameFooter));
+  if (file.footer.magic != kSpillFileMagic || file.footer.frameSize == 0) {
+    throw std::runtime_error("Encounter bad frame index when reading.");
+  }
+  file.entries.resize(file.footer.frameCount);
+  preadFully(file.fd, reinterpret_cast<char *>(file.entries.data()),
+             file.entries.size() * sizeof(FrameEntry),
+             file.base + sizeof(file.meta) + file.meta.compressedSize);
+}
+
+SpillFilePtr FileUtils::open(const std::string &fileName, bool direct) {
+  auto file = std::make_shared<SpillFile>();
+  file->fileName = fileName;
+  file->fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file->fd < 0) {
+    throw std::runtime_error("Can't open " + fileName + " for read.");
+  }
+  struct stat st;
+  if (fstat(file->fd, &st) != 0) {
+    throw std::runtime_error("Encounter bad spill file when reading.");
+  }
+  loadIndex(*file, st.st_size);
+  if (direct) {
+    // Not every filesystem supports O_DIRECT, buffered reads still work.
+    file->directFd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+  }
+  return file;
+}
+
+SpillFilePtr FileUtils::open(const std::string &name, int fd, int directFd,
+                             uint64_t base, memSize length) {
+  auto file = std::make_shared<SpillFile>();
+  file->fileName = name;
+  file->fd = fd;
+  file->directFd = directFd;
+  file->base = base;
+  file->ownsFds = false;
+  loadIndex(*file, length);
+  return file;
+}
+
+memSize FileUtils::maxFramedSize(memSize size, memSize frameSize) {
+  memSize frames = (size + frameSize - 1) / frameSize;
+  memSize bound = std::max<memSize>(
+      {frameSize, compressBound(frameSize, CompressionType::Zstd),
+       compressBound(frameSize, CompressionType::Lz4)});
+  return sizeof(FileMeta) + frames * (bound + sizeof(FrameEntry)) +
+         sizeof(FrameFooter);
+}
+
+void FileUtils::read(const SpillFile &file, int64_t offset, char *addr,
+                     memSize size, CompressionContext &ctx) {
+  if (static_cast<uint64_t>(offset) + size > file.meta.originalSize) {
+    throw std::runtime_error("Read range exceeds original size");
+  }
+  if (size == 0) {
+    return;
+  }
+  uint64_t first = static_cast<uint64_t>(offset) / file.footer.frameSize;
+  uint64_t last =
+      (static_cast<uint64_t>(offset) + size - 1) / file.footer.frameSize;
+  memSize produced = 0;
+  for (uint64_t i = first; i <= last; ++i) {
+    const FrameEntry &entry = file.entries[i];
+    uint64_t frameStart = i * file.footer.frameSize;
+    memSize frameLen = file.frameLength(i);
+    uint64_t from = std::max<uint64_t>(offset, frameStart) - frameStart;
+    memSize cp = std::min<memSize>(frameLen - from, size - produced);
+    char *compressed =
+        ctx.buffer(CompressionContext::kInputBuffer, entry.compressedSize);
+    preadFully(file.fd, compressed, entry.compressedSize,
+               file.base + entry.offset);
+    decodeFrame(entry, compressed, frameLen, from, addr + produced, cp, ctx);
+    produced += cp;
+  }
+}
 
 std::string FileUtils::write(const std::string &fileName, char *addr,
-                             memSize size, CompressionType type) {
+                             memSize size, CompressionType type,
+                             memSize frameSize) {
+  if (type != CompressionType::None && type != CompressionType::Zstd &&
+      type != CompressionType::Lz4 && type != CompressionType::Adaptive) {
+    throw std::runtime_error("Unsupported compression type");
+  }
+  if (frameSize == 0) {
+    throw std::runtime_error("Frame size must be positive");
+  }
+
   std::ofstream file(fileName, std::ios::binary);
   if (!file.is_open()) {
     throw std::runtime_error("Can't open " + fileName + " for write.");
   }
 
   FileMeta meta;
-  meta.magic = kMagic;
-  meta.version = kVersion;
+  meta.magic = kSpillFileMagic;
+  meta.version = kSpillFileFramedVersion;
   meta.method = static_cast<uint16_t>(type);
   meta.originalSize = size;
+  meta.compressedSize = 0;
+  // Placeholder meta, rewritten once the frames are out.
+  file.write(reinterpret_cast<const char *>(&meta), sizeof(meta));
+  if (!file.good()) {
+    throw std::runtime_error("Encounter error for writing file.");
+  }
 
-  if (type == CompressionType::None) {
-    meta.compressedSize = size;
-    file.write(reinterpret_cast<const char *>(&meta), sizeof(meta));
-    if (!file.good()) {
-      throw std::runtime_error("Encounter error for writing file.");
-    }
-    file.write(static_cast<const char *>(addr), size);
-    if (!file.good()) {
-      throw std::runtime_error("Encounter error for writing file.");
-    }
-  } else if (type == CompressionType::Zstd || type == CompressionType::Lz4) {
-    // Write placeholder meta, then stream-compress to file, then update meta with compressed size
-    meta.compressedSize = 0;
-    file.write(reinterpret_cast<const char *>(&meta), sizeof(meta));
+  auto &ctx = CompressionContext::local();
+  memSize bound = compressBound(frameSize, type);
+  std::vector<FrameEntry> entries;
+  entries.reserve(size / frameSize + 1);
+  uint64_t pos = sizeof(meta);
+  for (memSize start = 0; start < size; start += frameSize) {
+    memSize frameLen = std::min(frameSize, size - start);
+    FrameEntry entry{pos, static_cast<uint32_t>(frameLen),
+                     static_cast<uint16_t>(CompressionType::None), 0};
+    char *buffer = ctx.buffer(CompressionContext::kOutputBuffer, bound);
+    const char *data =
+        encodeFrame(addr + start, frameLen, buffer, bound, type, entry, ctx);
+    file.write(data, entry.compressedSize);
     if (!file.good()) {
       throw std::runtime_error("Encounter error for writing file.");
     }
-    auto startPos = file.tellp();
-    compressToStream(addr, size, type, file);
-    auto endPos = file.tellp();
-    if (startPos == std::ostream::pos_type(-1) || endPos == std::ostream::pos_type(-1)) {
-      throw std::runtime_error("Encounter error for computing compressed size.");
-    }
-    meta.compressedSize = static_cast<uint64_t>(endPos - startPos);
-    file.seekp(0);
-    file.write(reinterpret_cast<const char *>(&meta), sizeof(meta));
-    if (!file.good()) {
-      throw std::runtime_error("Encounter error for writing file meta.");
-    }
-  } else {
-    throw std::runtime_error("Unsupported compression type");
+    pos += entry.compressedSize;
+    entries.push_back(entry);
+  }
+  meta.compressedSize = pos - sizeof(meta);
+
+  FrameFooter footer{frameSize, entries.size(), kSpillFileMagic, 0};
+  file.write(reinterpret_cast<const char *>(entries.data()),
+             entries.size() * sizeof(FrameEntry));
+  file.write(reinterpret_cast<const char *>(&footer), sizeof(footer));
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&meta), sizeof(meta));
+  if (!file.good()) {
+    throw std::runtime_error("Encounter error for writing file meta.");
   }
 
   file.close();
@@ -81,7 +354,7 @@ void FileUtils::read(std::string &fileName, int64_t offset, char *addr,
     throw std::runtime_error("Encounter error for reading file.");
   }
 
-  if (meta.magic != kMagic || meta.version == 0) {
+  if (meta.magic != kSpillFileMagic || meta.version == 0) {
     throw std::runtime_error("Encounter bad spill file when reading.");
   }
 
@@ -90,17 +363,13 @@ void FileUtils::read(std::string &fileName, int64_t offset, char *addr,
     throw std::runtime_error("Read range exceeds original size");
   }
 
-  auto method = static_cast<CompressionType>(meta.method);
-  if (method == CompressionType::None) {
-    file.seekg(static_cast<std::streamoff>(sizeof(meta)) + offset);
-    file.read(static_cast<char *>(addr), size);
-    if (!file.good()) {
-      throw std::runtime_error("Encounter error for reading file.");
-    }
+  if (meta.version == kSpillFileStreamVersion) {
+    readStream(file, meta, offset, addr, size);
+  } else if (meta.version == kSpillFileFramedVersion) {
+    readFramed(file, meta, offset, addr, size);
   } else {
-    file.seekg(static_cast<std::streamoff>(sizeof(meta)));
-    decompressFromStreamToRange(file, method, meta.originalSize, offset, addr,
-                                size);
+    throw std::runtime_error("Unsupported spill file version " +
+                             std::to_string(meta.version));
   }
 
   file.close();
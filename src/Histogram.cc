@@ -0,0 +1,105 @@
+#include "Histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr uint64_t kSubBuckets = 1ULL << Histogram::kSubBucketBits;
+
+// The shard of the calling thread, handed out round robin on first use.
+static size_t threadShard() {
+  static std::atomic<size_t> next{0};
+  thread_local size_t shard =
+      next.fetch_add(1, std::memory_order_relaxed) % Histogram::kShards;
+  return shard;
+}
+
+uint64_t HistogramSnapshot::percentile(double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  q = std::clamp(q, 0.0, 1.0);
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return std::min(Histogram::bucketHigh(i), max);
+    }
+  }
+  return max;
+}
+
+double HistogramSnapshot::mean() const {
+  return count == 0 ? 0.0 : static_cast<double>(sum) / count;
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot &other) {
+  if (counts.size() < other.counts.size()) {
+    counts.resize(other.counts.size(), 0);
+  }
+  for (size_t i = 0; i < other.counts.size(); ++i) {
+    counts[i] += other.counts[i];
+  }
+  count += other.count;
+  sum += other.sum;
+  max = std::max(max, other.max);
+}
+
+Histogram::Histogram() : shards_(new Shard[kShards]) {}
+
+Histogram::~Histogram() = default;
+
+void Histogram::record(uint64_t value) {
+  value = std::min(value, kMaxValue);
+  Shard &shard = shards_[threadShard()];
+  shard.counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  shard.count.fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = shard.max.load(std::memory_order_relaxed);
+  while (value > max && !shard.max.compare_exchange_weak(
+                            max, value, std::memory_order_relaxed)) {
+  }
+}
+
+HistogramSnapshot Histogram::snapshot() const {
+  HistogramSnapshot result;
+  result.counts.assign(kBucketCount, 0);
+  for (size_t s = 0; s < kShards; ++s) {
+    const Shard &shard = shards_[s];
+    for (size_t i = 0; i < kBucketCount; ++i) {
+      result.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+    }
+    result.count += shard.count.load(std::memory_order_relaxed);
+    result.sum += shard.sum.load(std::memory_order_relaxed);
+    result.max =
+        std::max(result.max, shard.max.load(std::memory_order_relaxed));
+  }
+  return result;
+}
+
+size_t Histogram::bucketOf(uint64_t value) {
+  value = std::min(value, kMaxValue);
+  if (value < 2 * kSubBuckets) {
+    return value;
+  }
+  // The top kSubBucketBits + 1 bits of the value pick the bucket.
+  int shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+  return shift * kSubBuckets + (value >> shift);
+}
+
+uint64_t Histogram::bucketLow(size_t bucket) {
+  if (bucket < 2 * kSubBuckets) {
+    return bucket;
+  }
+  int shift = bucket / kSubBuckets - 1;
+  return (bucket % kSubBuckets + kSubBuckets) << shift;
+}
+
+uint64_t Histogram::bucketHigh(size_t bucket) {
+  if (bucket < 2 * kSubBuckets) {
+    return bucket;
+  }
+  int shift = bucket / kSubBuckets - 1;
+  return bucketLow(bucket) + (1ULL << shift) - 1;
+}
@@ -0,0 +1,166 @@
+#include "MemRegions.h"
+
+#include <thread>
+#include <utility>
+
+struct MemRegions::Node {
+  MemRegion region;
+  uint64_t priority;
+  NodePtr left, right;
+};
+
+// Mixes the start address into a treap priority, equal inputs give equal
+// trees.
+static uint64_t priorityOf(char *start) {
+  uint64_t x = reinterpret_cast<uint64_t>(start);
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+MemRegions::MemRegions() : published_(nullptr), count_(0), epoch_(0) {
+  readers_[0] = 0;
+  readers_[1] = 0;
+}
+
+MemRegions::~MemRegions() = default;
+
+void MemRegions::add(char *addr, memSize size, memSize pageSize) {
+  std::lock_guard<std::mutex> guard(writeMutex_);
+  publish(insert(root_, {addr, size, pageSize}, priorityOf(addr)));
+  count_++;
+}
+
+MemRegion MemRegions::find(char *addr) const {
+  uint64_t parity = epoch_.load() & 1;
+  readers_[parity].fetch_add(1);
+  const Node *node = floor(published_.load(), addr);
+  bool found =
+      node != nullptr && addr < node->region.start + node->region.size;
+  MemRegion region = found ? node->region : MemRegion{};
+  readers_[parity].fetch_sub(1);
+  if (!found) {
+    throw std::runtime_error("Can't find start address");
+  }
+  return region;
+}
+
+bool MemRegions::remove(char *addr) {
+  std::lock_guard<std::mutex> guard(writeMutex_);
+  const Node *node = floor(root_.get(), addr);
+  if (node == nullptr || addr >= node->region.start + node->region.size) {
+    return false;
+  }
+  publish(erase(root_, node->region.start));
+  count_--;
+  return true;
+}
+
+size_t MemRegions::size() const {
+  std::lock_guard<std::mutex> guard(writeMutex_);
+  return count_;
+}
+
+MemRegions::NodePtr MemRegions::insert(const NodePtr &node,
+                                       const MemRegion &region,
+                                       uint64_t priority) {
+  if (node == nullptr || priority > node->priority) {
+    auto [left, right] = split(node, region.start);
+    return std::make_shared<const Node>(Node{region, priority, left, right});
+  }
+  if (region.start < node->region.start) {
+    return std::make_shared<const Node>(
+        Node{node->region, node->priority,
+             insert(node->left, region, priority), node->right});
+  }
+  return std::make_shared<const Node>(
+      Node{node->region, node->priority, node->left,
+           insert(node->right, region, priority)});
+}
+
+MemRegions::NodePtr MemRegions::erase(const NodePtr &node, char *start) {
+  if (node == nullptr) {
+    return nullptr;
+  }
+  if (node->region.start == start) {
+    return merge(node->left, node->right);
+  }
+  if (start < node->region.start) {
+    return std::make_shared<const Node>(Node{
+        node->region, node->priority, erase(node->left, start), node->right});
+  }
+  return std::make_shared<const Node>(Node{node->region, node->priority,
+                                           node->left,
+                                           erase(node->right, start)});
+}
+
+std::pair<MemRegions::NodePtr, MemRegions::NodePtr>
+MemRegions::split(const NodePtr &node, char *start) {
+  if (node == nullptr) {
+    return {nullptr, nullptr};
+  }
+  if (node->region.start < start) {
+    auto [left, right] = split(node->right, start);
+    return {std::make_shared<const Node>(
+                Node{node->region, node->priority, node->left, left}),
+            right};
+  }
+  auto [left, right] = split(node->left, start);
+  return {left, std::make_shared<const Node>(
+                    Node{node->region, node->priority, right, node->right})};
+}
+
+MemRegions::NodePtr MemRegions::merge(const NodePtr &left,
+                                      const NodePtr &right) {
+  if (left == nullptr) {
+    return right;
+  }
+  if (right == nullptr) {
+    return left;
+  }
+  if (left->priority > right->priority) {
+    return std::make_shared<const Node>(Node{left->region, left->priority,
+                                             left->left,
+                                             merge(left->right, right)});
+  }
+  return std::make_shared<const Node>(Node{right->region, right->priority,
+                                           merge(left, right->left),
+                                           right->right});
+}
+
+const MemRegions::Node *MemRegions::floor(const Node *node, char *addr) {
+  const Node *best = nullptr;
+  while (node != nullptr) {
+    if (node->region.start <= addr) {
+      best = node;
+      node = node->right.get();
+    } else {
+      node = node->left.get();
+    }
+  }
+  return best;
+}
+
+void MemRegions::publish(NodePtr root) {
+  NodePtr old = std::move(root_);
+  root_ = std::move(root);
+  published_.store(root_.get());
+  synchronize();
+  // Nodes only the old tree referenced are freed here.
+  old.reset();
+}
+
+void MemRegions::synchronize() {
+  // Lookups that read the new epoch are ordered after the store of the new
+  // root and see it. One that read the old epoch may register late, on a
+  // parity the previous update already waited for, and still see the root
+  // before this one, so both parities are flipped and drained. All
+  // operations are sequentially consistent for this argument to hold.
+  for (int phase = 0; phase < 2; ++phase) {
+    uint64_t parity = epoch_.fetch_add(1) & 1;
+    while (readers_[parity].load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+}
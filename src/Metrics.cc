@@ -0,0 +1,177 @@
+#include "Metrics.h"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+static constexpr struct {
+  double q;
+  const char *prometheus;
+  const char *json;
+} kQuantiles[] = {{0.5, "0.5", "p50"},
+                  {0.9, "0.9", "p90"},
+                  {0.99, "0.99", "p99"},
+                  {0.999, "0.999", "p999"}};
+
+// Integers print in full, anything else with 9 significant digits.
+static std::string formatValue(double value) {
+  if (std::isnan(value)) {
+    return "NaN";
+  }
+  char buf[32];
+  if (value == std::floor(value) && std::fabs(value) < 1e15) {
+    snprintf(buf, sizeof(buf), "%.0f", value);
+  } else {
+    snprintf(buf, sizeof(buf), "%.9g", value);
+  }
+  return buf;
+}
+
+// Prometheus escapes backslash and newline in help, and quotes as well in
+// label values. JSON needs the same plus the other control characters.
+static std::string escape(const std::string &s, bool quotes) {
+  std::string result;
+  for (char c : s) {
+    if (c == '\\' || (quotes && c == '"')) {
+      result += '\\';
+      result += c;
+    } else if (c == '\n') {
+      result += "\\n";
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+static std::string jsonString(const std::string &s) {
+  std::string result = "\"";
+  for (char c : escape(s, true)) {
+    if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      result += buf;
+    } else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+// JSON has no NaN.
+static std::string jsonNumber(double value) {
+  return std::isfinite(value) ? formatValue(value) : "null";
+}
+
+void MetricsSnapshot::addCounter(const std::string &name,
+                                 const std::string &help, double value,
+                                 const Label &label) {
+  add(name, help, "counter", value, label);
+}
+
+void MetricsSnapshot::addGauge(const std::string &name,
+                               const std::string &help, double value,
+                               const Label &label) {
+  add(name, help, "gauge", value, label);
+}
+
+void MetricsSnapshot::addHistogram(const std::string &name,
+                                   const std::string &help,
+                                   HistogramSnapshot histogram, double scale) {
+  summaries_.push_back({name, help, std::move(histogram), scale});
+}
+
+void MetricsSnapshot::add(const std::string &name, const std::string &help,
+                          const char *type, double value, const Label &label) {
+  samples_.push_back({name, help, type, label, value});
+}
+
+double MetricsSnapshot::value(const std::string &name,
+                              const std::string &label) const {
+  for (const auto &sample : samples_) {
+    if (sample.name == name && sample.label.value == label) {
+      return sample.value;
+    }
+  }
+  return std::numeric_limits<double>::quiet_NaN();
+}
+
+const HistogramSnapshot *
+MetricsSnapshot::histogram(const std::string &name) const {
+  for (const auto &summary : summaries_) {
+    if (summary.name == name) {
+      return &summary.histogram;
+    }
+  }
+  return nullptr;
+}
+
+std::string MetricsSnapshot::toPrometheus() const {
+  std::string out;
+  for (size_t i = 0; i < samples_.size(); ++i) {
+    const Sample &sample = samples_[i];
+    if (i == 0 || samples_[i - 1].name != sample.name) {
+      out += "# HELP " + sample.name + " " + escape(sample.help, false) + "\n";
+      out += "# TYPE " + sample.name + " " + sample.type + "\n";
+    }
+    out += sample.name;
+    if (!sample.label.name.empty()) {
+      out += "{" + sample.label.name + "=\"" +
+             escape(sample.label.value, true) + "\"}";
+    }
+    out += " " + formatValue(sample.value) + "\n";
+  }
+  for (const auto &summary : summaries_) {
+    const HistogramSnapshot &h = summary.histogram;
+    out += "# HELP " + summary.name + " " + escape(summary.help, false) + "\n";
+    out += "# TYPE " + summary.name + " summary\n";
+    for (const auto &quantile : kQuantiles) {
+      out += summary.name + "{quantile=\"" + quantile.prometheus + "\"} " +
+             formatValue(h.percentile(quantile.q) * summary.scale) + "\n";
+    }
+    out += summary.name + "_sum " + formatValue(h.sum * summary.scale) + "\n";
+    out += summary.name + "_count " + formatValue(h.count) + "\n";
+  }
+  return out;
+}
+
+std::string MetricsSnapshot::toJson() const {
+  std::string out = "{";
+  bool first = true;
+  for (size_t i = 0; i < samples_.size(); ++i) {
+    const Sample &sample = samples_[i];
+    bool labelled = !sample.label.name.empty();
+    bool opens = i == 0 || samples_[i - 1].name != sample.name;
+    bool closes =
+        i + 1 == samples_.size() || samples_[i + 1].name != sample.name;
+    if (opens) {
+      out += first ? "" : ",";
+      out += jsonString(sample.name) + ":";
+      out += labelled ? "{" : "";
+      first = false;
+    } else {
+      out += ",";
+    }
+    if (labelled) {
+      out += jsonString(sample.label.value) + ":";
+    }
+    out += jsonNumber(sample.value);
+    if (closes && labelled) {
+      out += "}";
+    }
+  }
+  for (const auto &summary : summaries_) {
+    const HistogramSnapshot &h = summary.histogram;
+    out += first ? "" : ",";
+    first = false;
+    out += jsonString(summary.name) + ":{\"count\":" + jsonNumber(h.count) +
+           ",\"sum\":" + jsonNumber(h.sum * summary.scale) +
+           ",\"max\":" + jsonNumber(h.max * summary.scale);
+    for (const auto &quantile : kQuantiles) {
+      out += std::string(",\"") + quantile.json +
+             "\":" + jsonNumber(h.percentile(quantile.q) * summary.scale);
+    }
+    out += "}";
+  }
+  return out + "}";
+}
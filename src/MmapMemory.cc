@@ -1,16 +1,21 @@
 #include "MmapMemory.h"
 #include <cstring>
 #include <stdexcept>
+#include <string>
 #include <sys/mman.h>
 
-MmapMemory::MmapMemory(memSize size) {
+MmapMemory::MmapMemory(memSize size, memSize pageSize) {
+  if (!isValidPageSize(pageSize)) {
+    throw std::runtime_error("invalid page size " + std::to_string(pageSize));
+  }
   requestSize_ = size;
-  size_ = ((size / kPageSize) + (size % kPageSize == 0 ? 0 : 1)) * kPageSize;
+  pageSize_ = pageSize;
+  size_ = ((size / pageSize) + (size % pageSize == 0 ? 0 : 1)) * pageSize;
   ptr_ = nullptr;
 }
 
-MmapMemory::MmapMemory(char *addr, memSize size)
-    : ptr_(addr), size_(size), requestSize_(size) {}
+MmapMemory::MmapMemory(char *addr, memSize size, memSize pageSize)
+    : size_(size), requestSize_(size), pageSize_(pageSize), ptr_(addr) {}
 
 char *MmapMemory::address() {
   if (ptr_ == nullptr) {
@@ -28,6 +33,8 @@ memSize MmapMemory::size() { return size_; }
 
 memSize MmapMemory::requestSize() { return requestSize_; }
 
+memSize MmapMemory::pageSize() { return pageSize_; }
+
 MmapMemory::~MmapMemory() {
   if (ptr_ != nullptr) {
     munmap(ptr_, size_);
@@ -1,7 +1,9 @@
 #include "PageFaultHandler.h"
 #include "Spiller.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cstring>
 #include <fcntl.h>
@@ -14,9 +16,13 @@
 #include <thread>
 #include <unistd.h>
 
-PageFaultHandler::PageFaultHandler(SpillerPtr spiller)
+// Consecutive page faults after which a region counts as sequential.
+static constexpr uint32_t kSequentialRun = 2;
+
+PageFaultHandler::PageFaultHandler(SpillerPtr spiller, uint32_t ioDepth,
+                                   uint32_t threads, uint32_t prefetchDepth)
     : userFaultFd_(-1), stopEventFd_(-1), spiller_(spiller),
-      buffer_(std::make_shared<Buffer>(kPageSize)) {
+      prefetchDepth_(prefetchDepth) {
   userFaultFd_ = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
   if (userFaultFd_ < 0) {
     throw std::runtime_error("create userfaultfd failed!");
@@ -25,28 +31,59 @@ PageFaultHandler::PageFaultHandler(SpillerPtr spiller)
   if (stopEventFd_ < 0) {
     throw std::runtime_error("create eventfd failed!");
   }
-  uffdio_api api = {.api = UFFD_API, .features = 0};
+  uffdio_api api = {.api = UFFD_API,
+                    .features = UFFD_FEATURE_PAGEFAULT_FLAG_WP};
   if (ioctl(userFaultFd_, UFFDIO_API, &api) < 0) {
     throw std::runtime_error("setting API failed!");
   }
-  std::atomic<bool> hasStarted{false};
-  handlerThread_ = std::thread([this, &hasStarted]() {
-    hasStarted.store(true, std::memory_order_release);
-    loop();
-  });
-  while (!hasStarted.load(std::memory_order_acquire)) {
+  threads = std::max<uint32_t>(threads, 1);
+  ioDepth = std::max<uint32_t>(ioDepth, 1);
+  for (uint32_t t = 0; t < threads; ++t) {
+    auto worker = std::make_unique<Worker>();
+    worker->reader =
+        std::make_unique<AsyncSpillReader>(ioDepth,
+                                           kDefaultRegisteredFrameSize,
+                                           &stats_, &latency_);
+    // Started at the smallest page, each one grows to the pages it stages.
+    for (uint32_t i = 0; i < ioDepth + prefetchDepth_; ++i) {
+      worker->buffers.push_back(std::make_shared<Buffer>(kMinPageSize));
+      worker->freeBuffers.push_back(i);
+    }
+    worker->msgs.resize(ioDepth);
+    workers_.push_back(std::move(worker));
+  }
+  std::atomic<uint32_t> started{0};
+  for (auto &worker : workers_) {
+    Worker *w = worker.get();
+    w->thread = std::thread([this, w, &started]() {
+      started.fetch_add(1, std::memory_order_release);
+      loop(*w);
+    });
+  }
+  while (started.load(std::memory_order_acquire) < threads) {
     std::this_thread::yield();
   }
-  LOG(INFO) << "pagefault handler init userfaultfd=" << userFaultFd_;
+  int fd = userFaultFd_;
+  spiller_->setWriteProtector([fd](char *addr, memSize size, bool protect) {
+    uffdio_writeprotect wp = {
+        .range = {.start = (uint64_t)addr, .len = size},
+        .mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0};
+    return ioctl(fd, UFFDIO_WRITEPROTECT, &wp) == 0;
+  });
+  LOG(INFO) << "pagefault handler init userfaultfd=" << userFaultFd_
+            << " threads=" << threads;
 }
 
 PageFaultHandler::~PageFaultHandler() {
+  spiller_->setWriteProtector(nullptr);
   uint64_t v = 1;
   if (stopEventFd_ >= 0) {
     [[maybe_unused]] ssize_t w = write(stopEventFd_, &v, sizeof(v));
   }
-  if (handlerThread_.joinable()) {
-    handlerThread_.join();
+  for (auto &worker : workers_) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
+    }
   }
   if (userFaultFd_ >= 0) {
     close(userFaultFd_);
@@ -61,11 +98,12 @@ void PageFaultHandler::registerMemory(MmapMemoryPtr &mem) {
   char *addr = mem->address();
   memSize size = mem->size();
   uffdio_register reg = {.range = {.start = (uint64_t)addr, .len = size},
-                         .mode = UFFDIO_REGISTER_MODE_MISSING};
+                         .mode = UFFDIO_REGISTER_MODE_MISSING |
+                                 UFFDIO_REGISTER_MODE_WP};
   if (ioctl(userFaultFd_, UFFDIO_REGISTER, &reg) < 0) {
     throw std::runtime_error("register memory address failed!");
   }
-  regions_.add(addr, size);
+  regions_.add(addr, size, mem->pageSize());
   LOG(INFO) << "pagefault register range start=" << (uint64_t)addr
             << " size=" << size;
 }
@@ -78,48 +116,235 @@ bool PageFaultHandler::unregisterMemory(char *addr, memSize size) {
   //   throw std::runtime_error("unregister memory address failed!");
   // }
   bool removed = regions_.remove(addr);
+  {
+    std::lock_guard<std::mutex> guard(streamsMutex_);
+    auto it = streams_.find(addr);
+    if (it != streams_.end()) {
+      stats_.prefetchWastedCount.fetch_add(
+          it->second.prefetchEnd - it->second.prefetchStart,
+          std::memory_order_relaxed);
+      streams_.erase(it);
+    }
+  }
   LOG(INFO) << "pagefault unregister range start=" << (uint64_t)addr
             << " size=" << size;
   return true;
 }
 
-void PageFaultHandler::loop() {
+void PageFaultHandler::loop(Worker &worker) {
   while (true) {
-    pollfd pfds[2] = {{.fd = userFaultFd_, .events = POLLIN, .revents = 0},
-                      {.fd = stopEventFd_, .events = POLLIN, .revents = 0}};
-    int ret = poll(pfds, 2, -1);
+    // Stop taking faults while every staging buffer waits on a read.
+    pollfd pfds[3] = {
+        {.fd = worker.freeBuffers.empty() ? -1 : userFaultFd_,
+         .events = POLLIN,
+         .revents = 0},
+        {.fd = stopEventFd_, .events = POLLIN, .revents = 0},
+        {.fd = worker.reader->eventFd(), .events = POLLIN, .revents = 0}};
+    int ret = poll(pfds, 3, -1);
     if (ret > 0) {
       if (pfds[1].revents & POLLIN) {
-        uint64_t v;
-        [[maybe_unused]] ssize_t r = read(stopEventFd_, &v, sizeof(v));
+        // The stop event is left readable so that every thread sees it.
+        worker.reader->drain();
         LOG(INFO) << "pagefault handler stopping";
         break;
       }
+      if (pfds[2].revents & POLLIN) {
+        worker.reader->poll(false);
+      }
       if (pfds[0].revents & POLLIN) {
-        handleEvent();
+        handleEvents(worker);
       }
     }
   }
 }
 
-void PageFaultHandler::handleEvent() {
-  uffd_msg msg;
-  if (read(userFaultFd_, &msg, sizeof(msg)) != sizeof(msg)) {
+void PageFaultHandler::handleEvents(Worker &worker) {
+  uffd_msg *msgs = worker.msgs.data();
+  size_t batch =
+      std::min<size_t>(worker.freeBuffers.size(), worker.msgs.size());
+  // Another thread may have taken the messages, the fd is non-blocking.
+  ssize_t n = read(userFaultFd_, msgs, batch * sizeof(uffd_msg));
+  if (n <= 0) {
     return;
   }
-  if (msg.event == UFFD_EVENT_PAGEFAULT) {
-    char *addr = reinterpret_cast<char *>(msg.arg.pagefault.address);
-    stats_.pageFaultCount++;
-    auto startAddr = regions_.findStart(addr);
-    spiller_->recoverMem(startAddr, addr - startAddr, buffer_->data(),
-                         kPageSize);
-    uffdio_copy copy = {.dst = msg.arg.pagefault.address,
-                        .src = (uint64_t)buffer_->data(),
-                        .len = kPageSize,
-                        .mode = 0};
-    ioctl(userFaultFd_, UFFDIO_COPY, &copy);
-    LOG(INFO) << "pagefault copied page size=" << kPageSize;
+  for (ssize_t i = 0; i < n / static_cast<ssize_t>(sizeof(uffd_msg)); ++i) {
+    if (msgs[i].event != UFFD_EVENT_PAGEFAULT) {
+      continue;
+    }
+    char *addr = reinterpret_cast<char *>(msgs[i].arg.pagefault.address);
+    if (msgs[i].arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP) {
+      serveWriteFault(addr);
+    } else {
+      serveFault(worker, addr);
+    }
+  }
+}
+
+void PageFaultHandler::serveFault(Worker &worker, char *addr) {
+  stats_.pageFaultCount.fetch_add(1, std::memory_order_relaxed);
+  uint64_t faultNanos = nowNanos();
+  auto region = regions_.find(addr);
+  char *startAddr = region.start;
+  memSize pageSize = region.pageSize;
+  int64_t page = (addr - startAddr) / pageSize;
+  auto file = spiller_->spillFile(startAddr);
+  spiller_->recordAccess(startAddr);
+  latency_.lookup.recordSince(faultNanos);
+  int64_t pages = (file->meta.originalSize + pageSize - 1) / pageSize;
+  readPage(worker, file, startAddr, pageSize, page, false, faultNanos);
+  // Keep one staging buffer back for the next demand fault.
+  uint32_t budget = worker.freeBuffers.size() > 1
+                        ? static_cast<uint32_t>(worker.freeBuffers.size() - 1)
+                        : 0;
+  auto [from, to] = trackAccess(startAddr, page, pages, budget);
+  for (int64_t next = from; next < to; ++next) {
+    readPage(worker, file, startAddr, pageSize, next, true);
+  }
+}
+
+void PageFaultHandler::serveWriteFault(char *addr) {
+  stats_.writeFaultCount.fetch_add(1, std::memory_order_relaxed);
+  auto region = regions_.find(addr);
+  memSize pageSize = region.pageSize;
+  char *pageAddr = region.start + (addr - region.start) / pageSize * pageSize;
+  spiller_->recordWrite(region.start, pageAddr,
+                        std::min<memSize>(pageSize,
+                                          region.start + region.size -
+                                              pageAddr));
+}
+
+std::pair<int64_t, int64_t> PageFaultHandler::trackAccess(char *startAddr,
+                                                          int64_t page,
+                                                          int64_t pages,
+                                                          uint32_t budget) {
+  std::lock_guard<std::mutex> guard(streamsMutex_);
+  auto &stream = streams_[startAddr];
+  bool sequential = page == stream.lastPage + 1;
+  if (sequential && stream.run >= kSequentialRun) {
+    stats_.prefetchMissCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (stream.prefetchEnd > stream.prefetchStart) {
+    if (page >= stream.prefetchStart && page < stream.prefetchEnd) {
+      // Caught up with a read ahead still in flight.
+      stats_.prefetchHitCount.fetch_add(page - stream.prefetchStart,
+                                        std::memory_order_relaxed);
+      stream.prefetchStart = page + 1;
+    } else if (page == stream.prefetchEnd) {
+      stats_.prefetchHitCount.fetch_add(
+          stream.prefetchEnd - stream.prefetchStart, std::memory_order_relaxed);
+      stream.prefetchStart = stream.prefetchEnd = 0;
+    } else {
+      stats_.prefetchWastedCount.fetch_add(
+          stream.prefetchEnd - stream.prefetchStart, std::memory_order_relaxed);
+      stream.prefetchStart = stream.prefetchEnd = 0;
+    }
+  }
+  stream.run = sequential ? stream.run + 1 : 1;
+  stream.lastPage = page;
+  if (prefetchDepth_ == 0 || stream.run < kSequentialRun) {
+    return {0, 0};
+  }
+  int64_t from = std::max(page + 1, stream.prefetchEnd);
+  int64_t to = std::min<int64_t>(pages, page + 1 + prefetchDepth_);
+  to = std::min<int64_t>(to, from + budget);
+  if (from >= to) {
+    return {0, 0};
+  }
+  if (stream.prefetchEnd <= stream.prefetchStart) {
+    stream.prefetchStart = from;
+  }
+  stream.prefetchEnd = to;
+  stats_.prefetchCount.fetch_add(to - from, std::memory_order_relaxed);
+  return {from, to};
+}
+
+bool PageFaultHandler::readPage(Worker &worker, const SpillFilePtr &file,
+                                char *startAddr, memSize pageSize,
+                                int64_t page, bool prefetch,
+                                uint64_t faultNanos) {
+  int64_t offset = page * pageSize;
+  char *pageAddr = startAddr + offset;
+  if (worker.freeBuffers.empty()) {
+    if (prefetch) {
+      return false;
+    }
+    // A batch of faults can outrun the buffers, wait for a read to finish.
+    while (worker.freeBuffers.empty()) {
+      worker.reader->poll(true);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(inflightMutex_);
+    if (!inflightPages_.insert(pageAddr).second) {
+      if (!prefetch) {
+        stats_.duplicateFaultCount.fetch_add(1, std::memory_order_relaxed);
+      }
+      return false;
+    }
+  }
+  memSize size = std::min<memSize>(pageSize, file->meta.originalSize - offset);
+  uint32_t slot = worker.freeBuffers.back();
+  worker.freeBuffers.pop_back();
+  if (worker.buffers[slot]->size() < size) {
+    // Staging buffers grow to the largest page size seen.
+    worker.buffers[slot] = std::make_shared<Buffer>(size);
+  }
+  worker.reader->submit(
+      file, offset, worker.buffers[slot]->data(), size,
+      [this, &worker, startAddr, pageAddr, size, slot, prefetch,
+       faultNanos](bool ok) {
+        onPageRead(worker, startAddr, pageAddr, size, slot, prefetch,
+                   faultNanos, ok);
+      });
+  return true;
+}
+
+void PageFaultHandler::onPageRead(Worker &worker, char *startAddr,
+                                  char *pageAddr, memSize size, uint32_t slot,
+                                  bool prefetch, uint64_t faultNanos,
+                                  bool ok) {
+  if (!ok && !prefetch) {
+    // The faulting thread can't make progress without its data.
+    throw std::runtime_error("recover page failed address=" +
+                             std::to_string((uint64_t)pageAddr));
+  }
+  if (ok) {
+    // Back write protected, the spill file holds the page until it is
+    // written.
+    uffdio_copy copy = {.dst = (uint64_t)pageAddr,
+                        .src = (uint64_t)worker.buffers[slot]->data(),
+                        .len = size,
+                        .mode = UFFDIO_COPY_MODE_WP};
+    // Charged before it is mapped, a spill can't give back what the region
+    // doesn't hold yet.
+    spiller_->recordFaultIn(startAddr, size);
+    uint64_t start = nowNanos();
+    int error = ioctl(userFaultFd_, UFFDIO_COPY, &copy) < 0 ? errno : 0;
+    latency_.copy.recordSince(start);
+    if (error != 0) {
+      spiller_->cancelFaultIn(startAddr, size);
+    }
+    if (!prefetch) {
+      latency_.total.recordSince(faultNanos);
+    }
+    if (error != 0) {
+      if (error != EEXIST) {
+        LOG(ERROR) << "pagefault copy failed address=" << (uint64_t)pageAddr
+                   << " error=" << strerror(error);
+      } else if (prefetch) {
+        stats_.prefetchWastedCount.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+  // Only forget the page once it is mapped, a fault racing with the copy is
+  // then either woken by it or finds the page present.
+  {
+    std::lock_guard<std::mutex> guard(inflightMutex_);
+    inflightPages_.erase(pageAddr);
   }
+  worker.freeBuffers.push_back(slot);
+  LOG(INFO) << "pagefault copied page size=" << size
+            << " prefetch=" << prefetch;
 }
 
 Statistics PageFaultHandler::stats() const { return stats_; }
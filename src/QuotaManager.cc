@@ -1,38 +1,154 @@
 #include "QuotaManager.h"
+#include <algorithm>
+#include <chrono>
 #include <glog/logging.h>
+#include <stdexcept>
 
-QuotaManager::QuotaManager(memSize size, SpillerPtr &spiller)
-    : size_(size), used_(0), spiller_(spiller) {}
+// Pause before spilling again when the last round freed nothing.
+static constexpr std::chrono::milliseconds kSpillRetryInterval{10};
 
-QuotaManager::~QuotaManager() {}
+QuotaManager::QuotaManager(memSize size, SpillerPtr &spiller,
+                           double highWatermark, double lowWatermark,
+                           uint32_t waitMs)
+    : size_(size), highMark_(static_cast<memSize>(size * highWatermark)),
+      lowMark_(static_cast<memSize>(size * lowWatermark)),
+      lowWatermark_(lowWatermark), waitMs_(waitMs),
+      root_(QuotaPool::createRoot("process", size)), stop_(false),
+      spiller_(spiller) {
+  if (lowWatermark < 0 || lowWatermark > highWatermark || highWatermark > 1) {
+    throw std::runtime_error("invalid spill watermarks");
+  }
+  // Waiting allocations retry whenever quota comes back, whoever returns it.
+  root_->setReleaseListener([this]() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    freedCv_.notify_all();
+  });
+  spillThread_ = std::thread([this]() { spillLoop(); });
+}
 
-bool QuotaManager::tryAcquire(memSize size) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  int tryTimes = 3;
-  do {
-    if (used_ + size <= size_) {
-      used_ += size;
-      return true;
-    }
-    auto spilled = spiller_->spill(used_ + size - size_);
-    used_ -= spilled;
-  } while (--tryTimes > 0);
-  LOG(ERROR) << "quota acquire failed size=" << size << " used=" << used_
-             << " total=" << size_;
-  return false;
+QuotaManager::~QuotaManager() {
+  // Reservations may outlive the manager.
+  root_->setReleaseListener(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  spillCv_.notify_all();
+  spillThread_.join();
 }
 
-void QuotaManager::release(memSize size) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  used_ -= size;
+QuotaReservationPtr QuotaManager::reserve(memSize size,
+                                          const QuotaPoolPtr &pool) {
+  const QuotaPoolPtr &target = pool ? pool : root_;
+  if (!charge(*target, size)) {
+    return nullptr;
+  }
+  return std::make_shared<QuotaReservation>(target, size);
 }
 
-memSize QuotaManager::used() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return used_;
+bool QuotaManager::grow(QuotaReservation &reservation, memSize size) {
+  if (!charge(*reservation.pool(), size)) {
+    return false;
+  }
+  reservation.adopt(size);
+  return true;
 }
 
-memSize QuotaManager::available() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return size_ - used_;
+bool QuotaManager::tryAcquire(memSize size) { return charge(*root_, size); }
+
+bool QuotaManager::charge(QuotaPool &pool, memSize size) {
+  uint64_t start = nowNanos();
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMs_);
+  Waiter waiter{&pool, size};
+  bool waiting = false;
+  bool charged = pool.tryCharge(size);
+  while (!charged) {
+    QuotaPoolPtr blocking = pool.blocking(size);
+    if (blocking != nullptr && size > blocking->limit()) {
+      // Never fits, however much is spilled.
+      break;
+    }
+    if (!waiting) {
+      waiters_.push_back(&waiter);
+      waiting = true;
+    }
+    spillCv_.notify_one();
+    auto status = freedCv_.wait_until(lock, deadline);
+    charged = pool.tryCharge(size);
+    if (status == std::cv_status::timeout) {
+      break;
+    }
+  }
+  if (waiting) {
+    waiters_.erase(std::find(waiters_.begin(), waiters_.end(), &waiter));
+  }
+  waitLatency_.recordSince(start);
+  if (!charged) {
+    LOG(ERROR) << "quota acquire failed size=" << size
+               << " pool=" << pool.name() << " used=" << pool.used()
+               << " limit=" << pool.limit();
+    return false;
+  }
+  if (root_->used() > highMark_) {
+    spillCv_.notify_one();
+  }
+  return true;
+}
+
+void QuotaManager::release(memSize size) { root_->release(size); }
+
+memSize QuotaManager::used() { return root_->used(); }
+
+memSize QuotaManager::available() { return size_ - std::min(size_, used()); }
+
+bool QuotaManager::needSpill() const {
+  return root_->used() > highMark_ || !waiters_.empty();
+}
+
+void QuotaManager::spillLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    spillCv_.wait(lock, [this]() { return stop_ || needSpill(); });
+    if (stop_) {
+      break;
+    }
+    QuotaPoolPtr scope = root_;
+    memSize target = 0;
+    if (!waiters_.empty()) {
+      const Waiter &waiter = *waiters_.front();
+      if (auto blocking = waiter.pool->blocking(waiter.size)) {
+        scope = blocking;
+        memSize want = blocking->used() + waiter.size;
+        memSize lowMark =
+            static_cast<memSize>(blocking->limit() * lowWatermark_);
+        target = want - std::min(lowMark, want);
+      }
+    } else {
+      memSize used = root_->used();
+      target = used - std::min(lowMark_, used);
+    }
+    QuotaPoolPtr victim = scope->victim();
+    lock.unlock();
+    // Allocations and releases go on while the spiller writes. Evicted bytes
+    // come back through the reservations of the regions.
+    memSize spilled = 0;
+    if (target != 0) {
+      spilled = spiller_->spill(target, victim == root_ ? nullptr : victim);
+      if (spilled < target && victim != scope) {
+        spilled += spiller_->spill(target - spilled,
+                                   scope == root_ ? nullptr : scope);
+      }
+    }
+    lock.lock();
+    freedCv_.notify_all();
+    LOG(INFO) << "background spill pool=" << victim->name()
+              << " target=" << target << " spilled=" << spilled
+              << " used=" << root_->used();
+    if (spilled == 0) {
+      // Nothing to evict right now, wait for new regions or releases.
+      spillCv_.wait_for(lock, kSpillRetryInterval, [this]() { return stop_; });
+    }
+  }
 }
@@ -0,0 +1,165 @@
+#include "QuotaPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+QuotaPool::QuotaPool(const std::string &name, memSize limit,
+                     QuotaPoolPtr parent, std::shared_ptr<Tree> tree)
+    : name_(name), limit_(limit), parent_(std::move(parent)),
+      tree_(std::move(tree)), used_(0) {}
+
+QuotaPoolPtr QuotaPool::createRoot(const std::string &name, memSize limit) {
+  return QuotaPoolPtr(
+      new QuotaPool(name, limit, nullptr, std::make_shared<Tree>()));
+}
+
+QuotaPoolPtr QuotaPool::createChild(const std::string &name, memSize limit) {
+  if (limit > limit_) {
+    throw std::runtime_error("quota pool " + name +
+                             " exceeds the limit of " + name_);
+  }
+  QuotaPoolPtr child(new QuotaPool(name, limit, shared_from_this(), tree_));
+  std::lock_guard<std::mutex> guard(tree_->mutex);
+  children_.erase(std::remove_if(children_.begin(), children_.end(),
+                                 [](const std::weak_ptr<QuotaPool> &c) {
+                                   return c.expired();
+                                 }),
+                  children_.end());
+  children_.push_back(child);
+  return child;
+}
+
+bool QuotaPool::tryCharge(memSize size) {
+  std::lock_guard<std::mutex> guard(tree_->mutex);
+  if (blockingLocked(size) != nullptr) {
+    return false;
+  }
+  for (QuotaPool *pool = this; pool != nullptr; pool = pool->parent_.get()) {
+    pool->used_ += size;
+  }
+  return true;
+}
+
+void QuotaPool::forceCharge(memSize size) {
+  std::lock_guard<std::mutex> guard(tree_->mutex);
+  for (QuotaPool *pool = this; pool != nullptr; pool = pool->parent_.get()) {
+    pool->used_ += size;
+  }
+}
+
+void QuotaPool::release(memSize size) {
+  {
+    std::lock_guard<std::mutex> guard(tree_->mutex);
+    for (QuotaPool *pool = this; pool != nullptr;
+         pool = pool->parent_.get()) {
+      pool->used_ -= std::min(size, pool->used_);
+    }
+  }
+  std::lock_guard<std::mutex> guard(tree_->listenerMutex);
+  if (tree_->listener) {
+    tree_->listener();
+  }
+}
+
+QuotaPoolPtr QuotaPool::blocking(memSize size) {
+  std::lock_guard<std::mutex> guard(tree_->mutex);
+  QuotaPool *pool = blockingLocked(size);
+  return pool == nullptr ? nullptr : pool->shared_from_this();
+}
+
+QuotaPool *QuotaPool::blockingLocked(memSize size) {
+  QuotaPool *result = nullptr;
+  for (QuotaPool *pool = this; pool != nullptr; pool = pool->parent_.get()) {
+    if (pool->used_ + size > pool->limit_) {
+      result = pool;
+    }
+  }
+  return result;
+}
+
+QuotaPoolPtr QuotaPool::victim() {
+  std::lock_guard<std::mutex> guard(tree_->mutex);
+  QuotaPoolPtr node = shared_from_this();
+  while (true) {
+    std::vector<QuotaPoolPtr> children;
+    for (const auto &weak : node->children_) {
+      if (auto child = weak.lock()) {
+        children.push_back(std::move(child));
+      }
+    }
+    QuotaPoolPtr next, only;
+    memSize mostOver = 0;
+    size_t inUse = 0;
+    for (const auto &child : children) {
+      memSize share = std::min(child->limit_, node->limit_ / children.size());
+      if (child->used_ > share && child->used_ - share > mostOver) {
+        mostOver = child->used_ - share;
+        next = child;
+      }
+      if (child->used_ != 0) {
+        inUse++;
+        only = child;
+      }
+    }
+    // A child holding everything the pool holds is no choice either.
+    if (next == nullptr && inUse == 1 && only->used_ == node->used_) {
+      next = only;
+    }
+    if (next == nullptr) {
+      return node;
+    }
+    node = std::move(next);
+  }
+}
+
+bool QuotaPool::contains(const QuotaPool *pool) const {
+  for (; pool != nullptr; pool = pool->parent_.get()) {
+    if (pool == this) {
+      return true;
+    }
+  }
+  return false;
+}
+
+memSize QuotaPool::used() const {
+  std::lock_guard<std::mutex> guard(tree_->mutex);
+  return used_;
+}
+
+void QuotaPool::setReleaseListener(std::function<void()> listener) {
+  std::lock_guard<std::mutex> guard(tree_->listenerMutex);
+  tree_->listener = std::move(listener);
+}
+
+QuotaReservation::QuotaReservation(QuotaPoolPtr pool, memSize size)
+    : pool_(std::move(pool)), size_(size) {}
+
+QuotaReservation::~QuotaReservation() {
+  if (size_ != 0) {
+    pool_->release(size_);
+  }
+}
+
+bool QuotaReservation::grow(memSize size) {
+  if (!pool_->tryCharge(size)) {
+    return false;
+  }
+  adopt(size);
+  return true;
+}
+
+void QuotaReservation::forceGrow(memSize size) {
+  pool_->forceCharge(size);
+  adopt(size);
+}
+
+void QuotaReservation::shrink(memSize size) {
+  memSize current = size_.load();
+  memSize freed;
+  do {
+    freed = std::min(size, current);
+  } while (!size_.compare_exchange_weak(current, current - freed));
+  if (freed != 0) {
+    pool_->release(freed);
+  }
+}
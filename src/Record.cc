@@ -0,0 +1,179 @@
+#include "Record.h"
+
+#include "RadixSort.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+static const char *typeName(ColumnType type) {
+  switch (type) {
+  case ColumnType::Int64:
+    return "int64";
+  case ColumnType::Double:
+    return "double";
+  default:
+    return "string";
+  }
+}
+
+RecordSchema::RecordSchema(std::vector<Column> columns,
+                           std::vector<SortKeyColumn> key)
+    : columns_(std::move(columns)), key_(std::move(key)) {
+  fixedSize_ = RecordView::slotOffset(columns_.size());
+  uint32_t prefixBytes = 0;
+  prefixIsKey_ = true;
+  for (const auto &k : key_) {
+    if (k.column >= columns_.size()) {
+      throw std::runtime_error("sort key column " + std::to_string(k.column) +
+                               " out of " + std::to_string(columns_.size()));
+    }
+    prefixBytes += 8;
+    if (columns_[k.column].type == ColumnType::String ||
+        prefixBytes > kKeyPrefixBytes) {
+      prefixIsKey_ = false;
+    }
+  }
+}
+
+// Order preserving bits of a key column, flipped when descending.
+static uint64_t keyBits(ColumnType type, uint64_t value, bool descending) {
+  uint64_t bits;
+  if (type == ColumnType::Int64) {
+    bits = RadixKey<int64_t>::bits(static_cast<int64_t>(value));
+  } else {
+    double d;
+    memcpy(&d, &value, sizeof(d));
+    bits = RadixKey<double>::bits(d);
+  }
+  return descending ? ~bits : bits;
+}
+
+Record::Record(RecordSchemaPtr schema)
+    : schema_(std::move(schema)), values_(schema_->columnCount(), 0),
+      data_(schema_->columnCount()) {}
+
+void Record::checkColumn(size_t column, ColumnType type) const {
+  if (column >= schema_->columnCount() ||
+      schema_->column(column).type != type) {
+    throw std::runtime_error("column " + std::to_string(column) +
+                             " is not a " + typeName(type));
+  }
+}
+
+void Record::setInt64(size_t column, int64_t value) {
+  checkColumn(column, ColumnType::Int64);
+  values_[column] = static_cast<uint64_t>(value);
+}
+
+void Record::setDouble(size_t column, double value) {
+  checkColumn(column, ColumnType::Double);
+  memcpy(&values_[column], &value, sizeof(value));
+}
+
+void Record::setString(size_t column, std::string_view value) {
+  checkColumn(column, ColumnType::String);
+  if (value.size() > UINT32_MAX) {
+    throw std::runtime_error("string of " + std::to_string(value.size()) +
+                             " bytes too long for a record");
+  }
+  data_[column].assign(value);
+}
+
+void Record::deserialize(const char *src) {
+  RecordView view(src);
+  for (size_t i = 0; i < schema_->columnCount(); ++i) {
+    if (schema_->column(i).type == ColumnType::String) {
+      data_[i].assign(view.getString(i));
+    } else {
+      memcpy(&values_[i], src + RecordView::slotOffset(i), 8);
+    }
+  }
+}
+
+uint32_t Record::size() const {
+  uint64_t size = schema_->fixedSize();
+  for (const auto &s : data_) {
+    size += s.size();
+  }
+  size = (size + kRecordAlignment - 1) / kRecordAlignment * kRecordAlignment;
+  if (size > UINT32_MAX) {
+    throw std::runtime_error("record of " + std::to_string(size) +
+                             " bytes too large");
+  }
+  return static_cast<uint32_t>(size);
+}
+
+void Record::serialize(char *dst) const {
+  const uint32_t size = this->size();
+  memcpy(dst, &size, 4);
+  memset(dst + 4, 0, 4);
+
+  uint8_t *prefix =
+      reinterpret_cast<uint8_t *>(dst + RecordView::kPrefixOffset);
+  uint32_t filled = 0;
+  for (const auto &k : schema_->key()) {
+    if (filled == kKeyPrefixBytes) {
+      break;
+    }
+    ColumnType type = schema_->column(k.column).type;
+    uint32_t room = kKeyPrefixBytes - filled;
+    if (type == ColumnType::String) {
+      const std::string &s = data_[k.column];
+      uint32_t n = std::min<size_t>(s.size(), room);
+      for (uint32_t i = 0; i < n; ++i) {
+        uint8_t byte = static_cast<uint8_t>(s[i]);
+        prefix[filled + i] = k.descending ? static_cast<uint8_t>(~byte) : byte;
+      }
+      memset(prefix + filled + n, k.descending ? 0xff : 0, room - n);
+      filled = kKeyPrefixBytes;
+      break;
+    }
+    uint64_t bits =
+        __builtin_bswap64(keyBits(type, values_[k.column], k.descending));
+    uint32_t n = std::min<uint32_t>(8, room);
+    memcpy(prefix + filled, &bits, n);
+    filled += n;
+  }
+  memset(prefix + filled, 0, kKeyPrefixBytes - filled);
+
+  uint32_t offset = schema_->fixedSize();
+  for (size_t i = 0; i < schema_->columnCount(); ++i) {
+    uint64_t slot = values_[i];
+    if (schema_->column(i).type == ColumnType::String) {
+      const std::string &s = data_[i];
+      memcpy(dst + offset, s.data(), s.size());
+      slot = (static_cast<uint64_t>(s.size()) << 32) | offset;
+      offset += s.size();
+    }
+    memcpy(dst + RecordView::slotOffset(i), &slot, 8);
+  }
+  memset(dst + offset, 0, size - offset);
+}
+
+int RecordComparator::compareKey(const char *a, const char *b) const {
+  RecordView x(a), y(b);
+  for (const auto &k : schema_->key()) {
+    ColumnType type = schema_->column(k.column).type;
+    int c;
+    if (type == ColumnType::String) {
+      std::string_view s = x.getString(k.column);
+      std::string_view t = y.getString(k.column);
+      // As unsigned bytes, which std::string_view::compare doesn't promise.
+      int m = memcmp(s.data(), t.data(), std::min(s.size(), t.size()));
+      c = m != 0 ? (m < 0 ? -1 : 1)
+                 : (s.size() < t.size() ? -1 : s.size() > t.size());
+      c = k.descending ? -c : c;
+    } else {
+      uint64_t u, v;
+      memcpy(&u, a + RecordView::slotOffset(k.column), 8);
+      memcpy(&v, b + RecordView::slotOffset(k.column), 8);
+      u = keyBits(type, u, k.descending);
+      v = keyBits(type, v, k.descending);
+      c = u < v ? -1 : u > v;
+    }
+    if (c != 0) {
+      return c;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include "RecordSorter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <glog/logging.h>
+#include <stdexcept>
+
+RecordSorter::RecordSorter(BufferManager &manager, RecordSchemaPtr schema,
+                           const RecordSortOptions &options)
+    : manager_(manager), schema_(std::move(schema)), comparator_(schema_),
+      options_(options) {
+  if (!isValidPageSize(options_.pageSize)) {
+    throw std::runtime_error("invalid record sort page size " +
+                             std::to_string(options_.pageSize));
+  }
+}
+
+// Size of the record at `offset`, checked to fit what is left. The size is
+// only read once the fixed part of a record fits.
+static uint32_t recordSizeAt(const char *data, memSize bytes, memSize offset,
+                             const RecordSchema &schema) {
+  uint32_t size = bytes - offset < schema.fixedSize()
+                      ? 0
+                      : RecordView(data + offset).size();
+  if (size < schema.fixedSize() || size > bytes - offset) {
+    throw std::runtime_error("corrupt record at offset " +
+                             std::to_string(offset));
+  }
+  return size;
+}
+
+SortedRecords RecordSorter::sort(const char *data, memSize bytes,
+                                 const QuotaPoolPtr &pool) const {
+  if (bytes == 0) {
+    return {nullptr, 0, 0};
+  }
+  // Counted first so that wide records don't reserve entries they won't
+  // use, a read of one word per record.
+  size_t count = 0;
+  for (memSize offset = 0; offset < bytes; ++count) {
+    offset += recordSizeAt(data, bytes, offset, *schema_);
+  }
+  MmapMemoryPtr entryMem = manager_.accquireMemory(
+      count * sizeof(RecordSortEntry), options_.pageSize, pool, true);
+  auto *entries = reinterpret_cast<RecordSortEntry *>(entryMem->address());
+  buildEntries(data, bytes, entries);
+  sortEntries(entries, count, data);
+
+  // Pinned like the entries until it is filled, a spill in between would
+  // write it out only to write it again.
+  MmapMemoryPtr out =
+      manager_.accquireMemory(bytes, options_.pageSize, pool, true);
+  memSize written = gather(entries, count, data, out->address());
+  manager_.setPinned(out, false);
+  LOG(INFO) << "record sort count=" << count << " bytes=" << written;
+  return {std::move(out), written, count};
+}
+
+size_t RecordSorter::buildEntries(const char *data, memSize bytes,
+                                  RecordSortEntry *entries) const {
+  size_t count = 0;
+  for (memSize offset = 0; offset < bytes;) {
+    uint32_t size = recordSizeAt(data, bytes, offset, *schema_);
+    RecordView record(data + offset);
+    RecordSortEntry &e = entries[count++];
+    memcpy(&e.high, record.prefix(), 8);
+    memcpy(&e.low, record.prefix() + 8, 8);
+    e.high = __builtin_bswap64(e.high);
+    e.low = __builtin_bswap64(e.low);
+    e.offset = offset;
+    offset += size;
+  }
+  return count;
+}
+
+void RecordSorter::sortEntries(RecordSortEntry *entries, size_t count,
+                               const char *data) const {
+  RadixSorter<RecordSortEntry> radix({.threads = options_.threads});
+  radix.sortInPlace(entries, count);
+  if (schema_->prefixIsKey()) {
+    return;
+  }
+  auto byKey = [&](const RecordSortEntry &a, const RecordSortEntry &b) {
+    return comparator_.compareKey(data + a.offset, data + b.offset) < 0;
+  };
+  for (size_t begin = 0; begin < count;) {
+    size_t end = begin + 1;
+    while (end < count && entries[end].high == entries[begin].high &&
+           entries[end].low == entries[begin].low) {
+      ++end;
+    }
+    if (end - begin > 1) {
+      std::sort(entries + begin, entries + end, byKey);
+    }
+    begin = end;
+  }
+}
+
+memSize RecordSorter::gather(const RecordSortEntry *entries, size_t count,
+                             const char *data, char *out) const {
+  const size_t distance = options_.prefetchDistance;
+  char *dst = out;
+  for (size_t i = 0; i < count; ++i) {
+    if (distance != 0 && i + distance < count) {
+      // The first two lines, the copy streams through the rest.
+      const char *ahead = data + entries[i + distance].offset;
+      __builtin_prefetch(ahead);
+      __builtin_prefetch(ahead + 64);
+    }
+    const char *record = data + entries[i].offset;
+    uint32_t size = RecordView(record).size();
+    memcpy(dst, record, size);
+    dst += size;
+  }
+  return dst - out;
+}
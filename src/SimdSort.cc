@@ -0,0 +1,90 @@
+#include "SimdSort.h"
+
+#include <algorithm>
+
+// The kernels are only built on x86-64, see CMakeLists.txt.
+#ifdef SIMD_SORT_X86
+void simdSortAvx2(int32_t *data, size_t size);
+void simdSortAvx2(uint32_t *data, size_t size);
+void simdSortAvx2(int64_t *data, size_t size);
+void simdSortAvx2(uint64_t *data, size_t size);
+void simdSortAvx512(int32_t *data, size_t size);
+void simdSortAvx512(uint32_t *data, size_t size);
+void simdSortAvx512(int64_t *data, size_t size);
+void simdSortAvx512(uint64_t *data, size_t size);
+#endif
+
+void scalarSort(int32_t *data, size_t size) { std::sort(data, data + size); }
+
+void scalarSort(uint32_t *data, size_t size) { std::sort(data, data + size); }
+
+void scalarSort(int64_t *data, size_t size) { std::sort(data, data + size); }
+
+void scalarSort(uint64_t *data, size_t size) { std::sort(data, data + size); }
+
+static SimdLevel detectSimdLevel() {
+#ifdef SIMD_SORT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+      __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+    return SimdLevel::Avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::Avx2;
+  }
+#endif
+  return SimdLevel::Scalar;
+}
+
+SimdLevel simdLevel() {
+  static const SimdLevel level = detectSimdLevel();
+  return level;
+}
+
+const char *simdLevelName(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::Avx512:
+    return "avx512";
+  case SimdLevel::Avx2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+template <typename T>
+static void dispatch(T *data, size_t size, SimdLevel level) {
+  // Runs often arrive in order, which std::sort handles with well predicted
+  // branches and the vector partition doesn't, checking costs one pass.
+  if (std::is_sorted(data, data + size)) {
+    return;
+  }
+  level = std::min(level, simdLevel());
+#ifdef SIMD_SORT_X86
+  if (level == SimdLevel::Avx512) {
+    simdSortAvx512(data, size);
+    return;
+  }
+  if (level == SimdLevel::Avx2) {
+    simdSortAvx2(data, size);
+    return;
+  }
+#endif
+  scalarSort(data, size);
+}
+
+void simdSort(int32_t *data, size_t size, SimdLevel level) {
+  dispatch(data, size, level);
+}
+
+void simdSort(uint32_t *data, size_t size, SimdLevel level) {
+  dispatch(data, size, level);
+}
+
+void simdSort(int64_t *data, size_t size, SimdLevel level) {
+  dispatch(data, size, level);
+}
+
+void simdSort(uint64_t *data, size_t size, SimdLevel level) {
+  dispatch(data, size, level);
+}
@@ -0,0 +1,188 @@
+// Built with AVX2 enabled on x86-64, see CMakeLists.txt.
+#if defined(__AVX2__)
+
+#include "SimdSortKernel.h"
+
+#include <immintrin.h>
+
+namespace {
+
+// For every selection of up to 8 lanes, the 32-bit lane indices that move
+// the selected lanes to the front, in order, and the others behind them,
+// one index per byte.
+struct CompressTable {
+  uint64_t entries[256];
+
+  constexpr CompressTable() : entries() {
+    for (unsigned bits = 0; bits < 256; ++bits) {
+      uint64_t entry = 0;
+      unsigned out = 0;
+      for (unsigned pass = 0; pass < 2; ++pass) {
+        for (unsigned lane = 0; lane < 8; ++lane) {
+          bool selected = (bits >> lane) & 1;
+          if (selected == (pass == 0)) {
+            entry |= static_cast<uint64_t>(lane) << (8 * out++);
+          }
+        }
+      }
+      entries[bits] = entry;
+    }
+  }
+};
+
+constexpr CompressTable kCompress32;
+
+// The same for 4 lanes of 64 bits, as pairs of 32-bit lanes.
+struct CompressTable64 {
+  uint64_t entries[16];
+
+  constexpr CompressTable64() : entries() {
+    for (unsigned bits = 0; bits < 16; ++bits) {
+      uint64_t entry = 0;
+      unsigned out = 0;
+      for (unsigned pass = 0; pass < 2; ++pass) {
+        for (unsigned lane = 0; lane < 4; ++lane) {
+          bool selected = (bits >> lane) & 1;
+          if (selected == (pass == 0)) {
+            entry |= static_cast<uint64_t>(2 * lane) << (8 * out++);
+            entry |= static_cast<uint64_t>(2 * lane + 1) << (8 * out++);
+          }
+        }
+      }
+      entries[bits] = entry;
+    }
+  }
+};
+
+constexpr CompressTable64 kCompress64;
+
+template <typename K> struct Avx2 {
+  using T = K;
+  using Vec = __m256i;
+  using Mask = __m256i;
+  static constexpr size_t kLanes = 32 / sizeof(T);
+  static constexpr bool kWide = sizeof(T) == 8;
+  static constexpr bool kSigned = T(-1) < T(0);
+
+  static Vec load(const T *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  }
+
+  static void store(T *p, Vec v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+  }
+
+  static Vec set1(T x) {
+    if constexpr (kWide) {
+      return _mm256_set1_epi64x(static_cast<int64_t>(x));
+    } else {
+      return _mm256_set1_epi32(static_cast<int32_t>(x));
+    }
+  }
+
+  // All ones where a > b. AVX2 only compares signed, unsigned keys are
+  // compared with their top bit flipped.
+  static Vec greater(Vec a, Vec b) {
+    if constexpr (kWide) {
+      if constexpr (!kSigned) {
+        Vec flip = _mm256_set1_epi64x(INT64_MIN);
+        a = _mm256_xor_si256(a, flip);
+        b = _mm256_xor_si256(b, flip);
+      }
+      return _mm256_cmpgt_epi64(a, b);
+    } else {
+      if constexpr (!kSigned) {
+        Vec flip = _mm256_set1_epi32(INT32_MIN);
+        a = _mm256_xor_si256(a, flip);
+        b = _mm256_xor_si256(b, flip);
+      }
+      return _mm256_cmpgt_epi32(a, b);
+    }
+  }
+
+  static Vec min(Vec a, Vec b) {
+    if constexpr (kWide) {
+      return _mm256_blendv_epi8(a, b, greater(a, b));
+    } else {
+      return kSigned ? _mm256_min_epi32(a, b) : _mm256_min_epu32(a, b);
+    }
+  }
+
+  static Vec max(Vec a, Vec b) {
+    if constexpr (kWide) {
+      return _mm256_blendv_epi8(b, a, greater(a, b));
+    } else {
+      return kSigned ? _mm256_max_epi32(a, b) : _mm256_max_epu32(a, b);
+    }
+  }
+
+  // Lane i ^ j of 64 bits is 32-bit lanes 2i ^ 2j and 2i ^ 2j + 1.
+  static Vec permuteXor(Vec v, size_t j) {
+    Vec index = _mm256_xor_si256(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                 _mm256_set1_epi32(kWide ? 2 * j : j));
+    return _mm256_permutevar8x32_epi32(v, index);
+  }
+
+  static Mask maskFromBits(unsigned bits) {
+    if constexpr (kWide) {
+      Vec lanes = _mm256_setr_epi64x(1, 2, 4, 8);
+      return _mm256_cmpeq_epi64(
+          _mm256_and_si256(_mm256_set1_epi64x(bits), lanes), lanes);
+    } else {
+      Vec lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+      return _mm256_cmpeq_epi32(
+          _mm256_and_si256(_mm256_set1_epi32(bits), lanes), lanes);
+    }
+  }
+
+  static Vec blend(Mask mask, Vec a, Vec b) {
+    return _mm256_blendv_epi8(a, b, mask);
+  }
+
+  static unsigned bitsOf(Vec mask) {
+    if constexpr (kWide) {
+      return _mm256_movemask_pd(_mm256_castsi256_pd(mask));
+    } else {
+      return _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+    }
+  }
+
+  static unsigned lessBits(Vec v, Vec p) { return bitsOf(greater(p, v)); }
+
+  static unsigned lessEqualBits(Vec v, Vec p) {
+    return ~bitsOf(greater(v, p)) & ((1u << kLanes) - 1);
+  }
+
+  // One permutation puts the selected lanes first and the others last, the
+  // whole vector is stored on both sides.
+  static void partitionStore(Vec v, unsigned bits, T *&left, T *&right) {
+    uint64_t entry = kWide ? kCompress64.entries[bits] : kCompress32.entries[bits];
+    Vec index = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(entry));
+    Vec packed = _mm256_permutevar8x32_epi32(v, index);
+    unsigned count = __builtin_popcount(bits);
+    store(left, packed);
+    store(right - kLanes, packed);
+    left += count;
+    right -= kLanes - count;
+  }
+};
+
+} // namespace
+
+void simdSortAvx2(int32_t *data, size_t size) {
+  SortKernel<Avx2<int32_t>>::sort(data, size);
+}
+
+void simdSortAvx2(uint32_t *data, size_t size) {
+  SortKernel<Avx2<uint32_t>>::sort(data, size);
+}
+
+void simdSortAvx2(int64_t *data, size_t size) {
+  SortKernel<Avx2<int64_t>>::sort(data, size);
+}
+
+void simdSortAvx2(uint64_t *data, size_t size) {
+  SortKernel<Avx2<uint64_t>>::sort(data, size);
+}
+
+#endif
@@ -0,0 +1,137 @@
+// Built with AVX-512 F/DQ/BW/VL enabled on x86-64, see CMakeLists.txt.
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+
+#include "SimdSortKernel.h"
+
+// GCC 12 seeds the unmasked AVX-512 intrinsics with a self-initialized
+// _mm512_undefined_epi32(), -Wmaybe-uninitialized then flags every place
+// one is inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+namespace {
+
+template <typename K> struct Avx512 {
+  using T = K;
+  using Vec = __m512i;
+  using Mask = unsigned;
+  static constexpr size_t kLanes = 64 / sizeof(T);
+  static constexpr bool kWide = sizeof(T) == 8;
+  static constexpr bool kSigned = T(-1) < T(0);
+
+  static Vec load(const T *p) { return _mm512_loadu_si512(p); }
+
+  static void store(T *p, Vec v) { _mm512_storeu_si512(p, v); }
+
+  static Vec set1(T x) {
+    if constexpr (kWide) {
+      return _mm512_set1_epi64(static_cast<int64_t>(x));
+    } else {
+      return _mm512_set1_epi32(static_cast<int32_t>(x));
+    }
+  }
+
+  static Vec min(Vec a, Vec b) {
+    if constexpr (kWide) {
+      return kSigned ? _mm512_min_epi64(a, b) : _mm512_min_epu64(a, b);
+    } else {
+      return kSigned ? _mm512_min_epi32(a, b) : _mm512_min_epu32(a, b);
+    }
+  }
+
+  static Vec max(Vec a, Vec b) {
+    if constexpr (kWide) {
+      return kSigned ? _mm512_max_epi64(a, b) : _mm512_max_epu64(a, b);
+    } else {
+      return kSigned ? _mm512_max_epi32(a, b) : _mm512_max_epu32(a, b);
+    }
+  }
+
+  static Vec permuteXor(Vec v, size_t j) {
+    if constexpr (kWide) {
+      Vec index = _mm512_xor_si512(_mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0),
+                                   _mm512_set1_epi64(j));
+      return _mm512_permutexvar_epi64(index, v);
+    } else {
+      Vec index = _mm512_xor_si512(
+          _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+                           0),
+          _mm512_set1_epi32(j));
+      return _mm512_permutexvar_epi32(index, v);
+    }
+  }
+
+  static Mask maskFromBits(unsigned bits) { return bits; }
+
+  static Vec blend(Mask mask, Vec a, Vec b) {
+    if constexpr (kWide) {
+      return _mm512_mask_blend_epi64(static_cast<__mmask8>(mask), a, b);
+    } else {
+      return _mm512_mask_blend_epi32(static_cast<__mmask16>(mask), a, b);
+    }
+  }
+
+  static unsigned lessBits(Vec v, Vec p) {
+    if constexpr (kWide) {
+      return kSigned ? _mm512_cmplt_epi64_mask(v, p)
+                     : _mm512_cmplt_epu64_mask(v, p);
+    } else {
+      return kSigned ? _mm512_cmplt_epi32_mask(v, p)
+                     : _mm512_cmplt_epu32_mask(v, p);
+    }
+  }
+
+  static unsigned lessEqualBits(Vec v, Vec p) {
+    if constexpr (kWide) {
+      return kSigned ? _mm512_cmple_epi64_mask(v, p)
+                     : _mm512_cmple_epu64_mask(v, p);
+    } else {
+      return kSigned ? _mm512_cmple_epi32_mask(v, p)
+                     : _mm512_cmple_epu32_mask(v, p);
+    }
+  }
+
+  // Compresses in registers and stores with a mask, compressing straight to
+  // memory is microcoded on some cores.
+  static void partitionStore(Vec v, unsigned bits, T *&left, T *&right) {
+    unsigned count = __builtin_popcount(bits);
+    unsigned rest = kLanes - count;
+    if constexpr (kWide) {
+      __mmask8 m = static_cast<__mmask8>(bits);
+      _mm512_storeu_si512(left, _mm512_maskz_compress_epi64(m, v));
+      right -= rest;
+      _mm512_mask_storeu_epi64(right, static_cast<__mmask8>((1u << rest) - 1),
+                               _mm512_maskz_compress_epi64(~m, v));
+    } else {
+      __mmask16 m = static_cast<__mmask16>(bits);
+      _mm512_storeu_si512(left, _mm512_maskz_compress_epi32(m, v));
+      right -= rest;
+      _mm512_mask_storeu_epi32(right,
+                               static_cast<__mmask16>((1u << rest) - 1),
+                               _mm512_maskz_compress_epi32(~m, v));
+    }
+    left += count;
+  }
+};
+
+} // namespace
+
+void simdSortAvx512(int32_t *data, size_t size) {
+  SortKernel<Avx512<int32_t>>::sort(data, size);
+}
+
+void simdSortAvx512(uint32_t *data, size_t size) {
+  SortKernel<Avx512<uint32_t>>::sort(data, size);
+}
+
+void simdSortAvx512(int64_t *data, size_t size) {
+  SortKernel<Avx512<int64_t>>::sort(data, size);
+}
+
+void simdSortAvx512(uint64_t *data, size_t size) {
+  SortKernel<Avx512<uint64_t>>::sort(data, size);
+}
+
+#endif
@@ -0,0 +1,234 @@
+#pragma once
+
+// The vector sort kernel, shared by SimdSortAvx2.cc and SimdSortAvx512.cc
+// which are built with their instruction set enabled and each instantiate it
+// with their own vector traits. Everything here is in an anonymous namespace
+// and uses no inline library code, an inline function compiled for AVX-512
+// must not be the copy the linker keeps for the rest of the library.
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// Defined in SimdSort.cc, built for the baseline ISA.
+void scalarSort(int32_t *data, size_t size);
+void scalarSort(uint32_t *data, size_t size);
+void scalarSort(int64_t *data, size_t size);
+void scalarSort(uint64_t *data, size_t size);
+
+namespace {
+
+// Traits V provide, for keys V::T in vectors V::Vec of V::kLanes lanes:
+//   load, store, set1, min, max
+//   permuteXor(v, j)     lane i gets lane i ^ j
+//   maskFromBits(bits)   a V::Mask from one bit per lane
+//   blend(mask, a, b)    b where the mask is set, a elsewhere
+//   lessBits(v, p), lessEqualBits(v, p)   one bit per lane
+//   partitionStore(v, bits, left, right)  the lanes with their bit set to
+//       `left`, which moves past them, the others to just below `right`,
+//       which moves down. May write up to a vector past `left` and below
+//       `right`.
+template <typename V> struct SortKernel {
+  using T = typename V::T;
+  using Vec = typename V::Vec;
+  static constexpr size_t kLanes = V::kLanes;
+  static constexpr size_t kMaxRegs = 16;
+  // Ranges up to this size are sorted by the network.
+  static constexpr size_t kNetworkSize = kLanes * kMaxRegs;
+  static constexpr unsigned kAllLanes = (1u << kLanes) - 1;
+  static constexpr T kMaxKey = std::numeric_limits<T>::max();
+
+  static void sort(T *data, size_t size) {
+    int depth = 0;
+    for (size_t n = size; n > 1; n >>= 1) {
+      depth += 2;
+    }
+    sortRange(data, data + size, depth);
+  }
+
+  // Introsort: quicksort until `depth` runs out, then the scalar sort.
+  static void sortRange(T *lo, T *hi, int depth) {
+    while (static_cast<size_t>(hi - lo) > kNetworkSize) {
+      if (depth-- == 0) {
+        scalarSort(lo, hi - lo);
+        return;
+      }
+      T pivot = choosePivot(lo, hi);
+      T *split = partition(lo, hi, pivot, false);
+      if (split == lo) {
+        // The pivot is the smallest key, the keys equal to it are done.
+        lo = partition(lo, hi, pivot, true);
+        continue;
+      }
+      if (split - lo < hi - split) {
+        sortRange(lo, split, depth);
+        lo = split;
+      } else {
+        sortRange(split, hi, depth);
+        hi = split;
+      }
+    }
+    sortSmall(lo, hi - lo);
+  }
+
+  static T median3(T a, T b, T c) {
+    if (b < a) {
+      T t = a;
+      a = b;
+      b = t;
+    }
+    if (c < b) {
+      b = c < a ? a : c;
+    }
+    return b;
+  }
+
+  // Median of three, of three medians of three for larger ranges.
+  static T choosePivot(const T *lo, const T *hi) {
+    size_t n = hi - lo;
+    const T *mid = lo + n / 2;
+    const T *last = hi - 1;
+    if (n < 1024) {
+      return median3(*lo, *mid, *last);
+    }
+    size_t s = n / 8;
+    return median3(median3(lo[0], lo[s], lo[2 * s]),
+                   median3(mid[-s], mid[0], mid[s]),
+                   median3(last[-2 * s], last[-s], last[0]));
+  }
+
+  static unsigned selectBits(Vec v, Vec pivot, bool orEqual) {
+    return orEqual ? V::lessEqualBits(v, pivot) : V::lessBits(v, pivot);
+  }
+
+  static bool select(T key, T pivot, bool orEqual) {
+    return orEqual ? !(pivot < key) : key < pivot;
+  }
+
+  // Moves the keys below `pivot`, or not above it if `orEqual`, in front of
+  // the others and returns where the others start. The first and last vector
+  // are held back so that there is always a vector of room on both sides of
+  // the unread keys, which are read from the side with less room.
+  static T *partition(T *lo, T *hi, T pivot, bool orEqual) {
+    size_t n = hi - lo;
+    if (n < 2 * kLanes) {
+      T *split = lo;
+      for (T *p = lo; p < hi; ++p) {
+        if (select(*p, pivot, orEqual)) {
+          T t = *p;
+          *p = *split;
+          *split++ = t;
+        }
+      }
+      return split;
+    }
+    Vec p = V::set1(pivot);
+    T held[2 * kLanes];
+    V::store(held, V::load(lo));
+    V::store(held + kLanes, V::load(hi - kLanes));
+    T *readLeft = lo + kLanes, *readRight = hi - kLanes;
+    T *writeLeft = lo, *writeRight = hi;
+    while (static_cast<size_t>(readRight - readLeft) >= kLanes) {
+      Vec v;
+      if (readLeft - writeLeft <= writeRight - readRight) {
+        v = V::load(readLeft);
+        readLeft += kLanes;
+      } else {
+        readRight -= kLanes;
+        v = V::load(readRight);
+      }
+      V::partitionStore(v, selectBits(v, p, orEqual), writeLeft, writeRight);
+    }
+    // The last few keys and the two held back vectors, one at a time, the
+    // room left is exactly what they need.
+    T rest[3 * kLanes];
+    size_t restSize = 0;
+    for (T *q = readLeft; q < readRight; ++q) {
+      rest[restSize++] = *q;
+    }
+    for (size_t i = 0; i < 2 * kLanes; ++i) {
+      rest[restSize++] = held[i];
+    }
+    for (size_t i = 0; i < restSize; ++i) {
+      if (select(rest[i], pivot, orEqual)) {
+        *writeLeft++ = rest[i];
+      } else {
+        *--writeRight = rest[i];
+      }
+    }
+    return writeLeft;
+  }
+
+  // Bitonic sort of `regs` vectors, a power of two, ascending across them
+  // in order. Compare-exchanges between lanes `kLanes` or more apart are
+  // min/max of two vectors, closer ones permute within a vector and blend.
+  static void network(Vec *v, size_t regs) {
+    const size_t n = regs * kLanes;
+    for (size_t k = 2; k <= n; k *= 2) {
+      for (size_t j = k / 2; j > 0; j /= 2) {
+        if (j >= kLanes) {
+          size_t step = j / kLanes;
+          for (size_t r = 0; r < regs; ++r) {
+            size_t q = r ^ step;
+            if (q < r) {
+              continue;
+            }
+            Vec lo = V::min(v[r], v[q]);
+            Vec hi = V::max(v[r], v[q]);
+            bool descending = ((r * kLanes) & k) != 0;
+            v[r] = descending ? hi : lo;
+            v[q] = descending ? lo : hi;
+          }
+          continue;
+        }
+        // Lanes taking the larger key of their pair, in an ascending block.
+        unsigned bits = 0;
+        for (unsigned lane = 0; lane < kLanes; ++lane) {
+          bool upper = (lane & j) != 0;
+          bool descending = k < kLanes && (lane & k) != 0;
+          bits |= static_cast<unsigned>(upper != descending) << lane;
+        }
+        auto ascending = V::maskFromBits(bits);
+        auto descending = V::maskFromBits(~bits & kAllLanes);
+        for (size_t r = 0; r < regs; ++r) {
+          Vec other = V::permuteXor(v[r], j);
+          Vec lo = V::min(v[r], other);
+          Vec hi = V::max(v[r], other);
+          bool flip = k >= kLanes && ((r * kLanes) & k) != 0;
+          v[r] = V::blend(flip ? descending : ascending, lo, hi);
+        }
+      }
+    }
+  }
+
+  static void sortSmall(T *data, size_t size) {
+    if (size < 2) {
+      return;
+    }
+    size_t regs = 1;
+    while (regs * kLanes < size) {
+      regs *= 2;
+    }
+    T buffer[kNetworkSize];
+    for (size_t i = 0; i < size; ++i) {
+      buffer[i] = data[i];
+    }
+    // Padding sorts to the end.
+    for (size_t i = size; i < regs * kLanes; ++i) {
+      buffer[i] = kMaxKey;
+    }
+    Vec v[kMaxRegs];
+    for (size_t r = 0; r < regs; ++r) {
+      v[r] = V::load(buffer + r * kLanes);
+    }
+    network(v, regs);
+    for (size_t r = 0; r < regs; ++r) {
+      V::store(buffer + r * kLanes, v[r]);
+    }
+    for (size_t i = 0; i < size; ++i) {
+      data[i] = buffer[i];
+    }
+  }
+};
+
+} // namespace
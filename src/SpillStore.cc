@@ -0,0 +1,211 @@
+#include "SpillStore.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+
+// Extents start and end on filesystem blocks, so O_DIRECT reads and hole
+// punching line up with them.
+static constexpr uint64_t kExtentAlignment = 4096;
+
+static uint64_t alignUp(uint64_t value) {
+  return (value + kExtentAlignment - 1) / kExtentAlignment * kExtentAlignment;
+}
+
+SpillStore::SpillStore(const std::string &path, memSize segmentSize,
+                       bool directIo)
+    : path_(path), segmentSize_(alignUp(segmentSize)), directIo_(directIo) {
+  if (segmentSize_ == 0) {
+    throw std::runtime_error("Segment size must be positive");
+  }
+}
+
+SpillStore::~SpillStore() {
+  for (uint32_t id = 0; id < segments_.size(); ++id) {
+    if (segments_[id] != nullptr) {
+      removeSegment(id);
+    }
+  }
+}
+
+SpillExtent SpillStore::allocate(memSize length) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  uint64_t reserved = alignUp(std::max<memSize>(length, 1));
+  for (uint32_t id = 0; id < segments_.size(); ++id) {
+    Segment *seg = segments_[id].get();
+    if (seg == nullptr) {
+      continue;
+    }
+    for (auto it = seg->freeRanges.begin(); it != seg->freeRanges.end();
+         ++it) {
+      if (it->second < reserved) {
+        continue;
+      }
+      uint64_t offset = it->first;
+      uint64_t rest = it->second - reserved;
+      seg->freeRanges.erase(it);
+      if (rest > 0) {
+        seg->freeRanges.emplace(offset + reserved, rest);
+      }
+      seg->used += reserved;
+      return {id, offset, length};
+    }
+  }
+  uint32_t id = createSegment(std::max<memSize>(segmentSize_, reserved));
+  Segment &seg = *segments_[id];
+  if (seg.size > reserved) {
+    seg.freeRanges.emplace(reserved, seg.size - reserved);
+  }
+  seg.used = reserved;
+  return {id, 0, length};
+}
+
+SpillExtent SpillStore::shrink(const SpillExtent &extent, memSize length) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  uint64_t reserved = alignUp(std::max<memSize>(extent.length, 1));
+  uint64_t kept = alignUp(std::max<memSize>(length, 1));
+  if (length > extent.length) {
+    throw std::runtime_error("Can't grow a spill extent");
+  }
+  if (kept < reserved) {
+    freeRange(segment(extent.segmentId), extent.offset + kept,
+              reserved - kept);
+  }
+  return {extent.segmentId, extent.offset, length};
+}
+
+void SpillStore::release(const SpillExtent &extent) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  Segment &seg = segment(extent.segmentId);
+  freeRange(seg, extent.offset, alignUp(std::max<memSize>(extent.length, 1)));
+  size_t live = 0;
+  for (const auto &s : segments_) {
+    live += s != nullptr;
+  }
+  if (seg.used == 0 && live > 1) {
+    removeSegment(extent.segmentId);
+  }
+}
+
+int SpillStore::fd(const SpillExtent &extent) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return segment(extent.segmentId).fd;
+}
+
+SpillFilePtr SpillStore::open(const SpillExtent &extent) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  Segment &seg = segment(extent.segmentId);
+  return FileUtils::open(seg.fileName, seg.fd, seg.directFd, extent.offset,
+                         extent.length);
+}
+
+size_t SpillStore::segmentCount() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  size_t count = 0;
+  for (const auto &seg : segments_) {
+    count += seg != nullptr;
+  }
+  return count;
+}
+
+memSize SpillStore::usedBytes() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  memSize used = 0;
+  for (const auto &seg : segments_) {
+    used += seg != nullptr ? seg->used : 0;
+  }
+  return used;
+}
+
+SpillStore::Segment &SpillStore::segment(uint32_t segmentId) {
+  if (segmentId >= segments_.size() || segments_[segmentId] == nullptr) {
+    throw std::runtime_error("Can't find spill segment " +
+                             std::to_string(segmentId));
+  }
+  return *segments_[segmentId];
+}
+
+uint32_t SpillStore::createSegment(memSize size) {
+  auto seg = std::make_unique<Segment>();
+  uint32_t id = segments_.size();
+  seg->fileName = path_ + "/segment-" + std::to_string(id) + ".seg";
+  seg->fd = ::open(seg->fileName.c_str(),
+                   O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (seg->fd < 0) {
+    throw std::runtime_error("Can't open " + seg->fileName + " for write.");
+  }
+  // Reserving the blocks up front keeps the file contiguous and spills from
+  // failing halfway on a full disk. Filesystems without fallocate get a
+  // sparse file.
+  if (fallocate(seg->fd, 0, 0, size) != 0 &&
+      ftruncate(seg->fd, static_cast<off_t>(size)) != 0) {
+    int err = errno;
+    close(seg->fd);
+    unlink(seg->fileName.c_str());
+    throw std::runtime_error("Can't allocate " + seg->fileName + ": " +
+                             strerror(err));
+  }
+  if (directIo_) {
+    // Not every filesystem supports O_DIRECT, buffered reads still work.
+    seg->directFd =
+        ::open(seg->fileName.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+  }
+  seg->size = size;
+  segments_.push_back(std::move(seg));
+  LOG(INFO) << "spill store new segment id=" << id << " size=" << size;
+  return id;
+}
+
+void SpillStore::removeSegment(uint32_t segmentId) {
+  auto &seg = segments_[segmentId];
+  close(seg->fd);
+  if (seg->directFd >= 0) {
+    close(seg->directFd);
+  }
+  unlink(seg->fileName.c_str());
+  LOG(INFO) << "spill store removed segment id=" << segmentId;
+  seg.reset();
+}
+
+void SpillStore::freeRange(Segment &seg, uint64_t offset, uint64_t length) {
+  bool wasSparse = seg.used < seg.size / 2;
+  seg.used -= length;
+  auto next = seg.freeRanges.lower_bound(offset);
+  if (next != seg.freeRanges.end() && next->first == offset + length) {
+    length += next->second;
+    next = seg.freeRanges.erase(next);
+  }
+  if (next != seg.freeRanges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      length += prev->second;
+      seg.freeRanges.erase(prev);
+    }
+  }
+  seg.freeRanges.emplace(offset, length);
+  if (seg.used >= seg.size / 2) {
+    return;
+  }
+  if (wasSparse) {
+    punch(seg, offset, length);
+  } else {
+    // Just went sparse, give every free range back to the filesystem.
+    for (const auto &[start, len] : seg.freeRanges) {
+      punch(seg, start, len);
+    }
+  }
+}
+
+void SpillStore::punch(Segment &seg, uint64_t offset, uint64_t length) {
+  if (fallocate(seg.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                static_cast<off_t>(offset), static_cast<off_t>(length)) != 0) {
+    LOG(WARNING) << "spill store punch hole failed file=" << seg.fileName
+                 << " error=" << strerror(errno);
+  }
+}
@@ -1,73 +1,382 @@
 #include "Spiller.h"
 #include "DirectoryUtils.h"
 #include "FileUtils.h"
+#include "MemoryUtils.h"
 
-#include <atomic>
+#include <algorithm>
 #include <glog/logging.h>
+#include <optional>
 #include <sys/mman.h>
+#include <unistd.h>
 
-Spiller::Spiller(const std::string &path, CompressionType compressionType)
-    : spillPath_(path), compressionType_(compressionType) {
+Spiller::Spiller(const std::string &path, CompressionType compressionType,
+                 uint32_t ioDepth, bool directIo,
+                 EvictionPolicyType evictionPolicy, memSize segmentSize,
+                 uint32_t compressionThreads)
+    : spillPath_(path), policy_(createEvictionPolicy(evictionPolicy)),
+      compressionType_(compressionType),
+      writer_(std::make_unique<AsyncSpillWriter>(
+          ioDepth, kDefaultRegisteredFrameSize, &stats_,
+          compressionThreads)) {
   DirectoryUtils::createDir(spillPath_);
-  LOG(INFO) << "spiller init path=" << spillPath_;
+  store_ = std::make_unique<SpillStore>(spillPath_, segmentSize, directIo);
+  LOG(INFO) << "spiller init path=" << spillPath_
+            << " evictionPolicy=" << evictionPolicy;
 }
 
 Spiller::~Spiller() {
+  writer_->drain();
+  LOG(INFO) << "Spiller statistics: " << stats_.toString();
+  openFiles_.clear();
+  store_.reset();
   LOG(INFO) << "spiller cleanup path=" << spillPath_;
   DirectoryUtils::removeAll(spillPath_);
 }
 
+Statistics Spiller::stats() const { return stats_; }
+
+Spiller::Usage Spiller::usage() {
+  std::vector<MmapMemoryPtr> mems;
+  {
+    std::lock_guard<std::mutex> guard(regionsMutex_);
+    for (auto &[addr, region] : regions_) {
+      if (auto mem = region.mem.lock()) {
+        mems.push_back(std::move(mem));
+      }
+    }
+  }
+  Usage usage{0, 0, store_->usedBytes()};
+  for (const auto &mem : mems) {
+    usage.regionBytes += mem->size();
+    for (memSize bytes : MemoryUtils::residentBytes(
+             mem->address(), mem->size(), mem->pageSize())) {
+      usage.residentBytes += bytes;
+    }
+  }
+  return usage;
+}
+
 void Spiller::recoverMem(char *startAddr, int64_t offset, char *dst,
                          memSize size) {
-  auto fileNameOpt = addrToFileMap_.get(startAddr);
-  if (!fileNameOpt) {
-    throw std::runtime_error("Can't find file name mapping for address: " +
+  FileUtils::read(*spillFile(startAddr), offset, dst, size);
+}
+
+SpillFilePtr Spiller::spillFile(char *startAddr) {
+  std::lock_guard<std::mutex> guard(openFilesMutex_);
+  auto it = openFiles_.find(startAddr);
+  if (it != openFiles_.end()) {
+    return it->second;
+  }
+  auto extent = addrToFileMap_.get(startAddr);
+  if (!extent) {
+    throw std::runtime_error("Can't find spill extent for address: " +
                              std::to_string((uint64_t)startAddr));
   }
-  FileUtils::read(*fileNameOpt, offset, dst, size);
+  auto file = store_->open(*extent);
+  openFiles_.emplace(startAddr, file);
+  return file;
+}
+
+void Spiller::closeFile(char *startAddr) {
+  std::lock_guard<std::mutex> guard(openFilesMutex_);
+  openFiles_.erase(startAddr);
+}
+
+void Spiller::registerMem(MmapMemoryPtr &mem,
+                          QuotaReservationPtr reservation, bool pinned) {
+  char *addr = mem->address();
+  // A region at the same address that was never unregistered is gone.
+  unregisterMem(addr);
+  std::lock_guard<std::mutex> guard(regionsMutex_);
+  memSize charged = reservation ? reservation->size() : mem->size();
+  regions_[addr] = {mem, charged, std::move(reservation), pinned, true};
+  policy_->add(addr, mem->size());
+}
+
+void Spiller::setPinned(char *startAddr, bool pinned) {
+  std::lock_guard<std::mutex> guard(regionsMutex_);
+  auto it = regions_.find(startAddr);
+  if (it != regions_.end()) {
+    it->second.pinned = pinned;
+  }
+}
+
+void Spiller::setWriteProtector(WriteProtector protector) {
+  std::lock_guard<std::mutex> guard(regionsMutex_);
+  writeProtector_ = std::move(protector);
+  if (!writeProtector_) {
+    // Writes are not reported anymore.
+    for (auto &[addr, region] : regions_) {
+      region.dirty = true;
+    }
+  }
+}
+
+memSize Spiller::unregisterMem(char *startAddr) {
+  memSize charged = 0;
+  QuotaReservationPtr reservation;
+  std::optional<SpillExtent> extent;
+  {
+    std::lock_guard<std::mutex> guard(regionsMutex_);
+    auto it = regions_.find(startAddr);
+    if (it == regions_.end()) {
+      return 0;
+    }
+    charged = it->second.charged;
+    reservation = std::move(it->second.reservation);
+    regions_.erase(it);
+    policy_->remove(startAddr);
+    if (addrToFileMap_.get(startAddr).has_value()) {
+      extent = addrToFileMap_.erase(startAddr);
+    }
+  }
+  LOG(INFO) << "<Release> address=" << (uint64_t)startAddr
+            << " charged=" << charged;
+  closeFile(startAddr);
+  if (extent) {
+    store_->release(*extent);
+  }
+  // The reservation, if any, gives its quota back here.
+  return charged;
+}
+
+void Spiller::recordAccess(char *startAddr) {
+  std::lock_guard<std::mutex> guard(regionsMutex_);
+  policy_->recordAccess(startAddr);
+}
+
+void Spiller::recordFaultIn(char *startAddr, memSize size) {
+  std::lock_guard<std::mutex> guard(regionsMutex_);
+  auto it = regions_.find(startAddr);
+  if (it == regions_.end()) {
+    return;
+  }
+  it->second.charged += size;
+  if (it->second.reservation) {
+    it->second.reservation->forceGrow(size);
+  }
 }
 
-void Spiller::registerMem(MmapMemoryPtr &mem) { queue_.push(mem); }
+void Spiller::cancelFaultIn(char *startAddr, memSize size) {
+  memSize freed = 0;
+  QuotaReservationPtr reservation;
+  {
+    std::lock_guard<std::mutex> guard(regionsMutex_);
+    auto it = regions_.find(startAddr);
+    if (it == regions_.end()) {
+      return;
+    }
+    freed = std::min(size, it->second.charged);
+    it->second.charged -= freed;
+    reservation = it->second.reservation;
+  }
+  if (reservation) {
+    reservation->shrink(freed);
+  }
+}
 
-memSize Spiller::spill(memSize targetSize) {
-  memSize spilledSize = 0;
-  auto elementSize = queue_.size();
-  while (elementSize > 0 && spilledSize < targetSize) {
-    auto mem = queue_.front();
-    queue_.pop();
-    if (mem.use_count() == 1) {
-      LOG(INFO) << "<Release> address=" << (uint64_t)mem->address()
-                << " size=" << mem->size() << " use_count=" << mem.use_count();
-      spilledSize += mem->size();
-      addrToFileMap_.erase(mem->address());
+void Spiller::recordWrite(char *startAddr, char *addr, memSize size) {
+  std::lock_guard<std::mutex> guard(regionsMutex_);
+  auto it = regions_.find(startAddr);
+  if (it != regions_.end()) {
+    it->second.dirty = true;
+  }
+  // The writer waits on it even for a region just released.
+  if (writeProtector_) {
+    writeProtector_(addr, size, false);
+  }
+}
+
+memSize Spiller::spill(memSize targetSize, const QuotaPoolPtr &pool) {
+  uint64_t start = nowNanos();
+  memSize spilledSize = 0, failedSize = 0;
+  std::vector<char *> victims;
+  {
+    std::lock_guard<std::mutex> guard(regionsMutex_);
+    victims = policy_->victims();
+  }
+  for (char *addr : victims) {
+    if (spilledSize >= targetSize) {
+      break;
+    }
+    MmapMemoryPtr mem;
+    {
+      std::lock_guard<std::mutex> guard(regionsMutex_);
+      auto it = regions_.find(addr);
+      if (it == regions_.end() || it->second.pinned) {
+        continue;
+      }
+      const auto &reservation = it->second.reservation;
+      if (pool != nullptr &&
+          (reservation == nullptr ||
+           !pool->contains(reservation->pool().get()))) {
+        continue;
+      }
+      mem = it->second.mem.lock();
+    }
+    if (mem == nullptr) {
+      // The owner has let go without unregistering.
+      spilledSize += unregisterMem(addr);
     } else {
-      LOG(INFO) << "<Spill> mem address=" << (uint64_t)mem->address()
-                << " size=" << mem->size() << " use_count=" << mem.use_count();
-      spilledSize += mem->size();
-      queue_.push(mem);
-      eraseMem(mem);
+      spilledSize += eraseMem(mem, targetSize - spilledSize, failedSize);
     }
-    elementSize--;
   }
+  // Regions are only released once their files are durable.
+  writer_->drain();
+  spilledSize -= failedSize;
+  latency_.spill.recordSince(start);
+  latency_.spillBytes.record(spilledSize);
   LOG(INFO) << "spiller spill done target=" << targetSize
             << " spilled=" << spilledSize;
   return spilledSize;
 }
 
-void Spiller::eraseMem(MmapMemoryPtr &mem) {
+memSize Spiller::eraseMem(MmapMemoryPtr &mem, memSize need,
+                          memSize &failedSize) {
   char *addr = mem->address();
+  bool spilled = false, rewrite = false, dropped = false, tracked = false;
+  {
+    std::lock_guard<std::mutex> guard(regionsMutex_);
+    auto it = regions_.find(addr);
+    if (it == regions_.end() || it->second.pinned) {
+      return 0;
+    }
+    spilled = addrToFileMap_.get(addr).has_value();
+    if (spilled && it->second.dirty && !writeProtector_) {
+      // The file may miss writes and the pages not in memory can't be read
+      // back to write a new one.
+      return 0;
+    }
+    rewrite = spilled && it->second.dirty;
+  }
+  if (rewrite) {
+    // Written since its file was, the new one is written from memory. The
+    // pages are charged as they come back and evicted like the others.
+    faultIn(mem);
+  }
+  memSize resident = 0;
+  memSize fromPage = coldTail(mem, need, resident);
+  memSize freed = 0;
+  // Only shrunk once the pages are gone, allocations waiting on the quota
+  // must not run ahead of the eviction.
+  QuotaReservationPtr reservation;
+  {
+    std::lock_guard<std::mutex> guard(regionsMutex_);
+    auto it = regions_.find(addr);
+    if (it == regions_.end() || it->second.pinned) {
+      return 0;
+    }
+    Region &region = it->second;
+    if (spilled && region.dirty && !rewrite) {
+      // Written since the check above, not all of it is in memory.
+      return 0;
+    }
+    // A page being copied back in is charged before it is mapped, never
+    // give back more than is held.
+    freed = std::min(resident, region.charged);
+    region.charged -= freed;
+    reservation = region.reservation;
+    policy_->recordEviction(addr);
+    dropped = spilled && !region.dirty;
+    if (dropped) {
+      // The whole region is on disk already, evicting is just dropping
+      // pages.
+      evictPages(mem, fromPage);
+    } else if (writeProtector_) {
+      // Writes from here on are seen, the file is written after this.
+      tracked = writeProtector_(addr, mem->size(), true);
+      region.dirty = !tracked;
+    }
+  }
+  LOG(INFO) << "<Spill> mem address=" << (uint64_t)addr
+            << " size=" << mem->size() << " fromPage=" << fromPage
+            << " resident=" << resident << " dropped=" << dropped
+            << " use_count=" << mem.use_count();
+  if (dropped) {
+    if (reservation) {
+      reservation->shrink(freed);
+    }
+    return freed;
+  }
+  // The whole region is written so that later evictions of it need no I/O.
+  // The extent fits the worst case and is trimmed to what was written. The
+  // callback keeps `mem` alive until the write has completed.
   memSize size = mem->size();
-  if (addrToFileMap_.get(addr).has_value()) {
-    return;
+  SpillExtent extent =
+      store_->allocate(FileUtils::maxFramedSize(size, mem->pageSize()));
+  uint64_t start = nowNanos();
+  writer_->submit(
+      store_->fd(extent), extent.offset, addr, size, compressionType_,
+      mem->pageSize(),
+      [this, mem, reservation, extent, fromPage, freed, tracked, start,
+       &failedSize](bool ok, memSize length) {
+        latency_.write.recordSince(start);
+        char *addr = mem->address();
+        {
+          std::lock_guard<std::mutex> guard(regionsMutex_);
+          auto it = regions_.find(addr);
+          // Written while the file was, it misses that write.
+          bool stale = tracked && it != regions_.end() && it->second.dirty;
+          if (!ok || stale) {
+            if (!ok) {
+              LOG(ERROR) << "spill failed address=" << (uint64_t)addr;
+            }
+            store_->release(extent);
+            failedSize += freed;
+            if (it != regions_.end()) {
+              it->second.charged += freed;
+              it->second.dirty = true;
+            }
+            return;
+          }
+          latency_.writeBytes.record(length);
+          std::optional<SpillExtent> replaced = addrToFileMap_.get(addr);
+          addrToFileMap_.set(addr, store_->shrink(extent, length));
+          if (replaced) {
+            closeFile(addr);
+            store_->release(*replaced);
+          }
+          policy_->recordSpillFile(addr, length);
+          evictPages(mem, fromPage);
+        }
+        if (reservation) {
+          reservation->shrink(freed);
+        }
+      });
+  return freed;
+}
+
+memSize Spiller::coldTail(MmapMemoryPtr &mem, memSize need,
+                          memSize &resident) {
+  const memSize pageSize = mem->pageSize();
+  auto pages = MemoryUtils::residentBytes(mem->address(), mem->size(),
+                                          pageSize);
+  resident = 0;
+  memSize page = pages.size();
+  while (page > 0 && resident < need) {
+    resident += pages[--page];
+  }
+  return page;
+}
+
+void Spiller::faultIn(const MmapMemoryPtr &mem) {
+  const memSize pageSize = mem->pageSize();
+  const memSize step = sysconf(_SC_PAGESIZE);
+  char *addr = mem->address();
+  auto pages = MemoryUtils::residentBytes(addr, mem->size(), pageSize);
+  for (memSize page = 0; page < pages.size(); ++page) {
+    if (pages[page] == static_cast<int64_t>(pageSize)) {
+      continue;
+    }
+    for (memSize offset = 0; offset < pageSize; offset += step) {
+      (void)*static_cast<volatile char *>(addr + page * pageSize + offset);
+    }
   }
-  std::string fileName = FileUtils::write(nextFileName(), addr, size, compressionType_);
-  addrToFileMap_.set(addr, fileName);
-  madvise(addr, size, MADV_DONTNEED);
 }
 
-std::string Spiller::nextFileName() {
-  static std::atomic<int64_t> fileId_{0};
-  static const std::string kFileSuffix = ".bin";
-  int64_t id = fileId_.fetch_add(1);
-  return spillPath_ + "/" + std::to_string(id) + kFileSuffix;
+void Spiller::evictPages(const MmapMemoryPtr &mem, memSize fromPage) {
+  memSize offset = fromPage * mem->pageSize();
+  if (offset < mem->size()) {
+    madvise(mem->address() + offset, mem->size() - offset, MADV_DONTNEED);
+  }
 }
@@ -0,0 +1,50 @@
+#include "AsyncSpillReader.h"
+#include "FileUtils.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+
+static std::vector<char> makeData(size_t size) {
+  std::vector<char> data(size);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>((i / 5) % 256);
+  return data;
+}
+
+TEST(AsyncSpillReaderTest, ReadsOutstandingRanges) {
+  const memSize frameSize = 4096;
+  std::string fileName = "./test_async_reader.bin";
+  auto data = makeData(10 * frameSize + 300);
+  FileUtils::write(fileName, data.data(), data.size(), CompressionType::Zstd, frameSize);
+
+  for (bool direct : {false, true}) {
+    auto file = FileUtils::open(fileName, direct);
+    AsyncSpillReader reader(2, frameSize);
+    std::vector<std::vector<char>> outs(4, std::vector<char>(frameSize + 500));
+    int done = 0;
+    for (size_t i = 0; i < outs.size(); ++i) {
+      reader.submit(file, i * 2 * frameSize + 100, outs[i].data(), outs[i].size(),
+                    [&done](bool ok) {
+                      EXPECT_TRUE(ok);
+                      done++;
+                    });
+    }
+    reader.drain();
+    EXPECT_EQ(done, 4);
+    EXPECT_EQ(reader.pendingReads(), 0);
+    for (size_t i = 0; i < outs.size(); ++i) {
+      EXPECT_EQ(std::memcmp(outs[i].data(), data.data() + i * 2 * frameSize + 100, outs[i].size()), 0);
+    }
+  }
+  FileUtils::remove(fileName);
+}
+
+TEST(AsyncSpillReaderTest, RangeOutOfFileThrows) {
+  std::string fileName = "./test_async_reader_range.bin";
+  auto data = makeData(1000);
+  FileUtils::write(fileName, data.data(), data.size(), CompressionType::Lz4, 256);
+  auto file = FileUtils::open(fileName);
+  AsyncSpillReader reader(1, 256);
+  std::vector<char> out(200);
+  EXPECT_THROW(reader.submit(file, 900, out.data(), out.size(), nullptr), std::runtime_error);
+  FileUtils::remove(fileName);
+}
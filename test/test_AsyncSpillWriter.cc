@@ -0,0 +1,157 @@
+#include "AsyncSpillWriter.h"
+#include "FileUtils.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <unistd.h>
+#include <vector>
+
+TEST(AsyncSpillWriterTest, WriteFramesAndReadBack) {
+  const memSize frameSize = 4096;
+  AsyncSpillWriter writer(2, frameSize);
+  std::vector<std::vector<char>> regions(3, std::vector<char>(5 * frameSize + 100));
+  for (size_t r = 0; r < regions.size(); ++r) {
+    for (size_t i = 0; i < regions[r].size(); ++i) {
+      regions[r][i] = static_cast<char>((i / (r + 2)) % 256);
+    }
+  }
+
+  int done = 0;
+  std::vector<memSize> lengths(regions.size());
+  for (size_t r = 0; r < regions.size(); ++r) {
+    std::string file = "./test_async_spill_" + std::to_string(r) + ".bin";
+    auto type = r == 0 ? CompressionType::None
+                       : (r == 1 ? CompressionType::Zstd : CompressionType::Lz4);
+    writer.submit(file, regions[r].data(), regions[r].size(), type, frameSize,
+                  [&done, &lengths, r](bool ok, memSize length) {
+                    EXPECT_TRUE(ok);
+                    lengths[r] = length;
+                    done++;
+                  });
+  }
+  writer.drain();
+  EXPECT_EQ(done, 3);
+  EXPECT_EQ(writer.pendingFiles(), 0);
+
+  for (size_t r = 0; r < regions.size(); ++r) {
+    std::string file = "./test_async_spill_" + std::to_string(r) + ".bin";
+    EXPECT_EQ(lengths[r], std::filesystem::file_size(file));
+    std::vector<char> buf(frameSize + 200);
+    FileUtils::read(file, 3 * frameSize - 100, buf.data(), buf.size());
+    EXPECT_EQ(std::memcmp(buf.data(), regions[r].data() + 3 * frameSize - 100, buf.size()), 0);
+    FileUtils::remove(file);
+  }
+}
+
+TEST(AsyncSpillWriterTest, OpenFailureThrows) {
+  AsyncSpillWriter writer(1, 4096);
+  std::vector<char> data(100);
+  EXPECT_THROW(writer.submit("./no_such_dir/x.bin", data.data(), data.size(),
+                             CompressionType::Zstd, 4096, nullptr),
+               std::runtime_error);
+  EXPECT_EQ(writer.pendingFiles(), 0);
+}
+
+TEST(AsyncSpillWriterTest, WriteIntoExtentOfOpenFile) {
+  const memSize frameSize = 4096;
+  AsyncSpillWriter writer(2, frameSize);
+  std::vector<char> data(3 * frameSize + 10);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i % 7);
+  }
+  std::string fileName = "./test_async_spill_extent.bin";
+  int fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+  const uint64_t base = 3 * 4096;
+  memSize written = 0;
+  writer.submit(fd, base, data.data(), data.size(), CompressionType::Zstd,
+                frameSize, [&written](bool ok, memSize length) {
+                  EXPECT_TRUE(ok);
+                  written = length;
+                });
+  writer.drain();
+  EXPECT_GT(written, 0u);
+  EXPECT_LE(written, FileUtils::maxFramedSize(data.size(), frameSize));
+
+  auto file = FileUtils::open(fileName, fd, -1, base, written);
+  std::vector<char> buf(frameSize);
+  FileUtils::read(*file, frameSize + 5, buf.data(), buf.size());
+  EXPECT_EQ(std::memcmp(buf.data(), data.data() + frameSize + 5, buf.size()),
+            0);
+  close(fd);
+  FileUtils::remove(fileName);
+}
+
+TEST(AsyncSpillWriterTest, AdaptiveRecordsCodecStatistics) {
+  const memSize frameSize = 4096;
+  Statistics stats;
+  AsyncSpillWriter writer(2, frameSize, &stats);
+  std::vector<char> data(4 * frameSize);
+  uint32_t seed = 1;
+  for (memSize i = 0; i < 2 * frameSize; ++i) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = static_cast<char>(seed >> 24);
+  }
+  std::string file = "./test_async_spill_adaptive.bin";
+  bool ok = false;
+  writer.submit(file, data.data(), data.size(), CompressionType::Adaptive,
+                frameSize, [&ok](bool success, memSize) { ok = success; });
+  writer.drain();
+  EXPECT_TRUE(ok);
+  // The random half is stored raw, the zero half compressed.
+  EXPECT_EQ(stats.codecFrames[CompressionType::None], 2);
+  EXPECT_EQ(stats.codecFrames[CompressionType::Zstd] +
+                stats.codecFrames[CompressionType::Lz4],
+            2);
+  EXPECT_EQ(stats.compressionRatio(CompressionType::None), 1.0);
+  EXPECT_LT(stats.compressionRatio(), 0.6);
+  EXPECT_GT(stats.codecSelectNanos, 0);
+
+  auto spillFile = FileUtils::open(file);
+  std::vector<char> buf(data.size());
+  FileUtils::read(*spillFile, 0, buf.data(), buf.size());
+  EXPECT_EQ(std::memcmp(buf.data(), data.data(), buf.size()), 0);
+  FileUtils::remove(file);
+}
+
+TEST(AsyncSpillWriterTest, ParallelCompressionKeepsFrameOrder) {
+  const memSize frameSize = 4096;
+  Statistics stats;
+  AsyncSpillWriter writer(2, frameSize, &stats, 3);
+  std::vector<char> data(40 * frameSize + 123);
+  for (size_t i = 0; i < data.size(); ++i) {
+    // Frames differ in how well they compress.
+    data[i] = static_cast<char>((i / ((i / frameSize) % 5 + 1)) % 256);
+  }
+  int done = 0;
+  for (auto type : {CompressionType::Zstd, CompressionType::Lz4,
+                    CompressionType::Adaptive}) {
+    std::string file =
+        "./test_async_spill_parallel_" + std::to_string(type) + ".bin";
+    writer.submit(file, data.data(), data.size(), type, frameSize,
+                  [&done](bool ok, memSize) {
+                    EXPECT_TRUE(ok);
+                    done++;
+                  });
+  }
+  writer.drain();
+  EXPECT_EQ(done, 3);
+  uint64_t frames = 0;
+  for (int i = 0; i < Statistics::kCodecCount; ++i) {
+    frames += stats.codecFrames[i];
+  }
+  EXPECT_EQ(frames, 3 * 41);
+
+  for (auto type : {CompressionType::Zstd, CompressionType::Lz4,
+                    CompressionType::Adaptive}) {
+    std::string file =
+        "./test_async_spill_parallel_" + std::to_string(type) + ".bin";
+    auto spillFile = FileUtils::open(file);
+    EXPECT_EQ(spillFile->footer.frameCount, 41);
+    std::vector<char> buf(data.size());
+    FileUtils::read(*spillFile, 0, buf.data(), buf.size());
+    EXPECT_EQ(std::memcmp(buf.data(), data.data(), buf.size()), 0);
+    FileUtils::remove(file);
+  }
+}
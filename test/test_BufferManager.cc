@@ -1,7 +1,20 @@
 #include "BufferManager.h"
 #include "Conf.h"
 #include <gtest/gtest.h>
+#include <chrono>
 #include <cstring>
+#include <thread>
+
+// A spill still writing a region holds a reference to it, the quota comes
+// back once that write is done.
+static memSize usedOnceSettled(const QuotaPoolPtr &pool, memSize expected) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (pool->used() != expected &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return pool->used();
+}
 
 TEST(BufferManagerTest, AcquireMemory) {
   Config conf{.spillDir = "./spill_bufmgr", .quota = 2 * kPageSize};
@@ -13,3 +26,67 @@ TEST(BufferManagerTest, AcquireMemory) {
   std::string s(m1->address(), 16);
   EXPECT_FALSE(s.empty());
 }
+
+TEST(BufferManagerTest, QuotaFollowsRegionLifetime) {
+  const memSize pageSize = 64 * 1024;
+  Config conf{.spillDir = "./spill_bufmgr_pools",
+              .quota = 8 * pageSize,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  auto op = mgr.quotaPool()->createChild("operator", 4 * pageSize);
+  auto mem = mgr.accquireMemory(3 * pageSize + 1, pageSize, op);
+  // Charged in whole pages.
+  EXPECT_EQ(op->used(), 4 * pageSize);
+  // Room is made by spilling the first region, the process has plenty.
+  auto more = mgr.accquireMemory(2 * pageSize, pageSize, op);
+  EXPECT_LE(op->used(), 4 * pageSize);
+  EXPECT_THROW(mgr.accquireMemory(5 * pageSize, pageSize, op),
+               std::runtime_error);
+  mem.reset();
+  EXPECT_EQ(usedOnceSettled(op, 2 * pageSize), 2 * pageSize);
+  more.reset();
+  EXPECT_EQ(usedOnceSettled(op, 0), 0);
+  EXPECT_EQ(usedOnceSettled(mgr.quotaPool(), 0), 0);
+}
+
+TEST(BufferManagerTest, MetricsCoverFaultAndSpill) {
+  const memSize pageSize = 64 * 1024;
+  Config conf{.spillDir = "./spill_bufmgr_metrics",
+              .quota = 4 * pageSize,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  auto first = mgr.accquireMemory(2 * pageSize, pageSize);
+  for (memSize i = 0; i < first->size(); ++i) {
+    first->address()[i] = static_cast<char>(i % 251);
+  }
+  // Only fits once the first region is spilled.
+  auto second = mgr.accquireMemory(3 * pageSize, pageSize);
+  for (memSize i = 0; i < first->size(); ++i) {
+    ASSERT_EQ(first->address()[i], static_cast<char>(i % 251));
+  }
+
+  MetricsSnapshot m = mgr.metrics();
+  EXPECT_GT(m.value("buffer_manager_page_faults_total"), 0);
+  EXPECT_GT(m.value("buffer_manager_process_rss_bytes"), 0);
+  EXPECT_EQ(m.value("buffer_manager_region_bytes"), 5 * pageSize);
+  EXPECT_GT(m.value("buffer_manager_spill_file_bytes"), 0);
+  EXPECT_GE(m.value("buffer_manager_compression_ratio", "zstd"), 0);
+  for (const char *name :
+       {"buffer_manager_fault_seconds", "buffer_manager_fault_lookup_seconds",
+        "buffer_manager_fault_read_seconds",
+        "buffer_manager_fault_copy_seconds", "buffer_manager_spill_seconds",
+        "buffer_manager_spill_write_bytes",
+        "buffer_manager_quota_wait_seconds"}) {
+    ASSERT_NE(m.histogram(name), nullptr) << name;
+    EXPECT_GT(m.histogram(name)->count, 0) << name;
+  }
+  std::string text = m.toPrometheus();
+  EXPECT_NE(text.find("# TYPE buffer_manager_fault_seconds summary"),
+            std::string::npos);
+  EXPECT_NE(text.find("buffer_manager_spill_frames_total{codec=\"zstd\"}"),
+            std::string::npos);
+  std::string json = m.toJson();
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_NE(json.find("\"buffer_manager_fault_copy_seconds\":{\"count\":"),
+            std::string::npos);
+}
@@ -3,6 +3,23 @@
 #include <vector>
 #include <cstring>
 #include <sstream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+// Counts allocations through operator new, for the steady state tests.
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = std::malloc(size == 0 ? 1 : size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
 
 TEST(CompressionTest, NoneRoundTrip) {
   std::vector<char> data(1024);
@@ -97,3 +114,62 @@ TEST(CompressionTest, StreamInvalidRangeNone) {
   std::vector<char> out(100);
   EXPECT_THROW(decompressFromStreamToRange(iss, CompressionType::None, data.size(), 950, out.data(), 100), std::runtime_error);
 }
+
+TEST(CompressionTest, ContextRoundTrip) {
+  std::vector<char> data(100000);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>((i / 7) % 256);
+  CompressionContext ctx;
+  for (auto type : {CompressionType::None, CompressionType::Zstd, CompressionType::Lz4}) {
+    std::vector<char> comp(compressBound(data.size(), type));
+    size_t n = ctx.compress(data.data(), data.size(), comp.data(), comp.size(), type);
+    std::vector<char> out(data.size());
+    ctx.decompress(comp.data(), n, out.data(), out.size(), type);
+    EXPECT_EQ(0, std::memcmp(data.data(), out.data(), data.size()));
+  }
+}
+
+TEST(CompressionTest, ContextBufferGrowsOnly) {
+  CompressionContext ctx;
+  char *small = ctx.buffer(CompressionContext::kFrameBuffer, 100);
+  EXPECT_EQ(small, ctx.buffer(CompressionContext::kFrameBuffer, 50));
+  char *large = ctx.buffer(CompressionContext::kFrameBuffer, 1 << 20);
+  EXPECT_EQ(large, ctx.buffer(CompressionContext::kFrameBuffer, 100));
+  EXPECT_NE(large, ctx.buffer(CompressionContext::kInputBuffer, 100));
+}
+
+TEST(CompressionTest, SteadyStateAllocatesNothing) {
+  std::vector<char> data(65536);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>((i * 13) % 97);
+  std::vector<char> out(data.size());
+  for (auto type : {CompressionType::Zstd, CompressionType::Lz4}) {
+    auto &ctx = CompressionContext::local();
+    std::vector<char> comp(compressBound(data.size(), type));
+    // Warm up, the codec state and buffers are created here.
+    size_t n = ctx.compress(data.data(), data.size(), comp.data(), comp.size(), type);
+    ctx.decompress(comp.data(), n, out.data(), out.size(), type);
+    size_t before = allocations.load();
+    for (int i = 0; i < 10; ++i) {
+      n = compressBuffer(data.data(), data.size(), comp.data(), comp.size(), type);
+      decompressBuffer(comp.data(), n, out.data(), out.size(), type);
+    }
+    EXPECT_EQ(before, allocations.load());
+    EXPECT_EQ(0, std::memcmp(data.data(), out.data(), data.size()));
+  }
+}
+
+TEST(CompressionTest, ChooseCodec) {
+  std::vector<char> random(65536);
+  std::mt19937 rng(7);
+  for (auto &c : random) c = static_cast<char>(rng());
+  EXPECT_EQ(chooseCodec(random.data(), random.size()).type, CompressionType::None);
+
+  std::vector<char> zeros(65536, 0);
+  CodecChoice choice = chooseCodec(zeros.data(), zeros.size());
+  EXPECT_NE(choice.type, CompressionType::None);
+
+  EXPECT_EQ(chooseCodec(random.data(), 0).type, CompressionType::None);
+  EXPECT_EQ(chooseCodec(random.data(), 10).type, CompressionType::None);
+  EXPECT_EQ(compressBound(1000, CompressionType::Adaptive),
+            std::max(compressBound(1000, CompressionType::Zstd),
+                     compressBound(1000, CompressionType::Lz4)));
+}
@@ -0,0 +1,69 @@
+#include "EvictionPolicy.h"
+#include <gtest/gtest.h>
+
+static char regions[4];
+
+TEST(EvictionPolicyTest, FifoRotatesEvictedRegions) {
+  auto policy = createEvictionPolicy(EvictionPolicyType::Fifo);
+  for (int i = 0; i < 3; ++i) {
+    policy->add(&regions[i], kPageSize);
+  }
+  policy->recordAccess(&regions[0]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[0], &regions[1], &regions[2]}));
+  policy->recordEviction(&regions[0]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[1], &regions[2], &regions[0]}));
+  policy->remove(&regions[2]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[1], &regions[0]}));
+}
+
+TEST(EvictionPolicyTest, LruEvictsLeastRecentlyFaulted) {
+  auto policy = createEvictionPolicy(EvictionPolicyType::Lru);
+  for (int i = 0; i < 3; ++i) {
+    policy->add(&regions[i], kPageSize);
+  }
+  policy->recordAccess(&regions[0]);
+  policy->recordEviction(&regions[1]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[1], &regions[2], &regions[0]}));
+}
+
+TEST(EvictionPolicyTest, ClockGivesSecondChance) {
+  auto policy = createEvictionPolicy(EvictionPolicyType::Clock);
+  for (int i = 0; i < 3; ++i) {
+    policy->add(&regions[i], kPageSize);
+  }
+  // New regions start referenced, the first turn only clears the bits.
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[0], &regions[1], &regions[2]}));
+  policy->recordAccess(&regions[0]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[1], &regions[2], &regions[0]}));
+  // The hand moves past the last evicted region.
+  policy->recordEviction(&regions[1]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[2], &regions[0], &regions[1]}));
+  policy->remove(&regions[2]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[0], &regions[1]}));
+}
+
+TEST(EvictionPolicyTest, CostAwarePrefersRegionsOnDisk) {
+  auto policy = createEvictionPolicy(EvictionPolicyType::CostAware);
+  for (int i = 0; i < 3; ++i) {
+    policy->add(&regions[i], kPageSize);
+  }
+  // Evicting a region without a spill file costs a write.
+  policy->recordSpillFile(&regions[1], kPageSize / 2);
+  policy->recordSpillFile(&regions[2], kPageSize / 2);
+  EXPECT_EQ(policy->victims().back(), &regions[0]);
+  // A fresh fault makes reading it back likely.
+  policy->recordAccess(&regions[2]);
+  EXPECT_EQ(policy->victims(),
+            (std::vector<char *>{&regions[1], &regions[2], &regions[0]}));
+  // Better compression makes it cheaper to bring back.
+  policy->recordSpillFile(&regions[2], kPageSize / 64);
+  EXPECT_EQ(policy->victims().front(), &regions[2]);
+}
@@ -0,0 +1,253 @@
+#include "ExternalSorter.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+static constexpr memSize kSortPage = 64 * 1024;
+
+TEST(ExternalSorterTest, SortsAcrossSpilledRuns) {
+  Config conf{.spillDir = "./spill_sorter",
+              .quota = 64 * 1024 * 1024L,
+              .compressionType = CompressionType::Lz4};
+  BufferManager mgr(conf);
+  const memSize budget = 2 * 1024 * 1024L;
+  ExternalSorter<int64_t> sorter(mgr, budget, {}, {.pageSize = kSortPage});
+
+  std::mt19937_64 rng(7);
+  std::vector<int64_t> input(1500000);
+  for (auto &v : input) {
+    v = static_cast<int64_t>(rng());
+  }
+  // Single records and batches.
+  sorter.add(input[0]);
+  sorter.add(input.data() + 1, input.size() - 1);
+  EXPECT_EQ(sorter.recordCount(), input.size());
+  EXPECT_EQ(sorter.runCount(), 12);
+
+  std::vector<int64_t> output;
+  sorter.finish([&](const int64_t *records, size_t count) {
+    EXPECT_LE(count, kDefaultSortOutputBatch);
+    output.insert(output.end(), records, records + count);
+  });
+  std::sort(input.begin(), input.end());
+  EXPECT_EQ(output, input);
+  // Older runs had to go to disk, all of the quota is back.
+  EXPECT_GT(mgr.spillStats().codecInputBytes[CompressionType::Lz4], 0);
+  EXPECT_EQ(sorter.pool()->used(), 0);
+  EXPECT_THROW(sorter.add(1), std::runtime_error);
+}
+
+struct Row {
+  uint32_t key;
+  uint32_t payload;
+};
+
+TEST(ExternalSorterTest, CustomOrderFromSource) {
+  Config conf{.spillDir = "./spill_sorter_rows",
+              .quota = 16 * 1024 * 1024L,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  auto byKeyDescending = [](const Row &a, const Row &b) {
+    return a.key > b.key;
+  };
+  ExternalSorter<Row, decltype(byKeyDescending)> sorter(
+      mgr, 1024 * 1024L, byKeyDescending,
+      {.pageSize = kSortPage, .runSize = 256 * 1024L, .outputBatch = 100});
+
+  uint32_t next = 0;
+  const uint32_t count = 200000;
+  sorter.addAll([&](Row &row) {
+    row = {next * 2654435761u, next};
+    return next++ < count;
+  });
+  EXPECT_EQ(sorter.recordCount(), count);
+
+  std::vector<Row> output;
+  sorter.finish([&](const Row *rows, size_t n) {
+    output.insert(output.end(), rows, rows + n);
+  });
+  ASSERT_EQ(output.size(), count);
+  EXPECT_TRUE(std::is_sorted(output.begin(), output.end(), byKeyDescending));
+  std::vector<bool> seen(count);
+  for (const Row &row : output) {
+    EXPECT_EQ(row.key, row.payload * 2654435761u);
+    seen[row.payload] = true;
+  }
+  EXPECT_EQ(std::count(seen.begin(), seen.end(), true), count);
+}
+
+TEST(ExternalSorterTest, EmptyAndInvalid) {
+  Config conf{.spillDir = "./spill_sorter_empty",
+              .quota = 4 * kSortPage,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  ExternalSorter<int64_t> sorter(mgr, 2 * kSortPage, {},
+                                 {.pageSize = kSortPage});
+  size_t emitted = 0;
+  sorter.finish([&](const int64_t *, size_t n) { emitted += n; });
+  EXPECT_EQ(emitted, 0);
+  EXPECT_EQ(sorter.runCount(), 0);
+  // Half the budget is less than a page.
+  EXPECT_THROW(ExternalSorter<int64_t>(mgr, kSortPage, {},
+                                       {.pageSize = kSortPage}),
+               std::runtime_error);
+  // Over the process pool.
+  EXPECT_THROW(ExternalSorter<int64_t>(mgr, 8 * kSortPage, {},
+                                       {.pageSize = kSortPage}),
+               std::runtime_error);
+}
+
+TEST(ExternalSorterTest, RadixRunSorts) {
+  Config conf{.spillDir = "./spill_sorter_radix",
+              .quota = 64 * 1024 * 1024L,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  std::mt19937_64 rng(11);
+  std::vector<double> input(600000);
+  for (auto &v : input) {
+    v = static_cast<double>(static_cast<int64_t>(rng())) / 1e9;
+  }
+  std::vector<double> expected = input;
+  std::sort(expected.begin(), expected.end());
+  for (RunSort runSort : {RunSort::Auto, RunSort::Comparison,
+                          RunSort::RadixInPlace, RunSort::RadixPingPong}) {
+    ExternalSorter<double> sorter(
+        mgr, 2 * 1024 * 1024L, {},
+        {.pageSize = kSortPage, .runSort = runSort, .sortThreads = 2});
+    sorter.add(input.data(), input.size());
+    std::vector<double> output;
+    sorter.finish([&](const double *records, size_t count) {
+      output.insert(output.end(), records, records + count);
+    });
+    EXPECT_EQ(output, expected) << static_cast<int>(runSort);
+    EXPECT_EQ(sorter.pool()->used(), 0);
+  }
+  // Two runs don't fit.
+  EXPECT_THROW(ExternalSorter<double>(mgr, 2 * 1024 * 1024L, {},
+                                      {.pageSize = kSortPage,
+                                       .runSize = 1536 * 1024L,
+                                       .runSort = RunSort::RadixPingPong}),
+               std::runtime_error);
+  // No digits for a custom order.
+  EXPECT_THROW((ExternalSorter<double, std::greater<double>>(
+                   mgr, 2 * 1024 * 1024L, {},
+                   {.pageSize = kSortPage, .runSort = RunSort::RadixInPlace})),
+               std::runtime_error);
+}
+
+TEST(ExternalSorterTest, ReplacementSelectionRuns) {
+  Config conf{.spillDir = "./spill_sorter_selection",
+              .quota = 64 * 1024 * 1024L,
+              .compressionType = CompressionType::Lz4};
+  BufferManager mgr(conf);
+  const memSize budget = 2 * 1024 * 1024L;
+  std::mt19937_64 rng(5);
+  std::vector<int64_t> random(1500000);
+  for (auto &v : random) {
+    v = static_cast<int64_t>(rng());
+  }
+  std::vector<int64_t> sorted = random;
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<int64_t> reversed(sorted.rbegin(), sorted.rend());
+
+  auto sort = [&](const std::vector<int64_t> &input, RunSort runSort) {
+    ExternalSorter<int64_t> sorter(
+        mgr, budget, {},
+        {.pageSize = kSortPage,
+         .runGeneration = RunGeneration::ReplacementSelection,
+         .runSort = runSort});
+    // Odd batches, so that batches of the workspace end anywhere.
+    for (size_t i = 0; i < input.size(); i += 9999) {
+      sorter.add(input.data() + i, std::min<size_t>(9999, input.size() - i));
+    }
+    size_t runs = sorter.runCount();
+    std::vector<int64_t> output;
+    sorter.finish([&](const int64_t *records, size_t count) {
+      output.insert(output.end(), records, records + count);
+    });
+    EXPECT_EQ(output, sorted);
+    EXPECT_EQ(sorter.pool()->used(), 0);
+    return runs;
+  };
+  // Blocks of half the budget give 12 runs, runs about twice the workspace
+  // give 4.
+  size_t runs = sort(random, RunSort::Auto);
+  EXPECT_GE(runs, 3);
+  EXPECT_LE(runs, 4);
+  EXPECT_EQ(sort(random, RunSort::RadixInPlace), runs);
+  EXPECT_EQ(sort(sorted, RunSort::Auto), 1);
+  // The worst case, every run is only the workspace.
+  EXPECT_LE(sort(reversed, RunSort::Auto), 8);
+}
+
+TEST(ExternalSorterTest, ReplacementSelectionCustomOrder) {
+  Config conf{.spillDir = "./spill_sorter_selection_rows",
+              .quota = 16 * 1024 * 1024L,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  auto byKeyDescending = [](const Row &a, const Row &b) {
+    return a.key > b.key;
+  };
+  ExternalSorter<Row, decltype(byKeyDescending)> sorter(
+      mgr, 1024 * 1024L, byKeyDescending,
+      {.pageSize = kSortPage, .outputBatch = 100,
+       .runGeneration = RunGeneration::ReplacementSelection});
+  const uint32_t count = 300000;
+  for (uint32_t i = 0; i < count; ++i) {
+    // Few distinct keys, ties across batches and runs.
+    sorter.add({(i * 2654435761u) % 1000, i});
+  }
+  std::vector<Row> output;
+  sorter.finish([&](const Row *rows, size_t n) {
+    EXPECT_LE(n, 100);
+    output.insert(output.end(), rows, rows + n);
+  });
+  ASSERT_EQ(output.size(), count);
+  EXPECT_TRUE(std::is_sorted(output.begin(), output.end(), byKeyDescending));
+  std::vector<bool> seen(count);
+  for (const Row &row : output) {
+    EXPECT_EQ(row.key, (row.payload * 2654435761u) % 1000);
+    seen[row.payload] = true;
+  }
+  EXPECT_EQ(std::count(seen.begin(), seen.end(), true), count);
+  // The budget can't hold a run region and a workspace.
+  EXPECT_THROW((ExternalSorter<Row, decltype(byKeyDescending)>(
+                   mgr, kSortPage, byKeyDescending,
+                   {.pageSize = kSortPage,
+                    .runGeneration = RunGeneration::ReplacementSelection})),
+               std::runtime_error);
+}
+
+TEST(ExternalSorterTest, ParallelMerge) {
+  Config conf{.spillDir = "./spill_sorter_parallel",
+              .quota = 64 * 1024 * 1024L,
+              .compressionType = CompressionType::Lz4};
+  BufferManager mgr(conf);
+  std::mt19937_64 rng(13);
+  std::vector<int64_t> input(1500000);
+  for (auto &v : input) {
+    // Ties across runs.
+    v = static_cast<int64_t>(rng() % 100000);
+  }
+  std::vector<int64_t> expected = input;
+  std::sort(expected.begin(), expected.end());
+  for (RunGeneration generation :
+       {RunGeneration::Blocks, RunGeneration::ReplacementSelection}) {
+    ExternalSorter<int64_t> sorter(mgr, 2 * 1024 * 1024L, {},
+                                   {.pageSize = kSortPage,
+                                    .runGeneration = generation,
+                                    .mergeThreads = 4});
+    sorter.add(input.data(), input.size());
+    std::vector<int64_t> output;
+    sorter.finish([&](const int64_t *records, size_t count) {
+      EXPECT_LE(count, kDefaultSortOutputBatch);
+      output.insert(output.end(), records, records + count);
+    });
+    EXPECT_EQ(output, expected) << static_cast<int>(generation);
+    EXPECT_EQ(sorter.pool()->used(), 0);
+  }
+}
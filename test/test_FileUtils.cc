@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include <cstring>
 #include <filesystem>
+#include <random>
 #include <vector>
 
 TEST(FileUtilsTest, WriteReadRemove) {
@@ -54,3 +55,102 @@ TEST(FileUtilsTest, WriteReadCompressedLz4) {
   FileUtils::remove(file);
   EXPECT_FALSE(std::filesystem::exists(file));
 }
+
+TEST(FileUtilsTest, FramedReadAcrossFrames) {
+  std::string file = "./test_fileutils_frames.bin";
+  std::vector<char> data(10000);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>((i / 3) % 256);
+  for (auto type : {CompressionType::None, CompressionType::Zstd, CompressionType::Lz4}) {
+    FileUtils::write(file, data.data(), data.size(), type, 1024);
+    std::vector<char> part(3000);
+    FileUtils::read(file, 1000, part.data(), part.size());
+    EXPECT_EQ(std::memcmp(part.data(), data.data() + 1000, part.size()), 0);
+    std::vector<char> tail(data.size() - 9216);
+    FileUtils::read(file, 9216, tail.data(), tail.size());
+    EXPECT_EQ(std::memcmp(tail.data(), data.data() + 9216, tail.size()), 0);
+    EXPECT_THROW(FileUtils::read(file, 9000, part.data(), 2000), std::runtime_error);
+    FileUtils::remove(file);
+  }
+}
+
+TEST(FileUtilsTest, FramedIncompressibleStoredRaw) {
+  std::string file = "./test_fileutils_raw.bin";
+  std::vector<char> data(8192);
+  uint32_t x = 12345;
+  for (auto &c : data) {
+    x = x * 1103515245 + 12345;
+    c = static_cast<char>(x >> 16);
+  }
+  FileUtils::write(file, data.data(), data.size(), CompressionType::Zstd, 4096);
+  EXPECT_LE(std::filesystem::file_size(file),
+            data.size() + sizeof(FileMeta) + 2 * sizeof(FrameEntry) + sizeof(FrameFooter));
+  std::vector<char> buf(4096);
+  FileUtils::read(file, 2048, buf.data(), buf.size());
+  EXPECT_EQ(std::memcmp(buf.data(), data.data() + 2048, buf.size()), 0);
+  FileUtils::remove(file);
+}
+
+TEST(FileUtilsTest, ReadLegacyStreamFile) {
+  std::string file = "./test_fileutils_v1.bin";
+  std::vector<char> data(4096);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>((i * 7) % 256);
+  {
+    std::ofstream out(file, std::ios::binary);
+    FileMeta meta{0x53554C46, 1, static_cast<uint16_t>(CompressionType::Zstd), data.size(), 0};
+    out.write(reinterpret_cast<const char *>(&meta), sizeof(meta));
+    compressToStream(data.data(), data.size(), CompressionType::Zstd, out);
+  }
+  std::vector<char> buf(1000);
+  FileUtils::read(file, 3000, buf.data(), buf.size());
+  EXPECT_EQ(std::memcmp(buf.data(), data.data() + 3000, buf.size()), 0);
+  FileUtils::remove(file);
+}
+
+TEST(FileUtilsTest, OpenSpillFileAndRead) {
+  std::string file = "./test_fileutils_open.bin";
+  std::vector<char> data(6000);
+  for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<char>((i * 3) % 256);
+  FileUtils::write(file, data.data(), data.size(), CompressionType::Lz4, 1000);
+  auto spillFile = FileUtils::open(file);
+  EXPECT_EQ(spillFile->footer.frameCount, 6);
+  EXPECT_EQ(spillFile->meta.originalSize, data.size());
+  std::vector<char> buf(2500);
+  FileUtils::read(*spillFile, 1500, buf.data(), buf.size());
+  EXPECT_EQ(std::memcmp(buf.data(), data.data() + 1500, buf.size()), 0);
+  EXPECT_THROW(FileUtils::read(*spillFile, 5000, buf.data(), buf.size()), std::runtime_error);
+  FileUtils::remove(file);
+}
+
+TEST(FileUtilsTest, AdaptiveCodecPerFrame) {
+  std::string file = "./test_fileutils_adaptive.bin";
+  const memSize frameSize = 65536;
+  std::vector<char> data(3 * frameSize);
+  std::mt19937_64 rng(42);
+  for (memSize i = 0; i < frameSize; i += sizeof(uint64_t)) {
+    uint64_t v = rng();
+    std::memcpy(data.data() + i, &v, sizeof(v));
+  }
+  // A sorted run of int64 keys, then plain text.
+  uint64_t key = 0;
+  for (memSize i = frameSize; i < 2 * frameSize; i += sizeof(uint64_t)) {
+    key += rng() % 1000;
+    std::memcpy(data.data() + i, &key, sizeof(key));
+  }
+  const char *text = "the quick brown fox jumps over the lazy dog ";
+  for (memSize i = 2 * frameSize; i < data.size(); ++i) {
+    data[i] = text[i % std::strlen(text)];
+  }
+  FileUtils::write(file, data.data(), data.size(), CompressionType::Adaptive,
+                   frameSize);
+  auto spillFile = FileUtils::open(file);
+  ASSERT_EQ(spillFile->entries.size(), 3);
+  EXPECT_EQ(spillFile->entries[0].method, CompressionType::None);
+  EXPECT_NE(spillFile->entries[1].method, CompressionType::None);
+  EXPECT_LT(spillFile->entries[1].compressedSize, frameSize);
+  EXPECT_NE(spillFile->entries[2].method, CompressionType::None);
+  EXPECT_LT(spillFile->entries[2].compressedSize, frameSize / 10);
+  std::vector<char> buf(data.size());
+  FileUtils::read(*spillFile, 0, buf.data(), buf.size());
+  EXPECT_EQ(std::memcmp(buf.data(), data.data(), buf.size()), 0);
+  FileUtils::remove(file);
+}
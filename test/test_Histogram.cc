@@ -0,0 +1,101 @@
+#include "Histogram.h"
+#include "Metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <thread>
+#include <vector>
+
+TEST(HistogramTest, BucketsCoverValues) {
+  for (uint64_t v : std::vector<uint64_t>{0, 1, 31, 32, 33, 1000, 123456789,
+                                          Histogram::kMaxValue}) {
+    size_t bucket = Histogram::bucketOf(v);
+    ASSERT_LT(bucket, Histogram::kBucketCount);
+    EXPECT_LE(Histogram::bucketLow(bucket), v);
+    EXPECT_GE(Histogram::bucketHigh(bucket), v);
+    // Within 1/16 of the value.
+    EXPECT_LE(Histogram::bucketHigh(bucket) - Histogram::bucketLow(bucket),
+              v / 16);
+  }
+  for (size_t b = 1; b < Histogram::kBucketCount; ++b) {
+    EXPECT_EQ(Histogram::bucketLow(b), Histogram::bucketHigh(b - 1) + 1);
+  }
+  EXPECT_EQ(Histogram::bucketOf(UINT64_MAX), Histogram::kBucketCount - 1);
+}
+
+TEST(HistogramTest, Percentiles) {
+  Histogram h;
+  EXPECT_EQ(h.snapshot().percentile(0.5), 0);
+  for (uint64_t v = 1; v <= 10000; ++v) {
+    h.record(v);
+  }
+  auto s = h.snapshot();
+  EXPECT_EQ(s.count, 10000);
+  EXPECT_EQ(s.sum, 10000ULL * 10001 / 2);
+  EXPECT_EQ(s.max, 10000);
+  EXPECT_NEAR(s.percentile(0.5), 5000, 5000 / 16);
+  EXPECT_NEAR(s.percentile(0.99), 9900, 9900 / 16);
+  EXPECT_EQ(s.percentile(1.0), 10000);
+  EXPECT_DOUBLE_EQ(s.mean(), 5000.5);
+}
+
+TEST(HistogramTest, ThreadsMergeOnRead) {
+  Histogram h;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 12; ++t) {
+    threads.emplace_back([&h, t]() {
+      for (int i = 0; i < 10000; ++i) {
+        h.record(t * 100 + i % 100);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto s = h.snapshot();
+  EXPECT_EQ(s.count, 120000);
+  EXPECT_EQ(s.max, 1199);
+  uint64_t total = 0;
+  for (uint64_t c : s.counts) {
+    total += c;
+  }
+  EXPECT_EQ(total, s.count);
+}
+
+TEST(MetricsSnapshotTest, RendersPrometheusAndJson) {
+  Histogram h;
+  h.record(1000);
+  h.record(3000);
+  MetricsSnapshot m;
+  m.addCounter("faults_total", "Faults.", 3);
+  m.addGauge("ratio", "Ratio \"x\".", 0.5, {"codec", "zstd"});
+  m.addGauge("ratio", "Ratio \"x\".", 1, {"codec", "lz4"});
+  m.addHistogram("wait_seconds", "Wait.", h.snapshot(), 1e-9);
+
+  EXPECT_EQ(m.value("faults_total"), 3);
+  EXPECT_EQ(m.value("ratio", "lz4"), 1);
+  EXPECT_TRUE(std::isnan(m.value("missing")));
+  EXPECT_EQ(m.histogram("wait_seconds")->count, 2);
+
+  EXPECT_EQ(m.toPrometheus(),
+            "# HELP faults_total Faults.\n"
+            "# TYPE faults_total counter\n"
+            "faults_total 3\n"
+            "# HELP ratio Ratio \"x\".\n"
+            "# TYPE ratio gauge\n"
+            "ratio{codec=\"zstd\"} 0.5\n"
+            "ratio{codec=\"lz4\"} 1\n"
+            "# HELP wait_seconds Wait.\n"
+            "# TYPE wait_seconds summary\n"
+            "wait_seconds{quantile=\"0.5\"} 1.023e-06\n"
+            "wait_seconds{quantile=\"0.9\"} 3e-06\n"
+            "wait_seconds{quantile=\"0.99\"} 3e-06\n"
+            "wait_seconds{quantile=\"0.999\"} 3e-06\n"
+            "wait_seconds_sum 4e-06\n"
+            "wait_seconds_count 2\n");
+  EXPECT_EQ(m.toJson(),
+            "{\"faults_total\":3,\"ratio\":{\"zstd\":0.5,\"lz4\":1},"
+            "\"wait_seconds\":{\"count\":2,\"sum\":4e-06,\"max\":3e-06,"
+            "\"p50\":1.023e-06,\"p90\":3e-06,\"p99\":3e-06,\"p999\":3e-06}}");
+}
@@ -0,0 +1,176 @@
+#include "LoserTree.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+template <typename T>
+static std::vector<std::vector<T>> sortedRuns(size_t fanIn, size_t maxLength,
+                                              uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<std::vector<T>> runs(fanIn);
+  for (auto &run : runs) {
+    run.resize(rng() % (maxLength + 1));
+    for (auto &v : run) {
+      // Narrow range, plenty of ties between runs.
+      v = static_cast<T>(rng() % 1000) - 500;
+    }
+    std::sort(run.begin(), run.end());
+  }
+  return runs;
+}
+
+template <typename T>
+static std::vector<MergeSource<T>> sourcesOf(const std::vector<std::vector<T>> &runs) {
+  std::vector<MergeSource<T>> sources;
+  for (const auto &run : runs) {
+    sources.push_back({run.data(), run.data() + run.size()});
+  }
+  return sources;
+}
+
+TEST(LoserTreeTest, InlineKeysMergeAnyFanIn) {
+  for (size_t fanIn : {1, 2, 3, 7, 64, 1000}) {
+    auto runs = sortedRuns<int64_t>(fanIn, 200, fanIn);
+    std::vector<int64_t> expected;
+    for (const auto &run : runs) {
+      expected.insert(expected.end(), run.begin(), run.end());
+    }
+    std::sort(expected.begin(), expected.end());
+
+    LoserTree<int64_t> tree(sourcesOf(runs));
+    std::vector<int64_t> merged(expected.size() + 1);
+    // Odd batch sizes so that batches end everywhere.
+    size_t total = 0;
+    while (size_t n = tree.pop(merged.data() + total, 37)) {
+      total += n;
+    }
+    merged.resize(total);
+    EXPECT_EQ(merged, expected) << "fanIn=" << fanIn;
+    EXPECT_TRUE(tree.empty());
+    for (size_t i = 0; i < fanIn; ++i) {
+      EXPECT_TRUE(tree.exhausted(i));
+    }
+  }
+}
+
+TEST(LoserTreeTest, InlineKeysKeepExtremes) {
+  std::vector<std::vector<int64_t>> signedRuns = {
+      {std::numeric_limits<int64_t>::min(), -1, 0},
+      {},
+      {-2, std::numeric_limits<int64_t>::max()}};
+  LoserTree<int64_t> signedTree(sourcesOf(signedRuns));
+  std::vector<int64_t> out;
+  while (!signedTree.empty()) {
+    out.push_back(signedTree.top());
+    signedTree.pop();
+  }
+  EXPECT_EQ(out, (std::vector<int64_t>{std::numeric_limits<int64_t>::min(),
+                                       -2, -1, 0,
+                                       std::numeric_limits<int64_t>::max()}));
+
+  // The largest key still beats an exhausted source.
+  const uint64_t max = std::numeric_limits<uint64_t>::max();
+  std::vector<std::vector<uint64_t>> unsignedRuns = {{max, max}, {0, max}};
+  LoserTree<uint64_t> unsignedTree(sourcesOf(unsignedRuns));
+  std::vector<uint64_t> merged(4);
+  // The batch ends where the first source runs out.
+  EXPECT_EQ(unsignedTree.pop(merged.data(), 10), 3);
+  EXPECT_TRUE(unsignedTree.exhausted(0));
+  EXPECT_EQ(unsignedTree.pop(merged.data() + 3, 10), 1);
+  EXPECT_EQ(merged, (std::vector<uint64_t>{0, max, max, max}));
+}
+
+// Each source comes in parts of 1 to 5 records, refilled as they run out.
+template <typename T, typename Compare = std::less<T>>
+static void checkRefills(Compare compare = Compare()) {
+  auto runs = sortedRuns<T>(13, 300, 5);
+  std::vector<T> expected;
+  for (auto &run : runs) {
+    std::sort(run.begin(), run.end(), compare);
+    expected.insert(expected.end(), run.begin(), run.end());
+  }
+  std::stable_sort(expected.begin(), expected.end(), compare);
+
+  std::vector<size_t> next(runs.size());
+  auto part = [&](size_t r) {
+    const T *begin = runs[r].data() + next[r];
+    next[r] = std::min(runs[r].size(), next[r] + 1 + next[r] % 5);
+    return MergeSource<T>{begin, runs[r].data() + next[r]};
+  };
+  std::vector<MergeSource<T>> sources;
+  for (size_t r = 0; r < runs.size(); ++r) {
+    sources.push_back(part(r));
+  }
+  LoserTree<T, Compare> tree(sources, compare);
+  std::vector<T> merged;
+  std::vector<T> batch(64);
+  while (size_t n = tree.pop(batch.data(), batch.size())) {
+    merged.insert(merged.end(), batch.begin(), batch.begin() + n);
+    for (size_t r = 0; r < runs.size(); ++r) {
+      if (tree.exhausted(r) && next[r] < runs[r].size()) {
+        EXPECT_EQ(tree.position(r), runs[r].data() + next[r]);
+        MergeSource<T> s = part(r);
+        tree.refill(r, s.begin, s.end);
+      }
+    }
+  }
+  EXPECT_EQ(merged, expected);
+}
+
+TEST(LoserTreeTest, RefillsSourcesInParts) {
+  checkRefills<int64_t>();
+  checkRefills<int32_t, std::greater<int32_t>>();
+}
+
+struct Keyed {
+  int32_t key;
+  int32_t source;
+};
+
+TEST(LoserTreeTest, ComparatorTiesInSourceOrder) {
+  std::mt19937_64 rng(3);
+  std::vector<std::vector<Keyed>> runs(9);
+  size_t total = 0;
+  for (size_t s = 0; s < runs.size(); ++s) {
+    runs[s].resize(rng() % 50);
+    for (auto &k : runs[s]) {
+      k = {static_cast<int32_t>(rng() % 10), static_cast<int32_t>(s)};
+    }
+    // Descending keys.
+    std::sort(runs[s].begin(), runs[s].end(),
+              [](const Keyed &a, const Keyed &b) { return a.key > b.key; });
+    total += runs[s].size();
+  }
+  auto descending = [](const Keyed &a, const Keyed &b) {
+    return a.key > b.key;
+  };
+  LoserTree<Keyed, decltype(descending)> tree(sourcesOf(runs), descending);
+  std::vector<Keyed> out;
+  while (!tree.empty()) {
+    EXPECT_EQ(static_cast<int32_t>(tree.topSource()), tree.top().source);
+    out.push_back(tree.top());
+    tree.pop();
+  }
+  ASSERT_EQ(out.size(), total);
+  for (size_t i = 1; i < out.size(); ++i) {
+    ASSERT_GE(out[i - 1].key, out[i].key);
+    if (out[i - 1].key == out[i].key) {
+      EXPECT_LE(out[i - 1].source, out[i].source);
+    }
+  }
+}
+
+TEST(LoserTreeTest, NoSources) {
+  LoserTree<int64_t> inlineTree({});
+  EXPECT_TRUE(inlineTree.empty());
+  auto greater = std::greater<int32_t>();
+  LoserTree<int32_t, std::greater<int32_t>> tree({}, greater);
+  EXPECT_TRUE(tree.empty());
+  int32_t out;
+  EXPECT_EQ(tree.pop(&out, 1), 0);
+}
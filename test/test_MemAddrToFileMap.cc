@@ -7,13 +7,14 @@ TEST(MemAddrToFileMapTest, SetGetErase) {
   char *addr = &a;
 
   EXPECT_FALSE(map.get(addr).has_value());
-  map.set(addr, "x.bin");
-  EXPECT_EQ(map.get(addr).value(), "x.bin");
+  map.set(addr, {1, 8192, 4096});
+  auto extent = map.get(addr);
+  ASSERT_TRUE(extent.has_value());
+  EXPECT_EQ(extent->segmentId, 1u);
+  EXPECT_EQ(extent->offset, 8192u);
+  EXPECT_EQ(extent->length, 4096u);
 
-  {
-    std::ofstream ofs("x.bin", std::ios::binary);
-    ofs << "data";
-  }
-  map.erase(addr);
+  EXPECT_EQ(map.erase(addr).offset, 8192u);
   EXPECT_FALSE(map.get(addr).has_value());
+  EXPECT_THROW(map.erase(addr), std::runtime_error);
 }
@@ -1,6 +1,9 @@
 #include "MemRegions.h"
 #include <gtest/gtest.h>
+#include <atomic>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
 TEST(MemRegionsTest, AddFindRemove) {
   MemRegions regions;
@@ -74,3 +77,51 @@ TEST(MemRegionsTest, ManyRegionsCorrectness) {
   }
   EXPECT_THROW(regions.findStart(buffer + 1024), std::runtime_error);
 }
+
+TEST(MemRegionsTest, FindKeepsPageSize) {
+  MemRegions regions;
+  char buffer[1024];
+  regions.add(buffer, 512, 4096);
+  regions.add(buffer + 512, 512);
+  EXPECT_EQ(regions.find(buffer + 10).pageSize, 4096);
+  EXPECT_EQ(regions.find(buffer + 600).pageSize, kPageSize);
+  EXPECT_EQ(regions.find(buffer + 600).size, 512);
+}
+
+TEST(MemRegionsTest, ConcurrentFindDuringUpdates) {
+  MemRegions regions;
+  static char buffer[64 * 1024];
+  // Every even slot stays, odd slots come and go while readers run.
+  for (int i = 0; i < 1024; i += 2) {
+    regions.add(buffer + i * 64, 64, 4096);
+  }
+  std::atomic<bool> stop{false};
+  std::atomic<int64_t> errors{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&]() {
+      while (!stop.load()) {
+        for (int i = 0; i < 1024; i += 2) {
+          auto region = regions.find(buffer + i * 64 + 10);
+          if (region.start != buffer + i * 64 || region.pageSize != 4096) {
+            errors++;
+          }
+        }
+      }
+    });
+  }
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 1; i < 1024; i += 2) {
+      regions.add(buffer + i * 64, 64);
+    }
+    for (int i = 1; i < 1024; i += 2) {
+      EXPECT_TRUE(regions.remove(buffer + i * 64));
+    }
+  }
+  stop = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(errors.load(), 0);
+  EXPECT_EQ(regions.size(), 512u);
+}
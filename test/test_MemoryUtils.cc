@@ -5,3 +5,18 @@ TEST(MemoryUtilsTest, GetProcessRss) {
   auto rss = MemoryUtils::getProcessRss();
   EXPECT_GE(rss, 0);
 }
+
+TEST(MemoryUtilsTest, ResidentBytes) {
+  const int64_t page = MemoryUtils::systemPageSize();
+  char *addr = reinterpret_cast<char *>(mmap(nullptr, 4 * page,
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  ASSERT_NE(addr, MAP_FAILED);
+  addr[0] = 1;
+  addr[3 * page] = 1;
+  auto resident = MemoryUtils::residentBytes(addr, 4 * page, 2 * page);
+  ASSERT_EQ(resident.size(), 2u);
+  EXPECT_EQ(resident[0], page);
+  EXPECT_EQ(resident[1], page);
+  munmap(addr, 4 * page);
+}
@@ -11,3 +11,13 @@ TEST(MmapMemoryTest, AllocationAlignment) {
   std::memset(addr, 0xAB, mem.size());
   EXPECT_NE(addr, nullptr);
 }
+
+TEST(MmapMemoryTest, PerRegionPageSize) {
+  MmapMemory small(100 * 1024 + 1, 64 * 1024);
+  EXPECT_EQ(small.pageSize(), 64 * 1024);
+  EXPECT_EQ(small.size(), 2 * 64 * 1024);
+  EXPECT_THROW(MmapMemory(1024, 3000), std::runtime_error);
+  EXPECT_THROW(MmapMemory(1024, 2 * kMaxPageSize), std::runtime_error);
+  EXPECT_TRUE(isValidPageSize(kMinPageSize));
+  EXPECT_FALSE(isValidPageSize(kMinPageSize / 2));
+}
@@ -1,8 +1,12 @@
 #include "BufferManager.h"
+#include "MemoryUtils.h"
 #include "PageFaultHandler.h"
 #include "Spiller.h"
 #include <gtest/gtest.h>
+#include <atomic>
 #include <cstring>
+#include <thread>
+#include <vector>
 
 TEST(PageFaultHandlerTest, RegisterAndFault) {
   auto spiller = std::make_shared<Spiller>("./spill_pf", CompressionType::Zstd);
@@ -18,3 +22,193 @@ TEST(PageFaultHandlerTest, RegisterAndFault) {
   (void)x;
   handler.unregisterMemory(mem->address(), mem->size());
 }
+
+TEST(PageFaultHandlerTest, FaultInsideLaterPages) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_pages", CompressionType::Lz4);
+  PageFaultHandler handler(spiller);
+  auto mem = std::make_shared<MmapMemory>(3 * kPageSize);
+  char *addr = mem->address();
+  for (memSize i = 0; i < mem->size(); ++i) addr[i] = (char)(i % 253);
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+
+  handler.registerMemory(mem);
+  EXPECT_EQ(addr[2 * kPageSize + 12345], (char)((2 * kPageSize + 12345) % 253));
+  EXPECT_EQ(addr[kPageSize - 1], (char)((kPageSize - 1) % 253));
+  EXPECT_EQ(addr[mem->size() - 1], (char)((mem->size() - 1) % 253));
+  EXPECT_EQ(handler.stats().pageFaultCount, 2);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
+
+TEST(PageFaultHandlerTest, ConcurrentFaultsFromManyThreads) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_threads", CompressionType::Zstd);
+  PageFaultHandler handler(spiller, 2, 3);
+  const memSize pages = 4;
+  auto mem = std::make_shared<MmapMemory>(pages * kPageSize);
+  char *addr = mem->address();
+  for (memSize i = 0; i < mem->size(); i += 4096) addr[i] = (char)((i / 4096) % 127);
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+  handler.registerMemory(mem);
+
+  std::vector<std::thread> threads;
+  std::atomic<int> mismatches{0};
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t]() {
+      // Two threads share every page.
+      memSize page = t % pages;
+      memSize off = page * kPageSize + (t / pages) * 4096;
+      if (addr[off] != (char)((off / 4096) % 127)) mismatches++;
+    });
+  }
+  for (auto &t : threads) t.join();
+  EXPECT_EQ(mismatches.load(), 0);
+  auto s = handler.stats();
+  EXPECT_GE(s.pageFaultCount, pages);
+  EXPECT_LE(s.pageFaultCount - s.duplicateFaultCount, 8);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
+
+TEST(PageFaultHandlerTest, DeeperThanDefaultIoDepth) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_depth", CompressionType::Lz4);
+  // One thread reads up to 16 faults at a time, above kDefaultFaultIoDepth.
+  const uint32_t depth = 4 * kDefaultFaultIoDepth;
+  PageFaultHandler handler(spiller, depth, 1, 0);
+  const memSize pages = depth;
+  auto mem = std::make_shared<MmapMemory>(pages * kPageSize);
+  char *addr = mem->address();
+  for (memSize i = 0; i < mem->size(); i += 4096) addr[i] = (char)((i / 4096) % 127);
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+  handler.registerMemory(mem);
+
+  std::vector<std::thread> threads;
+  std::atomic<int> mismatches{0};
+  for (memSize page = 0; page < pages; ++page) {
+    threads.emplace_back([&, page]() {
+      memSize off = page * kPageSize + 4096;
+      if (addr[off] != (char)((off / 4096) % 127)) mismatches++;
+    });
+  }
+  for (auto &t : threads) t.join();
+  EXPECT_EQ(mismatches.load(), 0);
+  EXPECT_EQ(handler.stats().pageFaultCount - handler.stats().duplicateFaultCount,
+            pages);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
+
+TEST(PageFaultHandlerTest, SequentialFaultsPrefetchAhead) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_prefetch", CompressionType::Lz4);
+  PageFaultHandler handler(spiller, 2, 1, 2);
+  const memSize pages = 6;
+  auto mem = std::make_shared<MmapMemory>(pages * kPageSize);
+  char *addr = mem->address();
+  for (memSize p = 0; p < pages; ++p) std::memset(addr + p * kPageSize, (int)p + 1, kPageSize);
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+  handler.registerMemory(mem);
+
+  for (memSize p = 0; p < pages; ++p) {
+    EXPECT_EQ(addr[p * kPageSize + 7], (char)(p + 1));
+  }
+  auto s = handler.stats();
+  EXPECT_GE(s.prefetchCount, 1);
+  EXPECT_LT(s.pageFaultCount - s.duplicateFaultCount, pages);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
+
+TEST(PageFaultHandlerTest, RandomFaultsDoNotPrefetch) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_random", CompressionType::Zstd);
+  PageFaultHandler handler(spiller, 2, 1, 2);
+  const memSize pages = 6;
+  auto mem = std::make_shared<MmapMemory>(pages * kPageSize);
+  char *addr = mem->address();
+  for (memSize p = 0; p < pages; ++p) std::memset(addr + p * kPageSize, (int)p + 1, kPageSize);
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+  handler.registerMemory(mem);
+
+  for (memSize p : {4, 1, 5, 0}) {
+    EXPECT_EQ(addr[p * kPageSize], (char)(p + 1));
+  }
+  auto s = handler.stats();
+  EXPECT_EQ(s.pageFaultCount, 4);
+  EXPECT_EQ(s.prefetchCount, 0);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
+
+TEST(PageFaultHandlerTest, SmallPagesFaultOnlyTouchedPages) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_small", CompressionType::Zstd);
+  PageFaultHandler handler(spiller, 2, 1, 0);
+  const memSize pageSize = 64 * 1024;
+  auto mem = std::make_shared<MmapMemory>(kPageSize, pageSize);
+  char *addr = mem->address();
+  for (memSize i = 0; i < mem->size(); ++i) addr[i] = (char)((i / pageSize) % 100);
+  spiller->registerMem(mem);
+  spiller->spill(mem->size());
+  handler.registerMemory(mem);
+
+  for (memSize p : {200, 3, 101}) {
+    EXPECT_EQ(addr[p * pageSize + 5], (char)(p % 100));
+    EXPECT_EQ(addr[p * pageSize + pageSize - 1], (char)(p % 100));
+  }
+  EXPECT_EQ(handler.stats().pageFaultCount, 3);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
+
+TEST(PageFaultHandlerTest, WriteAfterSpillIsSpilledAgain) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_write", CompressionType::Lz4);
+  PageFaultHandler handler(spiller, 2, 1, 0);
+  const memSize pageSize = 64 * 1024;
+  auto mem = std::make_shared<MmapMemory>(8 * pageSize, pageSize);
+  char *addr = mem->address();
+  for (memSize i = 0; i < mem->size(); ++i) addr[i] = (char)(i / pageSize + 1);
+  spiller->registerMem(mem);
+  handler.registerMemory(mem);
+
+  // The tail goes, the rest of the region stays and is written.
+  EXPECT_EQ(spiller->spill(2 * pageSize), 2 * pageSize);
+  addr[0] = 42;
+  EXPECT_EQ(handler.stats().writeFaultCount, 1);
+  // The tail comes back to be written again, charged, and goes with the rest.
+  EXPECT_EQ(spiller->spill(8 * pageSize), 8 * pageSize);
+  char value = 0;
+  spiller->recoverMem(addr, 0, &value, 1);
+  EXPECT_EQ(value, 42);
+  EXPECT_EQ(addr[0], 42);
+  EXPECT_EQ(addr[7 * pageSize + 1], 8);
+
+  // Only read since, the file still holds the region.
+  EXPECT_EQ(spiller->spill(8 * pageSize), 2 * pageSize);
+  EXPECT_EQ(MemoryUtils::residentBytes(addr, mem->size(), pageSize)[0], 0);
+  EXPECT_EQ(handler.stats().writeFaultCount, 1);
+  EXPECT_EQ(addr[0], 42);
+  EXPECT_EQ(addr[pageSize], 2);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
+
+TEST(PageFaultHandlerTest, FaultedPagesAreChargedAgain) {
+  auto spiller = std::make_shared<Spiller>("./spill_pf_charge", CompressionType::Lz4);
+  PageFaultHandler handler(spiller, 2, 1, 0);
+  const memSize pageSize = 64 * 1024;
+  auto pool = QuotaPool::createRoot("root", 8 * pageSize);
+  ASSERT_TRUE(pool->tryCharge(8 * pageSize));
+  auto reservation = std::make_shared<QuotaReservation>(pool, 8 * pageSize);
+  auto mem = std::make_shared<MmapMemory>(8 * pageSize, pageSize);
+  char *addr = mem->address();
+  for (memSize i = 0; i < mem->size(); ++i) addr[i] = (char)(i / pageSize + 1);
+  spiller->registerMem(mem, reservation);
+  handler.registerMemory(mem);
+
+  EXPECT_EQ(spiller->spill(8 * pageSize), 8 * pageSize);
+  EXPECT_EQ(pool->used(), 0);
+  EXPECT_EQ(addr[3 * pageSize], 4);
+  EXPECT_EQ(addr[5 * pageSize], 6);
+  EXPECT_EQ(reservation->size(), 2 * pageSize);
+  EXPECT_EQ(pool->used(), 2 * pageSize);
+
+  // Evicting them again gives back what they took.
+  EXPECT_EQ(spiller->spill(8 * pageSize), 2 * pageSize);
+  EXPECT_EQ(pool->used(), 0);
+  handler.unregisterMemory(mem->address(), mem->size());
+}
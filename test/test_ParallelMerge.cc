@@ -0,0 +1,161 @@
+#include "ParallelMerge.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Compared by key only, the source tells the order of ties.
+struct Tagged {
+  int32_t key;
+  uint32_t source;
+
+  bool operator==(const Tagged &o) const {
+    return key == o.key && source == o.source;
+  }
+};
+
+struct ByKey {
+  bool operator()(const Tagged &a, const Tagged &b) const {
+    return a.key < b.key;
+  }
+};
+
+// `fanIn` sorted sources of few distinct keys.
+static std::vector<std::vector<Tagged>> makeSources(size_t fanIn,
+                                                    size_t maxLength,
+                                                    uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<std::vector<Tagged>> sources(fanIn);
+  for (uint32_t s = 0; s < fanIn; ++s) {
+    sources[s].resize(rng() % (maxLength + 1));
+    for (auto &v : sources[s]) {
+      v = {static_cast<int32_t>(rng() % 100) - 50, s};
+    }
+    std::sort(sources[s].begin(), sources[s].end(), ByKey());
+  }
+  return sources;
+}
+
+// The sources in parts of random length, some empty.
+static std::vector<PartedSource<Tagged>>
+partedOf(const std::vector<std::vector<Tagged>> &sources, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<PartedSource<Tagged>> parted;
+  for (const auto &source : sources) {
+    std::vector<MergeSource<Tagged>> parts;
+    for (size_t begin = 0; begin < source.size();) {
+      size_t end = std::min(source.size(), begin + rng() % 50);
+      parts.push_back({source.data() + begin, source.data() + end});
+      begin = end;
+    }
+    parted.emplace_back(std::move(parts));
+  }
+  return parted;
+}
+
+// Sorted by key, ties in source order, as a LoserTree merges them.
+static std::vector<Tagged>
+expectedMerge(const std::vector<std::vector<Tagged>> &sources) {
+  std::vector<Tagged> all;
+  for (const auto &source : sources) {
+    all.insert(all.end(), source.begin(), source.end());
+  }
+  std::stable_sort(all.begin(), all.end(), ByKey());
+  return all;
+}
+
+TEST(ParallelMergeTest, CoRankCutsAtEveryRank) {
+  auto sources = makeSources(7, 60, 1);
+  auto parted = partedOf(sources, 2);
+  auto merged = expectedMerge(sources);
+  std::vector<size_t> lo(sources.size(), 0), hi;
+  for (const auto &source : sources) {
+    hi.push_back(source.size());
+  }
+  std::vector<size_t> expected(sources.size(), 0);
+  for (size_t rank = 0; rank <= merged.size(); ++rank) {
+    EXPECT_EQ(coRank(parted, rank, lo, hi, ByKey()), expected)
+        << "rank=" << rank;
+    if (rank < merged.size()) {
+      ++expected[merged[rank].source];
+    }
+  }
+}
+
+TEST(ParallelMergeTest, PartedSourceSlices) {
+  std::vector<int64_t> data(100);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<int64_t>(i);
+  }
+  PartedSource<int64_t> source({{data.data(), data.data() + 30},
+                                {data.data() + 30, data.data() + 30},
+                                {data.data() + 30, data.data() + 100}});
+  EXPECT_EQ(source.size(), 100);
+  EXPECT_EQ(source[29], 29);
+  EXPECT_EQ(source[30], 30);
+  std::vector<MergeSource<int64_t>> pieces;
+  source.slice(10, 40, pieces);
+  ASSERT_EQ(pieces.size(), 2);
+  EXPECT_EQ(pieces[0].begin, data.data() + 10);
+  EXPECT_EQ(pieces[0].end, data.data() + 30);
+  EXPECT_EQ(pieces[1].begin, data.data() + 30);
+  EXPECT_EQ(pieces[1].end, data.data() + 40);
+  pieces.clear();
+  source.slice(50, 50, pieces);
+  EXPECT_TRUE(pieces.empty());
+}
+
+TEST(ParallelMergeTest, MatchesOneLoserTree) {
+  for (size_t fanIn : {1, 2, 5, 64}) {
+    auto sources = makeSources(fanIn, 20000, fanIn);
+    auto expected = expectedMerge(sources);
+    for (uint32_t threads : {1, 2, 3, 8}) {
+      // Windows small enough to use every thread, and odd.
+      for (size_t window : {kMergeRecordsPerThread * 8 + 7, size_t(50001)}) {
+        ParallelMerger<Tagged, ByKey> merger(partedOf(sources, threads),
+                                             threads);
+        std::vector<Tagged> merged(expected.size() + window);
+        size_t total = 0;
+        while (size_t n = merger.merge(merged.data() + total, window)) {
+          total += n;
+        }
+        merged.resize(total);
+        EXPECT_TRUE(merger.empty());
+        ASSERT_EQ(merged, expected)
+            << "fanIn=" << fanIn << " threads=" << threads
+            << " window=" << window;
+        for (size_t s = 0; s < fanIn; ++s) {
+          EXPECT_EQ(merger.position(s), sources[s].size());
+        }
+      }
+    }
+  }
+}
+
+TEST(ParallelMergeTest, InlineKeys) {
+  std::mt19937_64 rng(9);
+  std::vector<std::vector<int64_t>> runs(10);
+  std::vector<int64_t> expected;
+  for (auto &run : runs) {
+    run.resize(50000);
+    for (auto &v : run) {
+      v = static_cast<int64_t>(rng());
+    }
+    std::sort(run.begin(), run.end());
+    expected.insert(expected.end(), run.begin(), run.end());
+  }
+  std::sort(expected.begin(), expected.end());
+  std::vector<PartedSource<int64_t>> sources;
+  for (const auto &run : runs) {
+    sources.emplace_back(std::vector<MergeSource<int64_t>>{
+        {run.data(), run.data() + run.size()}});
+  }
+  ParallelMerger<int64_t> merger(std::move(sources), 4);
+  std::vector<int64_t> merged(expected.size());
+  EXPECT_EQ(merger.merge(merged.data(), merged.size() + 10), merged.size());
+  EXPECT_EQ(merger.merge(merged.data(), 10), 0);
+  EXPECT_EQ(merged, expected);
+}
@@ -1,5 +1,9 @@
 #include "QuotaManager.h"
 #include "Spiller.h"
+#include "MemoryUtils.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
 #include <gtest/gtest.h>
 
 TEST(QuotaManagerTest, AcquireReleaseSpill) {
@@ -20,3 +24,110 @@ TEST(QuotaManagerTest, AcquireReleaseSpill) {
   q.release(kPageSize);
   EXPECT_GE(q.available(), 0);
 }
+
+TEST(QuotaManagerTest, SpillReturnsEvictedBytes) {
+  const memSize pageSize = 64 * 1024;
+  auto spiller = std::make_shared<Spiller>("./spill_test_quota_tail",
+                                           CompressionType::Lz4);
+  QuotaManager q(8 * pageSize, spiller, 1.0, 0.75);
+  auto reservation = q.reserve(8 * pageSize);
+  ASSERT_NE(reservation, nullptr);
+  auto mem = std::make_shared<MmapMemory>(8 * pageSize, pageSize);
+  std::memset(mem->address(), 1, mem->size());
+  spiller->registerMem(mem, reservation);
+
+  // The waiting request counts against the low watermark, four tail pages
+  // go and the head stays resident.
+  EXPECT_TRUE(q.tryAcquire(2 * pageSize));
+  EXPECT_EQ(q.used(), 6 * pageSize);
+  EXPECT_EQ(reservation->size(), 4 * pageSize);
+  auto resident =
+      MemoryUtils::residentBytes(mem->address(), mem->size(), pageSize);
+  EXPECT_EQ(resident[3], (int64_t)pageSize);
+  EXPECT_EQ(resident[4], 0);
+}
+
+TEST(QuotaManagerTest, BackgroundSpillDownToLowWatermark) {
+  const memSize pageSize = 64 * 1024;
+  auto spiller = std::make_shared<Spiller>("./spill_test_quota_background",
+                                           CompressionType::Lz4);
+  QuotaManager q(8 * pageSize, spiller, 0.5, 0.25);
+  auto mem = std::make_shared<MmapMemory>(6 * pageSize, pageSize);
+  std::memset(mem->address(), 1, mem->size());
+
+  // Crossing the high watermark doesn't block the allocation.
+  auto reservation = q.reserve(6 * pageSize);
+  ASSERT_NE(reservation, nullptr);
+  spiller->registerMem(mem, reservation);
+  for (int i = 0; i < 500 && q.used() > 2 * pageSize; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(q.used(), 2 * pageSize);
+}
+
+TEST(QuotaManagerTest, AcquireTimesOutWithoutEvictableMemory) {
+  auto spiller = std::make_shared<Spiller>("./spill_test_quota_timeout",
+                                           CompressionType::Lz4);
+  QuotaManager q(kPageSize, spiller, kDefaultSpillHighWatermark,
+                 kDefaultSpillLowWatermark, 50);
+  ASSERT_TRUE(q.tryAcquire(kPageSize / 2));
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(q.tryAcquire(kPageSize));
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(50));
+  // Larger than the whole quota fails right away.
+  EXPECT_FALSE(q.tryAcquire(2 * kPageSize));
+  EXPECT_EQ(q.used(), kPageSize / 2);
+}
+
+TEST(QuotaManagerTest, SpillTargetsPoolOverItsShare) {
+  const memSize pageSize = 64 * 1024;
+  auto spiller = std::make_shared<Spiller>("./spill_test_quota_pools",
+                                           CompressionType::Lz4);
+  QuotaManager q(8 * pageSize, spiller, 1.0, 0.75);
+  auto query = q.root()->createChild("query", 8 * pageSize);
+  auto greedy = query->createChild("greedy", 8 * pageSize);
+  auto modest = query->createChild("modest", 8 * pageSize);
+
+  auto greedyReservation = q.reserve(6 * pageSize, greedy);
+  auto modestReservation = q.reserve(2 * pageSize, modest);
+  ASSERT_NE(greedyReservation, nullptr);
+  ASSERT_NE(modestReservation, nullptr);
+  // Registered first, a FIFO over all regions would evict it first.
+  auto modestMem = std::make_shared<MmapMemory>(2 * pageSize, pageSize);
+  std::memset(modestMem->address(), 1, modestMem->size());
+  spiller->registerMem(modestMem, modestReservation);
+  auto greedyMem = std::make_shared<MmapMemory>(6 * pageSize, pageSize);
+  std::memset(greedyMem->address(), 1, greedyMem->size());
+  spiller->registerMem(greedyMem, greedyReservation);
+
+  // Spilling goes down to the low watermark, all of it from the greedy pool.
+  EXPECT_TRUE(q.grow(*modestReservation, 2 * pageSize));
+  EXPECT_EQ(modestReservation->size(), 4 * pageSize);
+  EXPECT_EQ(greedyReservation->size(), 2 * pageSize);
+  EXPECT_EQ(modest->used(), 4 * pageSize);
+  EXPECT_EQ(query->used(), 6 * pageSize);
+  auto resident = MemoryUtils::residentBytes(modestMem->address(),
+                                             modestMem->size(), pageSize);
+  EXPECT_EQ(resident[0] + resident[1], (int64_t)(2 * pageSize));
+}
+
+TEST(QuotaManagerTest, DestroyedRegionReturnsQuota) {
+  const memSize pageSize = 64 * 1024;
+  auto spiller = std::make_shared<Spiller>("./spill_test_quota_release",
+                                           CompressionType::Lz4);
+  QuotaManager q(8 * pageSize, spiller);
+  auto pool = q.root()->createChild("operator", 4 * pageSize);
+  {
+    auto reservation = q.reserve(4 * pageSize, pool);
+    ASSERT_NE(reservation, nullptr);
+    auto mem = std::make_shared<MmapMemory>(4 * pageSize, pageSize);
+    spiller->registerMem(mem, std::move(reservation));
+    EXPECT_EQ(q.used(), 4 * pageSize);
+    EXPECT_EQ(spiller->unregisterMem(mem->address()), 4 * pageSize);
+  }
+  EXPECT_EQ(q.used(), 0);
+  EXPECT_EQ(pool->used(), 0);
+  // More than the pool holds fails right away, whatever the process has.
+  EXPECT_EQ(q.reserve(5 * pageSize, pool), nullptr);
+}
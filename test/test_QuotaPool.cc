@@ -0,0 +1,61 @@
+#include "QuotaPool.h"
+#include <gtest/gtest.h>
+
+TEST(QuotaPoolTest, ChargesCountAgainstAncestors) {
+  auto root = QuotaPool::createRoot("process", 100);
+  auto query = root->createChild("query", 60);
+  auto op = query->createChild("sort", 50);
+  EXPECT_TRUE(op->tryCharge(40));
+  EXPECT_EQ(query->used(), 40);
+  EXPECT_EQ(root->used(), 40);
+  // The operator has room, the query doesn't.
+  EXPECT_TRUE(root->tryCharge(30));
+  EXPECT_FALSE(op->tryCharge(25));
+  EXPECT_EQ(op->used(), 40);
+  EXPECT_EQ(root->blocking(40), root);
+  EXPECT_EQ(op->blocking(25), query);
+  EXPECT_EQ(op->blocking(5), nullptr);
+  op->release(40);
+  EXPECT_EQ(root->used(), 30);
+  EXPECT_THROW(query->createChild("big", 70), std::runtime_error);
+}
+
+TEST(QuotaPoolTest, ReservationGrowShrink) {
+  auto root = QuotaPool::createRoot("process", 100);
+  int releases = 0;
+  root->setReleaseListener([&releases]() { releases++; });
+  {
+    QuotaReservation reservation(root, 0);
+    EXPECT_TRUE(reservation.grow(60));
+    EXPECT_FALSE(reservation.grow(50));
+    reservation.shrink(20);
+    EXPECT_EQ(reservation.size(), 40);
+    reservation.shrink(100);
+    EXPECT_EQ(reservation.size(), 0);
+    EXPECT_TRUE(reservation.grow(100));
+    EXPECT_EQ(root->used(), 100);
+  }
+  EXPECT_EQ(root->used(), 0);
+  EXPECT_EQ(releases, 3);
+}
+
+TEST(QuotaPoolTest, VictimIsMostOverShare) {
+  auto root = QuotaPool::createRoot("process", 100);
+  auto a = root->createChild("a", 100);
+  auto b = root->createChild("b", 100);
+  auto a1 = a->createChild("a1", 100);
+  auto a2 = a->createChild("a2", 100);
+  EXPECT_EQ(root->victim(), root);
+  EXPECT_TRUE(a1->tryCharge(10));
+  EXPECT_TRUE(a2->tryCharge(55));
+  EXPECT_TRUE(b->tryCharge(30));
+  // a is over half of the root, a2 over half of a.
+  EXPECT_EQ(root->victim(), a2);
+  EXPECT_EQ(b->victim(), b);
+  // Everything is in a1 once the others are empty.
+  a2->release(55);
+  b->release(30);
+  EXPECT_EQ(root->victim(), a1);
+  EXPECT_TRUE(root->contains(a2.get()));
+  EXPECT_FALSE(b->contains(a2.get()));
+}
@@ -0,0 +1,162 @@
+#include "RadixSort.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+enum class Shape { Random, Sorted, FewDistinct, AllEqual, SharedHighBytes };
+
+template <typename T> static T keyFrom(uint64_t bits) {
+  if constexpr (std::is_floating_point_v<T>) {
+    // Both signs over many magnitudes.
+    return static_cast<T>((bits % 2 ? -1.0 : 1.0) *
+                          std::ldexp(static_cast<double>(bits >> 12) / 1e15,
+                                     static_cast<int>(bits % 64) - 32));
+  } else if constexpr (std::is_integral_v<T>) {
+    return static_cast<T>(bits);
+  } else {
+    T key;
+    for (size_t i = 0; i < sizeof(key.bytes); ++i) {
+      key.bytes[i] = static_cast<uint8_t>(bits >> (8 * (i % 8)));
+    }
+    return key;
+  }
+}
+
+template <typename T>
+static std::vector<T> makeKeys(size_t size, Shape shape, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<T> keys(size);
+  for (auto &key : keys) {
+    switch (shape) {
+    case Shape::Random:
+    case Shape::Sorted:
+      key = keyFrom<T>(rng());
+      break;
+    case Shape::FewDistinct:
+      key = keyFrom<T>(rng() % 5);
+      break;
+    case Shape::AllEqual:
+      key = keyFrom<T>(12345);
+      break;
+    case Shape::SharedHighBytes:
+      // Only the low bits vary, most passes are skipped.
+      key = keyFrom<T>(0x5a5a5a5a5a5a0000 | (rng() & 0x3ff));
+      break;
+    }
+  }
+  if (shape == Shape::Sorted) {
+    std::sort(keys.begin(), keys.end(), RadixKey<T>::less);
+  }
+  return keys;
+}
+
+// The same bytes, which tells -0 from +0 and NaNs apart where == can't.
+template <typename T>
+static bool sameBytes(const std::vector<T> &a, const std::vector<T> &b) {
+  return a.size() == b.size() &&
+         (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+template <typename T> static void checkSorts() {
+  for (uint32_t threads : {1, 3}) {
+    for (size_t threshold : {16, 0}) {
+      RadixSorter<T> sorter({.threads = threads,
+                             .comparisonThreshold = threshold});
+      for (size_t size : {0, 1, 100, 5000, 300000}) {
+        for (Shape shape : {Shape::Random, Shape::Sorted, Shape::FewDistinct,
+                            Shape::AllEqual, Shape::SharedHighBytes}) {
+          auto keys = makeKeys<T>(size, shape, size + threads);
+          auto expected = keys;
+          std::stable_sort(expected.begin(), expected.end(),
+                           RadixKey<T>::less);
+
+          auto data = keys;
+          std::vector<T> scratch(size);
+          T *sorted = sorter.sort(data.data(), scratch.data(), size);
+          ASSERT_TRUE(sorted == data.data() || sorted == scratch.data());
+          std::vector<T> lsd(sorted, sorted + size);
+          ASSERT_TRUE(sameBytes(lsd, expected))
+              << "lsd threads=" << threads << " size=" << size
+              << " shape=" << static_cast<int>(shape);
+
+          auto msd = keys;
+          sorter.sortInPlace(msd.data(), size);
+          ASSERT_TRUE(std::is_sorted(msd.begin(), msd.end(),
+                                     RadixKey<T>::less))
+              << "msd threads=" << threads << " size=" << size
+              << " shape=" << static_cast<int>(shape);
+          if (!std::is_floating_point_v<T>) {
+            ASSERT_TRUE(sameBytes(msd, expected));
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(RadixSortTest, Int32) { checkSorts<int32_t>(); }
+
+TEST(RadixSortTest, Uint64) { checkSorts<uint64_t>(); }
+
+TEST(RadixSortTest, Int64) { checkSorts<int64_t>(); }
+
+TEST(RadixSortTest, Int16) { checkSorts<int16_t>(); }
+
+TEST(RadixSortTest, Float) { checkSorts<float>(); }
+
+TEST(RadixSortTest, Double) { checkSorts<double>(); }
+
+TEST(RadixSortTest, ByteKey) { checkSorts<ByteKey<10>>(); }
+
+TEST(RadixSortTest, FloatOrder) {
+  const double inf = std::numeric_limits<double>::infinity();
+  std::vector<double> keys = {1.5,  -0.0, inf, -2.0, 0.0,
+                              -inf, 1e-300, -1e-300, 3.0};
+  std::vector<double> scratch(keys.size());
+  RadixSorter<double> sorter({.comparisonThreshold = 1});
+  double *sorted = sorter.sort(keys.data(), scratch.data(), keys.size());
+  std::vector<double> expected = {-inf, -2.0, -1e-300, -0.0, 0.0,
+                                  1e-300, 1.5, 3.0, inf};
+  std::vector<double> result(sorted, sorted + keys.size());
+  EXPECT_TRUE(sameBytes(result, expected));
+}
+
+// Digits of the key only, so that equal keys with another index tell
+// whether the LSD sort is stable.
+struct Indexed {
+  int32_t key;
+  uint32_t index;
+};
+
+template <> struct RadixKey<Indexed> {
+  static constexpr bool kSupported = true;
+  static constexpr size_t kBytes = 4;
+
+  static uint8_t digit(const Indexed &v, size_t d) {
+    return RadixKey<int32_t>::digit(v.key, d);
+  }
+  static bool less(const Indexed &a, const Indexed &b) { return a.key < b.key; }
+};
+
+TEST(RadixSortTest, StableLsd) {
+  std::mt19937_64 rng(3);
+  std::vector<Indexed> records(200000);
+  for (uint32_t i = 0; i < records.size(); ++i) {
+    records[i] = {static_cast<int32_t>(rng() % 1000) - 500, i};
+  }
+  std::vector<Indexed> scratch(records.size());
+  RadixSorter<Indexed> sorter({.threads = 4, .comparisonThreshold = 1});
+  Indexed *sorted = sorter.sort(records.data(), scratch.data(), records.size());
+  for (size_t i = 1; i < records.size(); ++i) {
+    ASSERT_TRUE(sorted[i - 1].key < sorted[i].key ||
+                (sorted[i - 1].key == sorted[i].key &&
+                 sorted[i - 1].index < sorted[i].index))
+        << i;
+  }
+}
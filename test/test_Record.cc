@@ -0,0 +1,152 @@
+#include "Record.h"
+#include "RandomGenerator.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Packs records one after another, returns where each starts.
+static std::vector<const char *> pack(RandomRecordGenerator &generator,
+                                      const RecordSchemaPtr &schema,
+                                      std::vector<uint64_t> &buffer) {
+  Record record(schema);
+  std::vector<size_t> offsets;
+  size_t used = 0;
+  while (generator.hasNext()) {
+    generator.next(record);
+    buffer.resize((used + record.size()) / 8);
+    record.serialize(reinterpret_cast<char *>(buffer.data()) + used);
+    offsets.push_back(used);
+    used += record.size();
+  }
+  std::vector<const char *> records;
+  for (size_t offset : offsets) {
+    records.push_back(reinterpret_cast<const char *>(buffer.data()) + offset);
+  }
+  return records;
+}
+
+TEST(RecordTest, SerializeRoundTrip) {
+  auto schema = std::make_shared<RecordSchema>(
+      std::vector<Column>{{"id", ColumnType::Int64},
+                          {"name", ColumnType::String},
+                          {"score", ColumnType::Double},
+                          {"note", ColumnType::String}},
+      std::vector<SortKeyColumn>{{1}, {0}});
+  Record record(schema);
+  record.setInt64(0, -42);
+  record.setString(1, "alice");
+  record.setDouble(2, 2.5);
+  std::string note("with\0zero", 9);
+  record.setString(3, note);
+  EXPECT_EQ(record.size() % kRecordAlignment, 0);
+  EXPECT_EQ(record.size(), schema->fixedSize() + 16);
+
+  std::vector<uint64_t> buffer(record.size() / 8);
+  char *data = reinterpret_cast<char *>(buffer.data());
+  record.serialize(data);
+  RecordView view(data);
+  EXPECT_EQ(view.size(), record.size());
+  EXPECT_EQ(view.getInt64(0), -42);
+  EXPECT_EQ(view.getString(1), "alice");
+  EXPECT_EQ(view.getDouble(2), 2.5);
+  EXPECT_EQ(view.getString(3), note);
+  // The string key takes the whole prefix.
+  EXPECT_EQ(memcmp(view.prefix(), "alice\0\0\0\0\0\0\0\0\0\0\0", 16), 0);
+
+  // Position independent, a copy reads the same.
+  std::vector<uint64_t> copy = buffer;
+  Record again(schema);
+  again.deserialize(reinterpret_cast<const char *>(copy.data()));
+  std::vector<uint64_t> repacked(again.size() / 8);
+  again.serialize(reinterpret_cast<char *>(repacked.data()));
+  EXPECT_EQ(repacked, buffer);
+
+  EXPECT_THROW(record.setInt64(1, 0), std::runtime_error);
+  EXPECT_THROW(record.setString(9, ""), std::runtime_error);
+  EXPECT_THROW(RecordSchema({{"a", ColumnType::Int64}}, {{1}}),
+               std::runtime_error);
+}
+
+// The comparator agrees with comparing the key columns in full.
+static void checkOrder(const RecordSchemaPtr &schema, uint32_t maxString) {
+  RandomRecordGenerator generator(schema, 20000, 7, maxString);
+  std::vector<uint64_t> buffer;
+  auto records = pack(generator, schema, buffer);
+  RecordComparator comparator(schema);
+  for (size_t i = 1; i < records.size(); ++i) {
+    int full = comparator.compareKey(records[i - 1], records[i]);
+    int fast = comparator.compare(records[i - 1], records[i]);
+    ASSERT_EQ(fast < 0, full < 0) << i;
+    ASSERT_EQ(fast > 0, full > 0) << i;
+    // A prefix that differs never contradicts the key.
+    int prefix = RecordComparator::comparePrefix(
+        RecordView(records[i - 1]).prefix(), RecordView(records[i]).prefix());
+    ASSERT_TRUE(prefix == 0 || (prefix < 0) == (full < 0)) << i;
+  }
+  std::sort(records.begin(), records.end(), comparator);
+  for (size_t i = 1; i < records.size(); ++i) {
+    ASSERT_LE(comparator.compareKey(records[i - 1], records[i]), 0) << i;
+  }
+}
+
+TEST(RecordTest, PrefixOrderMatchesKey) {
+  // Two integers fill the prefix and are the whole key.
+  auto ints = std::make_shared<RecordSchema>(
+      std::vector<Column>{{"a", ColumnType::Int64}, {"b", ColumnType::Int64}},
+      std::vector<SortKeyColumn>{{0}, {1, true}});
+  EXPECT_TRUE(ints->prefixIsKey());
+  checkOrder(ints, 0);
+
+  // Short strings tie on the prefix often, the double after them is only in
+  // the full key.
+  auto mixed = std::make_shared<RecordSchema>(
+      std::vector<Column>{{"s", ColumnType::String},
+                          {"d", ColumnType::Double},
+                          {"payload", ColumnType::String}},
+      std::vector<SortKeyColumn>{{1}, {0, true}, {2}});
+  EXPECT_FALSE(mixed->prefixIsKey());
+  checkOrder(mixed, 3);
+  checkOrder(mixed, 40);
+
+  auto strings = std::make_shared<RecordSchema>(
+      std::vector<Column>{{"s", ColumnType::String},
+                          {"i", ColumnType::Int64}},
+      std::vector<SortKeyColumn>{{0}, {1}});
+  checkOrder(strings, 2);
+  checkOrder(strings, 30);
+}
+
+TEST(RecordTest, PrefixEdgeCases) {
+  auto schema = std::make_shared<RecordSchema>(
+      std::vector<Column>{{"s", ColumnType::String}, {"d", ColumnType::Double}},
+      std::vector<SortKeyColumn>{{0}, {1}});
+  RecordComparator comparator(schema);
+  auto make = [&](std::string_view s, double d) {
+    Record record(schema);
+    record.setString(0, s);
+    record.setDouble(1, d);
+    std::vector<uint64_t> buffer(record.size() / 8);
+    record.serialize(reinterpret_cast<char *>(buffer.data()));
+    return buffer;
+  };
+  auto less = [&](const std::vector<uint64_t> &a,
+                  const std::vector<uint64_t> &b) {
+    return comparator(reinterpret_cast<const char *>(a.data()),
+                      reinterpret_cast<const char *>(b.data()));
+  };
+  // An embedded zero pads like a shorter string, the full key tells them
+  // apart.
+  EXPECT_TRUE(less(make("ab", 9), make(std::string_view("ab\0", 3), 1)));
+  EXPECT_FALSE(less(make(std::string_view("ab\0", 3), 1), make("ab", 9)));
+  // Past the prefix.
+  EXPECT_TRUE(less(make("0123456789abcdefA", 1), make("0123456789abcdefB", 0)));
+  EXPECT_TRUE(less(make("x", -0.0), make("x", 0.0)));
+  EXPECT_TRUE(less(make("x", -std::numeric_limits<double>::infinity()),
+                   make("x", -1e300)));
+  EXPECT_TRUE(less(make("\xff", 0), make("\xff\x01", 0)));
+}
@@ -0,0 +1,142 @@
+#include "RandomGenerator.h"
+#include "RecordSorter.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+static constexpr memSize kSortPage = 64 * 1024;
+
+// Wide records, a key and a payload of about 200 bytes.
+static RecordSchemaPtr makeSchema(std::vector<SortKeyColumn> key) {
+  return std::make_shared<RecordSchema>(
+      std::vector<Column>{{"id", ColumnType::Int64},
+                          {"name", ColumnType::String},
+                          {"score", ColumnType::Double},
+                          {"payload", ColumnType::String}},
+      std::move(key));
+}
+
+// Packs `count` random records into a region of `mgr`, returns the bytes
+// used. Ids are 0 to count - 1.
+static memSize fill(BufferManager &mgr, const RecordSchemaPtr &schema,
+                    size_t count, MmapMemoryPtr &mem,
+                    const QuotaPoolPtr &pool = nullptr) {
+  RandomRecordGenerator generator(schema, count, 5, 3);
+  Record record(schema);
+  std::vector<std::string> packed;
+  memSize bytes = 0;
+  for (size_t i = 0; generator.hasNext(); ++i) {
+    generator.next(record);
+    record.setInt64(0, i);
+    record.setString(3, std::string(200 + i % 64, 'p'));
+    std::string s(record.size(), '\0');
+    record.serialize(s.data());
+    bytes += s.size();
+    packed.push_back(std::move(s));
+  }
+  mem = mgr.accquireMemory(bytes, kSortPage, pool);
+  char *dst = mem->address();
+  for (const auto &s : packed) {
+    memcpy(dst, s.data(), s.size());
+    dst += s.size();
+  }
+  return bytes;
+}
+
+// Checks that `sorted` holds all `count` ids in key order.
+static void checkSorted(const RecordSchemaPtr &schema,
+                        const SortedRecords &sorted, memSize bytes,
+                        size_t count) {
+  ASSERT_EQ(sorted.count, count);
+  ASSERT_EQ(sorted.bytes, bytes);
+  RecordComparator comparator(schema);
+  std::vector<bool> seen(count);
+  const char *previous = nullptr;
+  for (memSize offset = 0; offset < sorted.bytes;) {
+    const char *record = sorted.mem->address() + offset;
+    RecordView view(record);
+    if (previous != nullptr) {
+      ASSERT_LE(comparator.compareKey(previous, record), 0) << offset;
+    }
+    int64_t id = view.getInt64(0);
+    ASSERT_FALSE(seen[id]);
+    seen[id] = true;
+    EXPECT_EQ(view.getString(3).size(), 200 + id % 64);
+    previous = record;
+    offset += view.size();
+  }
+}
+
+TEST(RecordSorterTest, SortsWideRecords) {
+  Config conf{.spillDir = "./spill_record_sorter",
+              .quota = 256 * 1024 * 1024L,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  // Short names tie on the prefix, the score decides.
+  auto byName = makeSchema({{1}, {2, true}});
+  MmapMemoryPtr input;
+  const size_t count = 50000;
+  memSize bytes = fill(mgr, byName, count, input);
+  for (uint32_t threads : {1, 2}) {
+    for (uint32_t prefetch : {0, 8}) {
+      RecordSorter sorter(mgr, byName,
+                          {.pageSize = kSortPage,
+                           .threads = threads,
+                           .prefetchDistance = prefetch});
+      SortedRecords sorted = sorter.sort(input->address(), bytes);
+      checkSorted(byName, sorted, bytes, count);
+    }
+  }
+
+  // The prefix is the whole key, no record is read before the gather.
+  auto byScore = makeSchema({{2}, {0, true}});
+  ASSERT_TRUE(byScore->prefixIsKey());
+  memSize scoreBytes = fill(mgr, byScore, count, input);
+  RecordSorter sorter(mgr, byScore, {.pageSize = kSortPage});
+  checkSorted(byScore, sorter.sort(input->address(), scoreBytes), scoreBytes,
+              count);
+
+  SortedRecords empty = sorter.sort(nullptr, 0);
+  EXPECT_EQ(empty.mem, nullptr);
+  EXPECT_EQ(empty.count, 0);
+}
+
+TEST(RecordSorterTest, GatherFaultsSpilledInput) {
+  Config conf{.spillDir = "./spill_record_sorter_spill",
+              .quota = 64 * 1024 * 1024L,
+              .compressionType = CompressionType::Lz4};
+  BufferManager mgr(conf);
+  auto schema = makeSchema({{0, true}});
+  const size_t count = 20000;
+  // Room for the entries and the output, not for the input as well.
+  auto pool = mgr.quotaPool()->createChild("sort", 8 * 1024 * 1024L);
+  MmapMemoryPtr input;
+  memSize bytes = fill(mgr, schema, count, input, pool);
+  ASSERT_GT(bytes, 4 * 1024 * 1024L);
+  RecordSorter sorter(mgr, schema, {.pageSize = kSortPage});
+  SortedRecords sorted = sorter.sort(input->address(), bytes, pool);
+  checkSorted(schema, sorted, bytes, count);
+  EXPECT_GT(mgr.pageFaultStats().pageFaultCount, 0);
+  // Descending ids.
+  EXPECT_EQ(RecordView(sorted.mem->address()).getInt64(0), count - 1);
+}
+
+TEST(RecordSorterTest, CorruptInput) {
+  Config conf{.spillDir = "./spill_record_sorter_bad",
+              .quota = 16 * kSortPage,
+              .compressionType = CompressionType::None};
+  BufferManager mgr(conf);
+  auto schema = makeSchema({{0}});
+  std::vector<uint64_t> data(64, 0);
+  data[0] = 8;
+  RecordSorter sorter(mgr, schema, {.pageSize = kSortPage});
+  EXPECT_THROW(sorter.sort(reinterpret_cast<char *>(data.data()),
+                           data.size() * 8),
+               std::runtime_error);
+  // Shorter than a record's size field.
+  EXPECT_THROW(sorter.sort(reinterpret_cast<char *>(data.data()), 2),
+               std::runtime_error);
+}
@@ -0,0 +1,80 @@
+#include "SimdSort.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+enum class Shape { Random, Sorted, Reversed, FewDistinct, AllEqual, Extremes };
+
+template <typename T>
+static std::vector<T> makeKeys(size_t size, Shape shape, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::vector<T> keys(size);
+  for (size_t i = 0; i < size; ++i) {
+    switch (shape) {
+    case Shape::Random:
+    case Shape::Sorted:
+    case Shape::Reversed:
+      keys[i] = static_cast<T>(rng());
+      break;
+    case Shape::FewDistinct:
+      keys[i] = static_cast<T>(rng() % 4) - 2;
+      break;
+    case Shape::AllEqual:
+      keys[i] = 7;
+      break;
+    case Shape::Extremes:
+      keys[i] = rng() % 2 ? std::numeric_limits<T>::max()
+                          : std::numeric_limits<T>::min();
+      break;
+    }
+  }
+  if (shape == Shape::Sorted) {
+    std::sort(keys.begin(), keys.end());
+  } else if (shape == Shape::Reversed) {
+    std::sort(keys.rbegin(), keys.rend());
+  }
+  return keys;
+}
+
+template <typename T> static void checkAllLevels() {
+  for (int level = 0; level <= static_cast<int>(simdLevel()); ++level) {
+    for (size_t size : {0, 1, 2, 5, 8, 16, 63, 64, 65, 129, 256, 257, 1000,
+                        4097, 100000}) {
+      for (Shape shape : {Shape::Random, Shape::Sorted, Shape::Reversed,
+                          Shape::FewDistinct, Shape::AllEqual,
+                          Shape::Extremes}) {
+        auto keys = makeKeys<T>(size, shape, size);
+        auto expected = keys;
+        std::sort(expected.begin(), expected.end());
+        simdSort(keys.data(), keys.size(), static_cast<SimdLevel>(level));
+        ASSERT_EQ(keys, expected)
+            << simdLevelName(static_cast<SimdLevel>(level))
+            << " size=" << size << " shape=" << static_cast<int>(shape);
+      }
+    }
+  }
+}
+
+TEST(SimdSortTest, Int32) { checkAllLevels<int32_t>(); }
+
+TEST(SimdSortTest, Uint32) { checkAllLevels<uint32_t>(); }
+
+TEST(SimdSortTest, Int64) { checkAllLevels<int64_t>(); }
+
+TEST(SimdSortTest, Uint64) { checkAllLevels<uint64_t>(); }
+
+TEST(SimdSortTest, LevelAboveCpuIsLowered) {
+  auto keys = makeKeys<int64_t>(5000, Shape::Random, 1);
+  auto expected = keys;
+  std::sort(expected.begin(), expected.end());
+  simdSort(keys.data(), keys.size(), SimdLevel::Avx512);
+  EXPECT_EQ(keys, expected);
+  EXPECT_TRUE((isSimdSortable<int64_t, std::less<int64_t>>));
+  EXPECT_FALSE((isSimdSortable<int64_t, std::greater<int64_t>>));
+  EXPECT_FALSE((isSimdSortable<double, std::less<double>>));
+}
@@ -0,0 +1,122 @@
+#include "SpillStore.h"
+#include "AsyncSpillWriter.h"
+#include "DirectoryUtils.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <sys/stat.h>
+#include <vector>
+
+static const memSize kSegment = 1024 * 1024;
+
+static blkcnt_t allocatedBlocks(const std::string &fileName) {
+  struct stat st;
+  EXPECT_EQ(stat(fileName.c_str(), &st), 0);
+  return st.st_blocks;
+}
+
+TEST(SpillStoreTest, AllocateReusesFreedExtents) {
+  std::string dir = "./spill_test_store";
+  DirectoryUtils::createDir(dir);
+  {
+    SpillStore store(dir, kSegment);
+    auto a = store.allocate(10000);
+    auto b = store.allocate(5000);
+    EXPECT_EQ(a.segmentId, b.segmentId);
+    EXPECT_EQ(a.offset, 0u);
+    EXPECT_EQ(a.length, 10000u);
+    // Extents start on block boundaries.
+    EXPECT_EQ(b.offset, 12288u);
+    EXPECT_EQ(store.usedBytes(), 12288u + 8192u);
+
+    store.release(a);
+    auto c = store.allocate(4096);
+    EXPECT_EQ(c.offset, 0u);
+    // The shrunk tail of an extent is free again.
+    auto d = store.shrink(b, 100);
+    EXPECT_EQ(d.length, 100u);
+    EXPECT_EQ(store.usedBytes(), 4096u + 4096u);
+    EXPECT_THROW(store.shrink(d, 200), std::runtime_error);
+    EXPECT_EQ(store.segmentCount(), 1u);
+  }
+  DirectoryUtils::removeAll(dir);
+}
+
+TEST(SpillStoreTest, SegmentsGrowAndEmptyOnesGo) {
+  std::string dir = "./spill_test_store_segments";
+  DirectoryUtils::createDir(dir);
+  {
+    SpillStore store(dir, kSegment);
+    auto a = store.allocate(kSegment - 4096);
+    auto b = store.allocate(8192);
+    EXPECT_NE(a.segmentId, b.segmentId);
+    // Larger than a segment gets a segment of its own.
+    auto c = store.allocate(3 * kSegment);
+    EXPECT_EQ(store.segmentCount(), 3u);
+    store.release(c);
+    EXPECT_EQ(store.segmentCount(), 2u);
+    store.release(a);
+    store.release(b);
+    // The last segment stays for the next spill.
+    EXPECT_EQ(store.segmentCount(), 1u);
+    EXPECT_EQ(store.usedBytes(), 0u);
+  }
+  EXPECT_TRUE(DirectoryUtils::exists(dir));
+  DirectoryUtils::removeAll(dir);
+}
+
+TEST(SpillStoreTest, SparseSegmentsArePunched) {
+  std::string dir = "./spill_test_store_punch";
+  DirectoryUtils::createDir(dir);
+  {
+    SpillStore store(dir, kSegment);
+    std::vector<SpillExtent> extents;
+    for (int i = 0; i < 4; ++i) {
+      extents.push_back(store.allocate(kSegment / 4));
+    }
+    std::string fileName = dir + "/segment-0.seg";
+    blkcnt_t before = allocatedBlocks(fileName);
+    // Still half full, the blocks stay reserved.
+    store.release(extents[0]);
+    EXPECT_EQ(allocatedBlocks(fileName), before);
+    store.release(extents[1]);
+    store.release(extents[2]);
+    EXPECT_LT(allocatedBlocks(fileName), before);
+  }
+  DirectoryUtils::removeAll(dir);
+}
+
+TEST(SpillStoreTest, WriteAndOpenExtent) {
+  std::string dir = "./spill_test_store_open";
+  DirectoryUtils::createDir(dir);
+  {
+    const memSize frameSize = 4096;
+    SpillStore store(dir, kSegment);
+    AsyncSpillWriter writer(2, frameSize);
+    std::vector<std::vector<char>> regions(2, std::vector<char>(5 * frameSize));
+    std::vector<SpillExtent> extents;
+    for (size_t r = 0; r < regions.size(); ++r) {
+      for (size_t i = 0; i < regions[r].size(); ++i) {
+        regions[r][i] = static_cast<char>((i / (r + 3)) % 256);
+      }
+      auto extent = store.allocate(
+          FileUtils::maxFramedSize(regions[r].size(), frameSize));
+      writer.submit(store.fd(extent), extent.offset, regions[r].data(),
+                    regions[r].size(), CompressionType::Lz4, frameSize,
+                    [&store, &extents, extent](bool ok, memSize length) {
+                      ASSERT_TRUE(ok);
+                      extents.push_back(store.shrink(extent, length));
+                    });
+    }
+    writer.drain();
+    ASSERT_EQ(extents.size(), 2u);
+    for (size_t r = 0; r < regions.size(); ++r) {
+      auto file = store.open(extents[r]);
+      std::vector<char> buf(2 * frameSize);
+      FileUtils::read(*file, frameSize + 7, buf.data(), buf.size());
+      EXPECT_EQ(std::memcmp(buf.data(), regions[r].data() + frameSize + 7,
+                            buf.size()),
+                0);
+    }
+  }
+  DirectoryUtils::removeAll(dir);
+}
@@ -1,6 +1,7 @@
 #include "Spiller.h"
 #include "MmapMemory.h"
 #include "DirectoryUtils.h"
+#include "MemoryUtils.h"
 #include <gtest/gtest.h>
 #include <cstring>
 #include <filesystem>
@@ -22,3 +23,102 @@ TEST(SpillerTest, RegisterSpillRecover) {
   }
   EXPECT_FALSE(DirectoryUtils::exists(dir));
 }
+
+TEST(SpillerTest, EvictsColdTailPages) {
+  const memSize pageSize = 64 * 1024;
+  std::filesystem::path dir = "./spill_test_tail";
+  Spiller s(dir.string(), CompressionType::Lz4);
+  // Nothing writes the region after its spill, as if protected.
+  s.setWriteProtector([](char *, memSize, bool) { return true; });
+  auto mem = std::make_shared<MmapMemory>(8 * pageSize, pageSize);
+  char *addr = mem->address();
+  for (memSize i = 0; i < mem->size(); ++i) {
+    addr[i] = static_cast<char>(i / pageSize);
+  }
+  s.registerMem(mem);
+
+  EXPECT_EQ(s.spill(2 * pageSize), 2 * pageSize);
+  auto resident = MemoryUtils::residentBytes(addr, mem->size(), pageSize);
+  for (int page = 0; page < 6; ++page) {
+    EXPECT_EQ(resident[page], (int64_t)pageSize) << "page " << page;
+  }
+  EXPECT_EQ(resident[6], 0);
+  EXPECT_EQ(resident[7], 0);
+
+  // The file already holds the region, the next pages go without a write.
+  EXPECT_EQ(s.spill(pageSize), pageSize);
+  resident = MemoryUtils::residentBytes(addr, mem->size(), pageSize);
+  EXPECT_EQ(resident[4], (int64_t)pageSize);
+  EXPECT_EQ(resident[5], 0);
+
+  char value = 0;
+  s.recoverMem(addr, 7 * pageSize + 1, &value, 1);
+  EXPECT_EQ(value, 7);
+
+  // Releasing the region gives back only the quota it still holds.
+  mem.reset();
+  EXPECT_EQ(s.spill(8 * pageSize), 5 * pageSize);
+}
+
+TEST(SpillerTest, UntrackedSpilledRegionKeepsItsPages) {
+  const memSize pageSize = 64 * 1024;
+  Spiller s("./spill_test_untracked", CompressionType::Lz4);
+  auto mem = std::make_shared<MmapMemory>(8 * pageSize, pageSize);
+  char *addr = mem->address();
+  std::memset(addr, 1, mem->size());
+  s.registerMem(mem);
+
+  EXPECT_EQ(s.spill(2 * pageSize), 2 * pageSize);
+  addr[0] = 42;
+  // Without a write protector the file may miss that write.
+  EXPECT_EQ(s.spill(8 * pageSize), 0);
+  EXPECT_EQ(addr[0], 42);
+  EXPECT_EQ(MemoryUtils::residentBytes(addr, mem->size(), pageSize)[0],
+            (int64_t)pageSize);
+}
+
+TEST(SpillerTest, PinnedRegionsStayResident) {
+  const memSize pageSize = 64 * 1024;
+  std::filesystem::path dir = "./spill_test_pinned";
+  Spiller s(dir.string(), CompressionType::None);
+  auto pinned = std::make_shared<MmapMemory>(4 * pageSize, pageSize);
+  auto other = std::make_shared<MmapMemory>(4 * pageSize, pageSize);
+  std::memset(pinned->address(), 1, pinned->size());
+  std::memset(other->address(), 2, other->size());
+  s.registerMem(pinned, nullptr, true);
+  s.registerMem(other);
+
+  // Only the unpinned region can give anything.
+  EXPECT_EQ(s.spill(8 * pageSize), 4 * pageSize);
+  auto resident = MemoryUtils::residentBytes(pinned->address(),
+                                             pinned->size(), pageSize);
+  for (int page = 0; page < 4; ++page) {
+    EXPECT_EQ(resident[page], (int64_t)pageSize) << "page " << page;
+  }
+  EXPECT_EQ(s.spill(pageSize), 0);
+
+  s.setPinned(pinned->address(), false);
+  EXPECT_EQ(s.spill(4 * pageSize), 4 * pageSize);
+}
+
+TEST(SpillerTest, LruKeepsFaultedRegionResident) {
+  const memSize pageSize = 64 * 1024;
+  Spiller s("./spill_test_lru", CompressionType::Lz4, kDefaultSpillIoDepth,
+            false, EvictionPolicyType::Lru);
+  std::vector<MmapMemoryPtr> mems;
+  for (int i = 0; i < 3; ++i) {
+    mems.push_back(std::make_shared<MmapMemory>(pageSize, pageSize));
+    std::memset(mems.back()->address(), i, pageSize);
+    s.registerMem(mems.back());
+  }
+  s.recordAccess(mems[0]->address());
+
+  EXPECT_EQ(s.spill(2 * pageSize), 2 * pageSize);
+  auto resident = [&](int i) {
+    return MemoryUtils::residentBytes(mems[i]->address(), pageSize,
+                                      pageSize)[0];
+  };
+  EXPECT_EQ(resident(0), (int64_t)pageSize);
+  EXPECT_EQ(resident(1), 0);
+  EXPECT_EQ(resident(2), 0);
+}